@@ -0,0 +1,925 @@
+#pragma once
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "WmiHelper.hpp"
+
+// Window a wmi_rolling_stats is maintained over. Set ticks for a window of the last N samples or milliseconds for a
+// window of the last T milliseconds. If both are set, a sample leaves the window as soon as either limit is exceeded.
+struct wmi_rolling_window
+{
+    std::uint32_t ticks = 0;
+    std::uint64_t milliseconds = 0;
+
+    [[nodiscard]] static wmi_rolling_window last_ticks(const std::uint32_t count)
+    {
+        return { count, 0 };
+    }
+
+    [[nodiscard]] static wmi_rolling_window last_milliseconds(const std::uint64_t ms)
+    {
+        return { 0, ms };
+    }
+};
+
+struct wmi_aggregate
+{
+    double min = std::numeric_limits<double>::quiet_NaN();
+    double max = std::numeric_limits<double>::quiet_NaN();
+    double mean = std::numeric_limits<double>::quiet_NaN();
+    double stddev = std::numeric_limits<double>::quiet_NaN();
+    double ewma = std::numeric_limits<double>::quiet_NaN();
+    double last = std::numeric_limits<double>::quiet_NaN();
+    std::uint64_t count = 0; // samples currently inside the window
+};
+
+// Rolling min/max/mean/stddev/ewma of a single series. push() is amortized O(1): min and max are kept in monotonic
+// queues and mean/stddev in running sums, so nothing is ever recomputed from the samples inside the window.
+class wmi_rolling_stats
+{
+public:
+
+    explicit wmi_rolling_stats(const wmi_rolling_window window = wmi_rolling_window::last_ticks(60)) : window_(window)
+    {
+    }
+
+    void push(const std::uint64_t time, const double value)
+    {
+        if (std::isnan(value))
+            return;
+
+        if (samples_.empty())
+            shift_ = value; // sums are kept relative to the first value to avoid cancellation in the variance
+
+        update_ewma(time, value);
+
+        const sample current{ time, value, next_sequence_++ };
+
+        samples_.push_back(current);
+        sum_ += value - shift_;
+        sum_sq_ += (value - shift_) * (value - shift_);
+
+        while (!min_queue_.empty() && min_queue_.back().value > value)
+            min_queue_.pop_back();
+        min_queue_.push_back(current);
+
+        while (!max_queue_.empty() && max_queue_.back().value < value)
+            max_queue_.pop_back();
+        max_queue_.push_back(current);
+
+        evict(time);
+    }
+
+    [[nodiscard]] wmi_aggregate aggregate() const
+    {
+        wmi_aggregate result;
+
+        result.count = samples_.size();
+        result.ewma = ewma_;
+
+        if (samples_.empty())
+            return result;
+
+        const auto n = static_cast<double>(samples_.size());
+        const auto mean = sum_ / n;
+
+        result.min = min_queue_.front().value;
+        result.max = max_queue_.front().value;
+        result.mean = shift_ + mean;
+        result.stddev = std::sqrt(std::max(0.0, sum_sq_ / n - mean * mean));
+        result.last = samples_.back().value;
+
+        return result;
+    }
+
+    void reset()
+    {
+        samples_.clear();
+        min_queue_.clear();
+        max_queue_.clear();
+        sum_ = sum_sq_ = shift_ = 0.0;
+        ewma_ = std::numeric_limits<double>::quiet_NaN();
+        ewma_time_ = 0;
+    }
+
+private:
+
+    struct sample
+    {
+        std::uint64_t time;
+        double value;
+        std::uint64_t sequence;
+    };
+
+    void update_ewma(const std::uint64_t time, const double value)
+    {
+        if (std::isnan(ewma_))
+        {
+            ewma_ = value;
+        }
+        else if (window_.milliseconds)
+        {
+            // time decayed so irregular tick spacing does not skew the average
+            const auto elapsed = static_cast<double>(time - ewma_time_);
+            const auto alpha = 1.0 - std::exp(-elapsed / static_cast<double>(window_.milliseconds));
+            ewma_ += alpha * (value - ewma_);
+        }
+        else
+        {
+            const auto alpha = 2.0 / (static_cast<double>(std::max<std::uint32_t>(window_.ticks, 1)) + 1.0);
+            ewma_ += alpha * (value - ewma_);
+        }
+
+        ewma_time_ = time;
+    }
+
+    [[nodiscard]] bool expired(const sample& oldest, const std::uint64_t now) const
+    {
+        if (window_.ticks && samples_.size() > window_.ticks)
+            return true;
+
+        return window_.milliseconds && now - oldest.time >= window_.milliseconds;
+    }
+
+    void evict(const std::uint64_t now)
+    {
+        while (samples_.size() > 1 && expired(samples_.front(), now))
+        {
+            const auto& oldest = samples_.front();
+
+            sum_ -= oldest.value - shift_;
+            sum_sq_ -= (oldest.value - shift_) * (oldest.value - shift_);
+
+            // the monotonic queues hold a subsequence of samples_, so the oldest sample can only be at their front
+            if (!min_queue_.empty() && min_queue_.front().sequence == oldest.sequence)
+                min_queue_.pop_front();
+
+            if (!max_queue_.empty() && max_queue_.front().sequence == oldest.sequence)
+                max_queue_.pop_front();
+
+            samples_.pop_front();
+        }
+    }
+
+    wmi_rolling_window window_;
+
+    std::deque<sample> samples_;
+    std::deque<sample> min_queue_;
+    std::deque<sample> max_queue_;
+
+    std::uint64_t next_sequence_ = 0;
+
+    double shift_ = 0.0;
+    double sum_ = 0.0;
+    double sum_sq_ = 0.0;
+
+    double ewma_ = std::numeric_limits<double>::quiet_NaN();
+    std::uint64_t ewma_time_ = 0;
+};
+
+// handle -> instance key -> aggregate
+using wmi_aggregate_result = std::map<wmi_var_handle, std::map<std::wstring, wmi_aggregate>>;
+
+using wmi_aggregate_callback = std::function<void(const wmi_helper_config&, const wmi_aggregate_result&)>;
+
+// Fills keys with one instance key per row: the value of key_handle when given (see wmi_column_view::key()), otherwise
+// or for rows whose key could not be read the row index. Returns false if key_handle was not part of the result.
+template<std::size_t AnySize>
+bool wmi_instance_keys(const wmi_wrapper_result_map<AnySize>& results, const std::optional<wmi_var_handle>& key_handle, std::vector<std::wstring>& keys)
+{
+    keys.clear();
+
+    if (key_handle)
+    {
+        if (!results.count(*key_handle))
+            return false;
+
+        const auto column = results.at(*key_handle);
+        std::wstring buffer;
+
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            const auto key = column.key(i, buffer);
+            keys.push_back(key.empty() ? std::to_wstring(i) : std::wstring(key));
+        }
+
+        return true;
+    }
+
+    std::size_t rows = 0;
+
+    for (wmi_var_handle handle = 0; handle < results.handle_count(); handle++)
+    {
+        if (results.count(handle))
+            rows = std::max(rows, results.column_size(handle));
+    }
+
+    for (std::size_t i = 0; i < rows; i++)
+        keys.push_back(std::to_wstring(i));
+
+    return true;
+}
+
+// Erases every entry of instances whose key is not in keys.
+template<typename Map>
+void wmi_drop_missing_instances(Map& instances, const std::vector<std::wstring>& keys, std::unordered_set<std::wstring>& seen)
+{
+    seen.clear();
+    seen.insert(keys.begin(), keys.end());
+
+    for (auto it = instances.begin(); it != instances.end();)
+    {
+        if (!seen.count(it->first))
+            it = instances.erase(it);
+        else
+            ++it;
+    }
+}
+
+// Maintains a wmi_rolling_stats per instance for every attached var. Instances are identified by the value of key_handle
+// (e.g. Name) when one is given, otherwise by row index. Instances missing from a result are dropped.
+template<std::size_t AnySize>
+class wmi_rolling_aggregator
+{
+public:
+
+    explicit wmi_rolling_aggregator(const wmi_rolling_window window, std::optional<wmi_var_handle> key_handle = std::nullopt) : window_(window), key_handle_(key_handle)
+    {
+    }
+
+    void attach(const wmi_var_handle handle)
+    {
+        series_[handle];
+    }
+
+    void update(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        const auto& results = wmi_result.result;
+
+        if (!wmi_instance_keys(results, key_handle_, keys_))
+            return;
+
+        for (auto& [handle, instances] : series_)
+        {
+            if (!results.count(handle))
+                continue;
+
+            const auto& column = results.at(handle);
+
+            for (std::size_t i = 0; i < column.size() && i < keys_.size(); i++)
+            {
+                auto it = instances.find(keys_[i]);
+
+                if (it == instances.end())
+                    it = instances.emplace(keys_[i], wmi_rolling_stats(window_)).first;
+
+                it->second.push(wmi_result.time, column.as_double(i));
+            }
+
+            wmi_drop_missing_instances(instances, keys_, seen_);
+        }
+    }
+
+    [[nodiscard]] wmi_aggregate_result aggregates() const
+    {
+        wmi_aggregate_result result;
+
+        for (auto& [handle, instances] : series_)
+        {
+            auto& out = result[handle];
+
+            for (auto& [key, stats] : instances)
+                out[key] = stats.aggregate();
+        }
+
+        return result;
+    }
+
+    // Returns a callback for query_async that feeds every sample into the aggregator and hands the aggregates to
+    // export_callback every export_every samples. Lets a helper sample at a high rate while exporting at a low one.
+    [[nodiscard]] wmi_helper_callback<AnySize> wrap(wmi_aggregate_callback export_callback, const std::uint32_t export_every)
+    {
+        return [this, export_callback = std::move(export_callback), export_every, ticks = std::uint32_t(0)](const wmi_helper_config& config, const wmi_wrapper_class_result<AnySize>& wmi_result) mutable
+        {
+            update(wmi_result);
+
+            if (++ticks >= export_every)
+            {
+                ticks = 0;
+                export_callback(config, aggregates());
+            }
+        };
+    }
+
+private:
+
+    wmi_rolling_window window_;
+    std::optional<wmi_var_handle> key_handle_;
+
+    std::map<wmi_var_handle, std::unordered_map<std::wstring, wmi_rolling_stats>> series_;
+    std::vector<std::wstring> keys_;
+    std::unordered_set<std::wstring> seen_;
+};
+
+using wmi_rolling_aggregator_32 = wmi_rolling_aggregator<32>;
+
+// DDSketch style quantile sketch. Values are bucketed on a logarithmic scale so any quantile is returned with a relative
+// error of at most relative_accuracy. Once more than max_buckets buckets are in use the lowest ones are collapsed, which
+// bounds memory no matter how many samples are added and only costs accuracy on the low end of the distribution.
+// Sketches with the same relative_accuracy can be merged, including ones rebuilt on another host from serialize().
+// NaN and infinite values are ignored. Bucket keys are clamped to +-2^29, so with a relative_accuracy so small that
+// the keys of very large or small values do not fit, those values share the outermost buckets.
+class wmi_quantile_sketch
+{
+public:
+
+    explicit wmi_quantile_sketch(const double relative_accuracy = 0.01, const std::uint32_t max_buckets = 2048) : relative_accuracy_(relative_accuracy), max_buckets_(std::clamp<std::uint32_t>(max_buckets, 1, max_key))
+    {
+        // also rejects NaN, 1 would make gamma infinite
+        if (!(relative_accuracy_ > 0.0 && relative_accuracy_ < 1.0))
+            throw std::invalid_argument("wmi_quantile_sketch requires a relative accuracy between 0 and 1.");
+
+        gamma_ = (1.0 + relative_accuracy_) / (1.0 - relative_accuracy_);
+        log_gamma_ = std::log(gamma_);
+    }
+
+    void add(const double value, const std::uint64_t count = 1)
+    {
+        if (!std::isfinite(value) || count == 0)
+            return;
+
+        if (value > min_indexable)
+            positive_.add(key(value), count, max_buckets_);
+        else if (value < -min_indexable)
+            negative_.add(key(-value), count, max_buckets_);
+        else
+            zero_count_ += count;
+
+        count_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const wmi_quantile_sketch& other)
+    {
+        if (other.relative_accuracy_ != relative_accuracy_)
+            throw std::invalid_argument("wmi_quantile_sketch::merge() requires both sketches to use the same relative accuracy.");
+
+        for (std::size_t i = 0; i < other.positive_.counts.size(); i++)
+            positive_.add(other.positive_.offset + static_cast<std::int32_t>(i), other.positive_.counts[i], max_buckets_);
+
+        for (std::size_t i = 0; i < other.negative_.counts.size(); i++)
+            negative_.add(other.negative_.offset + static_cast<std::int32_t>(i), other.negative_.counts[i], max_buckets_);
+
+        zero_count_ += other.zero_count_;
+        count_ += other.count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    // q in [0, 1]. NaN if the sketch is empty.
+    [[nodiscard]] double quantile(const double q) const
+    {
+        if (count_ == 0 || q < 0.0 || q > 1.0)
+            return std::numeric_limits<double>::quiet_NaN();
+
+        const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count_ - 1));
+        std::uint64_t seen = 0;
+        double result = 0.0;
+        bool found = false;
+
+        // most negative values first, they live in the highest negative keys
+        for (auto i = negative_.counts.size(); i-- > 0 && !found;)
+        {
+            seen += negative_.counts[i];
+
+            if (seen > rank)
+            {
+                result = -value(negative_.offset + static_cast<std::int32_t>(i));
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            seen += zero_count_;
+            found = seen > rank;
+        }
+
+        for (std::size_t i = 0; i < positive_.counts.size() && !found; i++)
+        {
+            seen += positive_.counts[i];
+
+            if (seen > rank)
+            {
+                result = value(positive_.offset + static_cast<std::int32_t>(i));
+                found = true;
+            }
+        }
+
+        return std::clamp(result, min_, max_);
+    }
+
+    [[nodiscard]] std::uint64_t count() const
+    {
+        return count_;
+    }
+
+    [[nodiscard]] double min() const
+    {
+        return count_ ? min_ : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    [[nodiscard]] double max() const
+    {
+        return count_ ? max_ : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    [[nodiscard]] double relative_accuracy() const
+    {
+        return relative_accuracy_;
+    }
+
+    void clear()
+    {
+        positive_ = {};
+        negative_ = {};
+        zero_count_ = 0;
+        count_ = 0;
+        min_ = std::numeric_limits<double>::infinity();
+        max_ = -std::numeric_limits<double>::infinity();
+    }
+
+    // Flat host byte order encoding for shipping sketches between hosts.
+    [[nodiscard]] std::vector<std::uint8_t> serialize() const
+    {
+        std::vector<std::uint8_t> out;
+
+        write(out, relative_accuracy_);
+        write(out, max_buckets_);
+        write(out, zero_count_);
+        write(out, count_);
+        write(out, min_);
+        write(out, max_);
+
+        for (auto* store : { &positive_, &negative_ })
+        {
+            write(out, store->offset);
+            write(out, static_cast<std::uint32_t>(store->counts.size()));
+
+            for (auto bucket : store->counts)
+                write(out, bucket);
+        }
+
+        return out;
+    }
+
+    [[nodiscard]] static wmi_quantile_sketch deserialize(const std::uint8_t* data, const std::size_t size)
+    {
+        std::size_t pos = 0;
+
+        const auto relative_accuracy = read<double>(data, size, pos);
+        const auto max_buckets = read<std::uint32_t>(data, size, pos);
+
+        wmi_quantile_sketch sketch(relative_accuracy, max_buckets);
+
+        sketch.zero_count_ = read<std::uint64_t>(data, size, pos);
+        sketch.count_ = read<std::uint64_t>(data, size, pos);
+        sketch.min_ = read<double>(data, size, pos);
+        sketch.max_ = read<double>(data, size, pos);
+
+        auto total = sketch.zero_count_;
+
+        for (auto* store : { &sketch.positive_, &sketch.negative_ })
+        {
+            store->offset = read<std::int32_t>(data, size, pos);
+
+            const auto count = read<std::uint32_t>(data, size, pos);
+
+            // a damaged count must not allocate more than the buffer can hold
+            if (count > (size - pos) / sizeof(std::uint64_t))
+                throw std::out_of_range("wmi_quantile_sketch::deserialize() ran past the end of the buffer.");
+
+            if (count > sketch.max_buckets_ || store->offset < -max_key || store->offset > max_key - static_cast<std::int32_t>(count))
+                throw std::invalid_argument("wmi_quantile_sketch::deserialize() found buckets outside of the sketch's limits.");
+
+            store->counts.resize(count);
+
+            for (auto& bucket : store->counts)
+            {
+                bucket = read<std::uint64_t>(data, size, pos);
+
+                if (bucket > std::numeric_limits<std::uint64_t>::max() - total)
+                    throw std::invalid_argument("wmi_quantile_sketch::deserialize() found bucket counts that overflow.");
+
+                total += bucket;
+            }
+        }
+
+        if (total != sketch.count_)
+            throw std::invalid_argument("wmi_quantile_sketch::deserialize() found a count that does not match its buckets.");
+
+        return sketch;
+    }
+
+private:
+
+    // values closer to zero than this are counted as zero
+    static constexpr double min_indexable = 1e-12;
+
+    // bound of bucket keys and max_buckets, leaves headroom for the int32 arithmetic on keys and offsets
+    static constexpr std::int32_t max_key = 1 << 29;
+
+    // dense run of buckets starting at key offset
+    struct bucket_store
+    {
+        std::vector<std::uint64_t> counts;
+        std::int32_t offset = 0;
+
+        void add(std::int32_t key, const std::uint64_t count, const std::uint32_t max_buckets)
+        {
+            if (counts.empty())
+            {
+                counts.assign(1, 0);
+                offset = key;
+            }
+
+            const auto top = offset + static_cast<std::int32_t>(counts.size()) - 1;
+
+            if (key < offset)
+            {
+                // extend downwards only as far as the bucket limit allows, the rest lands in the lowest bucket
+                key = std::max(key, top - static_cast<std::int32_t>(max_buckets) + 1);
+
+                if (key < offset)
+                {
+                    counts.insert(counts.begin(), static_cast<std::size_t>(offset - key), 0);
+                    offset = key;
+                }
+            }
+            else if (key > top)
+            {
+                collapse_below(key - static_cast<std::int32_t>(max_buckets) + 1);
+                counts.resize(static_cast<std::size_t>(key - offset) + 1, 0);
+            }
+
+            counts[static_cast<std::size_t>(key - offset)] += count;
+        }
+
+        // folds every bucket below new_offset into the bucket at new_offset
+        void collapse_below(const std::int32_t new_offset)
+        {
+            if (new_offset <= offset)
+                return;
+
+            const auto n = std::min(counts.size(), static_cast<std::size_t>(new_offset - offset));
+            std::uint64_t folded = 0;
+
+            for (std::size_t i = 0; i < n; i++)
+                folded += counts[i];
+
+            counts.erase(counts.begin(), counts.begin() + static_cast<std::ptrdiff_t>(n));
+
+            if (counts.empty())
+                counts.assign(1, 0);
+
+            offset = new_offset;
+            counts[0] += folded;
+        }
+    };
+
+    [[nodiscard]] std::int32_t key(const double magnitude) const
+    {
+        const auto bucket_key = std::ceil(std::log(magnitude) / log_gamma_);
+        return static_cast<std::int32_t>(std::clamp(bucket_key, -static_cast<double>(max_key), static_cast<double>(max_key)));
+    }
+
+    [[nodiscard]] double value(const std::int32_t bucket_key) const
+    {
+        return 2.0 * std::pow(gamma_, bucket_key) / (gamma_ + 1.0);
+    }
+
+    template<typename T>
+    static void write(std::vector<std::uint8_t>& out, const T value)
+    {
+        const auto pos = out.size();
+        out.resize(pos + sizeof(T));
+        std::memcpy(out.data() + pos, &value, sizeof(T));
+    }
+
+    template<typename T>
+    static T read(const std::uint8_t* data, const std::size_t size, std::size_t& pos)
+    {
+        if (pos + sizeof(T) > size)
+            throw std::out_of_range("wmi_quantile_sketch::deserialize() ran past the end of the buffer.");
+
+        T value;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    double relative_accuracy_;
+    std::uint32_t max_buckets_;
+    double gamma_;
+    double log_gamma_;
+
+    bucket_store positive_;
+    bucket_store negative_;
+    std::uint64_t zero_count_ = 0;
+    std::uint64_t count_ = 0;
+
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+};
+
+// Feeds captured vars into quantile sketches: one per instance that accumulates over time, and one per var that only
+// holds the current sample across all instances (rebuilt on every update).
+template<std::size_t AnySize>
+class wmi_quantile_tracker
+{
+public:
+
+    explicit wmi_quantile_tracker(std::optional<wmi_var_handle> key_handle = std::nullopt, const double relative_accuracy = 0.01, const std::uint32_t max_buckets = 2048) : key_handle_(key_handle), relative_accuracy_(relative_accuracy), max_buckets_(max_buckets)
+    {
+    }
+
+    void attach(const wmi_var_handle handle)
+    {
+        series_.try_emplace(handle, wmi_quantile_sketch(relative_accuracy_, max_buckets_));
+    }
+
+    void update(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        const auto& results = wmi_result.result;
+
+        if (!wmi_instance_keys(results, key_handle_, keys_))
+            return;
+
+        for (auto& [handle, tracked] : series_)
+        {
+            tracked.across_instances.clear();
+
+            if (!results.count(handle))
+                continue;
+
+            const auto& column = results.at(handle);
+
+            for (std::size_t i = 0; i < column.size() && i < keys_.size(); i++)
+            {
+                const auto value = column.as_double(i);
+
+                auto it = tracked.instances.find(keys_[i]);
+
+                if (it == tracked.instances.end())
+                    it = tracked.instances.emplace(keys_[i], wmi_quantile_sketch(relative_accuracy_, max_buckets_)).first;
+
+                it->second.add(value);
+                tracked.across_instances.add(value);
+            }
+
+            wmi_drop_missing_instances(tracked.instances, keys_, seen_);
+        }
+    }
+
+    // distribution of a single instance over every update it was part of
+    [[nodiscard]] const wmi_quantile_sketch* instance(const wmi_var_handle handle, const std::wstring& key) const
+    {
+        const auto series = series_.find(handle);
+
+        if (series == series_.end())
+            return nullptr;
+
+        const auto it = series->second.instances.find(key);
+        return it != series->second.instances.end() ? &it->second : nullptr;
+    }
+
+    // distribution across every instance of the most recent update
+    [[nodiscard]] const wmi_quantile_sketch* across_instances(const wmi_var_handle handle) const
+    {
+        const auto series = series_.find(handle);
+        return series != series_.end() ? &series->second.across_instances : nullptr;
+    }
+
+    // distribution of every instance over time, merged
+    [[nodiscard]] wmi_quantile_sketch merged(const wmi_var_handle handle) const
+    {
+        wmi_quantile_sketch result(relative_accuracy_, max_buckets_);
+        const auto series = series_.find(handle);
+
+        if (series != series_.end())
+        {
+            for (auto& [key, sketch] : series->second.instances)
+                result.merge(sketch);
+        }
+
+        return result;
+    }
+
+private:
+
+    struct tracked_var
+    {
+        explicit tracked_var(wmi_quantile_sketch sketch) : across_instances(std::move(sketch))
+        {
+        }
+
+        std::unordered_map<std::wstring, wmi_quantile_sketch> instances;
+        wmi_quantile_sketch across_instances;
+    };
+
+    std::optional<wmi_var_handle> key_handle_;
+    double relative_accuracy_;
+    std::uint32_t max_buckets_;
+
+    std::map<wmi_var_handle, tracked_var> series_;
+    std::vector<std::wstring> keys_;
+    std::unordered_set<std::wstring> seen_;
+};
+
+using wmi_quantile_tracker_32 = wmi_quantile_tracker<32>;
+
+struct wmi_top_k_row
+{
+    std::size_t row; // index into the result columns
+    std::wstring key;
+    double value;
+};
+
+enum class wmi_top_k_mode
+{
+    raw, // rank by the value itself
+    rate // rank by (value - prev value) per second, e.g. for raw perf counters
+};
+
+// Selects the k largest rows of a numeric column with a bounded min-heap, O(n log k) and no copy or sort of the full
+// column. Keys are only materialized for the rows that make it into the result. Scratch buffers are kept between calls
+// so a long lived selector does not allocate per tick once warmed up.
+template<std::size_t AnySize>
+class wmi_top_k
+{
+public:
+
+    wmi_top_k(const wmi_var_handle value_handle, std::optional<wmi_var_handle> key_handle, const std::size_t k, const wmi_top_k_mode mode = wmi_top_k_mode::raw)
+        : value_handle_(value_handle), key_handle_(key_handle), k_(k), mode_(mode)
+    {
+    }
+
+    // Rows ordered by descending value.
+    const std::vector<wmi_top_k_row>& select(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        rows_.clear();
+        heap_.clear();
+
+        const auto& results = wmi_result.result;
+
+        if (k_ == 0 || !results.count(value_handle_))
+            return rows_;
+
+        if (mode_ == wmi_top_k_mode::rate && !prepare_rate(wmi_result))
+            return rows_;
+
+        const auto& column = results.at(value_handle_);
+        const auto greater = [](const entry& a, const entry& b) { return a.value > b.value; };
+
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            const auto value = mode_ == wmi_top_k_mode::rate ? rate(i) : column.as_double(i);
+
+            if (std::isnan(value))
+                continue;
+
+            if (heap_.size() < k_)
+            {
+                heap_.push_back({ value, i });
+                std::push_heap(heap_.begin(), heap_.end(), greater);
+            }
+            else if (value > heap_.front().value)
+            {
+                std::pop_heap(heap_.begin(), heap_.end(), greater);
+                heap_.back() = { value, i };
+                std::push_heap(heap_.begin(), heap_.end(), greater);
+            }
+        }
+
+        std::sort_heap(heap_.begin(), heap_.end(), greater);
+
+        for (auto& [value, row] : heap_)
+            rows_.push_back({ row, key(results, row), value });
+
+        return rows_;
+    }
+
+private:
+
+    using column_type = typename wmi_wrapper_result_map<AnySize>::column_type;
+
+    struct entry
+    {
+        double value;
+        std::size_t row;
+    };
+
+    // key columns are empty if either result lacks them
+    struct rate_columns
+    {
+        column_type values;
+        column_type prev_values;
+        column_type keys;
+        column_type prev_keys;
+    };
+
+    [[nodiscard]] std::wstring key(const wmi_wrapper_result_map<AnySize>& results, const std::size_t row) const
+    {
+        if (!key_handle_ || !results.count(*key_handle_))
+            return std::to_wstring(row);
+
+        const auto& keys = results.at(*key_handle_);
+        std::wstring buffer;
+        const auto value = row < keys.size() ? keys.key(row, buffer) : std::wstring_view{};
+
+        return value.empty() ? std::to_wstring(row) : std::wstring(value);
+    }
+
+    // Looks up the columns rate() reads once per select.
+    bool prepare_rate(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        prev_by_key_.clear();
+        columns_.reset();
+
+        if (!wmi_result.prev_result.count(value_handle_) || wmi_result.time <= wmi_result.prev_time)
+            return false;
+
+        seconds_ = static_cast<double>(wmi_result.time - wmi_result.prev_time) / 1000.0;
+
+        const auto& results = wmi_result.result;
+        const auto& prev_results = wmi_result.prev_result;
+        const auto keyed = key_handle_ && results.count(*key_handle_) && prev_results.count(*key_handle_);
+
+        columns_.emplace(rate_columns{ results.at(value_handle_), prev_results.at(value_handle_),
+            keyed ? results.at(*key_handle_) : column_type(nullptr, 0, {}),
+            keyed ? prev_results.at(*key_handle_) : column_type(nullptr, 0, {}) });
+
+        return true;
+    }
+
+    // Instances usually keep their row between refreshes, so the previous value is looked up by row first and only
+    // falls back to a key map (built once per select) when the keys at that row differ.
+    [[nodiscard]] double rate(const std::size_t row)
+    {
+        const auto& [column, prev_column, keys, prev_keys] = *columns_;
+
+        const auto value = column.as_double(row);
+        auto prev = std::numeric_limits<double>::quiet_NaN();
+
+        if (!key_handle_)
+        {
+            if (row < prev_column.size())
+                prev = prev_column.as_double(row);
+        }
+        else if (row < keys.size() && row < prev_keys.size() && row < prev_column.size() && keys.value_equals(row, prev_keys, row))
+        {
+            prev = prev_column.as_double(row);
+        }
+        else if (row < keys.size())
+        {
+            if (prev_by_key_.empty())
+            {
+                for (std::size_t i = 0; i < prev_keys.size() && i < prev_column.size(); i++)
+                {
+                    const auto prev_key = prev_keys.key(i, key_buffer_);
+
+                    if (!prev_key.empty())
+                        prev_by_key_.emplace(prev_key, prev_column.as_double(i));
+                }
+            }
+
+            const auto it = prev_by_key_.find(std::wstring(keys.key(row, key_buffer_)));
+
+            if (it != prev_by_key_.end())
+                prev = it->second;
+        }
+
+        return (value - prev) / seconds_;
+    }
+
+    wmi_var_handle value_handle_;
+    std::optional<wmi_var_handle> key_handle_;
+    std::size_t k_;
+    wmi_top_k_mode mode_;
+
+    double seconds_ = 1.0;
+
+    std::vector<entry> heap_;
+    std::vector<wmi_top_k_row> rows_;
+    std::optional<rate_columns> columns_;
+    std::unordered_map<std::wstring, double> prev_by_key_;
+    std::wstring key_buffer_;
+};
+
+using wmi_top_k_32 = wmi_top_k<32>;
@@ -0,0 +1,1436 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "WmiExport.hpp"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary columnar capture files, for long captures that were kept as printed text before. Integers are little endian
+// and every block starts 8 byte aligned, so a reader can map the file and use the columns in place:
+//
+//   wmi_capture_file_header                   magic and version
+//   schema block                              class name and the captured properties
+//   per tick: [dictionary block] tick block   strings first seen on the tick, then the tick's columns
+//   index block                               time and offset of every tick block and offset of every dictionary block
+//   wmi_capture_file_trailer                  offset of the index block
+//
+// Blocks start with a wmi_capture_file_block, their payload is padded to a multiple of 8 bytes:
+//
+//   schema      u32 class name size and the name, u32 property count, per property u32 name size and the name
+//   dictionary  u32 first code, u32 count, per string u32 size and the UTF-8 bytes. Codes are consecutive and count
+//               up from 0 over the whole file
+//   tick        wmi_capture_file_tick, then per column a wmi_capture_file_column followed by its data
+//   index       u64 tick count, u64 dictionary count, a wmi_capture_file_index_entry per tick, u64 per dictionary
+//
+// Column data is a validity bitmap of (rows + 63) / 64 u64 words, bit set if the row has a value, followed by the
+// values as described by wmi_capture_file_encoding. Columns missing from a result are missing from its tick. A file
+// that was not closed has no index block and trailer, its blocks can still be read in order.
+
+inline constexpr char wmi_capture_file_magic[8] = { 'W', 'M', 'I', 'C', 'A', 'P', '\0', '\1' };
+inline constexpr char wmi_capture_file_index_magic[8] = { 'W', 'M', 'I', 'I', 'D', 'X', '\0', '\1' };
+inline constexpr std::uint32_t wmi_capture_file_version = 1;
+
+enum class wmi_capture_file_block_kind : std::uint32_t
+{
+    schema = 1,
+    dictionary = 2,
+    tick = 3,
+    index = 4
+};
+
+enum class wmi_capture_file_encoding : std::uint32_t
+{
+    scalar = 1, // width bytes per row, the value as read, zero for rows without one
+    code = 2, // u32 dictionary code per row
+    utf8 = 3, // rows + 1 u32 offsets into the UTF-8 bytes that follow (padded to 8 bytes), used once the dictionary is full
+    repeat = 4 // no data, same as the column whose header is at source. Written for columns that did not change
+};
+
+struct wmi_capture_file_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+};
+
+struct wmi_capture_file_block
+{
+    wmi_capture_file_block_kind kind;
+    std::uint32_t reserved;
+    std::uint64_t size; // payload bytes that follow, padding included
+};
+
+struct wmi_capture_file_tick
+{
+    std::uint64_t time; // get_current_time() of the result
+    std::uint32_t rows;
+    std::uint32_t columns;
+};
+
+struct wmi_capture_file_column
+{
+    std::uint32_t property; // index into the schema
+    std::uint32_t type; // CIMTYPE of the values, CIM_EMPTY if no row has one
+    wmi_capture_file_encoding encoding;
+    std::uint32_t width; // bytes per value of scalar columns
+    std::uint64_t size; // data bytes that follow
+    std::uint64_t source; // file offset of the header holding the data of a repeat column
+};
+
+struct wmi_capture_file_index_entry
+{
+    std::uint64_t time;
+    std::uint64_t offset; // of the tick's wmi_capture_file_block
+};
+
+struct wmi_capture_file_trailer
+{
+    std::uint64_t index_offset; // of the index block's wmi_capture_file_block
+    std::uint64_t ticks;
+    char magic[8];
+};
+
+static_assert(sizeof(wmi_capture_file_header) == 16 && sizeof(wmi_capture_file_block) == 16 && sizeof(wmi_capture_file_tick) == 16
+    && sizeof(wmi_capture_file_column) == 32 && sizeof(wmi_capture_file_index_entry) == 16 && sizeof(wmi_capture_file_trailer) == 24,
+    "capture file structures are meant to have no padding.");
+
+class wmi_capture_file_error : public std::runtime_error
+{
+public:
+
+    using std::runtime_error::runtime_error;
+};
+
+// Encodes results into the capture file format, appending the bytes of the file to fmt::memory_buffers in order.
+// The first encode() writes the file header and schema, finish() the index and trailer. Strings of every column share
+// one dictionary: a string costs its bytes once and 4 bytes on every tick after that. Columns equal to the ones of
+// the previous tick cost a header.
+template<std::size_t AnySize>
+class wmi_capture_file_encoder
+{
+public:
+
+    using column_type = typename wmi_wrapper_result_map<AnySize>::column_type;
+
+    // Strings that arrive once the dictionary holds max_dictionary_entries are written as plain UTF-8.
+    explicit wmi_capture_file_encoder(const std::wstring_view class_name, const std::uint32_t max_dictionary_entries = 1 << 20)
+        : class_name_(wmi_to_utf8(class_name)), dictionary_(std::make_unique<wmi_string_dictionary>(max_dictionary_entries))
+    {
+    }
+
+    void attach(const wmi_var_handle handle, const std::wstring_view property)
+    {
+        if (position_ != 0)
+            throw wmi_capture_file_error("wmi_capture_file_encoder::attach() called after the schema was written.");
+
+        field added;
+        added.handle = handle;
+        added.name = wmi_to_utf8(property);
+        fields_.push_back(std::move(added));
+    }
+
+    template<typename Backend>
+    void attach(const wmi_helper<AnySize, Backend>& helper, const wmi_var_handle handle)
+    {
+        attach(handle, helper.var_name(handle));
+    }
+
+    // Appends the blocks of one result to out, preceded by the file header and schema on the first call.
+    void encode(const wmi_wrapper_class_result<AnySize>& wmi_result, fmt::memory_buffer& out)
+    {
+        if (finished_)
+            throw wmi_capture_file_error("wmi_capture_file_encoder::encode() called after finish().");
+
+        if (position_ == 0)
+            encode_schema(out);
+
+        const auto first_code = dictionary_->size();
+
+        // the tick goes to tick_ first, strings it adds to the dictionary have to be written before it
+        encode_tick(wmi_result, false);
+
+        if (dictionary_->size() != first_code)
+        {
+            dictionaries_.push_back(position_);
+            encode_dictionary(first_code, out);
+        }
+
+        // repeat columns refer to their source by file offset, now known
+        for (auto& field : fields_)
+        {
+            if (field.pending)
+            {
+                field.previous_offset += position_;
+                field.pending = false;
+            }
+        }
+
+        ticks_.push_back({ wmi_result.time, position_ });
+        out.append(tick_.data(), tick_.data() + tick_.size());
+        position_ += tick_.size();
+    }
+
+    // Appends a tick block of one result that stands on its own, with strings as UTF-8 and no repeat columns, for
+    // readers that do not see the other ticks like wmi_shared_snapshot_reader. It is not part of the file.
+    void encode_standalone(const wmi_wrapper_class_result<AnySize>& wmi_result, fmt::memory_buffer& out)
+    {
+        encode_tick(wmi_result, true);
+        out.append(tick_.data(), tick_.data() + tick_.size());
+    }
+
+    // Appends the schema block, without the file header.
+    void encode_schema_block(fmt::memory_buffer& out) const
+    {
+        const auto block_at = out.size();
+        append(out, wmi_capture_file_block{ wmi_capture_file_block_kind::schema, 0, 0 });
+        append_string(out, class_name_);
+        append(out, static_cast<std::uint32_t>(fields_.size()));
+
+        for (const auto& field : fields_)
+            append_string(out, field.name);
+
+        pad(out, block_at);
+        patch(out, block_at + offsetof(wmi_capture_file_block, size), static_cast<std::uint64_t>(out.size() - block_at - sizeof(wmi_capture_file_block)));
+    }
+
+    // Appends the index block and trailer. Nothing can be encoded after.
+    void finish(fmt::memory_buffer& out)
+    {
+        if (finished_)
+            return;
+
+        if (position_ == 0)
+            encode_schema(out);
+
+        const auto start = out.size();
+        const auto index_offset = position_;
+
+        append(out, wmi_capture_file_block{ wmi_capture_file_block_kind::index, 0, 0 });
+        append(out, static_cast<std::uint64_t>(ticks_.size()));
+        append(out, static_cast<std::uint64_t>(dictionaries_.size()));
+        out.append(reinterpret_cast<const char*>(ticks_.data()), reinterpret_cast<const char*>(ticks_.data() + ticks_.size()));
+        out.append(reinterpret_cast<const char*>(dictionaries_.data()), reinterpret_cast<const char*>(dictionaries_.data() + dictionaries_.size()));
+        patch(out, start + offsetof(wmi_capture_file_block, size), static_cast<std::uint64_t>(out.size() - start - sizeof(wmi_capture_file_block)));
+
+        wmi_capture_file_trailer trailer{ index_offset, ticks_.size(), {} };
+        std::memcpy(trailer.magic, wmi_capture_file_index_magic, sizeof(trailer.magic));
+        append(out, trailer);
+
+        position_ += out.size() - start;
+        finished_ = true;
+    }
+
+    // Bytes encoded so far, the file offset the next block starts at.
+    [[nodiscard]] std::uint64_t position() const
+    {
+        return position_;
+    }
+
+    [[nodiscard]] std::size_t ticks() const
+    {
+        return ticks_.size();
+    }
+
+private:
+
+    struct field
+    {
+        wmi_var_handle handle = 0;
+        std::string name;
+
+        // data of the last column written, to detect repeats. starts with its type, encoding, width and rows
+        std::vector<char> previous;
+        std::uint64_t previous_offset = 0; // file offset of its header, relative to tick_ while pending
+        bool pending = false;
+        bool has_previous = false;
+
+        // file codes of the codes of a dictionary encoded column, none if not interned yet
+        const wmi_string_dictionary* source = nullptr;
+        std::vector<std::uint32_t> remap;
+    };
+
+    static constexpr std::uint32_t none = 0xffffffff;
+
+    template<typename T>
+    static void append(fmt::memory_buffer& out, const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable values are written as is.");
+
+        const auto* bytes = reinterpret_cast<const char*>(&value);
+        out.append(bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    static void patch(fmt::memory_buffer& out, const std::size_t at, const T& value)
+    {
+        std::memcpy(out.data() + at, &value, sizeof(T));
+    }
+
+    static void append_string(fmt::memory_buffer& out, const std::string_view value)
+    {
+        append(out, static_cast<std::uint32_t>(value.size()));
+        out.append(value.data(), value.data() + value.size());
+    }
+
+    // zeros up to the next multiple of 8 bytes counted from start
+    static void pad(fmt::memory_buffer& out, const std::size_t start)
+    {
+        while ((out.size() - start) % 8)
+            out.push_back('\0');
+    }
+
+    // Appends size zeroed bytes and returns where they start.
+    static char* grow(fmt::memory_buffer& out, const std::size_t size)
+    {
+        const auto at = out.size();
+        out.resize(at + size);
+        std::memset(out.data() + at, 0, size);
+        return out.data() + at;
+    }
+
+    void encode_schema(fmt::memory_buffer& out)
+    {
+        const auto start = out.size();
+
+        wmi_capture_file_header header{ {}, wmi_capture_file_version, 0 };
+        std::memcpy(header.magic, wmi_capture_file_magic, sizeof(header.magic));
+        append(out, header);
+        encode_schema_block(out);
+
+        position_ += out.size() - start;
+    }
+
+    // Builds the tick block of a result in tick_.
+    void encode_tick(const wmi_wrapper_class_result<AnySize>& wmi_result, const bool standalone)
+    {
+        const auto& results = wmi_result.result;
+        std::size_t rows = 0;
+
+        for (const auto& field : fields_)
+        {
+            if (results.count(field.handle))
+                rows = std::max(rows, results[field.handle].size());
+        }
+
+        tick_.clear();
+        append(tick_, wmi_capture_file_block{ wmi_capture_file_block_kind::tick, 0, 0 });
+
+        const auto tick_at = tick_.size();
+        append(tick_, wmi_capture_file_tick{ wmi_result.time, static_cast<std::uint32_t>(rows), 0 });
+
+        std::uint32_t columns = 0;
+
+        for (std::uint32_t property = 0; property < fields_.size(); property++)
+        {
+            if (!results.count(fields_[property].handle))
+                continue;
+
+            encode_column(property, results[fields_[property].handle], rows, standalone);
+            columns++;
+        }
+
+        patch(tick_, tick_at + offsetof(wmi_capture_file_tick, columns), columns);
+        patch(tick_, offsetof(wmi_capture_file_block, size), static_cast<std::uint64_t>(tick_.size() - sizeof(wmi_capture_file_block)));
+    }
+
+    void encode_dictionary(const std::uint32_t first_code, fmt::memory_buffer& out)
+    {
+        const auto start = out.size();
+        const auto count = dictionary_->size() - first_code;
+
+        append(out, wmi_capture_file_block{ wmi_capture_file_block_kind::dictionary, 0, 0 });
+        append(out, first_code);
+        append(out, count);
+
+        for (auto code = first_code; code < first_code + count; code++)
+            append_string(out, dictionary_->utf8(code));
+
+        pad(out, start);
+        patch(out, start + offsetof(wmi_capture_file_block, size), static_cast<std::uint64_t>(out.size() - start - sizeof(wmi_capture_file_block)));
+
+        position_ += out.size() - start;
+    }
+
+    // Standalone columns keep strings as UTF-8 and are never repeats.
+    void encode_column(const std::uint32_t property, const column_type& column, const std::size_t rows, const bool standalone)
+    {
+        auto& field = fields_[property];
+
+        // the first cell with a value decides how the column is stored, cells that do not match it count as missing
+        CIMTYPE type = CIM_EMPTY;
+        auto strings = false;
+
+        for (std::size_t row = 0; row < column.size(); row++)
+        {
+            if (column.cell(row).has_value())
+            {
+                type = column.cell(row).type();
+                strings = column.cell(row).is_string();
+                break;
+            }
+        }
+
+        const auto header_at = tick_.size();
+        append(tick_, wmi_capture_file_column{ property, static_cast<std::uint32_t>(type), wmi_capture_file_encoding::scalar, 0, 0, 0 });
+
+        const auto data_at = tick_.size();
+        const auto words = (rows + 63) / 64;
+        grow(tick_, words * sizeof(std::uint64_t));
+
+        auto encoding = wmi_capture_file_encoding::scalar;
+        std::uint32_t width = 0;
+
+        if (strings)
+        {
+            encoding = wmi_capture_file_encoding::code;
+            width = sizeof(std::uint32_t);
+
+            if (standalone || !encode_codes(field, column, rows, data_at))
+            {
+                tick_.resize(data_at);
+                grow(tick_, words * sizeof(std::uint64_t));
+                encode_utf8(column, rows, data_at);
+
+                encoding = wmi_capture_file_encoding::utf8;
+                width = 0;
+            }
+        }
+        else if (type != CIM_EMPTY)
+        {
+            width = static_cast<std::uint32_t>(std::max<std::size_t>(wmi_cim_type_size(type), 1));
+            encode_scalars(column, rows, type, width, data_at);
+        }
+
+        pad(tick_, data_at);
+
+        if (standalone)
+        {
+            patch(tick_, header_at + offsetof(wmi_capture_file_column, encoding), encoding);
+            patch(tick_, header_at + offsetof(wmi_capture_file_column, width), width);
+            patch(tick_, header_at + offsetof(wmi_capture_file_column, size), static_cast<std::uint64_t>(tick_.size() - data_at));
+            return;
+        }
+
+        const std::uint32_t description[4] = { static_cast<std::uint32_t>(type), static_cast<std::uint32_t>(encoding), width, static_cast<std::uint32_t>(rows) };
+        const auto data_size = tick_.size() - data_at;
+
+        const auto repeated = field.has_previous && field.previous.size() == sizeof(description) + data_size
+            && std::memcmp(field.previous.data(), description, sizeof(description)) == 0
+            && std::memcmp(field.previous.data() + sizeof(description), tick_.data() + data_at, data_size) == 0;
+
+        if (repeated)
+        {
+            tick_.resize(data_at);
+            patch(tick_, header_at + offsetof(wmi_capture_file_column, encoding), wmi_capture_file_encoding::repeat);
+            patch(tick_, header_at + offsetof(wmi_capture_file_column, source), field.previous_offset);
+            return;
+        }
+
+        field.previous.resize(sizeof(description) + data_size);
+        std::memcpy(field.previous.data(), description, sizeof(description));
+        std::memcpy(field.previous.data() + sizeof(description), tick_.data() + data_at, data_size);
+        field.previous_offset = header_at;
+        field.pending = true;
+        field.has_previous = true;
+
+        patch(tick_, header_at + offsetof(wmi_capture_file_column, encoding), encoding);
+        patch(tick_, header_at + offsetof(wmi_capture_file_column, width), width);
+        patch(tick_, header_at + offsetof(wmi_capture_file_column, size), static_cast<std::uint64_t>(data_size));
+    }
+
+    void encode_scalars(const column_type& column, const std::size_t rows, const CIMTYPE type, const std::uint32_t width, const std::size_t data_at)
+    {
+        const auto values_at = tick_.size();
+        grow(tick_, rows * width);
+
+        auto* valid = tick_.data() + data_at;
+        auto* values = tick_.data() + values_at;
+
+        for (std::size_t row = 0; row < std::min(rows, column.size()); row++)
+        {
+            const auto& cell = column.cell(row);
+
+            if (!cell.has_value() || cell.is_string() || cell.type() != type)
+                continue;
+
+            // bits() is zero extended, the low width bytes are the value
+            const auto bits = cell.bits();
+            std::memcpy(values + row * width, &bits, width);
+            valid[row / 8] |= static_cast<char>(1 << (row % 8));
+        }
+    }
+
+    // false if the dictionary is full
+    bool encode_codes(field& field, const column_type& column, const std::size_t rows, const std::size_t data_at)
+    {
+        const auto values_at = tick_.size();
+        grow(tick_, rows * sizeof(std::uint32_t));
+
+        const auto* source = column.dictionary();
+
+        // dictionaries are append only, a new one (or a smaller one at the same address) starts over
+        if (source != field.source || (source && source->size() < field.remap.size()))
+        {
+            field.source = source;
+            field.remap.clear();
+        }
+
+        for (std::size_t row = 0; row < std::min(rows, column.size()); row++)
+        {
+            const auto& cell = column.cell(row);
+
+            if (!cell.is_string())
+                continue;
+
+            std::uint32_t code;
+
+            if (cell.is_code() && source)
+            {
+                if (cell.code() >= field.remap.size())
+                    field.remap.resize(source->size(), none);
+
+                code = field.remap[cell.code()];
+
+                if (code == none)
+                {
+                    const auto interned = dictionary_->intern(source->value(cell.code()));
+
+                    if (!interned)
+                        return false;
+
+                    code = field.remap[cell.code()] = *interned;
+                }
+            }
+            else
+            {
+                const auto interned = dictionary_->intern(column.string(row));
+
+                if (!interned)
+                    return false;
+
+                code = *interned;
+            }
+
+            std::memcpy(tick_.data() + values_at + row * sizeof(code), &code, sizeof(code));
+            tick_.data()[data_at + row / 8] |= static_cast<char>(1 << (row % 8));
+        }
+
+        return true;
+    }
+
+    void encode_utf8(const column_type& column, const std::size_t rows, const std::size_t data_at)
+    {
+        const auto offsets_at = tick_.size();
+        grow(tick_, (rows + 1) * sizeof(std::uint32_t));
+        pad(tick_, data_at);
+
+        const auto text_at = tick_.size();
+
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            if (row < column.size() && column.cell(row).is_string())
+            {
+                const auto& cell = column.cell(row);
+
+                if (cell.is_code() && column.dictionary())
+                {
+                    const auto value = column.dictionary()->utf8(cell.code());
+                    tick_.append(value.data(), value.data() + value.size());
+                }
+                else
+                {
+                    wmi_append_utf8(column.string(row), tick_);
+                }
+
+                tick_.data()[data_at + row / 8] |= static_cast<char>(1 << (row % 8));
+            }
+
+            const auto end = static_cast<std::uint32_t>(tick_.size() - text_at);
+            std::memcpy(tick_.data() + offsets_at + (row + 1) * sizeof(end), &end, sizeof(end));
+        }
+    }
+
+    std::string class_name_;
+    std::vector<field> fields_;
+    std::unique_ptr<wmi_string_dictionary> dictionary_;
+    std::vector<wmi_capture_file_index_entry> ticks_;
+    std::vector<std::uint64_t> dictionaries_;
+    fmt::memory_buffer tick_;
+    std::uint64_t position_ = 0;
+    bool finished_ = false;
+};
+
+using wmi_capture_file_encoder_32 = wmi_capture_file_encoder<32>;
+
+#if FMT_USE_FCNTL
+// Streams results into a capture file:
+//
+//   wmi_capture_file_encoder_32 encoder(L"Win32_PerfFormattedData_PerfProc_Process");
+//   encoder.attach(helper, name_handle);
+//   wmi_capture_file_writer_32 writer(std::move(encoder), wmi_export_output("capture.wmic", wmi_export_output::mode::truncate));
+//   helper.query_async(writer.callback());
+//
+// Blocks are buffered and written sequentially once batch_bytes are pending. close() writes the index, it is called
+// by the destructor if it was not called before; call it yourself to see errors.
+template<std::size_t AnySize>
+class wmi_capture_file_writer
+{
+public:
+
+    wmi_capture_file_writer(wmi_capture_file_encoder<AnySize> encoder, wmi_export_output output, const std::size_t batch_bytes = 1 << 20)
+        : encoder_(std::move(encoder)), output_(std::move(output)), batch_bytes_(batch_bytes)
+    {
+    }
+
+    wmi_capture_file_writer(const wmi_capture_file_writer&) = delete;
+    wmi_capture_file_writer& operator=(const wmi_capture_file_writer&) = delete;
+
+    ~wmi_capture_file_writer()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::exception&)
+        {
+            // nothing to report a failed write to
+        }
+    }
+
+    void write(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        encoder_.encode(wmi_result, buffer_);
+
+        if (buffer_.size() >= batch_bytes_)
+            flush();
+    }
+
+    void flush()
+    {
+        output_.write(buffer_);
+        buffer_.clear();
+    }
+
+    void close()
+    {
+        if (closed_)
+            return;
+
+        closed_ = true;
+        encoder_.finish(buffer_);
+        flush();
+    }
+
+    // Callback for wmi_helper::query_async() that writes every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            write(wmi_result);
+        };
+    }
+
+    [[nodiscard]] const wmi_capture_file_encoder<AnySize>& encoder() const
+    {
+        return encoder_;
+    }
+
+private:
+
+    wmi_capture_file_encoder<AnySize> encoder_;
+    wmi_export_output output_;
+    std::size_t batch_bytes_;
+    fmt::memory_buffer buffer_;
+    bool closed_ = false;
+};
+
+using wmi_capture_file_writer_32 = wmi_capture_file_writer<32>;
+#endif
+
+// Read only mapping of a whole file, with mmap or CreateFileMapping.
+class wmi_mapped_file
+{
+public:
+
+    explicit wmi_mapped_file(const char* path)
+    {
+#ifdef _WIN32
+        const auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+            throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot open {}, error {}.", path, GetLastError()));
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size))
+        {
+            const auto error = GetLastError();
+            CloseHandle(file);
+            throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot get the size of {}, error {}.", path, error));
+        }
+
+        size_ = static_cast<std::size_t>(size.QuadPart);
+
+        if (size_ > 0)
+        {
+            // the view keeps the file and the mapping alive
+            const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            auto error = GetLastError();
+            CloseHandle(file);
+
+            if (!mapping)
+                throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot map {}, error {}.", path, error));
+
+            data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            error = GetLastError();
+            CloseHandle(mapping);
+
+            if (!data_)
+                throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot map {}, error {}.", path, error));
+        }
+        else
+        {
+            CloseHandle(file);
+        }
+#else
+        const auto fd = ::open(path, O_RDONLY);
+
+        if (fd < 0)
+            throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot open {}: {}.", path, std::strerror(errno)));
+
+        struct stat info {};
+
+        if (fstat(fd, &info) != 0)
+        {
+            const auto error = errno;
+            ::close(fd);
+            throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot get the size of {}: {}.", path, std::strerror(error)));
+        }
+
+        size_ = static_cast<std::size_t>(info.st_size);
+
+        if (size_ > 0)
+        {
+            // the mapping stays valid once the descriptor is closed
+            auto* const mapped = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            const auto error = errno;
+            ::close(fd);
+
+            if (mapped == MAP_FAILED)
+                throw wmi_capture_file_error(fmt::format("wmi_mapped_file: cannot map {}: {}.", path, std::strerror(error)));
+
+            data_ = static_cast<const char*>(mapped);
+        }
+        else
+        {
+            ::close(fd);
+        }
+#endif
+    }
+
+    wmi_mapped_file(wmi_mapped_file&& other) noexcept : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    wmi_mapped_file& operator=(wmi_mapped_file&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+
+        return *this;
+    }
+
+    wmi_mapped_file(const wmi_mapped_file&) = delete;
+    wmi_mapped_file& operator=(const wmi_mapped_file&) = delete;
+
+    ~wmi_mapped_file()
+    {
+        unmap();
+    }
+
+    [[nodiscard]] const char* data() const
+    {
+        return data_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+
+    void unmap()
+    {
+        if (!data_)
+            return;
+
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap(const_cast<char*>(data_), size_);
+#endif
+        data_ = nullptr;
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Contiguous values inside a mapped file.
+template<typename T>
+class wmi_capture_file_span
+{
+public:
+
+    wmi_capture_file_span(const T* data, const std::size_t size) : data_(data), size_(size)
+    {
+    }
+
+    [[nodiscard]] const T* data() const
+    {
+        return data_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] const T& operator[](const std::size_t index) const
+    {
+        return data_[index];
+    }
+
+    [[nodiscard]] const T* begin() const
+    {
+        return data_;
+    }
+
+    [[nodiscard]] const T* end() const
+    {
+        return data_ + size_;
+    }
+
+private:
+
+    const T* data_;
+    std::size_t size_;
+};
+
+// Column of one tick of a capture file. Values point into the mapping and are valid as long as the reader is.
+class wmi_capture_file_column_view
+{
+public:
+
+    // header_offset is the file offset of the header holding the data, the source of repeat columns.
+    wmi_capture_file_column_view(const wmi_capture_file_column& header, const std::uint64_t header_offset, const char* data, const std::uint32_t rows, const std::vector<std::string_view>& dictionary)
+        : type_(static_cast<CIMTYPE>(header.type)), encoding_(header.encoding), width_(header.width), rows_(rows), header_offset_(header_offset), dictionary_(&dictionary)
+    {
+        const auto words = (static_cast<std::size_t>(rows) + 63) / 64;
+
+        valid_ = reinterpret_cast<const std::uint64_t*>(data);
+        values_ = data + words * sizeof(std::uint64_t);
+
+        if (encoding_ == wmi_capture_file_encoding::utf8)
+        {
+            text_ = values_ + ((static_cast<std::size_t>(rows) + 1) * sizeof(std::uint32_t) + 7) / 8 * 8;
+            text_size_ = static_cast<std::size_t>(std::max<std::int64_t>(data + header.size - text_, 0));
+        }
+    }
+
+    [[nodiscard]] std::uint32_t rows() const
+    {
+        return rows_;
+    }
+
+    [[nodiscard]] CIMTYPE type() const
+    {
+        return type_;
+    }
+
+    // Encoding of the data, never wmi_capture_file_encoding::repeat.
+    [[nodiscard]] wmi_capture_file_encoding encoding() const
+    {
+        return encoding_;
+    }
+
+    // Equal for columns sharing their data, a repeat column and its source.
+    [[nodiscard]] std::uint64_t header_offset() const
+    {
+        return header_offset_;
+    }
+
+    [[nodiscard]] bool has_value(const std::size_t row) const
+    {
+        return (valid_[row / 64] >> (row % 64)) & 1;
+    }
+
+    // Validity bitmap, bit row % 64 of word row / 64.
+    [[nodiscard]] wmi_capture_file_span<std::uint64_t> validity() const
+    {
+        return { valid_, (static_cast<std::size_t>(rows_) + 63) / 64 };
+    }
+
+    // Values of a scalar column, zero for rows without one. T has to match the CIMTYPE as for wmi_cell::get(),
+    // CIM_BOOLEAN is read as std::uint16_t. Throws wmi_type_error otherwise.
+    template<typename T>
+    [[nodiscard]] wmi_capture_file_span<T> values() const
+    {
+        const auto accepted = wmi_type_accepts<T>(type_) || (type_ == CIM_BOOLEAN && std::is_same_v<T, std::uint16_t>);
+
+        if (encoding_ != wmi_capture_file_encoding::scalar || sizeof(T) != width_ || !accepted)
+            throw wmi_type_error(fmt::format("wmi_capture_file_column_view::values() type does not match CIMTYPE {}.", type_));
+
+        return { reinterpret_cast<const T*>(values_), rows_ };
+    }
+
+    // Dictionary codes of a string column, see wmi_capture_file_reader::string().
+    [[nodiscard]] wmi_capture_file_span<std::uint32_t> codes() const
+    {
+        if (encoding_ != wmi_capture_file_encoding::code)
+            throw wmi_type_error("wmi_capture_file_column_view::codes() called for a column that is not dictionary encoded.");
+
+        return { reinterpret_cast<const std::uint32_t*>(values_), rows_ };
+    }
+
+    // UTF-8, empty for rows without a value and scalar columns.
+    [[nodiscard]] std::string_view string(const std::size_t row) const
+    {
+        if (!has_value(row))
+            return {};
+
+        if (encoding_ == wmi_capture_file_encoding::code)
+        {
+            std::uint32_t code;
+            std::memcpy(&code, values_ + row * sizeof(code), sizeof(code));
+            return code < dictionary_->size() ? (*dictionary_)[code] : std::string_view();
+        }
+
+        if (encoding_ == wmi_capture_file_encoding::utf8)
+        {
+            std::uint32_t range[2];
+            std::memcpy(range, values_ + row * sizeof(std::uint32_t), sizeof(range));
+
+            if (range[0] > range[1] || range[1] > text_size_)
+                return {};
+
+            return { text_ + range[0], range[1] - range[0] };
+        }
+
+        return {};
+    }
+
+    // Numeric value based on the CIMTYPE, strings are parsed. NaN for rows without a value.
+    [[nodiscard]] double as_double(const std::size_t row) const
+    {
+        if (!has_value(row))
+            return std::numeric_limits<double>::quiet_NaN();
+
+        if (encoding_ == wmi_capture_file_encoding::scalar)
+        {
+            std::uint64_t bits = 0;
+            std::memcpy(&bits, values_ + row * width_, width_);
+            return wmi_scalar_as_double(type_, &bits);
+        }
+
+        const auto value = string(row);
+
+        char buffer[64];
+        const auto length = std::min(value.size(), std::size(buffer) - 1);
+
+        std::memcpy(buffer, value.data(), length);
+        buffer[length] = '\0';
+
+        char* end = nullptr;
+        const auto number = std::strtod(buffer, &end);
+        return (end != buffer) ? number : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // Largest and smallest value of the rows that have one, NaNs ignored. Scalar columns are scanned 64 rows per
+    // validity word in a loop the compiler vectorizes.
+    [[nodiscard]] std::optional<double> max() const
+    {
+        return fold([](const auto candidate, const auto best) { return candidate > best; });
+    }
+
+    [[nodiscard]] std::optional<double> min() const
+    {
+        return fold([](const auto candidate, const auto best) { return candidate < best; });
+    }
+
+private:
+
+    template<typename Better>
+    [[nodiscard]] std::optional<double> fold(Better better) const
+    {
+        if (encoding_ != wmi_capture_file_encoding::scalar)
+        {
+            std::optional<double> best;
+
+            for (std::size_t row = 0; row < rows_; row++)
+            {
+                const auto value = as_double(row);
+
+                if (!std::isnan(value) && (!best || better(value, *best)))
+                    best = value;
+            }
+
+            return best;
+        }
+
+        switch (type_)
+        {
+        case CIM_SINT8: return fold_values<std::int8_t>(better);
+        case CIM_UINT8: return fold_values<std::uint8_t>(better);
+        case CIM_SINT16: return fold_values<std::int16_t>(better);
+        case CIM_UINT16: case CIM_BOOLEAN: case CIM_CHAR16: return fold_values<std::uint16_t>(better);
+        case CIM_SINT32: return fold_values<std::int32_t>(better);
+        case CIM_UINT32: return fold_values<std::uint32_t>(better);
+        case CIM_SINT64: return fold_values<std::int64_t>(better);
+        case CIM_UINT64: return fold_values<std::uint64_t>(better);
+        case CIM_REAL32: return fold_values<float>(better);
+        case CIM_REAL64: return fold_values<double>(better);
+        default: return std::nullopt;
+        }
+    }
+
+    template<typename T, typename Better>
+    [[nodiscard]] std::optional<double> fold_values(Better better) const
+    {
+        if (sizeof(T) != width_)
+            return std::nullopt;
+
+        const auto* values = reinterpret_cast<const T*>(values_);
+
+        // start from the first value, a NaN never wins a comparison after that
+        std::size_t row = 0;
+
+        while (row < rows_ && (!has_value(row) || values[row] != values[row]))
+            row++;
+
+        if (row == rows_)
+            return std::nullopt;
+
+        auto best = values[row];
+
+        for (; row < rows_ && row % 64; row++)
+        {
+            if (has_value(row) && better(values[row], best))
+                best = values[row];
+        }
+
+        for (; row < rows_; row += 64)
+        {
+            const auto word = valid_[row / 64];
+            const auto count = std::min<std::size_t>(64, rows_ - row);
+
+            if (count == 64 && word == ~std::uint64_t(0))
+            {
+                for (std::size_t i = row; i < row + 64; i++)
+                    best = better(values[i], best) ? values[i] : best;
+
+                continue;
+            }
+
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (((word >> i) & 1) && better(values[row + i], best))
+                    best = values[row + i];
+            }
+        }
+
+        return static_cast<double>(best);
+    }
+
+    CIMTYPE type_;
+    wmi_capture_file_encoding encoding_;
+    std::uint32_t width_;
+    std::uint32_t rows_;
+    std::uint64_t header_offset_;
+    const std::vector<std::string_view>* dictionary_;
+    const std::uint64_t* valid_ = nullptr;
+    const char* values_ = nullptr;
+    const char* text_ = nullptr;
+    std::size_t text_size_ = 0;
+};
+
+class wmi_capture_file_reader;
+
+// One tick of a capture file.
+class wmi_capture_file_tick_view
+{
+public:
+
+    wmi_capture_file_tick_view(const wmi_capture_file_reader& reader, const std::uint64_t offset, const wmi_capture_file_tick& tick)
+        : reader_(&reader), offset_(offset), tick_(tick)
+    {
+    }
+
+    [[nodiscard]] std::uint64_t time() const
+    {
+        return tick_.time;
+    }
+
+    [[nodiscard]] std::uint32_t rows() const
+    {
+        return tick_.rows;
+    }
+
+    // Column of a property (its index in wmi_capture_file_reader::properties()), empty if the tick has none.
+    [[nodiscard]] std::optional<wmi_capture_file_column_view> column(std::uint32_t property) const;
+
+private:
+
+    const wmi_capture_file_reader* reader_;
+    std::uint64_t offset_; // of the tick's wmi_capture_file_block
+    wmi_capture_file_tick tick_;
+};
+
+// Maps a capture file and reads it in place. Ticks are found by time with a binary search over the index, columns
+// are spans into the mapping, so multi GB captures are analyzed without loading them. Files that were not closed are
+// indexed by walking their blocks once, up to the last complete one. Throws wmi_capture_file_error for files that are
+// not capture files or are damaged.
+class wmi_capture_file_reader
+{
+public:
+
+    explicit wmi_capture_file_reader(const char* path) : file_(path)
+    {
+        if (file_.size() < sizeof(wmi_capture_file_header) || std::memcmp(file_.data(), wmi_capture_file_magic, sizeof(wmi_capture_file_magic)) != 0)
+            throw wmi_capture_file_error(fmt::format("wmi_capture_file_reader: {} is not a capture file.", path));
+
+        if (load<wmi_capture_file_header>(0).version != wmi_capture_file_version)
+            throw wmi_capture_file_error(fmt::format("wmi_capture_file_reader: {} has an unsupported version.", path));
+
+        read_schema();
+
+        if (!read_index())
+            walk_blocks();
+    }
+
+    [[nodiscard]] std::string_view class_name() const
+    {
+        return class_name_;
+    }
+
+    // UTF-8 property names, column views are looked up by their index.
+    [[nodiscard]] const std::vector<std::string_view>& properties() const
+    {
+        return properties_;
+    }
+
+    [[nodiscard]] std::optional<std::uint32_t> property(const std::string_view name) const
+    {
+        const auto it = std::find(properties_.begin(), properties_.end(), name);
+
+        if (it == properties_.end())
+            return std::nullopt;
+
+        return static_cast<std::uint32_t>(it - properties_.begin());
+    }
+
+    // false if the file was not closed and was indexed by walking its blocks
+    [[nodiscard]] bool indexed() const
+    {
+        return indexed_;
+    }
+
+    [[nodiscard]] std::size_t ticks() const
+    {
+        return tick_count_;
+    }
+
+    [[nodiscard]] std::uint64_t time(const std::size_t tick) const
+    {
+        check_tick(tick);
+        return ticks_[tick].time;
+    }
+
+    // First tick sampled at or after time, ticks() if there is none. Sample times are assumed to increase.
+    [[nodiscard]] std::size_t seek(const std::uint64_t time) const
+    {
+        const auto* const end = ticks_ + tick_count_;
+        return static_cast<std::size_t>(std::lower_bound(ticks_, end, time, [](const wmi_capture_file_index_entry& entry, const std::uint64_t value) { return entry.time < value; }) - ticks_);
+    }
+
+    [[nodiscard]] wmi_capture_file_tick_view tick(const std::size_t index) const
+    {
+        check_tick(index);
+
+        const auto offset = ticks_[index].offset;
+        return { *this, offset, load<wmi_capture_file_tick>(offset + sizeof(wmi_capture_file_block)) };
+    }
+
+    // UTF-8 string of a dictionary code.
+    [[nodiscard]] std::string_view string(const std::uint32_t code) const
+    {
+        return dictionary_.at(code);
+    }
+
+    // Calls visit(tick, column) for the column of property on every tick sampled in [from, to].
+    template<typename Visit>
+    void scan(const std::uint32_t property, const std::uint64_t from, const std::uint64_t to, Visit&& visit) const
+    {
+        for (auto index = seek(from); index < tick_count_ && ticks_[index].time <= to; index++)
+        {
+            const auto current = tick(index);
+
+            if (const auto column = current.column(property))
+                visit(current, *column);
+        }
+    }
+
+    // Largest and smallest value of property in [from, to], empty if there is none. Repeated columns are only
+    // scanned once.
+    [[nodiscard]] std::optional<double> max(const std::uint32_t property, const std::uint64_t from, const std::uint64_t to) const
+    {
+        return fold(property, from, to, &wmi_capture_file_column_view::max, [](const double candidate, const double best) { return candidate > best; });
+    }
+
+    [[nodiscard]] std::optional<double> min(const std::uint32_t property, const std::uint64_t from, const std::uint64_t to) const
+    {
+        return fold(property, from, to, &wmi_capture_file_column_view::min, [](const double candidate, const double best) { return candidate < best; });
+    }
+
+private:
+
+    friend class wmi_capture_file_tick_view;
+
+    // Copy of a structure at offset, throws if it is outside the file.
+    template<typename T>
+    [[nodiscard]] T load(const std::uint64_t offset) const
+    {
+        check(offset, sizeof(T));
+
+        T value;
+        std::memcpy(&value, file_.data() + offset, sizeof(T));
+        return value;
+    }
+
+    void check(const std::uint64_t offset, const std::uint64_t size) const
+    {
+        if (offset > file_.size() || size > file_.size() - offset)
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, a block points past its end.");
+    }
+
+    void check_tick(const std::size_t index) const
+    {
+        if (index >= tick_count_)
+            throw wmi_capture_file_error(fmt::format("wmi_capture_file_reader: tick {} requested, the file has {}.", index, tick_count_));
+    }
+
+    // The data of a column has to be inside the file and large enough for its rows.
+    void check_column(const std::uint64_t offset, const wmi_capture_file_column& header, const std::uint32_t rows) const
+    {
+        auto required = (static_cast<std::uint64_t>(rows) + 63) / 64 * sizeof(std::uint64_t);
+
+        if (header.encoding == wmi_capture_file_encoding::scalar)
+            required += static_cast<std::uint64_t>(rows) * header.width;
+        else if (header.encoding == wmi_capture_file_encoding::code)
+            required += static_cast<std::uint64_t>(rows) * sizeof(std::uint32_t);
+        else if (header.encoding == wmi_capture_file_encoding::utf8)
+            required += (static_cast<std::uint64_t>(rows) + 1) * sizeof(std::uint32_t);
+
+        if (header.size < required)
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, a column is smaller than its rows.");
+
+        check(offset + sizeof(header), header.size);
+    }
+
+    [[nodiscard]] std::string_view load_string(std::uint64_t& offset) const
+    {
+        const auto size = load<std::uint32_t>(offset);
+        check(offset + sizeof(size), size);
+
+        const std::string_view value(file_.data() + offset + sizeof(size), size);
+        offset += sizeof(size) + size;
+        return value;
+    }
+
+    void read_schema()
+    {
+        const auto block = load<wmi_capture_file_block>(sizeof(wmi_capture_file_header));
+
+        if (block.kind != wmi_capture_file_block_kind::schema)
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file has no schema.");
+
+        auto offset = sizeof(wmi_capture_file_header) + sizeof(wmi_capture_file_block);
+
+        class_name_ = load_string(offset);
+        properties_.resize(load<std::uint32_t>(offset));
+        offset += sizeof(std::uint32_t);
+
+        for (auto& property : properties_)
+            property = load_string(offset);
+
+        first_block_ = sizeof(wmi_capture_file_header) + sizeof(wmi_capture_file_block) + block.size;
+    }
+
+    // false if the file has no trailer
+    bool read_index()
+    {
+        if (file_.size() < first_block_ + sizeof(wmi_capture_file_trailer))
+            return false;
+
+        const auto trailer = load<wmi_capture_file_trailer>(file_.size() - sizeof(wmi_capture_file_trailer));
+
+        if (std::memcmp(trailer.magic, wmi_capture_file_index_magic, sizeof(trailer.magic)) != 0)
+            return false;
+
+        if (load<wmi_capture_file_block>(trailer.index_offset).kind != wmi_capture_file_block_kind::index)
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, the trailer does not point to an index.");
+
+        auto offset = trailer.index_offset + sizeof(wmi_capture_file_block);
+        const auto tick_count = load<std::uint64_t>(offset);
+        const auto dictionary_count = load<std::uint64_t>(offset + sizeof(std::uint64_t));
+        offset += 2 * sizeof(std::uint64_t);
+
+        // the entries are used in place. offset is inside the file since the counts were loaded, the counts are checked
+        // by division so that damaged ones cannot overflow the sizes
+        if (tick_count > (file_.size() - offset) / sizeof(wmi_capture_file_index_entry))
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, the index has more ticks than fit the file.");
+
+        ticks_ = reinterpret_cast<const wmi_capture_file_index_entry*>(file_.data() + offset);
+        tick_count_ = static_cast<std::size_t>(tick_count);
+        offset += tick_count * sizeof(wmi_capture_file_index_entry);
+
+        if (dictionary_count > (file_.size() - offset) / sizeof(std::uint64_t))
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, the index has more dictionaries than fit the file.");
+
+        for (std::uint64_t i = 0; i < dictionary_count; i++)
+            read_dictionary(load<std::uint64_t>(offset + i * sizeof(std::uint64_t)));
+
+        indexed_ = true;
+        return true;
+    }
+
+    void walk_blocks()
+    {
+        for (auto offset = first_block_; offset + sizeof(wmi_capture_file_block) <= file_.size();)
+        {
+            const auto block = load<wmi_capture_file_block>(offset);
+
+            // a block cut off by a crash ends the file
+            if (block.size > file_.size() - offset - sizeof(wmi_capture_file_block))
+                break;
+
+            if (block.kind == wmi_capture_file_block_kind::dictionary)
+                read_dictionary(offset);
+            else if (block.kind == wmi_capture_file_block_kind::tick)
+                owned_ticks_.push_back({ load<wmi_capture_file_tick>(offset + sizeof(wmi_capture_file_block)).time, offset });
+
+            offset += sizeof(wmi_capture_file_block) + block.size;
+        }
+
+        ticks_ = owned_ticks_.data();
+        tick_count_ = owned_ticks_.size();
+    }
+
+    void read_dictionary(const std::uint64_t block_offset)
+    {
+        if (load<wmi_capture_file_block>(block_offset).kind != wmi_capture_file_block_kind::dictionary)
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, a dictionary offset does not point to a dictionary.");
+
+        auto offset = block_offset + sizeof(wmi_capture_file_block);
+        const auto first = load<std::uint32_t>(offset);
+        const auto count = load<std::uint32_t>(offset + sizeof(std::uint32_t));
+        offset += 2 * sizeof(std::uint32_t);
+
+        if (first != dictionary_.size())
+            throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, dictionary codes are not consecutive.");
+
+        for (std::uint32_t i = 0; i < count; i++)
+            dictionary_.push_back(load_string(offset));
+    }
+
+    template<typename Column, typename Better>
+    [[nodiscard]] std::optional<double> fold(const std::uint32_t property, const std::uint64_t from, const std::uint64_t to, Column column_fold, Better better) const
+    {
+        std::optional<double> best;
+        std::optional<double> last;
+        auto last_offset = ~std::uint64_t(0);
+
+        scan(property, from, to, [&](const wmi_capture_file_tick_view&, const wmi_capture_file_column_view& column)
+        {
+            if (column.header_offset() != last_offset)
+            {
+                last = (column.*column_fold)();
+                last_offset = column.header_offset();
+            }
+
+            if (last && (!best || better(*last, *best)))
+                best = last;
+        });
+
+        return best;
+    }
+
+    wmi_mapped_file file_;
+    std::string_view class_name_;
+    std::vector<std::string_view> properties_;
+    std::vector<std::string_view> dictionary_;
+    const wmi_capture_file_index_entry* ticks_ = nullptr;
+    std::size_t tick_count_ = 0;
+    std::vector<wmi_capture_file_index_entry> owned_ticks_;
+    std::uint64_t first_block_ = 0;
+    bool indexed_ = false;
+};
+
+inline std::optional<wmi_capture_file_column_view> wmi_capture_file_tick_view::column(const std::uint32_t property) const
+{
+    auto offset = offset_ + sizeof(wmi_capture_file_block) + sizeof(wmi_capture_file_tick);
+
+    for (std::uint32_t i = 0; i < tick_.columns; i++)
+    {
+        const auto header = reader_->load<wmi_capture_file_column>(offset);
+
+        if (header.property == property)
+        {
+            if (header.encoding != wmi_capture_file_encoding::repeat)
+            {
+                reader_->check_column(offset, header, tick_.rows);
+                return wmi_capture_file_column_view(header, offset, reader_->file_.data() + offset + sizeof(header), tick_.rows, reader_->dictionary_);
+            }
+
+            const auto source = reader_->load<wmi_capture_file_column>(header.source);
+
+            if (source.property != property || source.encoding == wmi_capture_file_encoding::repeat)
+                throw wmi_capture_file_error("wmi_capture_file_reader: the file is damaged, a repeated column has no source.");
+
+            reader_->check_column(header.source, source, tick_.rows);
+            return wmi_capture_file_column_view(source, header.source, reader_->file_.data() + header.source + sizeof(source), tick_.rows, reader_->dictionary_);
+        }
+
+        offset += sizeof(header) + header.size;
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,972 @@
+#pragma once
+#include <cmath>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "WmiHelper.hpp"
+#include "fmt/compile.h"
+#include "fmt/os.h"
+
+// Renders results into text formats for monitoring pipelines. Renderers append to a caller owned fmt::memory_buffer
+// and keep everything they derive from names and instance keys between calls, so rendering a result of the same shape
+// again allocates nothing once the buffer has grown to fit.
+
+// Number held by a cell, see wmi_export_read_number().
+struct wmi_export_number
+{
+    enum class kind
+    {
+        none, // empty cell or a string that is not a number
+        signed_integer,
+        unsigned_integer,
+        real
+    };
+
+    kind type = kind::none;
+    std::int64_t signed_value = 0;
+    std::uint64_t unsigned_value = 0;
+    double real = 0.0;
+};
+
+// Number of a scalar cell, kind::none for strings and empty cells.
+inline wmi_export_number wmi_export_scalar_number(const wmi_cell& cell)
+{
+    wmi_export_number number;
+
+    const auto load_signed = [&cell](auto value)
+    {
+        const auto bits = cell.bits();
+        std::memcpy(&value, &bits, sizeof(value));
+        return static_cast<std::int64_t>(value);
+    };
+
+    if (!cell.has_value())
+        return number;
+
+    switch (cell.type())
+    {
+    case CIM_SINT8: number.signed_value = load_signed(std::int8_t{}); break;
+    case CIM_SINT16: number.signed_value = load_signed(std::int16_t{}); break;
+    case CIM_SINT32: number.signed_value = load_signed(std::int32_t{}); break;
+    case CIM_SINT64: number.signed_value = load_signed(std::int64_t{}); break;
+    case CIM_UINT8: case CIM_UINT16: case CIM_UINT32: case CIM_UINT64: case CIM_CHAR16:
+        number.type = wmi_export_number::kind::unsigned_integer;
+        number.unsigned_value = cell.bits() & (~0ull >> (64 - 8 * wmi_cim_type_size(cell.type())));
+        return number;
+    case CIM_BOOLEAN:
+        number.type = wmi_export_number::kind::unsigned_integer;
+        number.unsigned_value = cell.bits() != 0;
+        return number;
+    case CIM_REAL32: case CIM_REAL64:
+        number.type = wmi_export_number::kind::real;
+        number.real = cell.as_double({});
+        return number;
+    default:
+        return number;
+    }
+
+    number.type = wmi_export_number::kind::signed_integer;
+    return number;
+}
+
+// Integers are kept exact, including the 64 bit integers WMI reports as strings.
+template<std::size_t AnySize>
+wmi_export_number wmi_export_read_number(const wmi_column_view<AnySize>& column, const std::size_t row)
+{
+    wmi_export_number number;
+    const auto& cell = column.cell(row);
+
+    if (cell.is_string())
+    {
+        const auto text = column.string(row);
+        const auto negative = !text.empty() && text.front() == L'-';
+        std::uint64_t value = 0;
+        std::size_t i = negative ? 1 : 0;
+
+        for (; i < text.size() && text[i] >= L'0' && text[i] <= L'9' && value <= (std::numeric_limits<std::uint64_t>::max() - 9) / 10; i++)
+            value = value * 10 + static_cast<std::uint64_t>(text[i] - L'0');
+
+        if (i == text.size() && text.size() > (negative ? 1u : 0u) && (!negative || value <= static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max())))
+        {
+            number.type = negative ? wmi_export_number::kind::signed_integer : wmi_export_number::kind::unsigned_integer;
+            number.signed_value = -static_cast<std::int64_t>(value);
+            number.unsigned_value = value;
+            return number;
+        }
+
+        number.real = column.as_double(row);
+        number.type = std::isnan(number.real) ? wmi_export_number::kind::none : wmi_export_number::kind::real;
+        return number;
+    }
+
+    return wmi_export_scalar_number(cell);
+}
+
+// Appends an integer, or a finite real in the shortest form that reads back to the same double.
+inline void wmi_export_append_number(fmt::memory_buffer& out, const wmi_export_number& number)
+{
+    if (number.type == wmi_export_number::kind::real)
+    {
+        static constexpr auto real_format = fmt::compile<double>(FMT_STRING("{}"));
+
+        // the shortest round trip form of a double is at most 24 characters, format in place
+        const auto size = out.size();
+        out.resize(size + 32);
+        out.resize(static_cast<std::size_t>(fmt::format_to(out.data() + size, real_format, number.real) - out.data()));
+        return;
+    }
+
+    const auto digits = number.type == wmi_export_number::kind::signed_integer ? fmt::format_int(number.signed_value) : fmt::format_int(number.unsigned_value);
+    out.append(digits.data(), digits.data() + digits.size());
+}
+
+// Lower snake case form of a WMI identifier: PercentProcessorTime -> percent_processor_time, Win32_PerfRawData ->
+// win32_perf_raw_data. Anything but ASCII letters and digits becomes an underscore.
+inline void wmi_export_append_snake_case(std::string& out, const std::wstring_view name)
+{
+    for (std::size_t i = 0; i < name.size(); i++)
+    {
+        const auto c = name[i];
+        const auto upper = c >= L'A' && c <= L'Z';
+
+        if (upper)
+        {
+            const auto previous = i > 0 ? name[i - 1] : L'_';
+            const auto next = i + 1 < name.size() ? name[i + 1] : L'_';
+            const auto previous_lower = (previous >= L'a' && previous <= L'z') || (previous >= L'0' && previous <= L'9');
+            const auto previous_upper = previous >= L'A' && previous <= L'Z';
+
+            // word boundary before an upper case letter that follows a lower case one, or ends an acronym (IOData)
+            if (!out.empty() && out.back() != '_' && (previous_lower || (previous_upper && next >= L'a' && next <= L'z')))
+                out.push_back('_');
+
+            out.push_back(static_cast<char>(c - L'A' + 'a'));
+        }
+        else if ((c >= L'a' && c <= L'z') || (c >= L'0' && c <= L'9'))
+        {
+            out.push_back(static_cast<char>(c));
+        }
+        else if (!out.empty() && out.back() != '_')
+        {
+            out.push_back('_');
+        }
+    }
+}
+
+// Appends utf8 as a JSON string literal, quotes included. Escapes quotes, backslashes and control characters; spans
+// that need no escaping are copied at once.
+template<typename Out>
+void wmi_json_append_string(Out& out, const std::string_view utf8)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    out.push_back('"');
+
+    std::size_t start = 0;
+    std::size_t i = 0;
+
+    while (i < utf8.size())
+    {
+#ifdef WMI_HELPER_SSE2
+        // skip 16 bytes at a time while none is a control character, quote or backslash
+        if (utf8.size() - i >= 16)
+        {
+            const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(utf8.data() + i));
+            const auto control = _mm_cmpeq_epi8(_mm_min_epu8(block, _mm_set1_epi8(0x1f)), block);
+            const auto special = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')));
+
+            if (_mm_movemask_epi8(_mm_or_si128(control, special)) == 0)
+            {
+                i += 16;
+                continue;
+            }
+        }
+#endif
+
+        const auto c = static_cast<unsigned char>(utf8[i++]);
+
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        out.append(utf8.data() + start, utf8.data() + i - 1);
+        start = i;
+
+        const char escaped[] = { '\\', c == '"' ? '"' : c == '\\' ? '\\' : c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\t' ? 't' : 'u' };
+        out.append(escaped, escaped + 2);
+
+        if (escaped[1] == 'u')
+        {
+            const char code[] = { '0', '0', hex[c >> 4], hex[c & 0xf] };
+            out.append(code, code + 4);
+        }
+    }
+
+    out.append(utf8.data() + start, utf8.data() + utf8.size());
+    out.push_back('"');
+}
+
+// Per row text derived from the instance key of a result, e.g. escaped labels. The text of a row is only built again
+// when the key on that row changes, so renderers do not escape the same instance names on every result. Rows are keyed
+// by the value of key_handle (numbers in decimal), or by their index without one.
+template<std::size_t AnySize>
+class wmi_export_instances
+{
+public:
+
+    explicit wmi_export_instances(std::optional<wmi_var_handle> key_handle) : key_handle_(key_handle)
+    {
+    }
+
+    // Calls make(text, key, row) for every row whose text has to be built. key is empty without key_handle and where the
+    // key could not be read, callers write the row index then. Returns false if the key column is not part of results.
+    template<typename Make>
+    bool update(const wmi_wrapper_result_map<AnySize>& results, Make&& make)
+    {
+        std::size_t rows = 0;
+
+        if (key_handle_)
+        {
+            if (!results.count(*key_handle_))
+                return false;
+
+            rows = results.column_size(*key_handle_);
+        }
+        else
+        {
+            for (wmi_var_handle handle = 0; handle < results.handle_count(); handle++)
+            {
+                if (results.count(handle))
+                    rows = std::max(rows, results.column_size(handle));
+            }
+        }
+
+        if (instances_.size() < rows)
+            instances_.resize(rows);
+
+        std::optional<typename wmi_wrapper_result_map<AnySize>::column_type> keys;
+
+        if (key_handle_)
+            keys = results[*key_handle_];
+
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            auto& instance = instances_[row];
+
+            if (keys)
+            {
+                const auto key = keys->key(row, key_buffer_);
+
+                if (instance.valid && instance.key == key)
+                    continue;
+
+                instance.key.assign(key.data(), key.size());
+            }
+            else if (instance.valid)
+            {
+                continue;
+            }
+
+            instance.text.clear();
+            make(instance.text, std::wstring_view(instance.key), row);
+            instance.valid = true;
+        }
+
+        rows_ = rows;
+        return true;
+    }
+
+    [[nodiscard]] bool keyed() const
+    {
+        return key_handle_.has_value();
+    }
+
+    // rows of the last updated result
+    [[nodiscard]] std::size_t rows() const
+    {
+        return rows_;
+    }
+
+    [[nodiscard]] const std::string& text(const std::size_t row) const
+    {
+        return instances_[row].text;
+    }
+
+private:
+
+    struct instance
+    {
+        std::wstring key;
+        std::string text;
+        bool valid = false;
+    };
+
+    std::optional<wmi_var_handle> key_handle_;
+    std::wstring key_buffer_; // digits of numeric keys
+    std::vector<instance> instances_; // by row, reused while the instance on a row stays the same
+    std::size_t rows_ = 0;
+};
+
+// Renders results in the Prometheus text exposition format. Every attached var becomes a gauge named
+// <prefix>_<class>_<property> in snake case with one sample per instance, labeled <label>="<key>" by the value of
+// key_handle (or the row index without one, or where the key is empty). The label defaults to wmi_instance because
+// Prometheus attaches its own instance label to every scraped target. Label values are escaped once per instance and
+// reused while the instance stays on the same row, values are written with precompiled formats.
+template<std::size_t AnySize>
+class wmi_prometheus_renderer
+{
+public:
+
+    explicit wmi_prometheus_renderer(const std::wstring_view class_name, std::optional<wmi_var_handle> key_handle = std::nullopt, const std::string_view prefix = "wmi",
+        const std::string_view label = "wmi_instance")
+        : prefix_(prefix), instances_(key_handle)
+    {
+        label_.assign("{");
+        label_.append(label.data(), label.size());
+        label_.append("=\"");
+
+        if (!prefix_.empty())
+            prefix_.push_back('_');
+
+        wmi_export_append_snake_case(prefix_, class_name);
+    }
+
+    void attach(const wmi_var_handle handle, const std::wstring_view property)
+    {
+        metric added{ handle, prefix_, {} };
+
+        added.name.push_back('_');
+        wmi_export_append_snake_case(added.name, property);
+        added.header = fmt::format("# TYPE {} gauge\n", added.name);
+
+        metrics_.push_back(std::move(added));
+    }
+
+    template<typename Backend>
+    void attach(const wmi_helper<AnySize, Backend>& helper, const wmi_var_handle handle)
+    {
+        attach(handle, helper.var_name(handle));
+    }
+
+    // Adds the result's sample time (milliseconds) to every sample.
+    void timestamps(const bool enabled)
+    {
+        timestamps_ = enabled;
+    }
+
+    // Appends the samples of result to out. Samples without a numeric value are skipped.
+    void render(const wmi_wrapper_class_result<AnySize>& wmi_result, fmt::memory_buffer& out)
+    {
+        const auto& results = wmi_result.result;
+
+        const auto updated = instances_.update(results, [this](std::string& text, const std::wstring_view key, const std::size_t row)
+        {
+            text.assign(label_);
+
+            if (instances_.keyed() && !key.empty())
+                escape(key, text);
+            else
+                text.append(fmt::format_int(row).c_str());
+
+            text.append("\"}");
+        });
+
+        if (!updated)
+            return;
+
+        fmt::format_int time(wmi_result.time);
+
+        for (auto& metric : metrics_)
+        {
+            if (!results.count(metric.handle))
+                continue;
+
+            const auto column = results[metric.handle];
+            out.append(metric.header.data(), metric.header.data() + metric.header.size());
+
+            for (std::size_t row = 0; row < column.size() && row < instances_.rows(); row++)
+            {
+                const auto number = wmi_export_read_number(column, row);
+
+                if (number.type == wmi_export_number::kind::none)
+                    continue;
+
+                auto& label = instances_.text(row);
+
+                out.append(metric.name.data(), metric.name.data() + metric.name.size());
+                out.append(label.data(), label.data() + label.size());
+                out.push_back(' ');
+
+                if (number.type == wmi_export_number::kind::real && !std::isfinite(number.real))
+                {
+                    const std::string_view special = std::isnan(number.real) ? "NaN" : number.real > 0 ? "+Inf" : "-Inf";
+                    out.append(special.data(), special.data() + special.size());
+                }
+                else
+                {
+                    wmi_export_append_number(out, number);
+                }
+
+                if (timestamps_)
+                {
+                    out.push_back(' ');
+                    out.append(time.data(), time.data() + time.size());
+                }
+
+                out.push_back('\n');
+            }
+        }
+    }
+
+    // Renders into a buffer owned by the renderer, valid until the next call.
+    [[nodiscard]] std::string_view render(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        buffer_.clear();
+        render(wmi_result, buffer_);
+        return { buffer_.data(), buffer_.size() };
+    }
+
+private:
+
+    struct metric
+    {
+        wmi_var_handle handle;
+        std::string name;
+        std::string header; // # TYPE line
+    };
+
+    // label values escape backslash, double quote and line feed
+    void escape(const std::wstring_view value, std::string& out)
+    {
+        utf8_.clear();
+        wmi_append_utf8(value, utf8_);
+
+        for (const auto c : utf8_)
+        {
+            if (c == '\\' || c == '"')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (c == '\n')
+            {
+                out.append("\\n");
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+    }
+
+    std::string prefix_;
+    std::string label_; // {<label>="
+    wmi_export_instances<AnySize> instances_; // {<label>="..."} per row
+    bool timestamps_ = false;
+
+    std::vector<metric> metrics_;
+    std::string utf8_;
+    fmt::memory_buffer buffer_;
+};
+
+using wmi_prometheus_renderer_32 = wmi_prometheus_renderer<32>;
+
+// Serializes results as newline delimited JSON, one object per instance with the sample time (milliseconds), the class,
+// the instance key (the row number without a key or for an empty key) and the attached vars under their property names:
+//
+//   {"time":1700000000000,"class":"Win32_Process","instance":"svchost","WorkingSet":1234,"Name":"svchost"}
+//
+// Integers are written exactly, reals that are not finite and missing values as null. Strings are converted from UTF-16
+// and escaped in one pass per value, dictionary encoded columns reuse the UTF-8 their dictionary keeps.
+template<std::size_t AnySize>
+class wmi_ndjson_writer
+{
+public:
+
+    explicit wmi_ndjson_writer(const std::wstring_view class_name, std::optional<wmi_var_handle> key_handle = std::nullopt) : instances_(key_handle)
+    {
+        class_.assign(",\"class\":");
+        wmi_json_append_string(class_, wmi_to_utf8(class_name));
+    }
+
+    void attach(const wmi_var_handle handle, const std::wstring_view property)
+    {
+        field added{ handle, "," };
+
+        wmi_json_append_string(added.name, wmi_to_utf8(property));
+        added.name.push_back(':');
+
+        fields_.push_back(std::move(added));
+    }
+
+    template<typename Backend>
+    void attach(const wmi_helper<AnySize, Backend>& helper, const wmi_var_handle handle)
+    {
+        attach(handle, helper.var_name(handle));
+    }
+
+    // Appends one line per instance of result to out.
+    void render(const wmi_wrapper_class_result<AnySize>& wmi_result, fmt::memory_buffer& out)
+    {
+        const auto& results = wmi_result.result;
+
+        const auto updated = instances_.update(results, [this](std::string& text, const std::wstring_view key, const std::size_t row)
+        {
+            text.assign(class_);
+            text.append(",\"instance\":");
+
+            // instances with an empty or unread key are told apart by their row, as without a key
+            if (instances_.keyed() && !key.empty())
+            {
+                utf8_.clear();
+                wmi_append_utf8(key, utf8_);
+                wmi_json_append_string(text, utf8_);
+            }
+            else
+            {
+                text.append(fmt::format_int(row).c_str());
+            }
+        });
+
+        if (!updated)
+            return;
+
+        columns_.clear();
+
+        for (auto& field : fields_)
+            columns_.push_back(results.count(field.handle) ? std::optional<column_type>(results[field.handle]) : std::nullopt);
+
+        static constexpr std::string_view time_key = "{\"time\":";
+        const fmt::format_int time(wmi_result.time);
+
+        for (std::size_t row = 0; row < instances_.rows(); row++)
+        {
+            auto& instance = instances_.text(row);
+
+            out.append(time_key.data(), time_key.data() + time_key.size());
+            out.append(time.data(), time.data() + time.size());
+            out.append(instance.data(), instance.data() + instance.size());
+
+            for (std::size_t i = 0; i < fields_.size(); i++)
+            {
+                auto& name = fields_[i].name;
+                out.append(name.data(), name.data() + name.size());
+
+                if (!columns_[i] || row >= columns_[i]->size())
+                    append_literal(out, "null");
+                else
+                    append_value(*columns_[i], row, out);
+            }
+
+            out.push_back('}');
+            out.push_back('\n');
+        }
+    }
+
+    // Renders into a buffer owned by the writer, valid until the next call.
+    [[nodiscard]] std::string_view render(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        buffer_.clear();
+        render(wmi_result, buffer_);
+        return { buffer_.data(), buffer_.size() };
+    }
+
+private:
+
+    using column_type = typename wmi_wrapper_result_map<AnySize>::column_type;
+
+    struct field
+    {
+        wmi_var_handle handle;
+        std::string name; // ,"Property":
+    };
+
+    static void append_literal(fmt::memory_buffer& out, const std::string_view literal)
+    {
+        out.append(literal.data(), literal.data() + literal.size());
+    }
+
+    void append_value(const column_type& column, const std::size_t row, fmt::memory_buffer& out)
+    {
+        const auto& cell = column.cell(row);
+
+        if (cell.is_code() && column.dictionary())
+        {
+            wmi_json_append_string(out, column.dictionary()->utf8(cell.code()));
+        }
+        else if (cell.is_string())
+        {
+            utf8_.clear();
+            wmi_append_utf8(column.string(row), utf8_);
+            wmi_json_append_string(out, utf8_);
+        }
+        else if (cell.has_value() && cell.type() == CIM_BOOLEAN)
+        {
+            append_literal(out, cell.bits() ? "true" : "false");
+        }
+        else
+        {
+            const auto number = wmi_export_read_number(column, row);
+
+            if (number.type == wmi_export_number::kind::none || (number.type == wmi_export_number::kind::real && !std::isfinite(number.real)))
+                append_literal(out, "null");
+            else
+                wmi_export_append_number(out, number);
+        }
+    }
+
+    std::string class_; // ,"class":"..."
+    wmi_export_instances<AnySize> instances_; // ,"class":"...","instance":"..." per row
+
+    std::vector<field> fields_;
+    std::vector<std::optional<column_type>> columns_; // of fields_, for the result being rendered
+    std::string utf8_;
+    fmt::memory_buffer buffer_;
+};
+
+using wmi_ndjson_writer_32 = wmi_ndjson_writer<32>;
+
+// Encodes results as InfluxDB line protocol, one line per instance. The class is the measurement, the instance key the
+// instance tag (the row number without a key or for an empty key), every attached var a field typed by its CIMTYPE
+// and the sample time a nanosecond timestamp:
+//
+//   Win32_Process,instance=svchost WorkingSet=1234i,Name="svchost",Critical=false 1700000000000000000
+//
+// Integers get the i suffix (unsigned values above the int64 range the u suffix of InfluxDB 2), reals are written
+// as floats and skipped when not finite, strings are quoted. The measurement and tag part of a line is rendered once
+// per instance.
+template<std::size_t AnySize>
+class wmi_influx_encoder
+{
+public:
+
+    explicit wmi_influx_encoder(const std::wstring_view measurement, std::optional<wmi_var_handle> key_handle = std::nullopt) : instances_(key_handle)
+    {
+        escape(wmi_to_utf8(measurement), measurement_, false);
+    }
+
+    void attach(const wmi_var_handle handle, const std::wstring_view property)
+    {
+        field added{ handle, {} };
+
+        escape(wmi_to_utf8(property), added.key, true);
+        added.key.push_back('=');
+
+        fields_.push_back(std::move(added));
+    }
+
+    template<typename Backend>
+    void attach(const wmi_helper<AnySize, Backend>& helper, const wmi_var_handle handle)
+    {
+        attach(handle, helper.var_name(handle));
+    }
+
+    // Appends one line per instance of result to out. Instances without any field value are left out, line protocol
+    // needs at least one field.
+    void encode(const wmi_wrapper_class_result<AnySize>& wmi_result, fmt::memory_buffer& out)
+    {
+        const auto& results = wmi_result.result;
+
+        const auto updated = instances_.update(results, [this](std::string& text, const std::wstring_view key, const std::size_t row)
+        {
+            text.assign(measurement_);
+            text.append(",instance=");
+
+            // line protocol has no empty tag values, instances with an empty or unread key fall back to the row
+            if (instances_.keyed() && !key.empty())
+            {
+                utf8_.clear();
+                wmi_append_utf8(key, utf8_);
+                escape(utf8_, text, true);
+            }
+            else
+            {
+                text.append(fmt::format_int(row).c_str());
+            }
+
+            text.push_back(' ');
+        });
+
+        if (!updated)
+            return;
+
+        columns_.clear();
+
+        for (auto& field : fields_)
+            columns_.push_back(results.count(field.handle) ? std::optional<column_type>(results[field.handle]) : std::nullopt);
+
+        // milliseconds to nanoseconds
+        const fmt::format_int time(wmi_result.time * 1000000ull);
+
+        for (std::size_t row = 0; row < instances_.rows(); row++)
+        {
+            const auto start = out.size();
+            auto& prefix = instances_.text(row);
+
+            out.append(prefix.data(), prefix.data() + prefix.size());
+
+            const auto fields_start = out.size();
+
+            for (std::size_t i = 0; i < fields_.size(); i++)
+            {
+                if (!columns_[i] || row >= columns_[i]->size())
+                    continue;
+
+                const auto size = out.size();
+
+                if (size != fields_start)
+                    out.push_back(',');
+
+                auto& key = fields_[i].key;
+                out.append(key.data(), key.data() + key.size());
+
+                if (!append_value(*columns_[i], row, out))
+                    out.resize(size);
+            }
+
+            if (out.size() == fields_start)
+            {
+                out.resize(start);
+                continue;
+            }
+
+            out.push_back(' ');
+            out.append(time.data(), time.data() + time.size());
+            out.push_back('\n');
+        }
+    }
+
+private:
+
+    using column_type = typename wmi_wrapper_result_map<AnySize>::column_type;
+
+    struct field
+    {
+        wmi_var_handle handle;
+        std::string key; // Property=
+    };
+
+    // measurements escape commas and spaces, tag keys, tag values and field keys also equal signs
+    static void escape(const std::string_view value, std::string& out, const bool key)
+    {
+        for (const auto c : value)
+        {
+            if (c == ',' || c == ' ' || (key && c == '='))
+                out.push_back('\\');
+
+            // line breaks would end the line, they are not allowed in names
+            out.push_back(c == '\n' || c == '\r' ? ' ' : c);
+        }
+    }
+
+    bool append_value(const column_type& column, const std::size_t row, fmt::memory_buffer& out)
+    {
+        const auto& cell = column.cell(row);
+
+        if (cell.is_string())
+        {
+            const auto value = cell.is_code() && column.dictionary() ? column.dictionary()->utf8(cell.code()) : convert(column.string(row));
+
+            // string field values escape double quotes and backslashes
+            out.push_back('"');
+
+            std::size_t start = 0;
+
+            for (std::size_t i = 0; i < value.size(); i++)
+            {
+                if (value[i] != '"' && value[i] != '\\')
+                    continue;
+
+                out.append(value.data() + start, value.data() + i);
+                out.push_back('\\');
+                start = i;
+            }
+
+            out.append(value.data() + start, value.data() + value.size());
+            out.push_back('"');
+            return true;
+        }
+
+        if (cell.has_value() && cell.type() == CIM_BOOLEAN)
+        {
+            const std::string_view literal = cell.bits() ? "true" : "false";
+            out.append(literal.data(), literal.data() + literal.size());
+            return true;
+        }
+
+        auto number = wmi_export_read_number(column, row);
+
+        switch (number.type)
+        {
+        case wmi_export_number::kind::real:
+            if (!std::isfinite(number.real))
+                return false;
+
+            wmi_export_append_number(out, number);
+            return true;
+        case wmi_export_number::kind::signed_integer:
+            wmi_export_append_number(out, number);
+            out.push_back('i');
+            return true;
+        case wmi_export_number::kind::unsigned_integer:
+            wmi_export_append_number(out, number);
+            out.push_back(number.unsigned_value > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) ? 'u' : 'i');
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    std::string_view convert(const std::wstring_view value)
+    {
+        utf8_.clear();
+        wmi_append_utf8(value, utf8_);
+        return utf8_;
+    }
+
+    std::string measurement_;
+    wmi_export_instances<AnySize> instances_; // measurement,instance=... per row
+
+    std::vector<field> fields_;
+    std::vector<std::optional<column_type>> columns_; // of fields_, for the result being encoded
+    std::string utf8_;
+};
+
+using wmi_influx_encoder_32 = wmi_influx_encoder<32>;
+
+#if FMT_USE_FCNTL
+// Where a sink writes to: a duplicate of a caller's descriptor (file, pipe or local socket, the caller keeps and closes
+// its own) or a file opened for appending. Formats that store offsets (capture files) open it truncated instead.
+class wmi_export_output
+{
+public:
+
+    enum class mode
+    {
+        append,
+        truncate
+    };
+
+    explicit wmi_export_output(const int fd) : file_(fmt::file::dup(fd))
+    {
+    }
+
+    explicit wmi_export_output(const char* path, const mode open_mode = mode::append)
+        : file_(path, fmt::file::WRONLY | O_CREAT | (open_mode == mode::truncate ? O_TRUNC : O_APPEND) | binary)
+    {
+    }
+
+    // Writes all of buffer, as few write calls as the descriptor allows. Throws fmt::system_error on failure.
+    void write(const fmt::memory_buffer& buffer)
+    {
+        std::size_t written = 0;
+
+        while (written < buffer.size())
+            written += file_.write(buffer.data() + written, buffer.size() - written);
+    }
+
+private:
+
+#ifdef _WIN32
+    static constexpr int binary = O_BINARY; // no \n -> \r\n translation
+#else
+    static constexpr int binary = 0;
+#endif
+
+    fmt::file file_;
+};
+
+// Writes the lines of every result it is given to a wmi_export_output, e.g. a pipe to a log shipper. Lines of one
+// result are written at once from a buffer that is reused for every result.
+template<std::size_t AnySize>
+class wmi_ndjson_sink
+{
+public:
+
+    wmi_ndjson_sink(wmi_ndjson_writer<AnySize> writer, wmi_export_output output) : writer_(std::move(writer)), output_(std::move(output))
+    {
+    }
+
+    void write(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        buffer_.clear();
+        writer_.render(wmi_result, buffer_);
+        output_.write(buffer_);
+    }
+
+    // Callback for wmi_helper::query_async() that writes every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            write(wmi_result);
+        };
+    }
+
+private:
+
+    wmi_ndjson_writer<AnySize> writer_;
+    wmi_export_output output_;
+    fmt::memory_buffer buffer_;
+};
+
+// Batches the lines of the results it is given and writes them to a wmi_export_output once batch_bytes are buffered,
+// e.g. to a file a Telegraf tail input reads or a local socket. The buffer is reused for every batch. Lines still
+// buffered are written by flush() and when the sink is destroyed.
+template<std::size_t AnySize>
+class wmi_influx_sink
+{
+public:
+
+    wmi_influx_sink(wmi_influx_encoder<AnySize> encoder, wmi_export_output output, const std::size_t batch_bytes = 1 << 20)
+        : encoder_(std::move(encoder)), output_(std::move(output)), batch_bytes_(batch_bytes)
+    {
+    }
+
+    wmi_influx_sink(const wmi_influx_sink&) = delete;
+    wmi_influx_sink& operator=(const wmi_influx_sink&) = delete;
+
+    ~wmi_influx_sink()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception&)
+        {
+            // nothing to report a failed write to, call flush() before destroying the sink to see errors
+        }
+    }
+
+    void write(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        encoder_.encode(wmi_result, buffer_);
+
+        if (buffer_.size() >= batch_bytes_)
+            flush();
+    }
+
+    void flush()
+    {
+        output_.write(buffer_);
+        buffer_.clear();
+    }
+
+    // Callback for wmi_helper::query_async() that writes every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            write(wmi_result);
+        };
+    }
+
+private:
+
+    wmi_influx_encoder<AnySize> encoder_;
+    wmi_export_output output_;
+    std::size_t batch_bytes_;
+    fmt::memory_buffer buffer_;
+};
+#endif
@@ -0,0 +1,437 @@
+#pragma once
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "WmiExport.hpp"
+
+// fmt::formatter specializations, so values, columns and whole results format straight into fmt buffers:
+//
+//   fmt::print("{}\n", results[speed_handle]);                     [3200, 3200]
+//   fmt::print("{:>8}\n", wmi_cell_at(results[bank_handle], 0));   '  BANK 0'
+//   fmt::print("{:t}", wmi_named(wmi_result.result, helper));      aligned table with property names
+//   fmt::print("{:c}", wmi_named(wmi_result.result, helper));      CSV
+//   fmt::print("{:k}", wmi_named(wmi_result.result, helper));      one line of Name=value pairs per row
+//
+// Values are formatted by CIMTYPE: strings as UTF-8, integers exactly, reals in their shortest round trip form and
+// booleans as true/false. Cells are formatted through their column (wmi_cell_at()) since strings live there.
+
+// Appends the value of row to out, nothing for empty cells.
+template<std::size_t AnySize>
+void wmi_format_value(fmt::memory_buffer& out, const wmi_column_view<AnySize>& column, const std::size_t row)
+{
+    const auto& cell = column.cell(row);
+
+    if (cell.is_code() && column.dictionary())
+    {
+        const auto value = column.dictionary()->utf8(cell.code());
+        out.append(value.data(), value.data() + value.size());
+    }
+    else if (cell.is_string())
+    {
+        wmi_append_utf8(column.string(row), out);
+    }
+    else if (cell.has_value() && cell.type() == CIM_BOOLEAN)
+    {
+        const std::string_view literal = cell.bits() ? "true" : "false";
+        out.append(literal.data(), literal.data() + literal.size());
+    }
+    else if (const auto number = wmi_export_scalar_number(cell); number.type != wmi_export_number::kind::none)
+    {
+        wmi_export_append_number(out, number);
+    }
+}
+
+template<std::size_t MaxSize>
+void wmi_format_value(fmt::memory_buffer& out, const wmi_any<MaxSize>& value)
+{
+    if (wmi_is_string_type(value.type))
+    {
+        wmi_append_utf8(value.str, out);
+        return;
+    }
+
+    const auto size = wmi_cim_type_size(value.type);
+
+    if (size == 0 || size > MaxSize)
+        return;
+
+    const auto cell = wmi_cell::scalar(value.type, value.reserved, size);
+
+    if (value.type == CIM_BOOLEAN)
+    {
+        const std::string_view literal = cell.bits() ? "true" : "false";
+        out.append(literal.data(), literal.data() + literal.size());
+    }
+    else
+    {
+        wmi_export_append_number(out, wmi_export_scalar_number(cell));
+    }
+}
+
+// One cell of a column, see wmi_cell_at().
+template<std::size_t AnySize>
+struct wmi_formatted_cell
+{
+    wmi_column_view<AnySize> column;
+    std::size_t row;
+};
+
+template<std::size_t AnySize>
+wmi_formatted_cell<AnySize> wmi_cell_at(const wmi_column_view<AnySize>& column, const std::size_t row)
+{
+    return { column, row };
+}
+
+// A result with the property names of the helper it came from, for the table, CSV and key=value formats.
+template<std::size_t AnySize, typename Backend>
+struct wmi_named_result
+{
+    const wmi_result_columns<AnySize>& result;
+    const wmi_helper<AnySize, Backend>& helper;
+};
+
+template<std::size_t AnySize, typename Backend>
+wmi_named_result<AnySize, Backend> wmi_named(const wmi_result_columns<AnySize>& result, const wmi_helper<AnySize, Backend>& helper)
+{
+    return { result, helper };
+}
+
+// Copies text to a format context's output.
+template<typename Context>
+auto wmi_format_copy(const std::string_view text, Context& ctx)
+{
+    auto out = ctx.out();
+
+    // fmt's own buffers take the text at once instead of char by char
+    if constexpr (std::is_same_v<decltype(out), std::back_insert_iterator<fmt::internal::buffer<char>>>)
+    {
+        fmt::internal::get_container(out).append(text.data(), text.data() + text.size());
+        return out;
+    }
+    else
+    {
+        return std::copy(text.begin(), text.end(), out);
+    }
+}
+
+// Values take the standard string specs (width, fill, alignment, precision), e.g. {:>12}.
+template<std::size_t MaxSize>
+struct fmt::formatter<wmi_any<MaxSize>> : fmt::formatter<fmt::string_view>
+{
+    template<typename Context>
+    auto format(const wmi_any<MaxSize>& value, Context& ctx)
+    {
+        fmt::memory_buffer text;
+        wmi_format_value(text, value);
+        return fmt::formatter<fmt::string_view>::format({ text.data(), text.size() }, ctx);
+    }
+};
+
+template<std::size_t AnySize>
+struct fmt::formatter<wmi_formatted_cell<AnySize>> : fmt::formatter<fmt::string_view>
+{
+    template<typename Context>
+    auto format(const wmi_formatted_cell<AnySize>& cell, Context& ctx)
+    {
+        fmt::memory_buffer text;
+        wmi_format_value(text, cell.column, cell.row);
+        return fmt::formatter<fmt::string_view>::format({ text.data(), text.size() }, ctx);
+    }
+};
+
+// Columns format as [value, value, ...].
+template<std::size_t AnySize>
+struct fmt::formatter<wmi_column_view<AnySize>>
+{
+    template<typename ParseContext>
+    constexpr auto parse(ParseContext& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template<typename Context>
+    auto format(const wmi_column_view<AnySize>& column, Context& ctx)
+    {
+        fmt::memory_buffer text;
+        text.push_back('[');
+
+        for (std::size_t row = 0; row < column.size(); row++)
+        {
+            if (row)
+            {
+                text.push_back(',');
+                text.push_back(' ');
+            }
+
+            wmi_format_value(text, column, row);
+        }
+
+        text.push_back(']');
+        return wmi_format_copy({ text.data(), text.size() }, ctx);
+    }
+};
+
+// Results format as a table ({} or {:t}), CSV ({:c}) or key=value lines ({:k}). Columns are named by the helper's
+// property names, or #<handle> for plain wmi_result_columns.
+template<std::size_t AnySize>
+class wmi_result_formatter
+{
+public:
+
+    template<typename ParseContext>
+    constexpr auto parse(ParseContext& ctx)
+    {
+        auto it = ctx.begin();
+
+        if (it != ctx.end() && (*it == 't' || *it == 'c' || *it == 'k'))
+            style_ = *it++;
+
+        if (it != ctx.end() && *it != '}')
+            throw fmt::format_error("invalid format for a WMI result, use {}, {:t}, {:c} or {:k}");
+
+        return it;
+    }
+
+    // name(handle, out) appends the name of a column. A sample time goes on a # time= line above tables, first on every
+    // key=value line and nowhere in CSV, which has to stay one header and one line per row.
+    template<typename Context, typename Name>
+    auto format(const wmi_result_columns<AnySize>& result, Name&& name, Context& ctx, const std::optional<std::uint64_t> time = std::nullopt)
+    {
+        fmt::memory_buffer text;
+        std::vector<named_column> columns;
+        std::size_t rows = 0;
+
+        // views and names are looked up once, not for every cell
+        for (wmi_var_handle handle = 0; handle < result.handle_count(); handle++)
+        {
+            if (!result.count(handle))
+                continue;
+
+            columns.emplace_back(result[handle]);
+            name(handle, columns.back().name);
+            rows = std::max(rows, columns.back().values.size());
+        }
+
+        if (style_ == 'k')
+        {
+            format_pairs(columns, rows, time, text);
+        }
+        else if (style_ == 'c')
+        {
+            format_csv(columns, rows, text);
+        }
+        else
+        {
+            if (time)
+            {
+                append_time("# time=", *time, text);
+                text.push_back('\n');
+            }
+
+            format_table(columns, rows, text);
+        }
+
+        return wmi_format_copy({ text.data(), text.size() }, ctx);
+    }
+
+private:
+
+    struct named_column
+    {
+        explicit named_column(const typename wmi_result_columns<AnySize>::column_type& column) : values(column)
+        {
+        }
+
+        typename wmi_result_columns<AnySize>::column_type values;
+        fmt::memory_buffer name;
+    };
+
+    static void append_time(const std::string_view key, const std::uint64_t time, fmt::memory_buffer& out)
+    {
+        const fmt::format_int digits(time);
+        out.append(key.data(), key.data() + key.size());
+        out.append(digits.data(), digits.data() + digits.size());
+    }
+
+    // row 0 is the header
+    static void append_cell(const named_column& column, const std::size_t row, fmt::memory_buffer& out)
+    {
+        if (row == 0)
+            out.append(column.name.data(), column.name.data() + column.name.size());
+        else if (row - 1 < column.values.size())
+            wmi_format_value(out, column.values, row - 1);
+    }
+
+    static void format_pairs(const std::vector<named_column>& columns, const std::size_t rows, const std::optional<std::uint64_t> time, fmt::memory_buffer& out)
+    {
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            auto first = true;
+
+            if (time)
+            {
+                append_time("time=", *time, out);
+                first = false;
+            }
+
+            for (const auto& column : columns)
+            {
+                if (!first)
+                    out.push_back(' ');
+
+                first = false;
+                out.append(column.name.data(), column.name.data() + column.name.size());
+                out.push_back('=');
+
+                if (row < column.values.size())
+                    wmi_format_value(out, column.values, row);
+            }
+
+            out.push_back('\n');
+        }
+    }
+
+    static void format_csv(const std::vector<named_column>& columns, const std::size_t rows, fmt::memory_buffer& out)
+    {
+        fmt::memory_buffer field;
+
+        // fields are quoted when they contain a separator, quote or line break, quotes are doubled
+        const auto append_field = [&out, &field]()
+        {
+            const std::string_view value(field.data(), field.size());
+
+            if (std::none_of(value.begin(), value.end(), [](const char c) { return c == ',' || c == '"' || c == '\r' || c == '\n'; }))
+            {
+                out.append(value.data(), value.data() + value.size());
+                return;
+            }
+
+            out.push_back('"');
+
+            for (const auto c : value)
+            {
+                if (c == '"')
+                    out.push_back('"');
+
+                out.push_back(c);
+            }
+
+            out.push_back('"');
+        };
+
+        for (std::size_t row = 0; row <= rows; row++)
+        {
+            for (std::size_t i = 0; i < columns.size(); i++)
+            {
+                if (i)
+                    out.push_back(',');
+
+                field.clear();
+                append_cell(columns[i], row, field);
+                append_field();
+            }
+
+            out.push_back('\r');
+            out.push_back('\n');
+        }
+    }
+
+    static void format_table(const std::vector<named_column>& columns, const std::size_t rows, fmt::memory_buffer& out)
+    {
+        fmt::memory_buffer field;
+
+        // display width in code points
+        const auto width = [](const fmt::memory_buffer& text)
+        {
+            return static_cast<std::size_t>(std::count_if(text.data(), text.data() + text.size(), [](const char c) { return (static_cast<unsigned char>(c) & 0xc0) != 0x80; }));
+        };
+
+        // first pass measures every column, the second writes the padded cells
+        std::vector<std::size_t> widths(columns.size());
+
+        for (std::size_t i = 0; i < columns.size(); i++)
+        {
+            widths[i] = width(columns[i].name);
+
+            for (std::size_t row = 0; row < columns[i].values.size(); row++)
+            {
+                field.clear();
+                wmi_format_value(field, columns[i].values, row);
+                widths[i] = std::max(widths[i], width(field));
+            }
+        }
+
+        for (std::size_t row = 0; row <= rows; row++)
+        {
+            for (std::size_t i = 0; i < columns.size(); i++)
+            {
+                if (i)
+                    out.append("  ", "  " + 2);
+
+                field.clear();
+                append_cell(columns[i], row, field);
+                out.append(field.data(), field.data() + field.size());
+
+                for (auto pad = width(field); pad < widths[i]; pad++)
+                    out.push_back(' ');
+            }
+
+            // no trailing padding
+            while (out.size() && out.data()[out.size() - 1] == ' ')
+                out.resize(out.size() - 1);
+
+            out.push_back('\n');
+        }
+    }
+
+    char style_ = 't';
+};
+
+// Column name of plain wmi_result_columns, #<handle>.
+inline void wmi_format_handle_name(const wmi_var_handle handle, fmt::memory_buffer& out)
+{
+    out.push_back('#');
+    const fmt::format_int digits(handle);
+    out.append(digits.data(), digits.data() + digits.size());
+}
+
+template<std::size_t AnySize>
+struct fmt::formatter<wmi_result_columns<AnySize>> : wmi_result_formatter<AnySize>
+{
+    template<typename Context>
+    auto format(const wmi_result_columns<AnySize>& result, Context& ctx)
+    {
+        return wmi_result_formatter<AnySize>::format(result, wmi_format_handle_name, ctx);
+    }
+};
+
+template<std::size_t AnySize, typename Backend>
+struct fmt::formatter<wmi_named_result<AnySize, Backend>> : wmi_result_formatter<AnySize>
+{
+    template<typename Context>
+    auto format(const wmi_named_result<AnySize, Backend>& named, Context& ctx)
+    {
+        return wmi_result_formatter<AnySize>::format(named.result, [&named](const wmi_var_handle handle, fmt::memory_buffer& out)
+        {
+            wmi_append_utf8(named.helper.var_name(handle), out);
+        }, ctx);
+    }
+};
+
+// The result with its sample time in milliseconds, in any of the result styles:
+//
+//   {:t}  # time=1700000000000, then the table
+//   {:k}  time=1700000000000 #0=svchost #1=1234 per row
+//   {:c}  the CSV of the result alone
+template<std::size_t AnySize>
+struct fmt::formatter<wmi_wrapper_class_result<AnySize>> : wmi_result_formatter<AnySize>
+{
+    template<typename Context>
+    auto format(const wmi_wrapper_class_result<AnySize>& wmi_result, Context& ctx)
+    {
+        return wmi_result_formatter<AnySize>::format(wmi_result.result, wmi_format_handle_name, ctx, wmi_result.time);
+    }
+};
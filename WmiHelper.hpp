@@ -1,6 +1,37 @@
 #pragma once
+#ifdef _WIN32
 #include <windows.h>
 #include <WbemCli.h>
+#pragma comment(lib, "comsuppw.lib")
+#pragma comment(lib, "wbemuuid.lib")
+#pragma comment(lib, "Propsys.lib")
+#else
+// Only wmi_com_backend needs WMI. Everything else builds on other platforms, e.g. to test against wmi_fake_backend.
+using CIMTYPE = long;
+
+enum CIMTYPE_ENUMERATION
+{
+    CIM_ILLEGAL = 0xfff,
+    CIM_EMPTY = 0,
+    CIM_SINT8 = 16,
+    CIM_UINT8 = 17,
+    CIM_SINT16 = 2,
+    CIM_UINT16 = 18,
+    CIM_SINT32 = 3,
+    CIM_UINT32 = 19,
+    CIM_SINT64 = 20,
+    CIM_UINT64 = 21,
+    CIM_REAL32 = 4,
+    CIM_REAL64 = 5,
+    CIM_BOOLEAN = 11,
+    CIM_STRING = 8,
+    CIM_DATETIME = 101,
+    CIM_REFERENCE = 102,
+    CIM_CHAR16 = 103,
+    CIM_OBJECT = 13,
+    CIM_FLAG_ARRAY = 0x2000
+};
+#endif
 #include <thread>
 #include <map>
 #include <optional>
@@ -10,133 +41,2422 @@
 #include <utility>
 #include <vector>
 #include <mutex>
-#pragma comment(lib, "comsuppw.lib")
-#pragma comment(lib, "wbemuuid.lib")
-#pragma comment(lib, "Propsys.lib")
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <cwchar>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WMI_HELPER_SSE2 1
+#endif
 
 #include "fmt/format.h"
 
-inline std::uint64_t get_current_time()
-{
-    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-}
+inline std::uint64_t get_current_time()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Size in bytes of a scalar numeric CIMTYPE as returned by ReadPropertyValue, 0 for strings and anything else.
+inline std::size_t wmi_cim_type_size(const CIMTYPE type)
+{
+    switch (type)
+    {
+    case CIM_SINT8: case CIM_UINT8: return 1;
+    case CIM_SINT16: case CIM_UINT16: case CIM_BOOLEAN: case CIM_CHAR16: return 2;
+    case CIM_SINT32: case CIM_UINT32: case CIM_REAL32: return 4;
+    case CIM_SINT64: case CIM_UINT64: case CIM_REAL64: return 8;
+    default: return 0;
+    }
+}
+
+// true for the CIMTYPEs ReadPropertyValue returns as wchar_t strings
+constexpr bool wmi_is_string_type(const CIMTYPE type)
+{
+    return type == CIM_STRING || type == CIM_DATETIME || type == CIM_REFERENCE;
+}
+
+// Whether a CIMTYPE value can be read as a T without conversion.
+template<typename T>
+constexpr bool wmi_type_accepts(const CIMTYPE type)
+{
+    if constexpr (std::is_same_v<T, std::wstring> || std::is_same_v<T, std::wstring_view>)
+        return wmi_is_string_type(type);
+    else if constexpr (std::is_same_v<T, bool>)
+        return type == CIM_BOOLEAN;
+    else if constexpr (std::is_same_v<T, float>)
+        return type == CIM_REAL32;
+    else if constexpr (std::is_same_v<T, double>)
+        return type == CIM_REAL64;
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        return (sizeof(T) == 1 && type == CIM_SINT8) || (sizeof(T) == 2 && type == CIM_SINT16)
+            || (sizeof(T) == 4 && type == CIM_SINT32) || (sizeof(T) == 8 && type == CIM_SINT64);
+    else if constexpr (std::is_integral_v<T>)
+        return (sizeof(T) == 1 && type == CIM_UINT8) || (sizeof(T) == 2 && (type == CIM_UINT16 || type == CIM_CHAR16))
+            || (sizeof(T) == 4 && type == CIM_UINT32) || (sizeof(T) == 8 && type == CIM_UINT64);
+    else
+        return false;
+}
+
+class wmi_type_error : public std::runtime_error
+{
+public:
+
+    using std::runtime_error::runtime_error;
+};
+
+// Numeric value of raw scalar bits based on CIMTYPE, NaN for anything that is not a number.
+inline double wmi_scalar_as_double(const CIMTYPE type, const void* bits)
+{
+    const auto load = [bits](auto value)
+    {
+        std::memcpy(&value, bits, sizeof(value));
+        return static_cast<double>(value);
+    };
+
+    switch (type)
+    {
+    case CIM_SINT8: return load(std::int8_t{});
+    case CIM_UINT8: return load(std::uint8_t{});
+    case CIM_SINT16: return load(std::int16_t{});
+    case CIM_UINT16: return load(std::uint16_t{});
+    case CIM_SINT32: return load(std::int32_t{});
+    case CIM_UINT32: return load(std::uint32_t{});
+    case CIM_SINT64: return load(std::int64_t{});
+    case CIM_UINT64: return load(std::uint64_t{});
+    case CIM_REAL32: return load(float{});
+    case CIM_REAL64: return load(double{});
+    case CIM_BOOLEAN: return load(std::uint16_t{}) ? 1.0 : 0.0;
+    default: return std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+// Numeric value of a string cell. WMI reports 64 bit integers as strings on some classes.
+inline double wmi_string_as_double(const std::wstring_view str)
+{
+    wchar_t buffer[64];
+    const auto length = std::min(str.size(), std::size(buffer) - 1);
+
+    std::wmemcpy(buffer, str.data(), length);
+    buffer[length] = L'\0';
+
+    wchar_t* end = nullptr;
+    const auto value = std::wcstod(buffer, &end);
+    return (end != buffer) ? value : std::numeric_limits<double>::quiet_NaN();
+}
+
+// Upper bound of the UTF-8 size of length wchar_t units. wchar_t is UTF-16 on Windows and UTF-32 elsewhere.
+constexpr std::size_t wmi_utf8_max_size(const std::size_t length)
+{
+    return length * (sizeof(wchar_t) == 2 ? 3 : 4);
+}
+
+// Converts str to UTF-8 into out, which must hold wmi_utf8_max_size(str.size()) bytes. Returns the number of bytes
+// written. Unpaired surrogates and invalid code points become U+FFFD. Runs of ASCII are converted 8 (SSE2) or 4 units
+// at a time, WMI strings are mostly ASCII.
+inline std::size_t wmi_utf8_encode(const std::wstring_view str, char* out)
+{
+    const auto* in = str.data();
+    const auto* const end = in + str.size();
+    auto* const start = out;
+
+    while (in < end)
+    {
+#ifdef WMI_HELPER_SSE2
+        constexpr std::size_t units = 16 / sizeof(wchar_t);
+
+        while (end - in >= static_cast<std::ptrdiff_t>(units))
+        {
+            const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                const auto high = _mm_and_si128(block, _mm_set1_epi16(static_cast<short>(0xff80)));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xffff)
+                    break;
+
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(block, block));
+            }
+            else
+            {
+                const auto high = _mm_and_si128(block, _mm_set1_epi32(static_cast<int>(0xffffff80)));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xffff)
+                    break;
+
+                const auto words = _mm_packs_epi32(block, block);
+                const auto bytes = _mm_packus_epi16(words, words);
+                const auto packed = _mm_cvtsi128_si32(bytes);
+                std::memcpy(out, &packed, sizeof(packed));
+            }
+
+            in += units;
+            out += units;
+        }
+#else
+        // four units at a time, checked as one (UTF-16) or two (UTF-32) 64 bit words
+        while (end - in >= 4)
+        {
+            std::uint64_t words[sizeof(wchar_t) / 2];
+            std::memcpy(words, in, sizeof(words));
+
+            std::uint64_t high = 0;
+
+            for (auto word : words)
+                high |= word & (sizeof(wchar_t) == 2 ? 0xff80ff80ff80ff80ull : 0xffffff80ffffff80ull);
+
+            if (high != 0)
+                break;
+
+            for (std::size_t i = 0; i < 4; i++)
+                out[i] = static_cast<char>(in[i]);
+
+            in += 4;
+            out += 4;
+        }
+#endif
+
+        if (in >= end)
+            break;
+
+        auto code_point = static_cast<std::uint32_t>(in[0]);
+        in++;
+
+        if (code_point < 0x80)
+        {
+            *out++ = static_cast<char>(code_point);
+            continue;
+        }
+
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            if (code_point >= 0xd800 && code_point <= 0xdbff && in < end && in[0] >= 0xdc00 && in[0] <= 0xdfff)
+            {
+                code_point = 0x10000 + ((code_point - 0xd800) << 10) + (static_cast<std::uint32_t>(in[0]) - 0xdc00);
+                in++;
+            }
+        }
+
+        if ((code_point >= 0xd800 && code_point <= 0xdfff) || code_point > 0x10ffff)
+            code_point = 0xfffd;
+
+        if (code_point < 0x800)
+        {
+            *out++ = static_cast<char>(0xc0 | (code_point >> 6));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+        else if (code_point < 0x10000)
+        {
+            *out++ = static_cast<char>(0xe0 | (code_point >> 12));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+    }
+
+    return static_cast<std::size_t>(out - start);
+}
+
+// Appends str as UTF-8 to out, a std::string, std::pmr::string or fmt::memory_buffer.
+template<typename Out>
+void wmi_append_utf8(const std::wstring_view str, Out& out)
+{
+    const auto size = out.size();
+
+    out.resize(size + wmi_utf8_max_size(str.size()));
+    out.resize(size + wmi_utf8_encode(str, out.data() + size));
+}
+
+[[nodiscard]] inline std::string wmi_to_utf8(const std::wstring_view str)
+{
+    std::string out;
+    wmi_append_utf8(str, out);
+    return out;
+}
+
+// Final mix of a 64 bit hash (the murmur3 finalizer), every input bit affects every output bit.
+constexpr std::uint64_t wmi_hash_mix(std::uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// Fast non-cryptographic 64 bit hash of raw bytes, used to detect changed results. Reads 8 bytes per step.
+inline std::uint64_t wmi_hash_bytes(const void* data, const std::size_t size, std::uint64_t seed = 0)
+{
+    constexpr std::uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+
+    const auto* in = static_cast<const unsigned char*>(data);
+    auto hash = seed ^ (size * multiplier);
+
+    std::size_t i = 0;
+
+    // one xxHash64 style round per word, the final mix spreads the bits
+    const auto round = [&](const std::uint64_t word)
+    {
+        hash ^= word * 0xc2b2ae3d27d4eb4full;
+        hash = ((hash << 31) | (hash >> 33)) * multiplier;
+    };
+
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, in + i, sizeof(word));
+        round(word);
+    }
+
+    if (i < size)
+    {
+        std::uint64_t word = 0;
+        std::memcpy(&word, in + i, size - i);
+        round(word);
+    }
+
+    return wmi_hash_mix(hash);
+}
+
+// Result cell, 16 bytes and trivially copyable. Scalars are stored inline, strings of up to inline_chars characters
+// too and longer ones as an offset into the string arena of the result they belong to.
+class wmi_cell
+{
+public:
+
+    static constexpr std::size_t inline_chars = 12 / sizeof(wchar_t);
+
+    [[nodiscard]] static wmi_cell scalar(const CIMTYPE type, const void* data, const std::size_t size)
+    {
+        wmi_cell cell;
+        cell.type_ = static_cast<std::uint16_t>(type);
+        cell.kind_ = kind_scalar;
+        std::memcpy(cell.payload_, data, std::min(size, sizeof(std::uint64_t)));
+        return cell;
+    }
+
+    template<typename T>
+    [[nodiscard]] static wmi_cell from(const CIMTYPE type, const T value)
+    {
+        static_assert(std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint64_t), "wmi_cell::from() takes scalars.");
+        return scalar(type, &value, sizeof(T));
+    }
+
+    // Stores value inline if it fits, otherwise appends it to arena (a std::wstring or std::pmr::wstring).
+    template<typename String>
+    [[nodiscard]] static wmi_cell string(const CIMTYPE type, const std::wstring_view value, String& arena)
+    {
+        wmi_cell cell;
+        cell.type_ = static_cast<std::uint16_t>(type);
+
+        if (value.size() <= inline_chars)
+        {
+            cell.kind_ = kind_inline;
+            cell.inline_size_ = static_cast<std::uint8_t>(value.size());
+            std::memcpy(cell.payload_, value.data(), value.size() * sizeof(wchar_t));
+            return cell;
+        }
+
+        const auto offset = static_cast<std::uint32_t>(arena.size());
+        const auto length = static_cast<std::uint32_t>(value.size());
+
+        arena.append(value);
+
+        cell.kind_ = kind_arena;
+        std::memcpy(cell.payload_, &offset, sizeof(offset));
+        std::memcpy(cell.payload_ + sizeof(offset), &length, sizeof(length));
+        return cell;
+    }
+
+    // Code into the column's wmi_string_dictionary.
+    [[nodiscard]] static wmi_cell code(const CIMTYPE type, const std::uint32_t code)
+    {
+        wmi_cell cell;
+        cell.type_ = static_cast<std::uint16_t>(type);
+        cell.kind_ = kind_code;
+        std::memcpy(cell.payload_, &code, sizeof(code));
+        return cell;
+    }
+
+    [[nodiscard]] CIMTYPE type() const
+    {
+        return static_cast<CIMTYPE>(type_);
+    }
+
+    // false if the property could not be read
+    [[nodiscard]] bool has_value() const
+    {
+        return kind_ != kind_empty;
+    }
+
+    [[nodiscard]] bool is_string() const
+    {
+        return kind_ == kind_inline || kind_ == kind_arena || kind_ == kind_code;
+    }
+
+    // true for cells of dictionary encoded columns, see wmi_capture_options
+    [[nodiscard]] bool is_code() const
+    {
+        return kind_ == kind_code;
+    }
+
+    // Dictionary code of the string, equal codes in one column mean equal strings.
+    [[nodiscard]] std::uint32_t code() const
+    {
+        std::uint32_t value;
+        std::memcpy(&value, payload_, sizeof(value));
+        return value;
+    }
+
+    // Checked scalar access, throws wmi_type_error if T does not match the cell's CIMTYPE.
+    template<typename T>
+    [[nodiscard]] T get() const
+    {
+        static_assert(std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint64_t), "wmi_cell::get() is for scalars, use get_wide_string() for strings.");
+
+        if (kind_ != kind_scalar || !wmi_type_accepts<T>(type()))
+            throw wmi_type_error(fmt::format("wmi_cell::get() type does not match CIMTYPE {}.", type_));
+
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return bits() != 0;
+        }
+        else
+        {
+            T value;
+            std::memcpy(&value, payload_, sizeof(T));
+            return value;
+        }
+    }
+
+    // Empty view for non string cells. arena is the string arena of the result the cell belongs to. Dictionary coded
+    // cells are resolved by their column, see wmi_column_view::string().
+    [[nodiscard]] std::wstring_view get_wide_string(const std::wstring_view arena) const
+    {
+        if (kind_ == kind_inline)
+            return { reinterpret_cast<const wchar_t*>(payload_), inline_size_ };
+
+        if (kind_ == kind_arena)
+        {
+            std::uint32_t offset, length;
+            std::memcpy(&offset, payload_, sizeof(offset));
+            std::memcpy(&length, payload_ + sizeof(offset), sizeof(length));
+            return { arena.data() + offset, length };
+        }
+
+        return {};
+    }
+
+    [[nodiscard]] double as_double(const std::wstring_view arena) const
+    {
+        if (kind_ == kind_scalar)
+            return wmi_scalar_as_double(type(), payload_);
+
+        if (kind_ == kind_inline || kind_ == kind_arena)
+            return wmi_string_as_double(get_wide_string(arena));
+
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // raw scalar bits, zero extended
+    [[nodiscard]] std::uint64_t bits() const
+    {
+        std::uint64_t value;
+        std::memcpy(&value, payload_, sizeof(value));
+        return value;
+    }
+
+    // Hashes count cells in one pass: adds the hash of every value, xored with salt to tell columns apart, to rows[i]
+    // and returns a hash of all values in order. Equal values hash the same in every result; strings in the arena are
+    // hashed by content since their cells only hold an offset. Two cells are hashed at once with SSE2, costing a few
+    // ns per cell.
+    static std::uint64_t hash_rows(const wmi_cell* cells, const std::size_t count, const std::wstring_view arena, const std::uint64_t salt, std::uint64_t* rows)
+    {
+        std::uint64_t column = 0;
+        std::size_t i = 0;
+
+#ifdef WMI_HELPER_SSE2
+        // same arithmetic as hash_bits(): multiply the 32 bit halves of each keyed word (x0 * x1, x2 * x3) and add the
+        // other word of the cell
+        const auto key = _mm_set_epi32(static_cast<int>(hash_key_hi >> 32), static_cast<int>(hash_key_hi), static_cast<int>(hash_key_lo >> 32), static_cast<int>(hash_key_lo));
+
+        const auto mix = [&](const __m128i data)
+        {
+            const auto keyed = _mm_xor_si128(data, key);
+            const auto products = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(3, 3, 1, 1)));
+            return _mm_add_epi64(products, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+        };
+
+        for (; i + 2 <= count; i += 2)
+        {
+            alignas(16) std::uint64_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), mix(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + i))));
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes + 2), mix(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + i + 1))));
+
+            const auto first = cells[i].kind_ == kind_arena ? cells[i].arena_hash(arena) : fold(lanes[0], lanes[1]);
+            const auto second = cells[i + 1].kind_ == kind_arena ? cells[i + 1].arena_hash(arena) : fold(lanes[2], lanes[3]);
+
+            rows[i] += first ^ salt;
+            rows[i + 1] += second ^ salt;
+            column += (first ^ (i * hash_key_lo)) + (second ^ ((i + 1) * hash_key_lo));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            const auto hash = cells[i].kind_ == kind_arena ? cells[i].arena_hash(arena) : cells[i].hash_bits();
+
+            rows[i] += hash ^ salt;
+            column += hash ^ (i * hash_key_lo);
+        }
+
+        return wmi_hash_mix(column ^ count);
+    }
+
+private:
+
+    static constexpr std::uint64_t hash_key_lo = 0x9e3779b97f4a7c15ull;
+    static constexpr std::uint64_t hash_key_hi = 0xc2b2ae3d27d4eb4full;
+
+    static std::uint64_t fold(const std::uint64_t low, const std::uint64_t high)
+    {
+        return low ^ ((high << 31) | (high >> 33));
+    }
+
+    [[nodiscard]] std::uint64_t hash_bits() const
+    {
+        std::uint64_t low, high;
+        std::memcpy(&low, this, sizeof(low));
+        std::memcpy(&high, reinterpret_cast<const unsigned char*>(this) + sizeof(low), sizeof(high));
+
+        const auto keyed_low = low ^ hash_key_lo;
+        const auto keyed_high = high ^ hash_key_hi;
+
+        return fold((keyed_low & 0xffffffff) * (keyed_low >> 32) + high, (keyed_high & 0xffffffff) * (keyed_high >> 32) + low);
+    }
+
+    [[nodiscard]] std::uint64_t arena_hash(const std::wstring_view arena) const
+    {
+        const auto value = get_wide_string(arena);
+        return wmi_hash_bytes(value.data(), value.size() * sizeof(wchar_t), type_);
+    }
+
+    static constexpr std::uint8_t kind_empty = 0;
+    static constexpr std::uint8_t kind_scalar = 1;
+    static constexpr std::uint8_t kind_inline = 2;
+    static constexpr std::uint8_t kind_arena = 3;
+    static constexpr std::uint8_t kind_code = 4;
+
+    std::uint16_t type_ = CIM_EMPTY;
+    std::uint8_t kind_ = kind_empty;
+    std::uint8_t inline_size_ = 0;
+    alignas(wchar_t) unsigned char payload_[12] = {};
+};
+
+static_assert(sizeof(wmi_cell) == 16, "wmi_cell is meant to stay 16 bytes.");
+static_assert(std::is_trivially_copyable_v<wmi_cell>, "wmi_cell is meant to be trivially copyable.");
+
+// Append only string dictionary of one column, shared by every result of a helper. Codes are indices and never
+// change, so a value that shows up again on a later tick gets the code it had before and costs no allocation.
+//
+// Entries live in chunks that never move (chunk i holds first_chunk << i entries), which lets value() run on
+// any thread for codes taken from a delivered result while the helper keeps adding entries. intern() and find() belong
+// to the thread filling results.
+class wmi_string_dictionary
+{
+public:
+
+    explicit wmi_string_dictionary(const std::uint32_t max_entries = 65536) : max_entries_(max_entries)
+    {
+    }
+
+    wmi_string_dictionary(const wmi_string_dictionary&) = delete;
+    wmi_string_dictionary& operator=(const wmi_string_dictionary&) = delete;
+
+    // Code of value, added if it is new. Empty if the dictionary is full.
+    [[nodiscard]] std::optional<std::uint32_t> intern(const std::wstring_view value)
+    {
+        if (const auto it = codes_.find(value); it != codes_.end())
+            return it->second;
+
+        const auto code = size_.load(std::memory_order_relaxed);
+
+        if (code >= max_entries_)
+            return std::nullopt;
+
+        const auto [chunk, index] = locate(code);
+
+        if (!chunks_[chunk])
+            chunks_[chunk] = std::make_unique<entry[]>(first_chunk << chunk);
+
+        auto& added = chunks_[chunk][index];
+        added.wide.assign(value);
+        added.utf8.clear();
+        wmi_append_utf8(value, added.utf8);
+
+        codes_.emplace(added.wide, code);
+        size_.store(code + 1, std::memory_order_release);
+
+        return code;
+    }
+
+    [[nodiscard]] std::optional<std::uint32_t> find(const std::wstring_view value) const
+    {
+        const auto it = codes_.find(value);
+
+        if (it == codes_.end())
+            return std::nullopt;
+
+        return it->second;
+    }
+
+    [[nodiscard]] std::wstring_view value(const std::uint32_t code) const
+    {
+        const auto [chunk, index] = locate(code);
+        return chunks_[chunk][index].wide;
+    }
+
+    // Converted once when the entry is added.
+    [[nodiscard]] std::string_view utf8(const std::uint32_t code) const
+    {
+        const auto [chunk, index] = locate(code);
+        return chunks_[chunk][index].utf8;
+    }
+
+    [[nodiscard]] std::uint32_t size() const
+    {
+        return size_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] std::uint32_t max_entries() const
+    {
+        return max_entries_;
+    }
+
+private:
+
+    static constexpr std::uint32_t first_chunk = 64;
+
+    struct entry
+    {
+        std::wstring wide;
+        std::string utf8;
+    };
+
+    // chunk c starts at first_chunk * (2^c - 1)
+    [[nodiscard]] static std::pair<std::size_t, std::size_t> locate(const std::uint32_t code)
+    {
+        const auto n = static_cast<std::uint64_t>(code) / first_chunk + 1;
+
+        std::size_t chunk = 0;
+
+        while ((n >> (chunk + 1)) != 0)
+            chunk++;
+
+        return { chunk, code - first_chunk * ((std::uint64_t(1) << chunk) - 1) };
+    }
+
+    std::unique_ptr<entry[]> chunks_[32];
+    std::unordered_map<std::wstring_view, std::uint32_t> codes_; // views into chunks_
+    std::atomic<std::uint32_t> size_ = 0;
+    std::uint32_t max_entries_;
+};
+
+// Per var options for wmi_helper::capture_var().
+struct wmi_capture_options
+{
+    // Store strings as codes into a dictionary kept across ticks. Meant for low cardinality columns (names, labels,
+    // states): repeated values cost no allocation and equality filters compare integers. Values that arrive once the
+    // dictionary holds max_dictionary_entries are stored as plain strings.
+    bool dictionary = false;
+    std::uint32_t max_dictionary_entries = 65536;
+
+    // Decode the column only when a consumer reads it. Columns nobody reads while the result is delivered (during
+    // the callback) are dropped from it; results kept beyond that, e.g. by query() or a stored copy, get every
+    // column. Meant for wide classes where only a few counters are looked at on a given tick. Filter columns are
+    // always read.
+    bool lazy = false;
+
+    // Read the var every Nth tick only, e.g. for properties like Capacity that do not change. Ticks in between carry
+    // the column of the previous result over, see wmi_result_columns::column_time() for its age, as long as the rows
+    // hold the same instances: every key var must have the same value in every row as on the previous tick. Without a
+    // key var, or when an instance came, went or moved, the column is read. Filter columns are read every tick.
+    std::uint32_t read_every = 1;
+
+    // The var identifies an instance, e.g. Name or IDProcess. Key vars are read every tick whatever their read_every
+    // and lazy options.
+    bool key = false;
+};
+
+// Owning copy of a cell with its string, as results were stored before wmi_cell. Kept for compatibility, results hand
+// these out by value through wmi_column_view::operator[].
+template<std::size_t MaxSize = 32>
+struct wmi_any
+{
+    CIMTYPE type;
+    char reserved[MaxSize];
+    std::wstring str;
+
+	template<typename T>
+    [[nodiscard]] T data() const
+    {
+	    // ReSharper disable once CppCStyleCast
+	    return (T)(reserved);
+    }
+
+    template<typename T>
+    [[nodiscard]] T get() const
+    {
+        static_assert(sizeof(T) <= MaxSize, "sizeof(T) too large to fit in WmiAny buffer. Please increase MaxSize template to fix this issue.");
+
+        T value;
+        std::memcpy(&value, reserved, sizeof(T));
+        return value;
+    }
+
+    template<typename T>
+    void set(const T value)
+    {
+        static_assert(sizeof(T) <= MaxSize, "sizeof(T) too large to fit in WmiAny buffer. Please increase MaxSize template to fix this issue.");
+        std::memcpy(reserved, &value, sizeof(T));
+    }
+
+    [[nodiscard]] std::wstring get_wide_string() const
+    {
+        return str;
+    }
+
+    // UTF-8
+    [[nodiscard]] std::string get_string() const
+    {
+        return wmi_to_utf8(str);
+    }
+
+	// numeric view of the cell based on its CIMTYPE. strings (WMI reports 64 bit integers as strings on some classes) are parsed, anything else is NaN.
+    [[nodiscard]] double as_double() const
+    {
+        if (type == CIM_STRING)
+            return wmi_string_as_double(str);
+
+        return wmi_scalar_as_double(type, reserved);
+    }
+
+};
+
+
+
+class wmi_helper_config
+{
+public:
+	
+    wmi_helper_config(std::wstring class_name, std::int32_t fire_count = infinite, std::int32_t fire_time = infinite, std::int32_t updates_per_second = 2) : class_name_(std::move(class_name)), fire_count_(fire_count), fire_time_(fire_time), updates_per_second_(updates_per_second)
+    {
+
+    }
+
+    wmi_helper_config() = default;
+
+    [[nodiscard]] std::wstring& server()
+    {
+        return server_;
+    }
+
+    [[nodiscard]] std::wstring& username()
+    {
+        return username_;
+    }
+
+    [[nodiscard]] std::wstring& password()
+    {
+        return password_;
+    }
+
+	
+    [[nodiscard]] const std::wstring& class_name() const
+    {
+        return class_name_;
+    }
+	
+    [[nodiscard]] const std::int32_t& fire_count() const
+    {
+        return fire_count_;
+    }
+
+    [[nodiscard]] const std::int32_t& fire_time() const
+    {
+        return fire_time_;
+    }
+
+    [[nodiscard]] const std::int32_t& updates_per_second() const
+    {
+        return updates_per_second_;
+    }
+
+    const static std::int32_t infinite = -1;
+private:
+    std::wstring class_name_;
+    std::int32_t fire_count_ = -1; // -1 for infinity. Counts refreshes, one without instances delivers no result
+    std::int32_t fire_time_ = 5000; // -1 for infinity
+    std::int32_t updates_per_second_ = 2; // times wmi is queried per second
+
+    std::wstring server_ = L"\\\\.\\root\\cimv2";
+    std::wstring username_;
+    std::wstring password_;
+
+};
+
+// Dense index of a captured var, assigned in capture order starting at 0.
+using wmi_var_handle = std::uint32_t;
+
+// FNV-1a over the lower cased UTF-16 code units of a property name. WMI property names are case insensitive and ASCII,
+// so wmi_name_hash(L"Speed") == wmi_name_hash(L"speed"). Usable at compile time, e.g. helper.handle_of<wmi_name_hash(L"Speed")>().
+constexpr std::uint64_t wmi_name_hash(const std::wstring_view name)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+
+    for (const auto c : name)
+    {
+        const auto unit = static_cast<std::uint16_t>((c >= L'A' && c <= L'Z') ? c - L'A' + L'a' : c);
+
+        hash = (hash ^ (unit & 0xff)) * 1099511628211ull;
+        hash = (hash ^ (unit >> 8)) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Compares property names the way wmi_name_hash() hashes them, ignoring ASCII case.
+constexpr bool wmi_name_equals(const std::wstring_view a, const std::wstring_view b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        const auto x = (a[i] >= L'A' && a[i] <= L'Z') ? a[i] - L'A' + L'a' : a[i];
+        const auto y = (b[i] >= L'A' && b[i] <= L'Z') ? b[i] - L'A' + L'a' : b[i];
+
+        if (x != y)
+            return false;
+    }
+
+    return true;
+}
+
+enum class wmi_predicate_op
+{
+    equal,
+    not_equal,
+    prefix,
+    one_of,
+    less,
+    less_equal,
+    greater,
+    greater_equal
+};
+
+// A filter on a single captured var. Rows are only kept when every predicate passed to wmi_helper::filter() matches.
+// String operands are compared against string properties, the numeric operand against everything else. String operands
+// of =, <> and IN on a numeric property (ProcessId = '4') are compared as numbers and must be numbers.
+struct wmi_predicate
+{
+    wmi_var_handle handle = 0;
+    wmi_predicate_op op = wmi_predicate_op::equal;
+    std::vector<std::wstring> strings;
+    double number = 0.0;
+
+    [[nodiscard]] static wmi_predicate equals(const wmi_var_handle handle, std::wstring value)
+    {
+        return { handle, wmi_predicate_op::equal, { std::move(value) } };
+    }
+
+    [[nodiscard]] static wmi_predicate equals(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::equal, {}, value };
+    }
+
+    [[nodiscard]] static wmi_predicate not_equals(const wmi_var_handle handle, std::wstring value)
+    {
+        return { handle, wmi_predicate_op::not_equal, { std::move(value) } };
+    }
+
+    [[nodiscard]] static wmi_predicate not_equals(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::not_equal, {}, value };
+    }
+
+    [[nodiscard]] static wmi_predicate starts_with(const wmi_var_handle handle, std::wstring value)
+    {
+        return { handle, wmi_predicate_op::prefix, { std::move(value) } };
+    }
+
+    [[nodiscard]] static wmi_predicate one_of(const wmi_var_handle handle, std::vector<std::wstring> values)
+    {
+        return { handle, wmi_predicate_op::one_of, std::move(values) };
+    }
+
+    [[nodiscard]] static wmi_predicate less(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::less, {}, value };
+    }
+
+    [[nodiscard]] static wmi_predicate less_equal(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::less_equal, {}, value };
+    }
+
+    [[nodiscard]] static wmi_predicate greater(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::greater, {}, value };
+    }
+
+    [[nodiscard]] static wmi_predicate greater_equal(const wmi_var_handle handle, const double value)
+    {
+        return { handle, wmi_predicate_op::greater_equal, {}, value };
+    }
+
+    // Clears mask[i] for every cell of column, whose property has the CIMTYPE type, that does not match. The whole
+    // column is evaluated in one pass so the numeric comparisons compile down to a tight, vectorizable loop.
+    template<typename Column>
+    void evaluate(const Column& column, const CIMTYPE type, std::vector<char>& mask, std::vector<double>& scratch) const
+    {
+        if (column.empty())
+            return;
+
+        // numeric operands are compared numerically even on string columns, WMI reports 64 bit integers as strings
+        if (wmi_is_string_type(type) && (!strings.empty() || op == wmi_predicate_op::prefix || op == wmi_predicate_op::one_of))
+        {
+            if (column.dictionary() && evaluate_codes(column, mask))
+                return;
+
+            for (std::size_t i = 0; i < column.size(); i++)
+                mask[i] &= static_cast<char>(matches(column.string(i)));
+
+            return;
+        }
+
+        const auto n = column.size();
+        const auto operands = op != wmi_predicate_op::prefix ? strings.size() : 0;
+
+        // string operands are parsed after the values, one_of compares against all of them
+        scratch.resize(n + operands);
+
+        for (std::size_t i = 0; i < n; i++)
+            scratch[i] = column.as_double(i);
+
+        for (std::size_t i = 0; i < operands; i++)
+            scratch[n + i] = parse_number(strings[i]);
+
+        const auto value = operands ? scratch[n] : number;
+        const auto* values = scratch.data();
+        auto* out = mask.data();
+
+        switch (op)
+        {
+        case wmi_predicate_op::equal: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] == value); break;
+        case wmi_predicate_op::not_equal: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] != value); break;
+        case wmi_predicate_op::less: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] < value); break;
+        case wmi_predicate_op::less_equal: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] <= value); break;
+        case wmi_predicate_op::greater: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] > value); break;
+        case wmi_predicate_op::greater_equal: for (std::size_t i = 0; i < n; i++) out[i] &= static_cast<char>(values[i] >= value); break;
+        case wmi_predicate_op::one_of:
+            for (std::size_t i = 0; i < n; i++)
+                out[i] &= static_cast<char>(std::find(values + n, values + n + operands, values[i]) != values + n + operands);
+            break;
+        default: std::fill(mask.begin(), mask.begin() + static_cast<std::ptrdiff_t>(n), 0); break; // prefix on a numeric column
+        }
+    }
+
+    // Equality on a dictionary encoded column, compares codes instead of strings. Returns false if the predicate can
+    // not be evaluated that way.
+    template<typename Column>
+    bool evaluate_codes(const Column& column, std::vector<char>& mask) const
+    {
+        constexpr std::size_t max_codes = 8;
+
+        if (op != wmi_predicate_op::equal && op != wmi_predicate_op::not_equal && op != wmi_predicate_op::one_of)
+            return false;
+
+        const auto operands = op == wmi_predicate_op::one_of ? strings.size() : std::min<std::size_t>(strings.size(), 1);
+
+        if (operands > max_codes)
+            return false;
+
+        // operands that are not in the dictionary can not match any code
+        std::uint32_t codes[max_codes];
+        std::size_t num_codes = 0;
+
+        for (std::size_t i = 0; i < operands; i++)
+        {
+            if (const auto code = column.dictionary()->find(strings[i]))
+                codes[num_codes++] = *code;
+        }
+
+        const auto negate = op == wmi_predicate_op::not_equal;
+
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            const auto& cell = column.cell(i);
+
+            if (!cell.is_code())
+            {
+                mask[i] &= static_cast<char>(matches(column.string(i))); // did not fit the dictionary
+                continue;
+            }
+
+            const auto hit = std::find(codes, codes + num_codes, cell.code()) != codes + num_codes;
+            mask[i] &= static_cast<char>(hit != negate);
+        }
+
+        return true;
+    }
+
+    // String operand compared with a numeric property, throws wmi_type_error unless all of it is a number.
+    [[nodiscard]] double parse_number(const std::wstring& operand) const
+    {
+        wchar_t* end = nullptr;
+        const auto value = std::wcstod(operand.c_str(), &end);
+
+        if (operand.empty() || end != operand.c_str() + operand.size())
+            throw wmi_type_error(fmt::format("wmi_predicate compares the numeric var {} with \"{}\", which is not a number.", handle, wmi_to_utf8(operand)));
+
+        return value;
+    }
+
+    [[nodiscard]] bool matches(const std::wstring_view value) const
+    {
+        switch (op)
+        {
+        case wmi_predicate_op::equal: return !strings.empty() && value == strings.front();
+        case wmi_predicate_op::not_equal: return strings.empty() || value != strings.front();
+        case wmi_predicate_op::prefix: return !strings.empty() && value.substr(0, strings.front().size()) == strings.front();
+        case wmi_predicate_op::one_of: return std::find(strings.begin(), strings.end(), value) != strings.end();
+        default: return false;
+        }
+    }
+};
+
+// Read only view of one result column.
+template<std::size_t AnySize>
+class wmi_column_view
+{
+public:
+
+    class iterator
+    {
+    public:
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = wmi_any<AnySize>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = wmi_any<AnySize>;
+
+        iterator(const wmi_column_view* view, const std::size_t index) : view_(view), index_(index)
+        {
+        }
+
+        reference operator*() const
+        {
+            return (*view_)[index_];
+        }
+
+        iterator& operator++()
+        {
+            index_++;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return index_ != other.index_;
+        }
+
+    private:
+
+        const wmi_column_view* view_;
+        std::size_t index_;
+    };
+
+    wmi_column_view(const wmi_cell* cells, const std::size_t size, const std::wstring_view arena, const wmi_string_dictionary* dictionary = nullptr)
+        : cells_(cells), size_(size), arena_(arena), dictionary_(dictionary)
+    {
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] const wmi_cell& cell(const std::size_t row) const
+    {
+        return cells_[row];
+    }
+
+    [[nodiscard]] const wmi_cell* data() const
+    {
+        return cells_;
+    }
+
+    // Checked typed access, see wmi_cell::get().
+    template<typename T>
+    [[nodiscard]] T get(const std::size_t row) const
+    {
+        return cell(row).template get<T>();
+    }
+
+    // Valid as long as the result is.
+    [[nodiscard]] std::wstring_view string(const std::size_t row) const
+    {
+        const auto& source = cell(row);
+
+        if (source.is_code())
+            return dictionary_->value(source.code());
+
+        return source.get_wide_string(arena_);
+    }
+
+    // Instance key of a row: the string of string cells, the decimal number of integer and boolean cells and the
+    // shortest round trip form of reals, which are formatted into buffer. Empty if the read failed.
+    [[nodiscard]] std::wstring_view key(const std::size_t row, std::wstring& buffer) const
+    {
+        const auto& source = cell(row);
+
+        if (source.is_string())
+            return string(row);
+
+        if (!source.has_value())
+            return {};
+
+        const auto bits = source.bits();
+
+        const auto load = [bits](auto value)
+        {
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        };
+
+        const auto digits = [&buffer](const fmt::format_int& number)
+        {
+            buffer.assign(number.data(), number.data() + number.size());
+            return std::wstring_view(buffer);
+        };
+
+        switch (source.type())
+        {
+        case CIM_SINT8: return digits(fmt::format_int(load(std::int8_t{})));
+        case CIM_UINT8: return digits(fmt::format_int(load(std::uint8_t{})));
+        case CIM_SINT16: return digits(fmt::format_int(load(std::int16_t{})));
+        case CIM_UINT16: case CIM_CHAR16: return digits(fmt::format_int(load(std::uint16_t{})));
+        case CIM_SINT32: return digits(fmt::format_int(load(std::int32_t{})));
+        case CIM_UINT32: return digits(fmt::format_int(load(std::uint32_t{})));
+        case CIM_SINT64: return digits(fmt::format_int(load(std::int64_t{})));
+        case CIM_UINT64: return digits(fmt::format_int(load(std::uint64_t{})));
+        case CIM_BOOLEAN: return digits(fmt::format_int(bits != 0 ? 1 : 0));
+        case CIM_REAL32: buffer = fmt::format(L"{}", load(float{})); return buffer;
+        case CIM_REAL64: buffer = fmt::format(L"{}", load(double{})); return buffer;
+        default: return {};
+        }
+    }
+
+    [[nodiscard]] double as_double(const std::size_t row) const
+    {
+        const auto& source = cell(row);
+
+        if (source.is_code())
+            return wmi_string_as_double(dictionary_->value(source.code()));
+
+        return source.as_double(arena_);
+    }
+
+    // Dictionary of a dictionary encoded column, nullptr otherwise.
+    [[nodiscard]] const wmi_string_dictionary* dictionary() const
+    {
+        return dictionary_;
+    }
+
+    // Compares two cells by value, strings as string_equals() does. false if either read failed.
+    [[nodiscard]] bool value_equals(const std::size_t row, const wmi_column_view& other, const std::size_t other_row) const
+    {
+        const auto& a = cell(row);
+        const auto& b = other.cell(other_row);
+
+        if (!a.has_value() || !b.has_value() || a.is_string() != b.is_string())
+            return false;
+
+        return a.is_string() ? string_equals(row, other, other_row) : a.bits() == b.bits();
+    }
+
+    // Compares two string cells, by code if both columns share a dictionary.
+    [[nodiscard]] bool string_equals(const std::size_t row, const wmi_column_view& other, const std::size_t other_row) const
+    {
+        const auto& a = cell(row);
+        const auto& b = other.cell(other_row);
+
+        if (a.is_code() && b.is_code() && dictionary_ == other.dictionary_)
+            return a.code() == b.code();
+
+        return string(row) == other.string(other_row);
+    }
+
+    // Owning copy of the cell, for code written against the wmi_any results.
+    [[nodiscard]] wmi_any<AnySize> operator[](const std::size_t row) const
+    {
+        const auto& source = cell(row);
+
+        wmi_any<AnySize> any{};
+        any.type = source.type();
+
+        if (source.is_string())
+        {
+            any.str = std::wstring(string(row));
+        }
+        else
+        {
+            const auto bits = source.bits();
+            std::memcpy(any.reserved, &bits, std::min(sizeof(bits), AnySize));
+        }
+
+        return any;
+    }
+
+    [[nodiscard]] iterator begin() const
+    {
+        return { this, 0 };
+    }
+
+    [[nodiscard]] iterator end() const
+    {
+        return { this, size() };
+    }
+
+private:
+
+    const wmi_cell* cells_;
+    std::size_t size_;
+    std::wstring_view arena_;
+    const wmi_string_dictionary* dictionary_;
+};
+
+// UTF-8 copy of a string column (a wmi_column_view), converted in one pass into one buffer. Dictionary coded cells
+// copy the UTF-8 their dictionary keeps. Reuse an instance across ticks to keep its capacity.
+class wmi_utf8_column
+{
+public:
+
+    template<typename Column>
+    void assign(const Column& column)
+    {
+        offsets_.resize(column.size() + 1);
+        offsets_[0] = 0;
+
+        std::size_t max_size = 0;
+
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            const auto& cell = column.cell(i);
+            max_size += cell.is_code() ? column.dictionary()->utf8(cell.code()).size() : wmi_utf8_max_size(column.string(i).size());
+        }
+
+        data_.resize(max_size);
+
+        std::size_t size = 0;
+
+        for (std::size_t i = 0; i < column.size(); i++)
+        {
+            const auto& cell = column.cell(i);
+
+            if (cell.is_code())
+            {
+                const auto utf8 = column.dictionary()->utf8(cell.code());
+                std::memcpy(data_.data() + size, utf8.data(), utf8.size());
+                size += utf8.size();
+            }
+            else
+            {
+                size += wmi_utf8_encode(column.string(i), data_.data() + size);
+            }
+
+            offsets_[i + 1] = static_cast<std::uint32_t>(size);
+        }
+
+        data_.resize(size);
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return offsets_.empty() ? 0 : offsets_.size() - 1;
+    }
+
+    [[nodiscard]] std::string_view operator[](const std::size_t row) const
+    {
+        return std::string_view(data_).substr(offsets_[row], offsets_[row + 1] - offsets_[row]);
+    }
+
+    // every row back to back
+    [[nodiscard]] std::string_view data() const
+    {
+        return data_;
+    }
+
+private:
+
+    std::string data_;
+    std::vector<std::uint32_t> offsets_;
+};
+
+// Monotonic memory resource that keeps its chunks. Deallocation is a no-op, reset() rewinds to the start so the next
+// cycle reuses the same memory. If a cycle needed more than one chunk they are merged into one on reset(), so a
+// steady workload settles on a single chunk and stops touching the upstream heap.
+class wmi_snapshot_arena : public std::pmr::memory_resource
+{
+public:
+
+    explicit wmi_snapshot_arena(const std::size_t initial_size = 16 * 1024) : next_size_(std::max<std::size_t>(initial_size, 256))
+    {
+    }
+
+    wmi_snapshot_arena(const wmi_snapshot_arena&) = delete;
+    wmi_snapshot_arena& operator=(const wmi_snapshot_arena&) = delete;
+
+    // Everything allocated from the arena must be dead.
+    void reset()
+    {
+        if (chunks_.size() > 1)
+        {
+            std::size_t total = 0;
+
+            for (auto& chunk : chunks_)
+                total += chunk.size;
+
+            chunks_.clear();
+            add_chunk(total);
+        }
+
+        current_ = 0;
+        offset_ = 0;
+    }
+
+    // number of chunks requested from the upstream heap so far
+    [[nodiscard]] std::uint64_t upstream_allocations() const
+    {
+        return upstream_allocations_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::size_t capacity() const
+    {
+        std::size_t total = 0;
+
+        for (auto& chunk : chunks_)
+            total += chunk.size;
+
+        return total;
+    }
+
+private:
+
+    struct chunk
+    {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+
+    void* do_allocate(const std::size_t bytes, const std::size_t alignment) override
+    {
+        while (current_ < chunks_.size())
+        {
+            auto& chunk = chunks_[current_];
+            const auto base = reinterpret_cast<std::uintptr_t>(chunk.data.get());
+            const auto aligned = (base + offset_ + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+
+            if (aligned + bytes <= base + chunk.size)
+            {
+                offset_ = aligned + bytes - base;
+                return reinterpret_cast<void*>(aligned);
+            }
+
+            current_++;
+            offset_ = 0;
+        }
+
+        add_chunk(std::max(next_size_, bytes + alignment));
+        next_size_ *= 2;
+
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+    }
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    void add_chunk(const std::size_t size)
+    {
+        chunks_.push_back({ std::make_unique<unsigned char[]>(size), size });
+        upstream_allocations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<chunk> chunks_;
+    std::size_t current_ = 0;
+    std::size_t offset_ = 0;
+    std::size_t next_size_;
+    std::atomic<std::uint64_t> upstream_allocations_ = 0;
+};
+
+struct wmi_result_storage;
+
+// Decodes the lazy columns of a result, see wmi_capture_options::lazy.
+class wmi_column_source
+{
+public:
+
+    virtual ~wmi_column_source() = default;
+
+    // Fills storage.columns[handle]. Called with the storage's mutex held.
+    virtual void materialize(wmi_result_storage& storage, wmi_var_handle handle) = 0;
+};
+
+// One column of a result. Strings that do not fit a cell go to the column's own arena, so decoding one column never
+// moves the strings of another.
+struct wmi_result_column
+{
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    explicit wmi_result_column(const allocator_type& allocator = {}) : cells(allocator), strings(allocator)
+    {
+    }
+
+    wmi_result_column(const wmi_result_column& other, const allocator_type& allocator)
+        : cells(other.cells, allocator), strings(other.strings, allocator), dictionary(other.dictionary), time(other.time), hash(other.hash), present(other.present), pending(other.pending), hashed(other.hashed)
+    {
+    }
+
+    wmi_result_column(wmi_result_column&& other, const allocator_type& allocator)
+        : cells(std::move(other.cells), allocator), strings(std::move(other.strings), allocator), dictionary(std::move(other.dictionary)), time(other.time), hash(other.hash), present(other.present), pending(other.pending), hashed(other.hashed)
+    {
+    }
+
+    std::pmr::vector<wmi_cell> cells;
+    std::pmr::wstring strings;
+    std::shared_ptr<const wmi_string_dictionary> dictionary; // keeps it alive with the result
+    std::uint64_t time = 0; // get_current_time() when the values were read
+    std::uint64_t hash = 0; // see wmi_cell::hash_rows(), valid once hashed
+    bool present = false;
+    bool pending = false; // lazy column that was not decoded yet
+    bool hashed = false; // hash and the storage's row hashes include this column
+};
+
+// Memory of one result. All containers allocate from the arena.
+struct wmi_result_storage
+{
+    explicit wmi_result_storage(const bool pooled = false) : columns(&arena), row_hashes(&arena), pooled(pooled)
+    {
+    }
+
+    // Drops all data and rewinds the arena. Only call while nothing else references the storage.
+    void recycle()
+    {
+        // everything pointing into the arena has to go before it is rewound. swapping with an empty vector releases
+        // the buffers, move assignment would keep a string's buffer
+        std::pmr::vector<wmi_result_column>(&arena).swap(columns);
+        std::pmr::vector<std::uint64_t>(&arena).swap(row_hashes);
+        source = nullptr;
+        pending.store(0, std::memory_order_relaxed);
+        lazy_rows = 0;
+        arena.reset();
+    }
+
+    // Adds the column if it is not part of the result yet.
+    wmi_result_column& column(const wmi_var_handle handle)
+    {
+        if (handle >= columns.size())
+            columns.resize(handle + 1);
+
+        columns[handle].present = true;
+        return columns[handle];
+    }
+
+    // Decodes handle if it is a pending lazy column.
+    void ensure(const wmi_var_handle handle)
+    {
+        if (pending.load(std::memory_order_acquire) == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (handle < columns.size() && columns[handle].pending)
+            decode(handle);
+    }
+
+    // Decodes every pending column, or drops the ones nobody asked for.
+    void seal(const bool decode_pending)
+    {
+        if (pending.load(std::memory_order_acquire) == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (wmi_var_handle handle = 0; handle < columns.size(); handle++)
+        {
+            if (!columns[handle].pending)
+                continue;
+
+            if (decode_pending)
+            {
+                decode(handle);
+            }
+            else
+            {
+                columns[handle].pending = false;
+                columns[handle].present = false;
+                pending.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        source = nullptr;
+    }
+
+    // Adds the values of a column that was read completely to the row hashes and computes its column hash.
+    void hash_column(const wmi_var_handle handle)
+    {
+        auto& column = columns[handle];
+
+        if (row_hashes.size() < column.cells.size())
+            row_hashes.resize(column.cells.size());
+
+        column.hash = wmi_cell::hash_rows(column.cells.data(), column.cells.size(), column.strings, wmi_hash_mix(handle + 1ull), row_hashes.data());
+        column.hashed = true;
+    }
+
+    // Hashes the present columns that are not hashed yet, lazy ones are hashed when they are decoded.
+    void hash_columns()
+    {
+        for (wmi_var_handle handle = 0; handle < columns.size(); handle++)
+        {
+            if (columns[handle].present && !columns[handle].pending && !columns[handle].hashed)
+                hash_column(handle);
+        }
+    }
+
+    // Forgets all hashes before a column is modified, they are computed again when asked for.
+    void invalidate_hashes()
+    {
+        std::fill(row_hashes.begin(), row_hashes.end(), 0);
+
+        for (auto& column : columns)
+            column.hashed = false;
+    }
+
+    wmi_snapshot_arena arena;
+    std::pmr::vector<wmi_result_column> columns;
+    std::pmr::vector<std::uint64_t> row_hashes; // sums of the salted cell hashes of each row, see hash_column()
+    wmi_column_source* source = nullptr;
+    std::atomic<std::uint32_t> pending = 0;
+    std::size_t lazy_rows = 0; // size of every pending column once decoded
+    std::mutex mutex;
+    bool pooled; // a wmi_snapshot_pool holds one extra reference
+
+private:
+
+    void decode(const wmi_var_handle handle)
+    {
+        source->materialize(*this, handle);
+        hash_column(handle);
+        columns[handle].pending = false;
+        pending.fetch_sub(1, std::memory_order_release);
+    }
+};
+
+// Small pool of result storages. acquire() hands out a storage nobody else references anymore, so once every
+// consumer lets go of old results the same arenas are reused tick after tick.
+class wmi_snapshot_pool
+{
+public:
+
+    explicit wmi_snapshot_pool(const std::size_t max_pooled = 4) : max_pooled_(max_pooled)
+    {
+    }
+
+    [[nodiscard]] std::shared_ptr<wmi_result_storage> acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto& entry : entries_)
+        {
+            if (entry.use_count() == 1)
+            {
+                // pairs with the release of the last outside reference
+                std::atomic_thread_fence(std::memory_order_acquire);
+                entry->recycle();
+                return entry;
+            }
+        }
+
+        created_++;
+
+        // everything is still referenced, results outlive the pool's budget
+        if (entries_.size() >= max_pooled_)
+            return std::make_shared<wmi_result_storage>();
+
+        entries_.push_back(std::make_shared<wmi_result_storage>(true));
+        return entries_.back();
+    }
+
+    // Storages created plus chunks the pooled arenas requested from the heap. Stays constant once sampling is warm.
+    [[nodiscard]] std::uint64_t upstream_allocations() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto total = created_;
+
+        for (auto& entry : entries_)
+            total += entry->arena.upstream_allocations();
+
+        return total;
+    }
+
+private:
+
+    std::vector<std::shared_ptr<wmi_result_storage>> entries_;
+    std::size_t max_pooled_;
+    std::uint64_t created_ = 0;
+    mutable std::mutex mutex_;
+};
+
+// Columns of a result indexed directly by wmi_var_handle. Keeps the lookup interface of the std::map it replaced
+// (count(), at(), operator[]) but every lookup is an array index. Cells are wmi_cell, strings that do not fit a cell
+// live in an arena per column.
+//
+// Copies share their storage (a reference count, no allocation) and the first mutation of a shared result copies it,
+// so results still behave like values. Lazy columns are decoded by the first at() or operator[] that asks for them.
+template<std::size_t AnySize>
+class wmi_result_columns
+{
+public:
+
+    using column_type = wmi_column_view<AnySize>;
+
+    wmi_result_columns() = default;
+
+    explicit wmi_result_columns(std::shared_ptr<wmi_result_storage> storage) : storage_(std::move(storage))
+    {
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        if (!storage_)
+            return true;
+
+        return std::none_of(storage_->columns.begin(), storage_->columns.end(), [](const wmi_result_column& column) { return column.present; });
+    }
+
+    // 1 if the column of handle is part of the result
+    [[nodiscard]] std::size_t count(const wmi_var_handle handle) const
+    {
+        return storage_ && handle < storage_->columns.size() && storage_->columns[handle].present;
+    }
+
+    [[nodiscard]] column_type at(const wmi_var_handle handle) const
+    {
+        if (!count(handle))
+            throw std::out_of_range("wmi_result_columns::at() called for a handle that is not part of the result.");
+
+        return (*this)[handle];
+    }
+
+    // unchecked, handle must be part of the result
+    [[nodiscard]] column_type operator[](const wmi_var_handle handle) const
+    {
+        storage_->ensure(handle);
+
+        const auto& column = storage_->columns[handle];
+        return { column.cells.data(), column.cells.size(), column.strings, column.dictionary.get() };
+    }
+
+    // Number of rows of a column without decoding it if it is lazy.
+    [[nodiscard]] std::size_t column_size(const wmi_var_handle handle) const
+    {
+        const auto& column = storage_->columns[handle];
+        return column.pending ? storage_->lazy_rows : column.cells.size();
+    }
+
+    // get_current_time() when the values of a column were read. Older than the result's time for columns carried over
+    // from an earlier tick (wmi_capture_options::read_every).
+    [[nodiscard]] std::uint64_t column_time(const wmi_var_handle handle) const
+    {
+        return storage_->columns[handle].time;
+    }
+
+    // one past the highest handle a column may exist for, iterate handles [0, handle_count()) and check count()
+    [[nodiscard]] wmi_var_handle handle_count() const
+    {
+        return storage_ ? static_cast<wmi_var_handle>(storage_->columns.size()) : 0;
+    }
+
+    // Mutable column, adds it if it is not part of the result yet.
+    wmi_result_column& column(const wmi_var_handle handle)
+    {
+        auto& storage = mutable_storage();
+
+        if (handle < storage.columns.size() && storage.columns[handle].hashed)
+            storage.invalidate_hashes();
+
+        return storage.column(handle);
+    }
+
+    // Computes the hashes of the columns read so far, see column_hash() and row_hash().
+    void hash_columns()
+    {
+        if (storage_)
+            storage_->hash_columns();
+    }
+
+    std::pmr::vector<wmi_cell>& cells(const wmi_var_handle handle)
+    {
+        return column(handle).cells;
+    }
+
+    [[nodiscard]] wmi_cell make_string(const wmi_var_handle handle, const CIMTYPE type, const std::wstring_view value)
+    {
+        return wmi_cell::string(type, value, column(handle).strings);
+    }
+
+    // Makes handle a dictionary encoded column, its code cells refer to dictionary.
+    void set_dictionary(const wmi_var_handle handle, std::shared_ptr<const wmi_string_dictionary> dictionary)
+    {
+        auto& storage = mutable_storage();
+
+        if (handle >= storage.columns.size())
+            storage.columns.resize(handle + 1);
+
+        storage.columns[handle].dictionary = std::move(dictionary);
+    }
+
+    // true if other has the column of handle with the same values in the same rows.
+    [[nodiscard]] bool same_values(const wmi_var_handle handle, const wmi_result_columns& other) const
+    {
+        if (!count(handle) || !other.count(handle))
+            return false;
+
+        const auto column = (*this)[handle];
+        const auto other_column = other[handle];
+
+        if (column.size() != other_column.size())
+            return false;
+
+        for (std::size_t row = 0; row < column.size(); row++)
+        {
+            if (!column.value_equals(row, other_column, row))
+                return false;
+        }
+
+        return true;
+    }
+
+    // Copies the column of handle from other, with its time. Returns false if other does not have it.
+    bool carry(const wmi_var_handle handle, const wmi_result_columns& other)
+    {
+        if (!other.count(handle))
+            return false;
+
+        other.storage_->ensure(handle);
+
+        const auto& source = other.storage_->columns[handle];
+        auto& target = column(handle);
+
+        target.cells.assign(source.cells.begin(), source.cells.end());
+        target.strings.assign(source.strings);
+        target.dictionary = source.dictionary;
+        target.time = source.time;
+
+        return true;
+    }
+
+    // Adds handle as a lazy column of rows rows that source decodes on first access.
+    void defer(const wmi_var_handle handle, wmi_column_source& source, const std::size_t rows)
+    {
+        auto& storage = mutable_storage();
+        auto& column = storage.column(handle);
+
+        if (!column.pending)
+        {
+            column.pending = true;
+            storage.pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        storage.source = &source;
+        storage.lazy_rows = rows;
+    }
+
+    // Ends lazy decoding, see wmi_result_storage::seal().
+    void seal(const bool decode_pending)
+    {
+        if (storage_)
+            storage_->seal(decode_pending);
+    }
+
+    // Number of wmi_result_columns sharing the storage, this one included.
+    [[nodiscard]] long references() const
+    {
+        return storage_ ? storage_.use_count() - (storage_->pooled ? 1 : 0) : 0;
+    }
+
+    // Hash of the values of a column in row order, computed while the values were read. Equal columns of two results
+    // have the same hash, so comparing hashes first skips comparing cells and strings of unchanged columns.
+    [[nodiscard]] std::uint64_t column_hash(const wmi_var_handle handle) const
+    {
+        storage_->ensure(handle);
+
+        // only a result modified after it was read has columns left to hash, and it is not shared
+        if (!storage_->columns[handle].hashed)
+            storage_->hash_column(handle);
+
+        return storage_->columns[handle].hash;
+    }
+
+    // Hash of the values of all columns in a row, equal rows (in this or another result of the same captured vars)
+    // have the same hash. Decodes lazy columns.
+    [[nodiscard]] std::uint64_t row_hash(const std::size_t row) const
+    {
+        hash_all();
+        return row < storage_->row_hashes.size() ? wmi_hash_mix(storage_->row_hashes[row]) : 0;
+    }
+
+    // Hash of the values of all columns, equal for results with the same content regardless of when they were read.
+    // Decodes lazy columns.
+    [[nodiscard]] std::uint64_t content_hash() const
+    {
+        std::uint64_t hash = 0;
+
+        if (!storage_)
+            return hash;
+
+        hash_all();
+
+        for (wmi_var_handle handle = 0; handle < handle_count(); handle++)
+        {
+            if (count(handle))
+                hash = wmi_hash_mix(hash ^ storage_->columns[handle].hash ^ (static_cast<std::uint64_t>(handle) << 32));
+        }
+
+        return hash;
+    }
+
+    // Memory retained by the result's arena.
+    [[nodiscard]] std::size_t capacity() const
+    {
+        return storage_ ? storage_->arena.capacity() : 0;
+    }
+
+    void clear()
+    {
+        if (storage_ && unique())
+            storage_->recycle();
+        else
+            storage_.reset();
+    }
+
+private:
+
+    [[nodiscard]] bool unique() const
+    {
+        return references() <= 1;
+    }
+
+    void hash_all() const
+    {
+        for (wmi_var_handle handle = 0; handle < handle_count(); handle++)
+        {
+            if (count(handle))
+                storage_->ensure(handle);
+        }
+
+        storage_->hash_columns();
+    }
+
+    wmi_result_storage& mutable_storage()
+    {
+        if (!storage_)
+        {
+            storage_ = std::make_shared<wmi_result_storage>();
+        }
+        else if (!unique())
+        {
+            storage_->seal(true);
+
+            auto copy = std::make_shared<wmi_result_storage>();
+            copy->columns.reserve(storage_->columns.size());
+
+            for (auto& column : storage_->columns)
+                copy->columns.push_back(column);
+
+            copy->row_hashes.assign(storage_->row_hashes.begin(), storage_->row_hashes.end());
+
+            storage_ = std::move(copy);
+        }
+
+        return *storage_;
+    }
+
+    std::shared_ptr<wmi_result_storage> storage_;
+};
+
+template<std::size_t AnySize>
+using wmi_wrapper_result_map = wmi_result_columns<AnySize>;
+
+template<std::size_t AnySize>
+struct wmi_wrapper_class_result
+{
+    wmi_wrapper_result_map<AnySize> result;
+    wmi_wrapper_result_map<AnySize> prev_result;
+    std::uint64_t time = 0; // get_current_time() when result was sampled
+    std::uint64_t prev_time = 0; // same for prev_result, 0 if there is none
+};
+
+using wmi_wrapper_32_class_result = wmi_wrapper_class_result<32>;
+
+template<std::size_t AnySize>
+using wmi_helper_callback = std::function<void(const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>&)>;
+
+template<std::size_t AnySize>
+using wmi_wrapper_vector_result = std::vector<wmi_wrapper_class_result<AnySize>>;
+
+class wmi_com_backend;
+
+template<typename Backend, typename = void>
+struct wmi_backend_has_wait : std::false_type
+{
+};
+
+template<typename Backend>
+struct wmi_backend_has_wait<Backend, std::void_t<decltype(std::declval<Backend&>().wait(std::chrono::milliseconds()))>> : std::true_type
+{
+};
+
+// Pause between two ticks. Backends with a wait(interval) member pace the query themselves, e.g. to replay a recording
+// at its own timing or as fast as possible; everything else sleeps for interval.
+template<typename Backend>
+void wmi_backend_wait(Backend& backend, const std::chrono::milliseconds interval)
+{
+    if constexpr (wmi_backend_has_wait<Backend>::value)
+        backend.wait(interval);
+    else
+        std::this_thread::sleep_for(interval);
+}
+
+template<typename Backend, typename = void>
+struct wmi_backend_has_finished : std::false_type
+{
+};
+
+template<typename Backend>
+struct wmi_backend_has_finished<Backend, std::void_t<decltype(bool(std::declval<const Backend&>().finished()))>> : std::true_type
+{
+};
+
+// Whether a backend has nothing left to sample, e.g. a replayed recording past its last tick. Queries end once it
+// has, whatever their fire_count and fire_time. Backends without a finished() member never are.
+template<typename Backend>
+bool wmi_backend_finished(const Backend& backend)
+{
+    if constexpr (wmi_backend_has_finished<Backend>::value)
+        return backend.finished();
+    else
+        return false;
+}
+
+#ifdef _WIN32
+// Reads instances through a WMI hi-perf refresher. This is the default backend of wmi_helper.
+//
+// A backend has to provide:
+//   void init(wmi_helper_config config)      connect, throws on failure
+//   void cleanup()                            release everything init acquired
+//   std::uint32_t refresh()                   refresh and fetch the current instances, returns how many there are
+//   bool property_handle(name, type, handle)  resolve a property, false if the class has no such property
+//   bool read(row, handle, size, read_bytes, buffer)
+//                                             IWbemObjectAccess::ReadPropertyValue semantics: false with read_bytes set
+//                                             to the required size if buffer is too small
+//   void release()                            release the instances fetched by the last refresh
+//
+// and may provide
+//   void wait(std::chrono::milliseconds)      called between ticks instead of sleeping, see wmi_backend_wait()
+//   bool finished() const                     true once there is nothing left to sample, see wmi_backend_finished()
+class wmi_com_backend
+{
+public:
+
+    wmi_com_backend() = default;
+    wmi_com_backend(const wmi_com_backend&) = delete;
+    wmi_com_backend& operator=(const wmi_com_backend&) = delete;
+
+    void init(wmi_helper_config config)
+    {
+        unsigned long hr = S_OK;
+        long    l_id_ = 0;
+
+        if (FAILED(hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("CoInitializeEx failed with error code {0:#x}.", hr));
+        }
+
+        if (FAILED(hr = CoInitializeSecurity(
+            nullptr,
+            -1,
+            nullptr,
+            nullptr,
+            RPC_C_AUTHN_LEVEL_NONE,
+            RPC_C_IMP_LEVEL_IMPERSONATE,
+            NULL, EOAC_NONE, nullptr)))
+        {
+            if (static_cast<HRESULT>(hr) != RPC_E_TOO_LATE) {
+                cleanup();
+                throw std::runtime_error(fmt::format("CoInitializeSecurity failed with error code {0:#x}.", hr));
+            }
+        }
+
+        if (FAILED(hr = CoCreateInstance(
+            CLSID_WbemLocator,
+            NULL,
+            CLSCTX_INPROC_SERVER,
+            IID_IWbemLocator,
+            reinterpret_cast<void**>(&p_wbem_locator_))))
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("CoCreateInstance failed with error code {0:#x}.", hr));
+        }
+
+        // Connect to the desired namespace.
+        bstr_name_space_ = SysAllocString(config.server().c_str());
+    	
+        if (nullptr == bstr_name_space_)
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("SysAllocString failed."));
+        }
+
+        BSTR username = nullptr;
+
+        if (!config.username().empty())
+            username = SysAllocString(config.username().c_str());
+
+        BSTR password = nullptr;
+
+        if (!config.password().empty())
+            password = SysAllocString(config.password().c_str());
+    	
+        if (FAILED(hr = p_wbem_locator_->ConnectServer(
+            bstr_name_space_,
+            username, // User name
+            password, // Password
+            NULL, // Locale
+            0L,   // Security flags
+            NULL, // Authority
+            NULL, // Wbem context
+            &p_name_space_)))
+        {
+
+            cleanup();
+            throw std::runtime_error(fmt::format("ConnectServer failed with error code {0:#x}.", hr));
+        }
+
+        p_wbem_locator_->Release();
+        p_wbem_locator_ = nullptr;
+        SysFreeString(bstr_name_space_);
+        bstr_name_space_ = nullptr;
+
+    	if(username)
+    	{
+            SysFreeString(username);
+            username = nullptr;
+    	}
+
+    	if(password)
+    	{
+            SysFreeString(password);
+            password = nullptr;
+    	}
+             
+        if (FAILED(hr = CoCreateInstance(
+            CLSID_WbemRefresher,
+            NULL,
+            CLSCTX_INPROC_SERVER,
+            IID_IWbemRefresher,
+            reinterpret_cast<void**>(&p_refresher_))))
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("CoCreateInstance failed with error code {0:#x}.", hr));
+        }
+
+        if (FAILED(hr = p_refresher_->QueryInterface(
+            IID_IWbemConfigureRefresher,
+            reinterpret_cast<void**>(&p_config_))))
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("QueryInterface failed with error code {0:#x}.", hr));
+        }
+
+        // Add an enumerator to the refresher.
+        if (FAILED(hr = p_config_->AddEnum(
+            p_name_space_,
+            config.class_name().c_str(),
+            0,
+            NULL,
+            &p_enum_,
+            &l_id_)))
+        {
+            cleanup();
+            throw std::runtime_error(fmt::format("AddEnum failed with error code {0:#x}.", hr));
+        }
+
+        p_config_->Release();
+        p_config_ = nullptr;
+    }
+
+    void cleanup()
+    {
+        if (p_wbem_locator_) {
+            p_wbem_locator_->Release();
+            p_wbem_locator_ = nullptr;
+        }
+
+        if (p_name_space_)
+        {
+            p_name_space_->Release();
+            p_name_space_ = nullptr;
+        }
+
+        if (bstr_name_space_) {
+            SysFreeString(bstr_name_space_);
+            bstr_name_space_ = nullptr;
+        }
+
+        if (p_refresher_)
+        {
+            p_refresher_->Release();
+            p_refresher_ = nullptr;
+        }
+
+        if (p_config_)
+        {
+            p_config_->Release();
+            p_config_ = nullptr;
+        }
+
+        if (p_enum_)
+        {
+            p_enum_->Release();
+            p_enum_ = nullptr;
+        }
+
+        if (ap_enum_access_)
+        {
+            release();
+            delete[] ap_enum_access_;
+            ap_enum_access_ = nullptr;
+            ap_enum_access_length_ = 0;
+        }
+
+        CoUninitialize();
+    }
+
+    std::uint32_t refresh()
+    {
+        HRESULT hr = S_OK;
+        ULONG dw_num_returned;
+
+        if (FAILED(hr = p_refresher_->Refresh(0L)))
+        {
+            return 0;
+        }
+
+        if (ap_enum_access_length_ > 0)
+        {
+            SecureZeroMemory(ap_enum_access_,
+                ap_enum_access_length_ * sizeof(IWbemObjectAccess*));
+        }
+
+        hr = p_enum_->GetObjects(0L,
+            ap_enum_access_length_,
+            ap_enum_access_,
+            &dw_num_returned);
+        // If the buffer was not big enough,
+        // allocate a bigger buffer and retry.
+        if (hr == WBEM_E_BUFFER_TOO_SMALL
+            && dw_num_returned > ap_enum_access_length_)
+        {
+            delete[] ap_enum_access_;
+            ap_enum_access_ = new IWbemObjectAccess * [dw_num_returned];
+            if (nullptr == ap_enum_access_)
+            {
+                hr = E_OUTOFMEMORY;
+                return 0;
+            }
+
+            SecureZeroMemory(ap_enum_access_,
+                dw_num_returned * sizeof(IWbemObjectAccess*));
+            ap_enum_access_length_ = dw_num_returned;
+
+            if (FAILED(hr = p_enum_->GetObjects(0L,
+                ap_enum_access_length_,
+                ap_enum_access_,
+                &dw_num_returned)))
+            {
+                return 0;
+            }
+        }
+        else if (FAILED(hr))
+        {
+            return 0;
+        }
+
+        num_returned_ = dw_num_returned;
+        return dw_num_returned;
+    }
+
+    bool property_handle(const std::wstring& name, CIMTYPE& type, long& handle) const
+    {
+        if (num_returned_ == 0 || !ap_enum_access_ || !ap_enum_access_[0])
+            return false;
+
+        return SUCCEEDED(ap_enum_access_[0]->GetPropertyHandle(name.c_str(), &type, &handle));
+    }
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer) const
+    {
+        return SUCCEEDED(ap_enum_access_[row]->ReadPropertyValue(handle, size, &read_bytes, static_cast<byte*>(buffer)));
+    }
+
+    void release()
+    {
+        for (ULONG i = 0; i < num_returned_; i++) {
+            if (ap_enum_access_[i])
+            {
+                ap_enum_access_[i]->Release();
+                ap_enum_access_[i] = nullptr;
+            }
+        }
+
+        num_returned_ = 0;
+    }
+
+private:
+
+    // Used by init method
+    IWbemConfigureRefresher* p_config_ = nullptr;
+    IWbemServices* p_name_space_ = nullptr;
+    IWbemLocator* p_wbem_locator_ = nullptr;
+    BSTR bstr_name_space_ = nullptr;
+
+    // Used by refresh method
+    IWbemObjectAccess** ap_enum_access_ = nullptr;
+    DWORD ap_enum_access_length_ = 0;
+    ULONG num_returned_ = 0;
+    IWbemHiPerfEnum* p_enum_ = nullptr;
+    IWbemRefresher* p_refresher_ = nullptr;
+};
+#endif
 
-template<std::size_t MaxSize = 32>
-struct wmi_any
+// In memory backend for tests and benchmarks. Properties are declared with add_property(), rows are filled with set()
+// and on_refresh() can change values between ticks. Builds on any platform.
+class wmi_fake_backend
 {
-    CIMTYPE type;
-    char reserved[MaxSize];
-    std::wstring str;
+public:
 
-	template<typename T>
-    [[nodiscard]] T data() const
+    void init(const wmi_helper_config& config)
     {
-	    // ReSharper disable once CppCStyleCast
-	    return (T)(reserved);
+        class_name_ = config.class_name();
     }
 
-    template<typename T>
-    [[nodiscard]] T& get() const
+    void cleanup()
     {
-        static_assert(sizeof(T) <= MaxSize, "sizeof(T) too large to fit in WmiAny buffer. Please increase MaxSize template to fix this issue.");
-        return *reinterpret_cast<T*>(data<void*>());
     }
 
-    [[nodiscard]] std::wstring get_wide_string() const
+    void add_property(const std::wstring& name, const CIMTYPE type)
     {
-        return str;
-    }
+        if (wmi_cim_type_size(type) == 0 && !wmi_is_string_type(type))
+            throw std::invalid_argument("wmi_fake_backend only supports scalar numeric and string properties.");
 
-    [[nodiscard]] std::string get_string() const
-    {
-        return std::string(str.begin(), str.end());
+        properties_.push_back({ name, type, {}, {} });
+        properties_.back().values.resize(rows_);
+        properties_.back().strings.resize(rows_);
     }
 
-};
+    void resize(const std::size_t rows)
+    {
+        rows_ = rows;
 
+        for (auto& property : properties_)
+        {
+            property.values.resize(rows);
+            property.strings.resize(rows);
+        }
+    }
 
+    [[nodiscard]] std::size_t rows() const
+    {
+        return rows_;
+    }
 
-class wmi_helper_config
-{
-public:
-	
-    wmi_helper_config(std::wstring class_name, std::int32_t fire_count = infinite, std::int32_t fire_time = infinite, std::int32_t updates_per_second = 2) : class_name_(std::move(class_name)), fire_count_(fire_count), fire_time_(fire_time), updates_per_second_(updates_per_second)
+    template<typename T>
+    void set(const std::size_t row, const std::wstring& name, const T value)
     {
+        static_assert(std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint64_t), "wmi_fake_backend::set() takes numbers or strings.");
 
+        auto& property = find(name);
+        property.values.at(row) = 0;
+        std::memcpy(&property.values[row], &value, std::min(sizeof(T), wmi_cim_type_size(property.type)));
     }
 
-    wmi_helper_config() = default;
+    void set(const std::size_t row, const std::wstring& name, std::wstring value)
+    {
+        find(name).strings.at(row) = std::move(value);
+    }
 
-    [[nodiscard]] std::wstring& server()
+    void set(const std::size_t row, const std::wstring& name, const wchar_t* value)
     {
-        return server_;
+        set(row, name, std::wstring(value));
     }
 
-    [[nodiscard]] std::wstring& username()
+    // called at the start of every refresh, e.g. to advance counters
+    void on_refresh(std::function<void(wmi_fake_backend&)> callback)
     {
-        return username_;
+        on_refresh_ = std::move(callback);
     }
 
-    [[nodiscard]] std::wstring& password()
+    // number of read() calls so far
+    [[nodiscard]] std::uint64_t read_count() const
     {
-        return password_;
+        return read_count_;
     }
 
-	
-    [[nodiscard]] const std::wstring& class_name() const
+    std::uint32_t refresh()
     {
-        return class_name_;
+        if (on_refresh_)
+            on_refresh_(*this);
+
+        return static_cast<std::uint32_t>(rows_);
     }
-	
-    [[nodiscard]] const std::int32_t& fire_count() const
+
+    bool property_handle(const std::wstring& name, CIMTYPE& type, long& handle) const
     {
-        return fire_count_;
+        for (std::size_t i = 0; i < properties_.size(); i++)
+        {
+            if (properties_[i].name == name)
+            {
+                type = properties_[i].type;
+                handle = static_cast<long>(i);
+                return true;
+            }
+        }
+
+        return false;
     }
 
-    [[nodiscard]] const std::int32_t& fire_time() const
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer)
     {
-        return fire_time_;
+        read_count_++;
+
+        if (handle < 0 || static_cast<std::size_t>(handle) >= properties_.size() || row >= rows_)
+            return false;
+
+        auto& property = properties_[static_cast<std::size_t>(handle)];
+
+        if (wmi_is_string_type(property.type))
+        {
+            auto& str = property.strings[row];
+            read_bytes = static_cast<long>((str.size() + 1) * sizeof(wchar_t));
+
+            if (size < read_bytes)
+                return false;
+
+            std::memcpy(buffer, str.c_str(), static_cast<std::size_t>(read_bytes));
+            return true;
+        }
+
+        read_bytes = static_cast<long>(wmi_cim_type_size(property.type));
+
+        if (size < read_bytes)
+            return false;
+
+        std::memcpy(buffer, &property.values[row], static_cast<std::size_t>(read_bytes));
+        return true;
     }
 
-    [[nodiscard]] const std::int32_t& updates_per_second() const
+    void release()
     {
-        return updates_per_second_;
     }
 
-    const static std::int32_t infinite = -1;
 private:
-    std::wstring class_name_;
-    std::int32_t fire_count_ = -1; // -1 for infinity
-    std::int32_t fire_time_ = 5000; // -1 for infinity
-    std::int32_t updates_per_second_ = 2; // times wmi is queried per second
 
-    std::wstring server_ = L"\\\\.\\root\\cimv2";
-    std::wstring username_;
-    std::wstring password_;
+    struct property
+    {
+        std::wstring name;
+        CIMTYPE type;
+        std::vector<std::uint64_t> values;
+        std::vector<std::wstring> strings;
+    };
 
-};
+    property& find(const std::wstring& name)
+    {
+        for (auto& property : properties_)
+        {
+            if (property.name == name)
+                return property;
+        }
 
-using wmi_var_handle = std::uint64_t;
+        throw std::invalid_argument("wmi_fake_backend::set() called for a property that was never added.");
+    }
 
-template<std::size_t AnySize>
-using wmi_wrapper_result_map = std::map< wmi_var_handle, std::vector<wmi_any<AnySize>>>;
+    std::wstring class_name_;
+    std::vector<property> properties_;
+    std::size_t rows_ = 0;
+    std::uint64_t read_count_ = 0;
+    std::function<void(wmi_fake_backend&)> on_refresh_;
+};
 
-template<std::size_t AnySize>
-struct wmi_wrapper_class_result
+// What ticks deliver while wmi_helper::cache_results() is on and the content did not change.
+enum class wmi_cache_delivery
 {
-    wmi_wrapper_result_map<AnySize> result;
-    wmi_wrapper_result_map<AnySize> prev_result;
+    changes, // nothing, a result is only delivered when its content changed
+    every_tick // the cached result, with the time it was sampled at
 };
 
-using wmi_wrapper_32_class_result = wmi_wrapper_class_result<32>;
-
-template<std::size_t AnySize>
-using wmi_helper_callback = std::function<void(const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>&)>;
-
-template<std::size_t AnySize>
-using wmi_wrapper_vector_result = std::vector<wmi_wrapper_class_result<AnySize>>;
-
-template<std::size_t AnySize>
+template<std::size_t AnySize, typename Backend = wmi_com_backend>
 class wmi_helper
 {
 public:
@@ -151,128 +2471,10 @@ public:
 
     void init(const wmi_helper_config& config)
     {
-        unsigned long hr = S_OK;
-        long    l_id_ = 0;
-
         config_ = config;
 
-        if (FAILED(hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED)))
-        {
-            cleanup();
-            throw std::exception(fmt::format("CoInitializeEx failed with error code {0:#x}.", hr).c_str());
-        }
-
-        if (FAILED(hr = CoInitializeSecurity(
-            nullptr,
-            -1,
-            nullptr,
-            nullptr,
-            RPC_C_AUTHN_LEVEL_NONE,
-            RPC_C_IMP_LEVEL_IMPERSONATE,
-            NULL, EOAC_NONE, nullptr)))
-        {
-            if (static_cast<HRESULT>(hr) != RPC_E_TOO_LATE) {
-                cleanup();
-                throw std::exception(fmt::format("CoInitializeSecurity failed with error code {0:#x}.", hr).c_str());
-            }
-        }
-
-        if (FAILED(hr = CoCreateInstance(
-            CLSID_WbemLocator,
-            NULL,
-            CLSCTX_INPROC_SERVER,
-            IID_IWbemLocator,
-            reinterpret_cast<void**>(&p_wbem_locator_))))
-        {
-            cleanup();
-            throw std::exception(fmt::format("CoCreateInstance failed with error code {0:#x}.", hr).c_str());
-        }
-
-        // Connect to the desired namespace.
-        bstr_name_space_ = SysAllocString(config_.server().c_str());
-    	
-        if (nullptr == bstr_name_space_)
-        {
-            cleanup();
-            throw std::exception(fmt::format("SysAllocString failed.").c_str());
-        }
-
-        BSTR username = nullptr;
-
-        if (!config_.username().empty())
-            username = SysAllocString(config_.username().c_str());
-
-        BSTR password = nullptr;
-
-        if (!config_.password().empty())
-            password = SysAllocString(config_.password().c_str());
-    	
-        if (FAILED(hr = p_wbem_locator_->ConnectServer(
-            bstr_name_space_,
-            username, // User name
-            password, // Password
-            NULL, // Locale
-            0L,   // Security flags
-            NULL, // Authority
-            NULL, // Wbem context
-            &p_name_space_)))
-        {
-
-            cleanup();
-            throw std::exception(fmt::format("ConnectServer failed with error code {0:#x}.", hr).c_str());
-        }
-
-        p_wbem_locator_->Release();
-        p_wbem_locator_ = nullptr;
-        SysFreeString(bstr_name_space_);
-        bstr_name_space_ = nullptr;
-
-    	if(username)
-    	{
-            SysFreeString(username);
-            username = nullptr;
-    	}
-
-    	if(password)
-    	{
-            SysFreeString(password);
-            password = nullptr;
-    	}
-             
-        if (FAILED(hr = CoCreateInstance(
-            CLSID_WbemRefresher,
-            NULL,
-            CLSCTX_INPROC_SERVER,
-            IID_IWbemRefresher,
-            reinterpret_cast<void**>(&p_refresher_))))
-        {
-            cleanup();
-            throw std::exception(fmt::format("CoCreateInstance failed with error code {0:#x}.", hr).c_str());
-        }
-
-        if (FAILED(hr = p_refresher_->QueryInterface(
-            IID_IWbemConfigureRefresher,
-            reinterpret_cast<void**>(&p_config_))))
-        {
-            cleanup();
-            throw std::exception(fmt::format("QueryInterface failed with error code {0:#x}.", hr).c_str());
-        }
-
-        // Add an enumerator to the refresher.
-        if (FAILED(hr = p_config_->AddEnum(
-            p_name_space_,
-            config_.class_name().c_str(),
-            0,
-            NULL,
-            &p_enum_,
-            &l_id_)))
-        {
-            cleanup();
-            throw std::exception(fmt::format("AddEnum failed with error code {0:#x}.", hr).c_str());
-        }
-
-        p_config_->Release();
-        p_config_ = nullptr;
+        backend_.init(config_);
+        invalidate_cache();
     }
 
     void stop_query()
@@ -296,121 +2498,164 @@ public:
     	// TODO: better thread termination signal system
         stop_query();
 
+        backend_.cleanup();
+    }
 
-        if (p_wbem_locator_) {
-            p_wbem_locator_->Release();
-            p_wbem_locator_ = nullptr;
-        }
-
-        if (p_name_space_)
+    // Returns the handle of var_name, capturing it if it was not captured yet. Handles index the columns of results.
+    // Capturing a var again returns its handle and replaces its options.
+    wmi_var_handle capture_var(const std::wstring& var_name, const wmi_capture_options& options = {})
+    {
+        if (const auto existing = find_var(var_name))
         {
-            p_name_space_->Release();
-            p_name_space_ = nullptr;
+            set_options(bound_vars_[*existing], options);
+            invalidate_cache();
+            return *existing;
         }
 
-        if (bstr_name_space_) {
-            SysFreeString(bstr_name_space_);
-            bstr_name_space_ = nullptr;
-        }
+        const auto handle = static_cast<wmi_var_handle>(bound_vars_.size());
 
-        if (p_refresher_)
-        {
-            p_refresher_->Release();
-            p_refresher_ = nullptr;
-        }
+        bound_vars_.push_back({ var_name, {}, nullptr });
+        set_options(bound_vars_.back(), options);
+        var_handles_.emplace(wmi_name_hash(var_name), handle);
+        invalidate_cache();
 
-        if (p_config_)
+        return handle;
+    }
+
+    // Handle of a var captured earlier, e.g. helper.handle_of<wmi_name_hash(L"Speed")>(). Throws std::out_of_range if
+    // no or more than one captured name has the hash, use handle_of(name) then.
+    template<std::uint64_t NameHash>
+    [[nodiscard]] wmi_var_handle handle_of() const
+    {
+        return handle_of_hash(NameHash);
+    }
+
+    [[nodiscard]] wmi_var_handle handle_of(const std::wstring_view var_name) const
+    {
+        const auto handle = find_var(var_name);
+
+        if (!handle)
+            throw std::out_of_range("wmi_helper::handle_of() called for a var that was never captured.");
+
+        return *handle;
+    }
+
+    // Handle of var_name if it was captured, std::nullopt otherwise.
+    [[nodiscard]] std::optional<wmi_var_handle> find_var(const std::wstring_view var_name) const
+    {
+        // different names can share a hash, the name decides
+        const auto [first, last] = var_handles_.equal_range(wmi_name_hash(var_name));
+
+        for (auto it = first; it != last; ++it)
         {
-            p_config_->Release();
-            p_config_ = nullptr;
+            if (wmi_name_equals(bound_vars_[it->second].name, var_name))
+                return it->second;
         }
 
-        if (p_enum_)
-        {
-            p_enum_->Release();
-            p_enum_ = nullptr;
-        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] const std::wstring& var_name(const wmi_var_handle handle) const
+    {
+        return bound_vars_.at(handle).name;
+    }
+
+    [[nodiscard]] const wmi_capture_options& var_options(const wmi_var_handle handle) const
+    {
+        return bound_vars_.at(handle).options;
+    }
+
+    [[nodiscard]] std::size_t var_count() const
+    {
+        return bound_vars_.size();
+    }
 
-        if (ap_enum_access_)
+    // Only rows matching every filter are returned. Filter columns are read first and the remaining captured vars are
+    // only read for rows that survive, which saves most property reads on large classes like per-process counters.
+    void filter(const wmi_predicate& predicate)
+    {
+        if (predicate.handle >= bound_vars_.size())
         {
-            delete[] ap_enum_access_;
-            ap_enum_access_ = nullptr;
+            throw std::runtime_error("wmi_helper::filter() requires the predicate handle to be returned by capture_var()!");
         }
 
-        CoUninitialize();
+        filters_.push_back(predicate);
+        invalidate_cache();
+    }
+
+    void clear_filters()
+    {
+        filters_.clear();
+        invalidate_cache();
     }
 
-    wmi_var_handle capture_var(const std::wstring& var_name)
+    // Caches the results of classes that rarely change, e.g. Win32_PhysicalMemory or Win32_BIOS. Ticks do not refresh
+    // while the cached result is younger than ttl_milliseconds. Then the class is sampled again and the cache is only
+    // replaced (and a new result published) if the content hash of the sample differs; otherwise the cached result
+    // stays valid for another ttl. delivery decides whether ticks that did not produce a new result deliver the cached
+    // one again; they count towards fire_count and are paced either way. 0 turns caching off. Lazy columns are always
+    // decoded when caching.
+    void cache_results(const std::uint64_t ttl_milliseconds, const wmi_cache_delivery delivery = wmi_cache_delivery::changes)
     {
-        const auto var_hash = std::hash<std::wstring>{}(var_name);
+        const std::lock_guard<std::mutex> lock(cache_mutex_);
 
-        bound_vars_[var_hash] = var_name;
+        cache_ttl_ = ttl_milliseconds;
+        cache_delivery_ = delivery;
 
-        return var_hash;
+        if (cache_ttl_ == 0)
+            cache_ = {};
     }
 
-    std::uint32_t refresh_data()
+    // The last result published while caching, regardless of its age.
+    [[nodiscard]] std::optional<wmi_wrapper_class_result<AnySize>> cached_result() const
     {
-        HRESULT hr = S_OK;
-        ULONG dw_num_returned;
+        const std::lock_guard<std::mutex> lock(cache_mutex_);
 
-        if (FAILED(hr = p_refresher_->Refresh(0L)))
-        {
-            return 0;
-        }
+        if (!cache_.valid)
+            return std::nullopt;
 
-        if (ap_enum_access_length_ > 0)
-        {
-            SecureZeroMemory(ap_enum_access_,
-                ap_enum_access_length_ * sizeof(IWbemObjectAccess*));
-        }
+        return cache_.result;
+    }
 
-        hr = p_enum_->GetObjects(0L,
-            ap_enum_access_length_,
-            ap_enum_access_,
-            &dw_num_returned);
-        // If the buffer was not big enough,
-        // allocate a bigger buffer and retry.
-        if (hr == WBEM_E_BUFFER_TOO_SMALL
-            && dw_num_returned > ap_enum_access_length_)
-        {
-            ap_enum_access_ = new IWbemObjectAccess * [dw_num_returned];
-            if (nullptr == ap_enum_access_)
-            {
-                hr = E_OUTOFMEMORY;
-                return 0;
-            }
+    // Drops the cached result, the next query samples the class.
+    void invalidate_cache()
+    {
+        const std::lock_guard<std::mutex> lock(cache_mutex_);
+        cache_ = {};
+    }
 
-            SecureZeroMemory(ap_enum_access_,
-                dw_num_returned * sizeof(IWbemObjectAccess*));
-            ap_enum_access_length_ = dw_num_returned;
+    std::uint32_t refresh_data()
+    {
+        return backend_.refresh();
+    }
 
-            if (FAILED(hr = p_enum_->GetObjects(0L,
-                ap_enum_access_length_,
-                ap_enum_access_,
-                &dw_num_returned)))
-            {
-                return 0;
-            }
-        }
+    // The backend the helper reads from, e.g. to fill a wmi_fake_backend with test data.
+    [[nodiscard]] Backend& backend()
+    {
+        return backend_;
+    }
 
-        return dw_num_returned;
+    // Heap allocations made for result memory so far, see wmi_snapshot_pool. Stops growing once sampling is warm and
+    // consumers do not hold on to old results.
+    [[nodiscard]] std::uint64_t snapshot_allocations() const
+    {
+        return snapshots_.upstream_allocations();
     }
-	
+
     wmi_wrapper_vector_result<AnySize> query()
     {
         if(querying_)
         {
-            throw std::exception("Cannot start query while another one is already running!");
+            throw std::runtime_error("Cannot start query while another one is already running!");
         }
     	
         if(config_.fire_count() == wmi_helper_config::infinite
             && config_.fire_time() == wmi_helper_config::infinite)
         {
-            throw std::exception("WmiHelper::query() (non async) cannot be called with an infinite fire_count and fire_time as it would never complete!");
+            throw std::runtime_error("WmiHelper::query() (non async) cannot be called with an infinite fire_count and fire_time as it would never complete!");
         }
     	
-        return query_internal(false, true, nullptr, bound_vars_, config_, get_current_time()).value();
+        return query_internal(false, true, nullptr, bound_vars_, filters_, config_, get_current_time()).value();
     }
 
     std::future<void> query_async(const wmi_helper_callback<AnySize>& callback)
@@ -418,10 +2663,11 @@ public:
         auto current_time = get_current_time();
         auto config = config_;
         auto vars = bound_vars_;
+        auto filters = filters_;
     	
-        return std::async(std::launch::async, [this, callback, current_time, vars, config]()
+        return std::async(std::launch::async, [this, callback, current_time, vars, filters, config]()
         {
-	        query_internal(true, false, callback, vars, config, current_time);
+	        query_internal(true, false, callback, vars, filters, config, current_time);
         });
     }
 
@@ -430,24 +2676,239 @@ public:
         auto current_time = get_current_time();
         auto config = config_;
         auto vars = bound_vars_;
+        auto filters = filters_;
 
-        return std::async(std::launch::async, [this, current_time, vars, config]()
+        return std::async(std::launch::async, [this, current_time, vars, filters, config]()
         {
-			auto opt = query_internal(true, true, nullptr, vars, config, current_time);
+			auto opt = query_internal(true, true, nullptr, vars, filters, config, current_time);
             return opt.value(); // no way to ever have no value
         });
     }
 	
 
 private:
+
+    struct bound_var
+    {
+        std::wstring name;
+        wmi_capture_options options;
+        std::shared_ptr<wmi_string_dictionary> dictionary; // kept across queries, null unless options.dictionary
+    };
+	
+    struct resolved_var
+    {
+        wmi_var_handle var;
+        CIMTYPE type;
+        long handle;
+        wmi_string_dictionary* dictionary;
+    };
+
+    static void set_options(bound_var& var, const wmi_capture_options& options)
+    {
+        if (options.dictionary && (!var.dictionary || var.dictionary->max_entries() != options.max_dictionary_entries))
+            var.dictionary = std::make_shared<wmi_string_dictionary>(options.max_dictionary_entries);
+        else if (!options.dictionary)
+            var.dictionary = nullptr;
+
+        var.options = options;
+    }
+
+    // Decodes lazy columns from the objects of the current refresh.
+    class lazy_reader final : public wmi_column_source
+    {
+    public:
+
+        lazy_reader(wmi_helper& helper, const std::vector<resolved_var>& vars, const std::vector<std::uint32_t>& rows) : helper_(helper), vars_(vars), rows_(rows)
+        {
+        }
+
+        void materialize(wmi_result_storage& storage, const wmi_var_handle handle) override
+        {
+            const auto var = std::find_if(vars_.begin(), vars_.end(), [handle](const resolved_var& v) { return v.var == handle; });
+            auto& column = storage.columns[handle];
+
+            if (var == vars_.end())
+                return;
+
+            column.cells.reserve(rows_.size());
+
+            // failed reads stay empty cells so the column lines up with the rows
+            for (auto row : rows_)
+            {
+                wmi_cell cell;
+                helper_.read_var(row, *var, column.strings, buffer_, cell);
+                column.cells.push_back(cell);
+            }
+        }
+
+    private:
+
+        wmi_helper& helper_;
+        const std::vector<resolved_var>& vars_;
+        const std::vector<std::uint32_t>& rows_;
+        std::wstring buffer_;
+    };
+
+    // Reads one property of one instance into cell, strings that do not fit the cell go to strings, the arena of its
+    // column. buffer is reused between reads. Returns false, leaving cell as it was, if the read failed.
+    bool read_var(const std::uint32_t row, const resolved_var& var, std::pmr::wstring& strings, std::wstring& buffer, wmi_cell& cell)
+    {
+        long read_bytes = 0x0;
+
+        if (wmi_is_string_type(var.type))
+        {
+            buffer.resize(buffer.capacity());
+
+            if (!backend_.read(row, var.handle, static_cast<long>(buffer.size() * sizeof(wchar_t)), read_bytes, buffer.data()))
+            {
+                buffer.resize(static_cast<std::size_t>(read_bytes) / sizeof(wchar_t));
+
+                if (!backend_.read(row, var.handle, read_bytes, read_bytes, buffer.data()))
+                {
+                    return false;
+                }
+            }
+
+            auto length = std::min(buffer.size(), static_cast<std::size_t>(read_bytes) / sizeof(wchar_t));
+
+            // the read includes the null terminator
+            while (length > 0 && buffer[length - 1] == L'\0')
+                length--;
+
+            const std::wstring_view value(buffer.data(), length);
+
+            if (var.dictionary)
+            {
+                if (const auto code = var.dictionary->intern(value))
+                {
+                    cell = wmi_cell::code(var.type, *code);
+                    return true;
+                }
+            }
+
+            cell = wmi_cell::string(var.type, value, strings);
+            return true;
+        }
+
+        std::uint64_t bits = 0;
+
+        if (!backend_.read(row, var.handle, sizeof(bits), read_bytes, &bits))
+            return false;
+
+        cell = wmi_cell::scalar(var.type, &bits, sizeof(bits));
+        return true;
+    }
+
+    // Reads var for every row into its column of results. Failed reads stay empty cells so the column lines up with the
+    // rows.
+    void read_column(const resolved_var& var, const std::vector<std::uint32_t>& rows, wmi_wrapper_result_map<AnySize>& results, std::wstring& buffer)
+    {
+        auto& column = results.column(var.var);
+        column.cells.reserve(rows.size());
+
+        for (auto row : rows)
+        {
+            wmi_cell cell;
+            read_var(row, var, column.strings, buffer, cell);
+            column.cells.push_back(cell);
+        }
+    }
+
+    // Narrows rows down to the instances matching every filter. Each filter column is only read for rows that survived
+    // the filters before it and is stored in results so it does not have to be read again.
+    void apply_filters(const std::vector<wmi_predicate>& filters, const std::vector<resolved_var>& vars, std::vector<std::uint32_t>& rows, wmi_wrapper_result_map<AnySize>& results, std::wstring& buffer, std::vector<char>& mask, std::vector<double>& scratch)
+    {
+        for (std::size_t f = 0; f < filters.size() && !rows.empty(); f++)
+        {
+            const auto handle = filters[f].handle;
+
+            if (results.count(handle))
+                continue; // all predicates on this var were evaluated together
+
+            const auto var = std::find_if(vars.begin(), vars.end(), [handle](const resolved_var& v) { return v.var == handle; });
+
+            if (var == vars.end())
+            {
+                rows.clear();
+                break;
+            }
+
+            auto& column = results.column(handle);
+            mask.assign(rows.size(), 1);
+            column.cells.resize(rows.size());
+
+            for (std::size_t i = 0; i < rows.size(); i++)
+            {
+                if (!read_var(rows[i], *var, column.strings, buffer, column.cells[i]))
+                    mask[i] = 0;
+            }
+
+            for (auto& predicate : filters)
+            {
+                if (predicate.handle == handle)
+                    predicate.evaluate(results[handle], var->type, mask, scratch);
+            }
+
+            std::size_t kept = 0;
+
+            for (std::size_t i = 0; i < rows.size(); i++)
+            {
+                if (!mask[i])
+                    continue;
+
+                rows[kept] = rows[i];
+
+                // earlier filter columns were read for the same rows, keep them aligned
+                for (wmi_var_handle filtered = 0; filtered < results.handle_count(); filtered++)
+                {
+                    if (results.count(filtered))
+                    {
+                        auto& cells = results.cells(filtered);
+                        cells[kept] = cells[i];
+                    }
+                }
+
+                kept++;
+            }
+
+            rows.resize(kept);
+
+            for (wmi_var_handle filtered = 0; filtered < results.handle_count(); filtered++)
+            {
+                if (results.count(filtered))
+                    results.cells(filtered).resize(kept);
+            }
+        }
+    }
 	
-    std::optional<wmi_wrapper_vector_result<AnySize>> query_internal(const bool async, const bool return_data, const wmi_helper_callback<AnySize> callback, const std::unordered_map<std::uint64_t, std::wstring> bound_vars, const wmi_helper_config& config, const std::uint64_t start_time)
+    std::optional<wmi_wrapper_vector_result<AnySize>> query_internal(const bool async, const bool return_data, const wmi_helper_callback<AnySize> callback, const std::vector<bound_var> bound_vars, const std::vector<wmi_predicate> filters, const wmi_helper_config& config, const std::uint64_t start_time)
     {
         auto fire_count = 0;
         wmi_wrapper_vector_result<AnySize> ret_value;
 
+        // results come from the snapshot pool, delivering them only shares the storage
         wmi_wrapper_result_map<AnySize> results_;
         wmi_wrapper_result_map<AnySize> prev_results_;
+        std::uint64_t prev_sample_time = 0;
+
+        std::vector<resolved_var> vars;
+        bool vars_resolved = false;
+        std::vector<std::uint32_t> rows;
+        std::uint64_t tick = 0;
+        std::vector<char> mask;
+        std::vector<double> scratch;
+        std::wstring buffer;
+        lazy_reader lazy(*this, vars, rows);
+
+        // counts a tick and tells whether it was the last one
+        const auto last_tick = [&]()
+        {
+            fire_count++;
+
+            return (config.fire_count() != wmi_helper_config::infinite && fire_count == config.fire_count())
+                || (config.fire_time() != wmi_helper_config::infinite && get_current_time() >= start_time + config.fire_time())
+                || wmi_backend_finished(backend_);
+        };
 
         querying_ = true;
     	
@@ -466,135 +2927,255 @@ private:
                 }
             }
         	
-            results_.clear();
-
-            HRESULT hr = S_OK;
-        	
-            const auto num_rows = refresh_data();
-
-            if (!ap_enum_access_ || !ap_enum_access_[0])
-                continue;
+            wmi_wrapper_class_result<AnySize> delivered;
+            auto deferred = false;
+            auto deliver = true;
 
-            for (auto& bound_var : bound_vars)
+            if (!cached_tick(delivered, deliver))
             {
-                auto& [hash, name] = bound_var;
+                results_ = wmi_wrapper_result_map<AnySize>(snapshots_.acquire());
 
-                CIMTYPE var_type;
-                long var_handle;
+                const auto num_rows = refresh_data();
+                const auto sample_time = get_current_time();
 
-                if (FAILED(hr = ap_enum_access_[0]->GetPropertyHandle(
-                    name.c_str(),
-                    &var_type,
-                    &var_handle)))
+                // an empty tick delivers nothing but counts, and is paced like any other
+                if (num_rows == 0)
                 {
+                    backend_.release();
+
+                    if (last_tick())
+                    {
+                        querying_ = false;
+
+                        if (async && !return_data)
+                        {
+                            return std::nullopt;
+                        }
+
+                        return ret_value;
+                    }
+
+                    wmi_backend_wait(backend_, std::chrono::milliseconds(1000 / config.updates_per_second()));
                     continue;
                 }
 
-                for (auto i = 0; i < num_rows; i++) {
+                // property handles are the same for every instance of a class, so they only have to be looked up once
+                if (!vars_resolved)
+                {
+                    for (wmi_var_handle handle = 0; handle < bound_vars.size(); handle++)
+                    {
+                        CIMTYPE var_type;
+                        long var_handle;
 
-                    wmi_any<AnySize> any{};
-                    any.type = var_type;
+                        if (!backend_.property_handle(bound_vars[handle].name, var_type, var_handle))
+                        {
+                            continue;
+                        }
 
-                    long read_bytes = 0x0;
+                        const auto dictionary = wmi_is_string_type(var_type) ? bound_vars[handle].dictionary.get() : nullptr;
+                        vars.push_back({ handle, var_type, var_handle, dictionary });
+                    }
 
-                	if(var_type == 8)
-                	{
-                        // wstring
+                    vars_resolved = true;
+                }
 
-                        if (FAILED(ap_enum_access_[i]->ReadPropertyValue(var_handle, 0, &read_bytes, any.data<byte*>())))
-                        {
-                            std::wstring str;
-                            str.resize(read_bytes);
+                rows.resize(num_rows);
 
-                            if (FAILED(ap_enum_access_[i]->ReadPropertyValue(var_handle, read_bytes, &read_bytes, reinterpret_cast<byte*>(str.data()))))
-                            {
-                                continue;
-                            }
+                for (std::uint32_t i = 0; i < num_rows; i++)
+                    rows[i] = i;
 
-                            any.str = str;
-                        }
-                		
-                	}
-                    else if (FAILED(ap_enum_access_[i]->ReadPropertyValue(var_handle, sizeof(any), &read_bytes, any.data<byte*>())))
+                for (auto& var : vars)
+                {
+                    if (var.dictionary)
+                        results_.set_dictionary(var.var, bound_vars[var.var].dictionary);
+                }
+
+                if (!filters.empty())
+                    apply_filters(filters, vars, rows, results_, buffer, mask, scratch);
+
+                // key columns are read first, the previous tick's columns only line up with the rows if every key
+                // is the same
+                auto keyed = false;
+                auto same_instances = true;
+
+                for (auto& var : vars)
+                {
+                    if (!bound_vars[var.var].options.key)
+                        continue;
+
+                    if (!results_.count(var.var))
+                        read_column(var, rows, results_, buffer);
+
+                    keyed = true;
+                    same_instances = same_instances && results_.same_values(var.var, prev_results_);
+                }
+
+                same_instances = same_instances && keyed;
+
+                for (auto& var : vars)
+                {
+                    if (results_.count(var.var))
+                        continue; // filter or key column, already read
+
+                    const auto read_every = bound_vars[var.var].options.read_every;
+
+                    if (read_every > 1 && tick % read_every != 0 && same_instances && results_.carry(var.var, prev_results_))
+                        continue;
+
+                    if (bound_vars[var.var].options.lazy)
                     {
+                        results_.defer(var.var, lazy, rows.size());
+                        deferred = true;
                         continue;
                     }
 
-                    results_[hash].push_back(any);
+                    read_column(var, rows, results_, buffer);
                 }
 
-            }
+                for (wmi_var_handle handle = 0; handle < results_.handle_count(); handle++)
+                {
+                    if (results_.count(handle) && results_.column_time(handle) == 0)
+                        results_.column(handle).time = sample_time;
+                }
+
+                // row and column hashes of everything read, lazy columns are hashed when they are decoded
+                results_.hash_columns();
+
+                // lazy columns read from the refreshed objects, they are released once the result is sealed
+                if (!deferred)
+                {
+                    backend_.release();
+                }
+
+                delivered = { results_, prev_results_, sample_time, prev_sample_time };
+
+                deliver = revalidate_cache(delivered);
 
-            for (auto i = 0; i < num_rows; i++) {
-                ap_enum_access_[i]->Release();
-                ap_enum_access_[i] = nullptr;
             }
 
-        	if(async && !return_data)
+        	// a tick that only has the cached result delivers nothing, unless wmi_cache_delivery::every_tick
+        	if(deliver && async && !return_data)
         	{
-				callback(config, { results_, prev_results_ });
+				callback(config, delivered);
         	}
-            else {  // NOLINT(readability-misleading-indentation)
-				ret_value.push_back({ results_, prev_results_ });
+            else if(deliver) {  // NOLINT(readability-misleading-indentation)
+				ret_value.push_back(delivered);
             }
-        	
-            prev_results_ = results_;
-
-            fire_count++;
 
-            if (config.fire_count() != wmi_helper_config::infinite) {
-                if (fire_count == config.fire_count())
-                {
-                    querying_ = false;
-                	
-                    if(async && !return_data)
-                    {
-                        return std::nullopt;
-                    }
-                	
-                    return ret_value;
-                }
+            if (deferred)
+            {
+                // a result held anywhere but here (and in delivered) gets its remaining lazy columns, otherwise they
+                // are dropped
+                results_.seal(results_.references() > 2);
+                backend_.release();
             }
 
-            if (config.fire_time() != wmi_helper_config::infinite) {
-                if (get_current_time() >= start_time + config.fire_time())
+            // the next sample is published with the one delivered now as its previous result
+            prev_results_ = delivered.result;
+            prev_sample_time = delivered.time;
+            tick++;
+
+            if (last_tick())
+            {
+                querying_ = false;
+
+                if (async && !return_data)
                 {
-                    querying_ = false;
-                    if (async && !return_data)
-                    {
-                        return std::nullopt;
-                    }
-                	
-                    return ret_value;
+                    return std::nullopt;
                 }
+
+                return ret_value;
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000 / config.updates_per_second()));
+            wmi_backend_wait(backend_, std::chrono::milliseconds(1000 / config.updates_per_second()));
         }
 
         querying_ = false;
         return std::nullopt;
     }
 
-    // Used by init method
-    IWbemConfigureRefresher* p_config_ = nullptr;
-    IWbemServices* p_name_space_ = nullptr;
-    IWbemLocator* p_wbem_locator_ = nullptr;
-    BSTR bstr_name_space_ = nullptr;
+    Backend backend_;
+    wmi_snapshot_pool snapshots_;
 
-    // Used by update_thread method
-    IWbemObjectAccess** ap_enum_access_ = nullptr;
-    DWORD ap_enum_access_length_ = 0;
-    IWbemHiPerfEnum* p_enum_ = nullptr;
-    IWbemRefresher* p_refresher_ = nullptr;
+    [[nodiscard]] wmi_var_handle handle_of_hash(const std::uint64_t name_hash) const
+    {
+        const auto it = var_handles_.find(name_hash);
+
+        if (it == var_handles_.end())
+            throw std::out_of_range("wmi_helper::handle_of() called for a var that was never captured.");
+
+        if (var_handles_.count(name_hash) > 1)
+            throw std::out_of_range("wmi_helper::handle_of() called with a hash shared by several captured vars.");
+
+        return it->second;
+    }
+
+    // Sets result to the cached result if it is younger than the TTL, and deliver to whether it is delivered again.
+    bool cached_tick(wmi_wrapper_class_result<AnySize>& result, bool& deliver)
+    {
+        const std::lock_guard<std::mutex> lock(cache_mutex_);
+
+        if (cache_ttl_ == 0 || !cache_.valid || get_current_time() - cache_.validated >= cache_ttl_)
+            return false;
 
-    std::unordered_map<std::uint64_t, std::wstring> bound_vars_;
+        result = cache_.result;
+        deliver = cache_delivery_ == wmi_cache_delivery::every_tick;
+        return true;
+    }
+
+    // Revalidates the cache with a fresh sample if caching is on. Replaces result with the cached one when their
+    // content is the same, otherwise the sample becomes the cached result. Returns whether result is delivered.
+    bool revalidate_cache(wmi_wrapper_class_result<AnySize>& result)
+    {
+        std::unique_lock<std::mutex> lock(cache_mutex_);
+
+        if (cache_ttl_ == 0)
+            return true;
+
+        // hashing decodes lazy columns, which can take a while
+        lock.unlock();
+        const auto hash = result.result.content_hash();
+        lock.lock();
+
+        const auto unchanged = cache_.valid && cache_.hash == hash;
+
+        if (unchanged)
+        {
+            result = cache_.result;
+        }
+        else
+        {
+            cache_.result = result;
+            cache_.hash = hash;
+            cache_.valid = true;
+        }
+
+        cache_.validated = get_current_time();
+        return !unchanged || cache_delivery_ == wmi_cache_delivery::every_tick;
+    }
+
+    struct result_cache
+    {
+        wmi_wrapper_class_result<AnySize> result;
+        std::uint64_t hash = 0; // wmi_result_columns::content_hash() of result.result
+        std::uint64_t validated = 0; // get_current_time() when a sample last confirmed result
+        bool valid = false;
+    };
+
+    std::vector<bound_var> bound_vars_; // indexed by wmi_var_handle
+    std::unordered_multimap<std::uint64_t, wmi_var_handle> var_handles_; // wmi_name_hash -> handles, names decide on collisions
+    std::vector<wmi_predicate> filters_;
 	
     std::int32_t updates_per_second_ = 1;
 	
     std::atomic_bool querying_ = false;
 
     wmi_helper_config config_;
+
+    std::uint64_t cache_ttl_ = 0; // cache_results(), 0 when off
+    wmi_cache_delivery cache_delivery_ = wmi_cache_delivery::changes;
+    result_cache cache_;
+    mutable std::mutex cache_mutex_;
 };
 
 using wmi_helper_32 = wmi_helper <32>;
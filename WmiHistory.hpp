@@ -0,0 +1,1045 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "WmiExport.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Compressed in-memory history of counters, for keeping hours of samples of thousands of instances instead of the
+// results themselves. Every (instance, property) pair is a wmi_history_series of Gorilla style compressed chunks:
+//
+//   times     delta of delta, a single bit while the sample interval does not change
+//   integers  delta of delta, a single bit for constant values and counters growing at a constant rate
+//   reals     XOR with the previous value, a single bit while it does not change
+//
+// Deltas of deltas are zigzag encoded into the smallest of a few bit lengths, each with a prefix of 1 bits:
+//   0 = 0, 10 + 5 bits, 110 + 9 bits, 1110 + 16 bits, 1111 + 64 bits
+// XORs are 0 for no change, 10 + the bits inside the window of the previous XOR, or 11 + 6 bits leading zeros, 6 bits
+// length - 1 and the bits. Times and values go to separate streams of 64 bit words, filled from the least significant
+// bit on.
+
+inline unsigned wmi_count_trailing_zeros(const std::uint64_t value)
+{
+    if (value == 0)
+        return 64;
+
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+
+inline unsigned wmi_count_leading_zeros(const std::uint64_t value)
+{
+    if (value == 0)
+        return 64;
+
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
+
+// Bit stream the chunks are written to. The word after the last bits is kept zero, so readers can load 8 bytes at the
+// byte of any bit in it.
+class wmi_bit_writer
+{
+public:
+
+    // Appends the low count bits of value, which has no bits set above them. count is at most 64.
+    void write(const std::uint64_t value, const unsigned count)
+    {
+        const auto index = static_cast<std::size_t>(bits_ / 64);
+        const auto offset = static_cast<unsigned>(bits_ % 64);
+
+        if (words_.size() < index + 3)
+            words_.resize(index + 3);
+
+        words_[index] |= value << offset;
+
+        if (offset + count > 64)
+            words_[index + 1] = value >> (64 - offset);
+
+        bits_ += count;
+    }
+
+    [[nodiscard]] const std::vector<std::uint64_t>& words() const
+    {
+        return words_;
+    }
+
+    [[nodiscard]] std::uint64_t bits() const
+    {
+        return bits_;
+    }
+
+    // Drops the spare words of the growth, keeping the zero one.
+    void shrink_to_fit()
+    {
+        words_.resize(static_cast<std::size_t>((bits_ + 63) / 64 + 1));
+        words_.shrink_to_fit();
+    }
+
+private:
+
+    std::vector<std::uint64_t> words_;
+    std::uint64_t bits_ = 0;
+};
+
+// Reads a wmi_bit_writer's words, which hold their bits least significant first, on little endian machines like the
+// capture files.
+class wmi_bit_reader
+{
+public:
+
+    explicit wmi_bit_reader(const std::uint64_t* words) : bytes_(reinterpret_cast<const char*>(words))
+    {
+    }
+
+    // The next 57 bits or more. Only valid while bits are left.
+    [[nodiscard]] std::uint64_t peek() const
+    {
+        std::uint64_t value;
+        std::memcpy(&value, bytes_ + position_ / 8, sizeof(value));
+        return value >> (position_ % 8);
+    }
+
+    void skip(const unsigned count)
+    {
+        position_ += count;
+    }
+
+    [[nodiscard]] std::uint64_t read(const unsigned count)
+    {
+        if (count > 56)
+        {
+            const auto low = read(32);
+            return low | (read(count - 32) << 32);
+        }
+
+        const auto value = peek() & ((std::uint64_t(1) << count) - 1);
+        position_ += count;
+        return value;
+    }
+
+private:
+
+    const char* bytes_;
+    std::uint64_t position_ = 0;
+};
+
+struct wmi_history_sample
+{
+    std::uint64_t time = 0;
+    std::uint64_t bits = 0; // the integer or the bits of the double
+    double value = 0.0;
+};
+
+// Kind of the values of a series, wmi_export_number::kind::none is never stored.
+using wmi_history_kind = wmi_export_number::kind;
+
+// Value bits of a number stored as kind. Reals stored as integers are truncated and saturated to the range of the kind,
+// NaN becomes 0.
+inline std::uint64_t wmi_history_bits(const wmi_history_kind kind, const wmi_export_number& number)
+{
+    double real = number.real;
+
+    if (kind != wmi_history_kind::real)
+    {
+        if (number.type == wmi_history_kind::signed_integer)
+            return static_cast<std::uint64_t>(number.signed_value);
+
+        if (number.type == wmi_history_kind::unsigned_integer)
+            return number.unsigned_value;
+
+        // 2^63 and 2^64 are exact doubles, every double below them converts without overflow
+        constexpr double signed_end = 9223372036854775808.0;
+        constexpr double unsigned_end = 18446744073709551616.0;
+
+        if (std::isnan(real))
+            return 0;
+
+        if (kind == wmi_history_kind::unsigned_integer && real >= 0.0)
+            return real < unsigned_end ? static_cast<std::uint64_t>(real) : ~std::uint64_t(0);
+
+        if (real < -signed_end)
+            return std::uint64_t(1) << 63;
+
+        return real < signed_end ? static_cast<std::uint64_t>(static_cast<std::int64_t>(real)) : ~std::uint64_t(0) >> 1;
+    }
+
+    if (number.type == wmi_history_kind::signed_integer)
+        real = static_cast<double>(number.signed_value);
+    else if (number.type == wmi_history_kind::unsigned_integer)
+        real = static_cast<double>(number.unsigned_value);
+
+    std::uint64_t bits;
+    std::memcpy(&bits, &real, sizeof(bits));
+    return bits;
+}
+
+inline double wmi_history_value(const wmi_history_kind kind, const std::uint64_t bits)
+{
+    switch (kind)
+    {
+    case wmi_history_kind::signed_integer:
+        return static_cast<double>(static_cast<std::int64_t>(bits));
+    case wmi_history_kind::unsigned_integer:
+        return static_cast<double>(bits);
+    default:
+        double real;
+        std::memcpy(&real, &bits, sizeof(real));
+        return real;
+    }
+}
+
+class wmi_history_chunk;
+
+// Bit lengths of the zigzag encoded deltas of deltas after 1, 2 and 3 leading 1 bits.
+constexpr unsigned wmi_history_delta_widths[4] = { 0, 5, 9, 16 };
+
+// Decoding state of a chunk, positioned at its first sample.
+struct wmi_history_decoder
+{
+    explicit wmi_history_decoder(const wmi_history_chunk& chunk);
+
+    void next(const wmi_history_kind kind)
+    {
+        switch (kind)
+        {
+        case wmi_history_kind::signed_integer:
+            next<wmi_history_kind::signed_integer>();
+            break;
+        case wmi_history_kind::unsigned_integer:
+            next<wmi_history_kind::unsigned_integer>();
+            break;
+        default:
+            next<wmi_history_kind::real>();
+            break;
+        }
+    }
+
+    template<wmi_history_kind Kind>
+    void next()
+    {
+        // the streams are independent, so the CPU decodes the time and the value in parallel
+        time_delta += delta(times);
+        sample.time += time_delta;
+
+        if constexpr (Kind == wmi_history_kind::real)
+        {
+            exclusive_or();
+        }
+        else
+        {
+            value_delta += delta(values);
+            sample.bits += value_delta;
+        }
+
+        sample.value = wmi_history_value(Kind, sample.bits);
+    }
+
+    // Branch free but for raw codes. Deltas are added modulo 2^64 like they were subtracted.
+    static std::uint64_t delta(wmi_bit_reader& reader)
+    {
+        const auto bits = reader.peek();
+
+        // at most 4 leading 1 bits count
+        const auto ones = wmi_count_trailing_zeros(~bits | 0x10);
+        std::uint64_t zigzag;
+
+        if (ones < 4)
+        {
+            // the lengths of the codes from constants rather than wmi_history_delta_widths, they are on the critical path
+            const auto width = static_cast<unsigned>((0x10090500u >> (ones * 8)) & 0xff);
+            zigzag = (bits >> (ones + 1)) & ((std::uint64_t(1) << width) - 1);
+            reader.skip(static_cast<unsigned>((0x140c0701u >> (ones * 8)) & 0xff));
+        }
+        else
+        {
+            reader.skip(4);
+            zigzag = reader.read(64);
+        }
+
+        return (zigzag >> 1) ^ (std::uint64_t(0) - (zigzag & 1));
+    }
+
+    void exclusive_or()
+    {
+        const auto bits = values.peek();
+
+        if (!(bits & 1))
+        {
+            values.skip(1);
+            return;
+        }
+
+        if (!(bits & 2))
+        {
+            values.skip(2);
+        }
+        else
+        {
+            leading = static_cast<unsigned>((bits >> 2) & 63);
+            trailing = 64 - leading - static_cast<unsigned>(((bits >> 8) & 63) + 1);
+            values.skip(14);
+        }
+
+        sample.bits ^= values.read(64 - leading - trailing) << trailing;
+    }
+
+    wmi_bit_reader times;
+    wmi_bit_reader values;
+    wmi_history_sample sample;
+    std::uint64_t time_delta = 0;
+    std::uint64_t value_delta = 0;
+    unsigned leading = 0;
+    unsigned trailing = 0;
+};
+
+// Up to capacity compressed samples in time order.
+class wmi_history_chunk
+{
+public:
+
+    class iterator
+    {
+    public:
+
+        using iterator_category = std::input_iterator_tag;
+        using value_type = wmi_history_sample;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const wmi_history_sample*;
+        using reference = const wmi_history_sample&;
+
+        iterator(const wmi_history_chunk* chunk, const std::uint32_t index)
+            : decoder_(*chunk), kind_(chunk->kind_), count_(chunk->count_), index_(index)
+        {
+        }
+
+        reference operator*() const
+        {
+            return decoder_.sample;
+        }
+
+        pointer operator->() const
+        {
+            return &decoder_.sample;
+        }
+
+        iterator& operator++()
+        {
+            if (++index_ < count_)
+                decoder_.next(kind_);
+
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return index_ != other.index_;
+        }
+
+    private:
+
+        wmi_history_decoder decoder_;
+        wmi_history_kind kind_;
+        std::uint32_t count_;
+        std::uint32_t index_;
+    };
+
+    wmi_history_chunk(const wmi_history_kind kind, const std::uint32_t capacity) : kind_(kind), capacity_(capacity)
+    {
+    }
+
+    // false if the chunk is full. time must not be older than the last sample's.
+    bool append(const std::uint64_t time, const std::uint64_t bits)
+    {
+        if (count_ >= capacity_)
+            return false;
+
+        if (count_ == 0)
+        {
+            first_time_ = last_time_ = time;
+            first_bits_ = last_bits_ = bits;
+            count_ = 1;
+            return true;
+        }
+
+        // differences wrap around in 64 bits, a counter that restarts or a value of any size gives no signed overflow
+        const auto time_delta = time - last_time_;
+        encode_delta(times_, static_cast<std::int64_t>(time_delta - time_delta_));
+        time_delta_ = time_delta;
+
+        if (kind_ == wmi_history_kind::real)
+        {
+            encode_xor(bits ^ last_bits_);
+        }
+        else
+        {
+            const auto value_delta = bits - last_bits_;
+            encode_delta(values_, static_cast<std::int64_t>(value_delta - value_delta_));
+            value_delta_ = value_delta;
+        }
+
+        last_time_ = time;
+        last_bits_ = bits;
+
+        if (++count_ == capacity_)
+        {
+            times_.shrink_to_fit();
+            values_.shrink_to_fit();
+        }
+
+        return true;
+    }
+
+    [[nodiscard]] iterator begin() const
+    {
+        return { this, 0 };
+    }
+
+    [[nodiscard]] iterator end() const
+    {
+        return { this, count_ };
+    }
+
+    // Calls visit(sample) for every sample, faster than the iterators.
+    template<typename Visit>
+    void for_each(Visit&& visit) const
+    {
+        switch (kind_)
+        {
+        case wmi_history_kind::signed_integer:
+            decode<wmi_history_kind::signed_integer>(visit);
+            break;
+        case wmi_history_kind::unsigned_integer:
+            decode<wmi_history_kind::unsigned_integer>(visit);
+            break;
+        default:
+            decode<wmi_history_kind::real>(visit);
+            break;
+        }
+    }
+
+    [[nodiscard]] std::uint32_t size() const
+    {
+        return count_;
+    }
+
+    [[nodiscard]] bool full() const
+    {
+        return count_ >= capacity_;
+    }
+
+    [[nodiscard]] std::uint64_t first_time() const
+    {
+        return first_time_;
+    }
+
+    [[nodiscard]] std::uint64_t last_time() const
+    {
+        return last_time_;
+    }
+
+    [[nodiscard]] wmi_history_kind kind() const
+    {
+        return kind_;
+    }
+
+    // memory held, the chunk included
+    [[nodiscard]] std::size_t bytes() const
+    {
+        return sizeof(*this) + (times_.words().capacity() + values_.words().capacity()) * sizeof(std::uint64_t);
+    }
+
+private:
+
+    friend struct wmi_history_decoder;
+
+    template<wmi_history_kind Kind, typename Visit>
+    void decode(Visit& visit) const
+    {
+        if (count_ == 0)
+            return;
+
+        wmi_history_decoder decoder(*this);
+        visit(static_cast<const wmi_history_sample&>(decoder.sample));
+
+        for (std::uint32_t index = 1; index < count_; index++)
+        {
+            decoder.next<Kind>();
+            visit(static_cast<const wmi_history_sample&>(decoder.sample));
+        }
+    }
+
+    static void encode_delta(wmi_bit_writer& stream, const std::int64_t delta)
+    {
+        if (delta == 0)
+        {
+            stream.write(0, 1);
+            return;
+        }
+
+        const auto zigzag = (static_cast<std::uint64_t>(delta) << 1) ^ static_cast<std::uint64_t>(delta >> 63);
+
+        for (unsigned ones = 1; ones < 4; ones++)
+        {
+            if (zigzag < (std::uint64_t(1) << wmi_history_delta_widths[ones]))
+            {
+                // ones 1 bits, a 0 bit, then the value
+                stream.write(((std::uint64_t(1) << ones) - 1) | (zigzag << (ones + 1)), ones + 1 + wmi_history_delta_widths[ones]);
+                return;
+            }
+        }
+
+        stream.write(0xf, 4);
+        stream.write(zigzag, 64);
+    }
+
+    void encode_xor(const std::uint64_t value)
+    {
+        if (value == 0)
+        {
+            values_.write(0, 1);
+            return;
+        }
+
+        const auto leading = wmi_count_leading_zeros(value);
+        const auto trailing = wmi_count_trailing_zeros(value);
+
+        if (window_ && leading >= leading_ && trailing >= trailing_)
+        {
+            values_.write(1, 2);
+            values_.write(value >> trailing_, 64 - leading_ - trailing_);
+            return;
+        }
+
+        const auto length = 64 - leading - trailing;
+
+        values_.write(3 | (leading << 2) | ((length - 1) << 8), 14);
+        values_.write(value >> trailing, length);
+
+        leading_ = leading;
+        trailing_ = trailing;
+        window_ = true;
+    }
+
+    wmi_history_kind kind_;
+    std::uint32_t capacity_;
+    std::uint32_t count_ = 0;
+    std::uint64_t first_time_ = 0;
+    std::uint64_t first_bits_ = 0;
+    wmi_bit_writer times_;
+    wmi_bit_writer values_;
+
+    // encoder state
+    std::uint64_t last_time_ = 0;
+    std::uint64_t last_bits_ = 0;
+    std::uint64_t time_delta_ = 0;
+    std::uint64_t value_delta_ = 0;
+    unsigned leading_ = 0;
+    unsigned trailing_ = 0;
+    bool window_ = false;
+};
+
+inline wmi_history_decoder::wmi_history_decoder(const wmi_history_chunk& chunk)
+    : times(chunk.times_.words().data()), values(chunk.values_.words().data())
+{
+    sample.time = chunk.first_time_;
+    sample.bits = chunk.first_bits_;
+    sample.value = wmi_history_value(chunk.kind_, sample.bits);
+}
+
+// Samples of one property of one instance, in chunks of chunk_samples.
+class wmi_history_series
+{
+public:
+
+    // Decodes every sample in order, chunk by chunk.
+    class iterator
+    {
+    public:
+
+        using iterator_category = std::input_iterator_tag;
+        using value_type = wmi_history_sample;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const wmi_history_sample*;
+        using reference = const wmi_history_sample&;
+
+        iterator(const wmi_history_series* series, const std::size_t chunk) : series_(series), chunk_(chunk)
+        {
+            if (chunk_ < series_->chunks_.size())
+                inner_.emplace(series_->chunks_[chunk_].begin());
+        }
+
+        reference operator*() const
+        {
+            return **inner_;
+        }
+
+        pointer operator->() const
+        {
+            return &**inner_;
+        }
+
+        iterator& operator++()
+        {
+            if (++*inner_ == series_->chunks_[chunk_].end())
+            {
+                inner_.reset();
+
+                if (++chunk_ < series_->chunks_.size())
+                    inner_.emplace(series_->chunks_[chunk_].begin());
+            }
+
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return chunk_ == other.chunk_ && (!inner_ || *inner_ == *other.inner_);
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+
+        const wmi_history_series* series_;
+        std::size_t chunk_;
+        std::optional<wmi_history_chunk::iterator> inner_;
+    };
+
+    wmi_history_series(const wmi_history_kind kind, const std::uint32_t chunk_samples) : kind_(kind), chunk_samples_(chunk_samples)
+    {
+    }
+
+    // Returns by how many bytes the series grew, less than 0 when a full chunk dropped its spare capacity.
+    std::ptrdiff_t append(const std::uint64_t time, const std::uint64_t bits)
+    {
+        const auto before = bytes_;
+
+        if (chunks_.empty() || chunks_.back().full())
+            chunks_.emplace_back(kind_, chunk_samples_);
+        else
+            bytes_ -= chunks_.back().bytes();
+
+        chunks_.back().append(time, bits);
+        bytes_ += chunks_.back().bytes();
+        samples_++;
+
+        return static_cast<std::ptrdiff_t>(bytes_) - static_cast<std::ptrdiff_t>(before);
+    }
+
+    [[nodiscard]] iterator begin() const
+    {
+        return { this, 0 };
+    }
+
+    [[nodiscard]] iterator end() const
+    {
+        return { this, chunks_.size() };
+    }
+
+    // Calls visit(sample) for the samples taken in [from, to], skipping chunks outside of it without decoding them.
+    template<typename Visit>
+    void for_each(const std::uint64_t from, const std::uint64_t to, Visit&& visit) const
+    {
+        for (const auto& chunk : chunks_)
+        {
+            if (chunk.last_time() < from)
+                continue;
+
+            if (chunk.first_time() > to)
+                break;
+
+            if (chunk.first_time() >= from && chunk.last_time() <= to)
+            {
+                chunk.for_each(visit);
+                continue;
+            }
+
+            chunk.for_each([&](const wmi_history_sample& sample)
+            {
+                if (sample.time >= from && sample.time <= to)
+                    visit(sample);
+            });
+        }
+    }
+
+    // Calls visit(sample) for every sample.
+    template<typename Visit>
+    void for_each(Visit&& visit) const
+    {
+        for (const auto& chunk : chunks_)
+            chunk.for_each(visit);
+    }
+
+    // Drops the chunks whose samples are all older than time, the one being appended to too: the next sample starts a
+    // new chunk then. Returns the bytes freed.
+    std::size_t drop_before(const std::uint64_t time)
+    {
+        auto end = chunks_.begin();
+        std::size_t freed = 0;
+
+        while (end != chunks_.end() && end->last_time() < time)
+        {
+            freed += end->bytes();
+            samples_ -= end->size();
+            ++end;
+        }
+
+        chunks_.erase(chunks_.begin(), end);
+        bytes_ -= freed;
+
+        return freed;
+    }
+
+    [[nodiscard]] const std::vector<wmi_history_chunk>& chunks() const
+    {
+        return chunks_;
+    }
+
+    [[nodiscard]] wmi_history_kind kind() const
+    {
+        return kind_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return samples_;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return samples_ == 0;
+    }
+
+    // memory held by the chunks
+    [[nodiscard]] std::size_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+
+    wmi_history_kind kind_;
+    std::uint32_t chunk_samples_;
+    std::vector<wmi_history_chunk> chunks_;
+    std::size_t samples_ = 0;
+    std::size_t bytes_ = 0;
+};
+
+// Tells apart the instances of the results a history ingests, by the key column, e.g. Name, or by their row without
+// one, and numbers them in the order they were first seen. Rows whose key did not change since the last result keep
+// their instance without a lookup. Numbers of erased instances are given to the next new ones.
+template<std::size_t AnySize>
+class wmi_history_instances
+{
+public:
+
+    explicit wmi_history_instances(std::optional<wmi_var_handle> key_handle) : key_handle_(key_handle)
+    {
+    }
+
+    // Resolves the instance of every row of results, whose rows are counted in the columns of handles without a key
+    // column. Returns the number of rows, 0 when the key column is missing.
+    std::size_t resolve(const wmi_result_columns<AnySize>& results, const std::vector<wmi_var_handle>& handles)
+    {
+        std::optional<typename wmi_result_columns<AnySize>::column_type> keys;
+        std::size_t rows = 0;
+
+        if (key_handle_)
+        {
+            if (!results.count(*key_handle_))
+                return 0;
+
+            keys = results[*key_handle_];
+            rows = keys->size();
+        }
+        else
+        {
+            for (const auto handle : handles)
+            {
+                if (results.count(handle))
+                    rows = std::max(rows, results[handle].size());
+            }
+        }
+
+        if (rows_.size() < rows)
+            rows_.resize(rows);
+
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            auto& cached = rows_[row];
+
+            // numbers are keys in decimal, empty and unread keys fall back to the row
+            auto key = keys ? keys->key(row, key_buffer_) : std::wstring_view();
+
+            if (keys && key.empty())
+            {
+                const fmt::format_int digits(row);
+                key_buffer_.assign(digits.data(), digits.data() + digits.size());
+                key = key_buffer_;
+            }
+
+            if (cached.valid && (!keys || cached.key == key))
+                continue;
+
+            if (keys)
+                cached.key.assign(key);
+            else
+                cached.key = std::to_wstring(row);
+
+            auto it = ids_.find(cached.key);
+
+            if (it == ids_.end())
+            {
+                auto instance = static_cast<std::uint32_t>(keys_.size());
+
+                if (free_.empty())
+                {
+                    keys_.push_back(cached.key);
+                }
+                else
+                {
+                    instance = free_.back();
+                    free_.pop_back();
+                    keys_[instance] = cached.key;
+                }
+
+                it = ids_.emplace(cached.key, instance).first;
+                bytes_ += key_bytes(keys_[instance]);
+                live_++;
+            }
+
+            cached.instance = it->second;
+            cached.valid = true;
+        }
+
+        return rows;
+    }
+
+    // Instance of a row of the last resolved result.
+    [[nodiscard]] std::uint32_t instance(const std::size_t row) const
+    {
+        return rows_[row].instance;
+    }
+
+    [[nodiscard]] std::optional<std::uint32_t> find(const std::wstring_view key) const
+    {
+        const auto it = ids_.find(std::wstring(key));
+
+        if (it == ids_.end())
+            return std::nullopt;
+
+        return it->second;
+    }
+
+    // Forgets an instance. Rows that resolved to it resolve again on the next result.
+    void erase(const std::uint32_t instance)
+    {
+        auto& key = keys_[instance];
+
+        if (key.empty())
+            return;
+
+        bytes_ -= key_bytes(key);
+        live_--;
+
+        ids_.erase(key);
+        std::wstring().swap(key);
+        free_.push_back(instance);
+
+        for (auto& cached : rows_)
+        {
+            if (cached.instance == instance)
+                cached.valid = false;
+        }
+    }
+
+    // Key of an instance, empty if it was erased: keys are never empty, an empty key column value is the row.
+    [[nodiscard]] const std::wstring& key(const std::uint32_t instance) const
+    {
+        return keys_[instance];
+    }
+
+    // instance numbers handed out so far, erased ones included
+    [[nodiscard]] std::size_t size() const
+    {
+        return keys_.size();
+    }
+
+    // instances not erased
+    [[nodiscard]] std::size_t count() const
+    {
+        return live_;
+    }
+
+    // memory held by the keys
+    [[nodiscard]] std::size_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+
+    struct row_instance
+    {
+        std::wstring key;
+        std::uint32_t instance = 0;
+        bool valid = false;
+    };
+
+    // the key is held by keys_ and ids_
+    static std::size_t key_bytes(const std::wstring& key)
+    {
+        return 2 * (sizeof(std::wstring) + key.capacity() * sizeof(wchar_t)) + sizeof(std::uint32_t);
+    }
+
+    std::optional<wmi_var_handle> key_handle_;
+    std::wstring key_buffer_; // digits of numeric keys
+    std::vector<std::wstring> keys_;
+    std::unordered_map<std::wstring, std::uint32_t> ids_;
+    std::vector<std::uint32_t> free_; // numbers of erased instances
+    std::vector<row_instance> rows_;
+    std::size_t live_ = 0;
+    std::size_t bytes_ = 0; // of the keys
+};
+
+// Keeps the history of the attached numeric properties of every instance of the results it ingests. Instances are told
+// apart by the key column, e.g. Name, or by their row without one. Integers are kept exact, including the 64 bit ones
+// WMI reports as strings. Not synchronized: ingest and read on one thread, or guard the history with a mutex.
+template<std::size_t AnySize>
+class wmi_counter_history
+{
+public:
+
+    explicit wmi_counter_history(std::optional<wmi_var_handle> key_handle = std::nullopt, const std::uint32_t chunk_samples = 1024)
+        : instances_(key_handle), chunk_samples_(chunk_samples)
+    {
+    }
+
+    void attach(const wmi_var_handle handle)
+    {
+        handles_.push_back(handle);
+    }
+
+    // Appends a sample for every attached property of every instance of the result.
+    void ingest(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        const auto& results = wmi_result.result;
+        const auto rows = instances_.resolve(results, handles_);
+
+        series_.resize(instances_.size());
+
+        for (std::size_t property = 0; property < handles_.size(); property++)
+        {
+            if (!results.count(handles_[property]))
+                continue;
+
+            const auto column = results[handles_[property]];
+
+            for (std::size_t row = 0; row < std::min(rows, column.size()); row++)
+            {
+                const auto number = wmi_export_read_number(column, row);
+
+                if (number.type == wmi_export_number::kind::none)
+                    continue;
+
+                auto& slots = series_[instances_.instance(row)];
+
+                if (slots.size() < handles_.size())
+                    slots.resize(handles_.size());
+
+                // the first value decides the kind of the series
+                if (!slots[property])
+                    slots[property].emplace(number.type, chunk_samples_);
+
+                bytes_ += static_cast<std::size_t>(slots[property]->append(wmi_result.time, wmi_history_bits(slots[property]->kind(), number)));
+                samples_++;
+            }
+        }
+    }
+
+    // Callback for wmi_helper::query_async() that ingests every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            ingest(wmi_result);
+        };
+    }
+
+    // History of an attached property of an instance, nullptr if there is none. key is the key column's value (numbers
+    // in decimal), or the row as a decimal number without a key column or for an empty key.
+    [[nodiscard]] const wmi_history_series* series(const std::wstring_view key, const wmi_var_handle handle) const
+    {
+        const auto instance = instances_.find(key);
+        const auto property = static_cast<std::size_t>(std::find(handles_.begin(), handles_.end(), handle) - handles_.begin());
+
+        if (!instance || property >= series_[*instance].size() || !series_[*instance][property])
+            return nullptr;
+
+        return &*series_[*instance][property];
+    }
+
+    // Calls visit(key) for every instance seen so far.
+    template<typename Visit>
+    void for_each_instance(Visit&& visit) const
+    {
+        for (std::uint32_t instance = 0; instance < instances_.size(); instance++)
+            visit(std::wstring_view(instances_.key(instance)));
+    }
+
+    [[nodiscard]] std::size_t instances() const
+    {
+        return instances_.size();
+    }
+
+    [[nodiscard]] std::size_t samples() const
+    {
+        return samples_;
+    }
+
+    // memory held by the compressed samples
+    [[nodiscard]] std::size_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+
+    wmi_history_instances<AnySize> instances_;
+    std::uint32_t chunk_samples_;
+    std::vector<wmi_var_handle> handles_;
+    std::vector<std::vector<std::optional<wmi_history_series>>> series_; // by instance and attached property
+    std::size_t samples_ = 0;
+    std::size_t bytes_ = 0;
+};
+
+using wmi_counter_history_32 = wmi_counter_history<32>;
@@ -0,0 +1,512 @@
+#pragma once
+#include <limits>
+#include <mutex>
+
+#include "WmiHistory.hpp"
+
+// In-process time-series store, for answering questions like "the last 24 hours" locally. Every sample of the attached
+// properties is kept in three tiers per (instance, property):
+//
+//   raw     every sample, compressed (wmi_history_series)
+//   minute  min/max/sum/count per minute
+//   hour    min/max/sum/count per hour
+//
+// Once the store holds more than its memory budget the oldest data is evicted tier by tier: raw chunks first, then an
+// hour of minutes at a time and last a day of hours at a time, so older history stays available at a coarser
+// resolution. Instances that are no longer seen age out the same way, and once their last sample is older than every
+// raw sample and minute still held they go with their hours and keys. Should the instances of the latest result alone
+// not fit, their raw samples are dropped too; what is left over the budget then are their open buckets and keys, see
+// over_budget(). Sample times are the helper's wall clock milliseconds and must not go back.
+
+// Summary of the samples of a bucket or a time range.
+struct wmi_history_rollup
+{
+    std::uint64_t start = 0; // first millisecond of the bucket
+    double min = std::numeric_limits<double>::quiet_NaN();
+    double max = std::numeric_limits<double>::quiet_NaN();
+    double sum = 0.0;
+    std::uint64_t count = 0;
+
+    void add(const double value)
+    {
+        if (count == 0 || value < min)
+            min = value;
+
+        if (count == 0 || value > max)
+            max = value;
+
+        sum += value;
+        count++;
+    }
+
+    void merge(const wmi_history_rollup& other)
+    {
+        if (other.count == 0)
+            return;
+
+        if (count == 0 || other.min < min)
+            min = other.min;
+
+        if (count == 0 || other.max > max)
+            max = other.max;
+
+        sum += other.sum;
+        count += other.count;
+    }
+
+    [[nodiscard]] double mean() const
+    {
+        return count ? sum / static_cast<double>(count) : std::numeric_limits<double>::quiet_NaN();
+    }
+};
+
+enum class wmi_history_tier
+{
+    raw,
+    minute,
+    hour
+};
+
+// Length of the buckets of a rollup tier in milliseconds.
+constexpr std::uint64_t wmi_history_tier_period(const wmi_history_tier tier)
+{
+    return tier == wmi_history_tier::hour ? 3600000 : tier == wmi_history_tier::minute ? 60000 : 0;
+}
+
+// Keeps the attached numeric properties of every instance of the results it ingests in memory_budget bytes, see above.
+// Instances are told apart by the key column, e.g. Name, or by their row without one. Ingesting and queries may run on
+// different threads, visitors are called with the store locked.
+template<std::size_t AnySize>
+class wmi_history_store
+{
+public:
+
+    explicit wmi_history_store(std::optional<wmi_var_handle> key_handle = std::nullopt, const std::size_t memory_budget = std::size_t(256) << 20, const std::uint32_t chunk_samples = 256)
+        : instances_(key_handle), memory_budget_(memory_budget), chunk_samples_(chunk_samples)
+    {
+    }
+
+    void attach(const wmi_var_handle handle)
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        handles_.push_back(handle);
+    }
+
+    // Adds every attached property of every instance of the result to the tiers, then evicts down to the budget.
+    void ingest(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        const auto& results = wmi_result.result;
+        const auto rows = instances_.resolve(results, handles_);
+
+        series_.resize(instances_.size());
+        last_seen_.resize(instances_.size());
+        now_ = std::max(now_, wmi_result.time);
+
+        for (std::size_t row = 0; row < rows; row++)
+            last_seen_[instances_.instance(row)] = wmi_result.time;
+
+        for (std::size_t property = 0; property < handles_.size(); property++)
+        {
+            if (!results.count(handles_[property]))
+                continue;
+
+            const auto column = results[handles_[property]];
+
+            for (std::size_t row = 0; row < std::min(rows, column.size()); row++)
+            {
+                const auto number = wmi_export_read_number(column, row);
+
+                if (number.type != wmi_export_number::kind::none)
+                    add(instances_.instance(row), property, wmi_result.time, number);
+            }
+        }
+
+        over_budget_ = bytes() > memory_budget_ && !evict();
+    }
+
+    // Callback for wmi_helper::query_async() that ingests every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            ingest(wmi_result);
+        };
+    }
+
+    // Calls visit(sample) for the raw samples of a property of an instance taken in [from, to] and still held. key is
+    // the key column's value, or the row as a decimal number without a key column. false for unknown ones.
+    template<typename Visit>
+    bool samples(const std::wstring_view key, const wmi_var_handle handle, const std::uint64_t from, const std::uint64_t to, Visit&& visit) const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        const auto* entry = find(key, handle);
+
+        if (!entry)
+            return false;
+
+        if (entry->raw)
+            entry->raw->for_each(from, to, visit);
+
+        return true;
+    }
+
+    // Calls visit(rollup) for the minute or hour buckets overlapping [from, to] in time order, the open one included.
+    template<typename Visit>
+    bool rollups(const std::wstring_view key, const wmi_var_handle handle, const wmi_history_tier tier, const std::uint64_t from, const std::uint64_t to, Visit&& visit) const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        const auto* entry = find(key, handle);
+
+        if (!entry || tier == wmi_history_tier::raw)
+            return false;
+
+        const auto& buckets = tier == wmi_history_tier::minute ? entry->minutes : entry->hours;
+        const auto& open = tier == wmi_history_tier::minute ? entry->minute : entry->hour;
+        const auto period = wmi_history_tier_period(tier);
+
+        const auto overlaps = [from, to, period](const wmi_history_rollup& bucket)
+        {
+            return bucket.count && bucket.start <= to && bucket.start + period > from;
+        };
+
+        for (const auto& bucket : buckets)
+        {
+            if (overlaps(bucket))
+                visit(bucket);
+        }
+
+        if (overlaps(open))
+            visit(open);
+
+        return true;
+    }
+
+    // Summary of the samples of a property of an instance in [from, to], from the finest tier still holding each part
+    // of the range: hours up to the oldest minute, minutes up to the oldest raw sample and raw samples after. Buckets
+    // count whole, so buckets the range starts or ends in are left out where no finer tier is held. Empty (count 0) for
+    // unknown ones.
+    [[nodiscard]] wmi_history_rollup aggregate(const std::wstring_view key, const wmi_var_handle handle, const std::uint64_t from, const std::uint64_t to) const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        const auto* entry = find(key, handle);
+        wmi_history_rollup result;
+        result.start = from;
+
+        if (!entry)
+            return result;
+
+        const auto none = std::numeric_limits<std::uint64_t>::max();
+        const auto raw_first = entry->raw && !entry->raw->empty() ? entry->raw->chunks().front().first_time() : none;
+        const auto minute_first = entry->minutes.empty() ? (entry->minute.count ? entry->minute.start : raw_first) : entry->minutes.front().start;
+        const auto end = to == none ? none : to + 1;
+
+        // [from, covered) is summed up already
+        auto covered = from;
+
+        // every tier holds every sample, so a bucket the next finer tier starts in counts whole and that tier goes on
+        // after it
+        const auto merge = [&](const std::vector<wmi_history_rollup>& buckets, const wmi_history_rollup& open, const std::uint64_t period, const std::uint64_t finer_first)
+        {
+            const auto merge_bucket = [&](const wmi_history_rollup& bucket)
+            {
+                if (bucket.count && bucket.start >= covered && bucket.start <= finer_first && bucket.start + period <= end)
+                {
+                    result.merge(bucket);
+                    covered = bucket.start + period;
+                }
+            };
+
+            for (const auto& bucket : buckets)
+                merge_bucket(bucket);
+
+            merge_bucket(open);
+        };
+
+        merge(entry->hours, entry->hour, wmi_history_tier_period(wmi_history_tier::hour), minute_first);
+        merge(entry->minutes, entry->minute, wmi_history_tier_period(wmi_history_tier::minute), raw_first);
+
+        if (entry->raw && covered <= to)
+        {
+            entry->raw->for_each(covered, to, [&result](const wmi_history_sample& sample)
+            {
+                result.add(sample.value);
+            });
+        }
+
+        return result;
+    }
+
+    // Calls visit(key) for every instance seen so far.
+    template<typename Visit>
+    void for_each_instance(Visit&& visit) const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+
+        for (std::uint32_t instance = 0; instance < instances_.size(); instance++)
+        {
+            if (!instances_.key(instance).empty())
+                visit(std::wstring_view(instances_.key(instance)));
+        }
+    }
+
+    [[nodiscard]] std::size_t instances() const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        return instances_.count();
+    }
+
+    // memory held by the tiers and the instance keys
+    [[nodiscard]] std::size_t memory() const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        return bytes();
+    }
+
+    [[nodiscard]] std::size_t memory_budget() const
+    {
+        return memory_budget_;
+    }
+
+    // true when the last eviction found nothing left to drop before reaching the budget: the latest result's instances,
+    // their open buckets and keys need more
+    [[nodiscard]] bool over_budget() const
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        return over_budget_;
+    }
+
+private:
+
+    struct entry
+    {
+        std::optional<wmi_history_series> raw;
+        wmi_history_rollup minute; // open buckets
+        wmi_history_rollup hour;
+        std::vector<wmi_history_rollup> minutes; // closed buckets in time order
+        std::vector<wmi_history_rollup> hours;
+    };
+
+    [[nodiscard]] const entry* find(const std::wstring_view key, const wmi_var_handle handle) const
+    {
+        const auto instance = instances_.find(key);
+        const auto property = static_cast<std::size_t>(std::find(handles_.begin(), handles_.end(), handle) - handles_.begin());
+
+        if (!instance || property >= series_[*instance].size())
+            return nullptr;
+
+        return &series_[*instance][property];
+    }
+
+    void add(const std::uint32_t instance, const std::size_t property, const std::uint64_t time, const wmi_export_number& number)
+    {
+        auto& entries = series_[instance];
+
+        if (entries.size() < handles_.size())
+        {
+            entries_bytes_ += (handles_.size() - entries.size()) * sizeof(entry);
+            entries.resize(handles_.size());
+        }
+
+        auto& target = entries[property];
+
+        // the first value decides the kind of the series
+        if (!target.raw)
+            target.raw.emplace(number.type, chunk_samples_);
+
+        const auto bits = wmi_history_bits(target.raw->kind(), number);
+        const auto value = wmi_history_value(target.raw->kind(), bits);
+
+        raw_bytes_ += static_cast<std::size_t>(target.raw->append(time, bits));
+        add(target.minutes, target.minute, wmi_history_tier_period(wmi_history_tier::minute), time, value);
+        add(target.hours, target.hour, wmi_history_tier_period(wmi_history_tier::hour), time, value);
+    }
+
+    void add(std::vector<wmi_history_rollup>& buckets, wmi_history_rollup& open, const std::uint64_t period, const std::uint64_t time, const double value)
+    {
+        const auto start = time - time % period;
+
+        // a time that went back still counts for the open bucket
+        if (open.count && start > open.start)
+        {
+            const auto before = buckets.capacity();
+            buckets.push_back(open);
+            rollup_bytes_ += (buckets.capacity() - before) * sizeof(wmi_history_rollup);
+            open = {};
+        }
+
+        if (!open.count)
+            open.start = start;
+
+        open.add(value);
+    }
+
+    [[nodiscard]] std::size_t bytes() const
+    {
+        return raw_bytes_ + rollup_bytes_ + entries_bytes_ + instances_.bytes();
+    }
+
+    // Drops the oldest data of the finest tier that has any until the store fits into its budget, false if it does not.
+    bool evict()
+    {
+        close_buckets();
+
+        while (bytes() > memory_budget_)
+        {
+            const auto evicted = evict_raw(false)
+                || evict_rollups(&entry::minutes, wmi_history_tier_period(wmi_history_tier::hour))
+                || evict_rollups(&entry::hours, 24 * wmi_history_tier_period(wmi_history_tier::hour))
+                || evict_raw(true);
+
+            // what is left are the open buckets of the instances of the latest result and their keys
+            if (!evicted)
+                return false;
+
+            erase_instances();
+        }
+
+        return true;
+    }
+
+    // Closes the open buckets whose period ended before the latest result, those of instances that were not seen since.
+    // Their rollups age out with the closed ones then.
+    void close_buckets()
+    {
+        const auto close = [this](std::vector<wmi_history_rollup>& buckets, wmi_history_rollup& open, const std::uint64_t period)
+        {
+            if (!open.count || open.start + period > now_)
+                return;
+
+            const auto before = buckets.capacity();
+            buckets.push_back(open);
+            rollup_bytes_ += (buckets.capacity() - before) * sizeof(wmi_history_rollup);
+            open = {};
+        };
+
+        for (auto& entries : series_)
+        {
+            for (auto& target : entries)
+            {
+                close(target.minutes, target.minute, wmi_history_tier_period(wmi_history_tier::minute));
+                close(target.hours, target.hour, wmi_history_tier_period(wmi_history_tier::hour));
+            }
+        }
+    }
+
+    // Drops the oldest raw chunks of every series, those that end before the first one ending. Chunks still being
+    // appended to, those of series with one chunk that were part of the latest result, only count when appending is
+    // set.
+    bool evict_raw(const bool appending)
+    {
+        auto cutoff = std::numeric_limits<std::uint64_t>::max();
+
+        for (const auto& entries : series_)
+        {
+            for (const auto& target : entries)
+            {
+                if (!target.raw || target.raw->empty())
+                    continue;
+
+                const auto& front = target.raw->chunks().front();
+
+                if (appending || target.raw->chunks().size() > 1 || front.last_time() < now_)
+                    cutoff = std::min(cutoff, front.last_time() + 1);
+            }
+        }
+
+        if (cutoff == std::numeric_limits<std::uint64_t>::max())
+            return false;
+
+        for (auto& entries : series_)
+        {
+            for (auto& target : entries)
+            {
+                if (target.raw)
+                    raw_bytes_ -= target.raw->drop_before(cutoff);
+            }
+        }
+
+        return true;
+    }
+
+    // Erases the instances that were not part of the latest result and have no raw samples or minutes left, their
+    // hours, entries and keys: the hours of every other instance would be evicted only once no minutes are left, so
+    // idle instances would pile up until then.
+    void erase_instances()
+    {
+        const auto aged_out = [](const entry& target)
+        {
+            return (!target.raw || target.raw->empty()) && !target.minute.count && target.minutes.empty();
+        };
+
+        for (std::uint32_t instance = 0; instance < series_.size(); instance++)
+        {
+            auto& entries = series_[instance];
+
+            if (instances_.key(instance).empty() || last_seen_[instance] >= now_ || !std::all_of(entries.begin(), entries.end(), aged_out))
+                continue;
+
+            for (const auto& target : entries)
+            {
+                raw_bytes_ -= target.raw ? target.raw->bytes() : 0;
+                rollup_bytes_ -= (target.minutes.capacity() + target.hours.capacity()) * sizeof(wmi_history_rollup);
+            }
+
+            entries_bytes_ -= entries.size() * sizeof(entry);
+            std::vector<entry>().swap(entries);
+            instances_.erase(instance);
+        }
+    }
+
+    // Drops the closed buckets of a rollup tier in the span after the oldest one.
+    bool evict_rollups(std::vector<wmi_history_rollup> entry::* tier, const std::uint64_t span)
+    {
+        auto cutoff = std::numeric_limits<std::uint64_t>::max();
+
+        for (const auto& entries : series_)
+        {
+            for (const auto& target : entries)
+            {
+                if (!(target.*tier).empty())
+                    cutoff = std::min(cutoff, (target.*tier).front().start + span);
+            }
+        }
+
+        if (cutoff == std::numeric_limits<std::uint64_t>::max())
+            return false;
+
+        for (auto& entries : series_)
+        {
+            for (auto& target : entries)
+            {
+                auto& buckets = target.*tier;
+                const auto end = std::find_if(buckets.begin(), buckets.end(), [cutoff](const wmi_history_rollup& bucket) { return bucket.start >= cutoff; });
+
+                if (end == buckets.begin())
+                    continue;
+
+                rollup_bytes_ -= buckets.capacity() * sizeof(wmi_history_rollup);
+                buckets.erase(buckets.begin(), end);
+                buckets.shrink_to_fit();
+                rollup_bytes_ += buckets.capacity() * sizeof(wmi_history_rollup);
+            }
+        }
+
+        return true;
+    }
+
+    mutable std::mutex mutex_;
+    wmi_history_instances<AnySize> instances_;
+    std::size_t memory_budget_;
+    std::uint32_t chunk_samples_;
+    std::vector<wmi_var_handle> handles_;
+    std::vector<std::vector<entry>> series_; // by instance and attached property
+    std::vector<std::uint64_t> last_seen_; // time of the last result with the instance, by instance
+    std::uint64_t now_ = 0; // time of the latest result
+    std::size_t raw_bytes_ = 0;
+    std::size_t rollup_bytes_ = 0;
+    std::size_t entries_bytes_ = 0;
+    bool over_budget_ = false;
+};
+
+using wmi_history_store_32 = wmi_history_store<32>;
@@ -0,0 +1,460 @@
+#pragma once
+#include <cwctype>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "WmiHelper.hpp"
+
+// Compiles a subset of WQL into a plan a wmi_helper can run against its hi-perf refresher, so queries can be written
+// declaratively without going through the (slow) IWbemServices::ExecQuery enumeration. Supported:
+//
+//   SELECT Name, PercentProcessorTime FROM Win32_PerfRawData_PerfProc_Process
+//   WHERE Name <> '_Total' AND PercentProcessorTime > 0 AND Name IN ('svchost', 'lsass') AND Name LIKE 'sql%'
+//
+// Conditions are comparisons (=, <>, !=, <, <=, >, >=) of a property against a string or number literal, IN lists and
+// prefix LIKE patterns, joined by AND. They are evaluated locally as wmi_helper filters.
+
+class wmi_query_error : public std::runtime_error
+{
+public:
+
+    wmi_query_error(const std::string& message, const std::size_t position) : std::runtime_error(fmt::format("{} (at position {})", message, position)), position_(position)
+    {
+    }
+
+    // offset into the query text
+    [[nodiscard]] std::size_t position() const
+    {
+        return position_;
+    }
+
+private:
+
+    std::size_t position_;
+};
+
+// WQL keywords and identifiers are case insensitive
+inline bool wmi_query_equal_ci(const std::wstring_view a, const std::wstring_view b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (std::towlower(a[i]) != std::towlower(b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+struct wmi_query_condition
+{
+    std::wstring property;
+    wmi_predicate_op op = wmi_predicate_op::equal;
+    std::vector<std::wstring> strings; // string literals, empty for numeric conditions
+    double number = 0.0;
+};
+
+struct wmi_query_plan
+{
+    std::wstring class_name;
+    std::vector<std::wstring> columns;
+    std::vector<wmi_query_condition> conditions;
+
+    [[nodiscard]] wmi_helper_config config(std::int32_t fire_count = wmi_helper_config::infinite, std::int32_t fire_time = wmi_helper_config::infinite, std::int32_t updates_per_second = 2) const
+    {
+        return wmi_helper_config(class_name, fire_count, fire_time, updates_per_second);
+    }
+};
+
+// A plan bound to a helper. columns[i] is the handle of plan.columns[i].
+struct wmi_prepared_query
+{
+    std::vector<std::wstring> names;
+    std::vector<wmi_var_handle> columns;
+
+    [[nodiscard]] wmi_var_handle handle(const std::wstring& name) const
+    {
+        for (std::size_t i = 0; i < names.size(); i++)
+        {
+            if (wmi_query_equal_ci(names[i], name))
+                return columns[i];
+        }
+
+        throw std::out_of_range("wmi_prepared_query::handle() called for a column the query does not select.");
+    }
+};
+
+class wmi_query_compiler
+{
+public:
+
+    [[nodiscard]] static wmi_query_plan compile(const std::wstring_view text)
+    {
+        wmi_query_compiler compiler(text);
+        return compiler.parse();
+    }
+
+private:
+
+    enum class token_kind
+    {
+        identifier,
+        string,
+        number,
+        symbol,
+        end
+    };
+
+    struct token
+    {
+        token_kind kind;
+        std::wstring text;
+        std::size_t position;
+    };
+
+    explicit wmi_query_compiler(const std::wstring_view text) : text_(text)
+    {
+        advance();
+    }
+
+    wmi_query_plan parse()
+    {
+        wmi_query_plan plan;
+
+        expect_keyword(L"SELECT");
+
+        if (current_.kind == token_kind::symbol && current_.text == L"*")
+            error("SELECT * is not supported, list the properties to capture");
+
+        plan.columns.push_back(expect_identifier());
+
+        while (accept_symbol(L","))
+            plan.columns.push_back(expect_identifier());
+
+        expect_keyword(L"FROM");
+        plan.class_name = expect_identifier();
+
+        if (accept_keyword(L"WHERE"))
+        {
+            plan.conditions.push_back(parse_condition());
+
+            while (accept_keyword(L"AND"))
+                plan.conditions.push_back(parse_condition());
+
+            if (is_keyword(L"OR"))
+                error("OR is not supported, only AND");
+        }
+
+        if (current_.kind != token_kind::end)
+            error("unexpected trailing input");
+
+        return plan;
+    }
+
+    wmi_query_condition parse_condition()
+    {
+        wmi_query_condition condition;
+        condition.property = expect_identifier();
+
+        if (accept_keyword(L"IN"))
+        {
+            condition.op = wmi_predicate_op::one_of;
+            expect_symbol(L"(");
+
+            do
+            {
+                condition.strings.push_back(expect_string());
+            } while (accept_symbol(L","));
+
+            expect_symbol(L")");
+            return condition;
+        }
+
+        if (accept_keyword(L"LIKE"))
+        {
+            const auto position = current_.position;
+            auto pattern = expect_string();
+
+            if (pattern.find_first_of(L"%_[") == std::wstring::npos)
+            {
+                condition.op = wmi_predicate_op::equal;
+            }
+            else if (pattern.back() == L'%' && pattern.find_first_of(L"%_[") == pattern.size() - 1)
+            {
+                pattern.pop_back();
+                condition.op = wmi_predicate_op::prefix;
+            }
+            else
+            {
+                throw wmi_query_error("only prefix LIKE patterns ('abc%') are supported", position);
+            }
+
+            condition.strings.push_back(std::move(pattern));
+            return condition;
+        }
+
+        const auto op_position = current_.position;
+
+        if (current_.kind != token_kind::symbol)
+            error("expected a comparison operator");
+
+        const auto op = current_.text;
+        advance();
+
+        if (op == L"=") condition.op = wmi_predicate_op::equal;
+        else if (op == L"<>" || op == L"!=") condition.op = wmi_predicate_op::not_equal;
+        else if (op == L"<") condition.op = wmi_predicate_op::less;
+        else if (op == L"<=") condition.op = wmi_predicate_op::less_equal;
+        else if (op == L">") condition.op = wmi_predicate_op::greater;
+        else if (op == L">=") condition.op = wmi_predicate_op::greater_equal;
+        else throw wmi_query_error("expected a comparison operator", op_position);
+
+        if (current_.kind == token_kind::string)
+        {
+            if (condition.op != wmi_predicate_op::equal && condition.op != wmi_predicate_op::not_equal)
+                error("strings can only be compared with = and <>");
+
+            condition.strings.push_back(current_.text);
+            advance();
+        }
+        else if (current_.kind == token_kind::number)
+        {
+            condition.number = std::wcstod(current_.text.c_str(), nullptr);
+            advance();
+        }
+        else if (is_keyword(L"TRUE") || is_keyword(L"FALSE"))
+        {
+            condition.number = is_keyword(L"TRUE") ? 1.0 : 0.0;
+            advance();
+        }
+        else
+        {
+            error("expected a string or number literal");
+        }
+
+        return condition;
+    }
+
+    void advance()
+    {
+        while (pos_ < text_.size() && std::iswspace(text_[pos_]))
+            pos_++;
+
+        current_ = { token_kind::end, {}, pos_ };
+
+        if (pos_ >= text_.size())
+            return;
+
+        const auto c = text_[pos_];
+
+        if (std::iswalpha(c) || c == L'_')
+        {
+            const auto start = pos_;
+
+            while (pos_ < text_.size() && (std::iswalnum(text_[pos_]) || text_[pos_] == L'_'))
+                pos_++;
+
+            current_ = { token_kind::identifier, std::wstring(text_.substr(start, pos_ - start)), start };
+        }
+        else if (std::iswdigit(c) || ((c == L'-' || c == L'.') && pos_ + 1 < text_.size() && std::iswdigit(text_[pos_ + 1])))
+        {
+            const auto start = pos_;
+
+            const auto at = [this](const wchar_t a, const wchar_t b)
+            {
+                return pos_ < text_.size() && (text_[pos_] == a || text_[pos_] == b);
+            };
+
+            const auto digits = [this]()
+            {
+                const auto from = pos_;
+
+                while (pos_ < text_.size() && std::iswdigit(text_[pos_]))
+                    pos_++;
+
+                return pos_ > from;
+            };
+
+            // [-]digits[.digits][(e|E)[+|-]digits], digits may be empty on one side of the point
+            if (c == L'-')
+                pos_++;
+
+            digits();
+
+            if (pos_ < text_.size() && text_[pos_] == L'.')
+            {
+                pos_++;
+                digits();
+            }
+
+            if (at(L'e', L'E'))
+            {
+                pos_++;
+
+                if (at(L'+', L'-'))
+                    pos_++;
+
+                if (!digits())
+                    throw wmi_query_error("malformed number literal", start);
+            }
+
+            // 1.2.3, 1e5e5, 12abc
+            if (pos_ < text_.size() && (text_[pos_] == L'.' || text_[pos_] == L'_' || std::iswalnum(text_[pos_])))
+                throw wmi_query_error("malformed number literal", start);
+
+            current_ = { token_kind::number, std::wstring(text_.substr(start, pos_ - start)), start };
+        }
+        else if (c == L'\'' || c == L'"')
+        {
+            const auto start = pos_++;
+            std::wstring value;
+
+            while (true)
+            {
+                if (pos_ >= text_.size())
+                    throw wmi_query_error("unterminated string literal", start);
+
+                if (text_[pos_] == c)
+                {
+                    // doubled quote is an escaped quote
+                    if (pos_ + 1 < text_.size() && text_[pos_ + 1] == c)
+                    {
+                        value.push_back(c);
+                        pos_ += 2;
+                        continue;
+                    }
+
+                    pos_++;
+                    break;
+                }
+
+                if (text_[pos_] == L'\\' && pos_ + 1 < text_.size())
+                    pos_++;
+
+                value.push_back(text_[pos_++]);
+            }
+
+            current_ = { token_kind::string, std::move(value), start };
+        }
+        else
+        {
+            const auto start = pos_;
+            const auto two = text_.substr(pos_, 2);
+
+            if (two == L"<>" || two == L"!=" || two == L"<=" || two == L">=")
+                pos_ += 2;
+            else if (std::wstring_view(L"=<>,()*").find(c) != std::wstring_view::npos)
+                pos_++;
+            else
+                throw wmi_query_error("unexpected character", start);
+
+            current_ = { token_kind::symbol, std::wstring(text_.substr(start, pos_ - start)), start };
+        }
+    }
+
+    [[noreturn]] void error(const char* message) const
+    {
+        throw wmi_query_error(message, current_.position);
+    }
+
+    [[nodiscard]] bool is_keyword(const wchar_t* keyword) const
+    {
+        return current_.kind == token_kind::identifier && wmi_query_equal_ci(current_.text, keyword);
+    }
+
+    bool accept_keyword(const wchar_t* keyword)
+    {
+        if (!is_keyword(keyword))
+            return false;
+
+        advance();
+        return true;
+    }
+
+    void expect_keyword(const wchar_t* keyword)
+    {
+        if (!accept_keyword(keyword))
+            throw wmi_query_error(fmt::format("expected {}", narrow(keyword)), current_.position);
+    }
+
+    bool accept_symbol(const wchar_t* symbol)
+    {
+        if (current_.kind != token_kind::symbol || current_.text != symbol)
+            return false;
+
+        advance();
+        return true;
+    }
+
+    void expect_symbol(const wchar_t* symbol)
+    {
+        if (!accept_symbol(symbol))
+            throw wmi_query_error(fmt::format("expected '{}'", narrow(symbol)), current_.position);
+    }
+
+    std::wstring expect_identifier()
+    {
+        if (current_.kind != token_kind::identifier)
+            error("expected an identifier");
+
+        auto name = std::move(current_.text);
+        advance();
+        return name;
+    }
+
+    std::wstring expect_string()
+    {
+        if (current_.kind != token_kind::string)
+            error("expected a string literal");
+
+        auto value = std::move(current_.text);
+        advance();
+        return value;
+    }
+
+    // keywords and symbols are ASCII
+    static std::string narrow(const std::wstring_view text)
+    {
+        return std::string(text.begin(), text.end());
+    }
+
+    std::wstring_view text_;
+    std::size_t pos_ = 0;
+    token current_{ token_kind::end, {}, 0 };
+};
+
+[[nodiscard]] inline wmi_query_plan wmi_compile_query(const std::wstring_view text)
+{
+    return wmi_query_compiler::compile(text);
+}
+
+// Captures the selected properties (plus the ones conditions need) on helper and replaces its filters with the plan's
+// conditions. The helper must have been initialized for plan.class_name.
+template<std::size_t AnySize, typename Backend>
+wmi_prepared_query wmi_prepare(wmi_helper<AnySize, Backend>& helper, const wmi_query_plan& plan)
+{
+    wmi_prepared_query prepared;
+
+    // vars captured before keep their handle and options, e.g. a dictionary or read_every set by the caller
+    const auto capture = [&helper](const std::wstring& name)
+    {
+        const auto handle = helper.find_var(name);
+        return handle ? *handle : helper.capture_var(name);
+    };
+
+    for (auto& column : plan.columns)
+    {
+        prepared.names.push_back(column);
+        prepared.columns.push_back(capture(column));
+    }
+
+    helper.clear_filters();
+
+    for (auto& condition : plan.conditions)
+        helper.filter({ capture(condition.property), condition.op, condition.strings, condition.number });
+
+    return prepared;
+}
@@ -0,0 +1,665 @@
+#pragma once
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "WmiCaptureFile.hpp"
+
+// Records what a backend hands to wmi_helper and replays it, to reproduce a host's data on another machine (Linux
+// included) and to benchmark and regression test the helper deterministically against real data shapes:
+//
+//   wmi_helper<32, wmi_recording_backend<wmi_com_backend>> recorder;
+//   recorder.backend().record(wmi_export_output("host.wmirec", wmi_export_output::mode::truncate));
+//   ... init, capture_var and query as usual ...
+//
+//   wmi_helper<32, wmi_replay_backend> replay;
+//   replay.backend().load("host.wmirec", wmi_replay_pacing::as_fast_as_possible);
+//   replay.init(wmi_helper_config(L"Win32_Process", static_cast<std::int32_t>(replay.backend().ticks())));
+//   ... the same capture_var calls, then query ...
+//
+// A recording holds the instance count of every refresh, the properties that were resolved and the bytes of every read
+// that succeeded. Reads that were never recorded fail on replay. Strings are stored as UTF-16 whatever the size of
+// wchar_t, so recordings made on Windows replay on Linux.
+//
+// File layout, little endian: a wmi_recording_header followed by records, each a wmi_recording_record and size bytes:
+//
+//   property  wmi_recording_property, then the name as UTF-16. Properties are numbered in the order they are recorded
+//   tick      wmi_recording_tick, the values that follow up to the next tick belong to it
+//   value     wmi_recording_value, then the bytes read (UTF-16 without the terminator for strings)
+
+inline constexpr char wmi_recording_magic[8] = { 'W', 'M', 'I', 'R', 'E', 'C', '\0', '\1' };
+inline constexpr std::uint32_t wmi_recording_version = 1;
+
+enum class wmi_recording_kind : std::uint32_t
+{
+    property = 1,
+    tick = 2,
+    value = 3
+};
+
+struct wmi_recording_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flags;
+};
+
+struct wmi_recording_record
+{
+    wmi_recording_kind kind;
+    std::uint32_t size; // payload bytes that follow
+};
+
+struct wmi_recording_property
+{
+    std::uint32_t type; // CIMTYPE
+    std::uint32_t reserved;
+};
+
+struct wmi_recording_tick
+{
+    std::uint64_t time; // milliseconds since the first recorded tick
+    std::uint32_t instances;
+    std::uint32_t reserved;
+};
+
+struct wmi_recording_value
+{
+    std::uint32_t row;
+    std::uint32_t property;
+};
+
+class wmi_replay_error : public std::runtime_error
+{
+public:
+
+    using std::runtime_error::runtime_error;
+};
+
+// Appends str as UTF-16 code units. Invalid code points become U+FFFD.
+inline void wmi_append_utf16(const std::wstring_view str, fmt::memory_buffer& out)
+{
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        const auto* bytes = reinterpret_cast<const char*>(str.data());
+        out.append(bytes, bytes + str.size() * sizeof(char16_t));
+    }
+    else
+    {
+        const auto push = [&out](const std::uint32_t unit)
+        {
+            const auto value = static_cast<char16_t>(unit);
+            const auto* bytes = reinterpret_cast<const char*>(&value);
+            out.append(bytes, bytes + sizeof(value));
+        };
+
+        for (const auto c : str)
+        {
+            auto code = static_cast<std::uint32_t>(c);
+
+            if (code > 0x10ffff || (code >= 0xd800 && code < 0xe000))
+                code = 0xfffd;
+
+            if (code >= 0x10000)
+            {
+                code -= 0x10000;
+                push(0xd800 + (code >> 10));
+                push(0xdc00 + (code & 0x3ff));
+            }
+            else
+            {
+                push(code);
+            }
+        }
+    }
+}
+
+// Converts units UTF-16 code units at data to wchar_t and returns how many were written. Only counts them if out is
+// nullptr. Unpaired surrogates become U+FFFD where wchar_t is 32 bits.
+inline std::size_t wmi_utf16_decode(const char* data, const std::size_t units, wchar_t* out)
+{
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        if (out)
+            std::memcpy(out, data, units * sizeof(char16_t));
+
+        return units;
+    }
+    else
+    {
+        const auto unit = [data](const std::size_t i)
+        {
+            char16_t value;
+            std::memcpy(&value, data + i * sizeof(value), sizeof(value));
+            return static_cast<std::uint32_t>(value);
+        };
+
+        std::size_t written = 0;
+
+        for (std::size_t i = 0; i < units; i++)
+        {
+            auto code = unit(i);
+
+            if (code >= 0xd800 && code < 0xdc00 && i + 1 < units && unit(i + 1) >= 0xdc00 && unit(i + 1) < 0xe000)
+                code = 0x10000 + ((code - 0xd800) << 10) + (unit(++i) - 0xdc00);
+            else if (code >= 0xd800 && code < 0xe000)
+                code = 0xfffd;
+
+            if (out)
+                out[written] = static_cast<wchar_t>(code);
+
+            written++;
+        }
+
+        return written;
+    }
+}
+
+#if FMT_USE_FCNTL
+// Backend decorator that passes everything through to Backend and records it while record() is active. Records are
+// buffered and written once batch_bytes are pending at the end of a tick, by stop() and by the destructor.
+template<typename Backend>
+class wmi_recording_backend
+{
+public:
+
+    wmi_recording_backend() = default;
+    wmi_recording_backend(const wmi_recording_backend&) = delete;
+    wmi_recording_backend& operator=(const wmi_recording_backend&) = delete;
+
+    ~wmi_recording_backend()
+    {
+        try
+        {
+            stop();
+        }
+        catch (const std::exception&)
+        {
+            // nothing to report a failed write to, call stop() to see errors
+        }
+    }
+
+    // Records everything from now on to output, starting with the properties resolved so far.
+    void record(wmi_export_output output, const std::size_t batch_bytes = 1 << 20)
+    {
+        stop();
+
+        output_.emplace(std::move(output));
+        batch_bytes_ = batch_bytes;
+        started_ = false;
+
+        wmi_recording_header header{ {}, wmi_recording_version, 0 };
+        std::memcpy(header.magic, wmi_recording_magic, sizeof(header.magic));
+        append(header);
+
+        for (std::uint32_t index = 0; index < properties_.size(); index++)
+            record_property(index);
+    }
+
+    // Writes what is pending and stops recording.
+    void stop()
+    {
+        if (!output_)
+            return;
+
+        flush();
+        output_.reset();
+    }
+
+    void flush()
+    {
+        if (!output_)
+            return;
+
+        output_->write(buffer_);
+        buffer_.clear();
+    }
+
+    [[nodiscard]] bool recording() const
+    {
+        return output_.has_value();
+    }
+
+    [[nodiscard]] Backend& inner()
+    {
+        return inner_;
+    }
+
+    void init(const wmi_helper_config& config)
+    {
+        inner_.init(config);
+    }
+
+    void cleanup()
+    {
+        inner_.cleanup();
+    }
+
+    std::uint32_t refresh()
+    {
+        const auto instances = inner_.refresh();
+
+        if (output_)
+        {
+            const auto now = get_current_time();
+
+            if (!started_)
+            {
+                start_ = now;
+                started_ = true;
+            }
+
+            append_record(wmi_recording_kind::tick, sizeof(wmi_recording_tick));
+            append(wmi_recording_tick{ now - start_, instances, 0 });
+        }
+
+        return instances;
+    }
+
+    bool property_handle(const std::wstring& name, CIMTYPE& type, long& handle)
+    {
+        if (!inner_.property_handle(name, type, handle))
+            return false;
+
+        if (handles_.find(handle) == handles_.end())
+        {
+            const auto index = static_cast<std::uint32_t>(properties_.size());
+
+            properties_.push_back({ name, type });
+            handles_.emplace(handle, index);
+
+            if (output_)
+                record_property(index);
+        }
+
+        return true;
+    }
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer)
+    {
+        if (!inner_.read(row, handle, size, read_bytes, buffer))
+            return false;
+
+        if (!output_)
+            return true;
+
+        const auto it = handles_.find(handle);
+
+        if (it == handles_.end())
+            return true;
+
+        const auto start = buffer_.size();
+        append_record(wmi_recording_kind::value, 0);
+        append(wmi_recording_value{ row, it->second });
+
+        if (wmi_is_string_type(properties_[it->second].type))
+        {
+            std::wstring_view value(static_cast<const wchar_t*>(buffer), static_cast<std::size_t>(read_bytes) / sizeof(wchar_t));
+
+            // the read includes the null terminator
+            while (!value.empty() && value.back() == L'\0')
+                value.remove_suffix(1);
+
+            wmi_append_utf16(value, buffer_);
+        }
+        else
+        {
+            const auto* bytes = static_cast<const char*>(buffer);
+            buffer_.append(bytes, bytes + read_bytes);
+        }
+
+        const auto payload = static_cast<std::uint32_t>(buffer_.size() - start - sizeof(wmi_recording_record));
+        std::memcpy(buffer_.data() + start + offsetof(wmi_recording_record, size), &payload, sizeof(payload));
+        return true;
+    }
+
+    void release()
+    {
+        inner_.release();
+
+        if (output_ && buffer_.size() >= batch_bytes_)
+            flush();
+    }
+
+    void wait(const std::chrono::milliseconds interval)
+    {
+        wmi_backend_wait(inner_, interval);
+    }
+
+private:
+
+    struct property
+    {
+        std::wstring name;
+        CIMTYPE type;
+    };
+
+    template<typename T>
+    void append(const T& value)
+    {
+        const auto* bytes = reinterpret_cast<const char*>(&value);
+        buffer_.append(bytes, bytes + sizeof(T));
+    }
+
+    void append_record(const wmi_recording_kind kind, const std::uint32_t size)
+    {
+        append(wmi_recording_record{ kind, size });
+    }
+
+    void record_property(const std::uint32_t index)
+    {
+        const auto& recorded = properties_[index];
+        const auto start = buffer_.size();
+
+        append_record(wmi_recording_kind::property, 0);
+        append(wmi_recording_property{ static_cast<std::uint32_t>(recorded.type), 0 });
+        wmi_append_utf16(recorded.name, buffer_);
+
+        const auto payload = static_cast<std::uint32_t>(buffer_.size() - start - sizeof(wmi_recording_record));
+        std::memcpy(buffer_.data() + start + offsetof(wmi_recording_record, size), &payload, sizeof(payload));
+    }
+
+    Backend inner_;
+    std::vector<property> properties_; // by recorded index
+    std::unordered_map<long, std::uint32_t> handles_; // backend handle -> recorded index
+    std::optional<wmi_export_output> output_;
+    fmt::memory_buffer buffer_;
+    std::size_t batch_bytes_ = 1 << 20;
+    std::uint64_t start_ = 0;
+    bool started_ = false;
+};
+#endif
+
+enum class wmi_replay_pacing
+{
+    original, // wait between ticks as long as the recording did
+    as_fast_as_possible // do not wait at all
+};
+
+// Backend that replays a recording made with wmi_recording_backend, one recorded tick per refresh. The file is mapped
+// and each tick's values are indexed when it is refreshed. Property handles are the recorded property indices.
+//
+// ticks() counts recorded ticks without instances too, they deliver no result but count towards fire_count as they did
+// when recorded. finished() ends a query after the last tick, also one without limits. Past the last tick refresh()
+// finds no instances.
+class wmi_replay_backend
+{
+public:
+
+    void load(const char* path, const wmi_replay_pacing pacing = wmi_replay_pacing::as_fast_as_possible)
+    {
+        file_.emplace(path);
+        pacing_ = pacing;
+        properties_.clear();
+        ticks_.clear();
+
+        const auto* const data = file_->data();
+        const auto size = file_->size();
+
+        if (size < sizeof(wmi_recording_header) || std::memcmp(data, wmi_recording_magic, sizeof(wmi_recording_magic)) != 0)
+            throw wmi_replay_error(fmt::format("wmi_replay_backend: {} is not a recording.", path));
+
+        wmi_recording_header header;
+        std::memcpy(&header, data, sizeof(header));
+
+        if (header.version != wmi_recording_version)
+            throw wmi_replay_error(fmt::format("wmi_replay_backend: {} has an unsupported version.", path));
+
+        // values are indexed per tick on refresh(), only properties and tick boundaries are read now
+        for (std::size_t offset = sizeof(header); offset + sizeof(wmi_recording_record) <= size;)
+        {
+            wmi_recording_record record;
+            std::memcpy(&record, data + offset, sizeof(record));
+
+            const auto payload = offset + sizeof(record);
+
+            // a record cut off by a crash ends the recording
+            if (record.size > size - payload)
+                break;
+
+            if (record.kind == wmi_recording_kind::property && record.size >= sizeof(wmi_recording_property))
+            {
+                wmi_recording_property property;
+                std::memcpy(&property, data + payload, sizeof(property));
+
+                const auto units = (record.size - sizeof(property)) / sizeof(char16_t);
+                std::wstring name(wmi_utf16_decode(data + payload + sizeof(property), units, nullptr), L'\0');
+                wmi_utf16_decode(data + payload + sizeof(property), units, name.data());
+
+                properties_.push_back({ std::move(name), static_cast<CIMTYPE>(property.type) });
+            }
+            else if (record.kind == wmi_recording_kind::tick && record.size >= sizeof(wmi_recording_tick))
+            {
+                wmi_recording_tick tick;
+                std::memcpy(&tick, data + payload, sizeof(tick));
+
+                ticks_.push_back({ tick.time, tick.instances, 0, payload + record.size, payload + record.size });
+            }
+            else if (record.kind == wmi_recording_kind::value && !ticks_.empty())
+            {
+                ticks_.back().values++;
+            }
+
+            offset = payload + record.size;
+
+            // records up to the next tick belong to the last one
+            if (!ticks_.empty())
+                ticks_.back().end = offset;
+        }
+
+        rewind();
+    }
+
+    // Starts over at the first tick.
+    void rewind()
+    {
+        next_ = 0;
+        instances_ = 0;
+        values_.clear();
+        table_.clear();
+        sparse_.clear();
+    }
+
+    [[nodiscard]] std::size_t ticks() const
+    {
+        return ticks_.size();
+    }
+
+    // number of ticks refreshed so far
+    [[nodiscard]] std::size_t position() const
+    {
+        return next_;
+    }
+
+    [[nodiscard]] bool finished() const
+    {
+        return next_ >= ticks_.size();
+    }
+
+    void init(const wmi_helper_config&)
+    {
+        if (!file_)
+            throw wmi_replay_error("wmi_replay_backend::init() called before load().");
+    }
+
+    void cleanup()
+    {
+    }
+
+    std::uint32_t refresh()
+    {
+        values_.clear();
+        table_.clear();
+        sparse_.clear();
+
+        if (finished())
+        {
+            instances_ = 0;
+            return 0;
+        }
+
+        if (next_ == 0)
+            started_at_ = std::chrono::steady_clock::now();
+
+        const auto& tick = ticks_[next_++];
+        instances_ = tick.instances;
+
+        // the instance count is only trusted as far as the tick has values for it, a damaged or hostile count falls
+        // back to a lookup as large as the values
+        dense_ = instances_ <= tick.values;
+
+        if (dense_)
+            table_.assign(static_cast<std::size_t>(instances_) * properties_.size(), none);
+
+        const auto* const data = file_->data();
+
+        for (auto offset = tick.begin; offset < tick.end;)
+        {
+            wmi_recording_record record;
+            std::memcpy(&record, data + offset, sizeof(record));
+
+            const auto payload = offset + sizeof(record);
+            offset = payload + record.size;
+
+            if (record.kind != wmi_recording_kind::value || record.size < sizeof(wmi_recording_value))
+                continue;
+
+            wmi_recording_value value;
+            std::memcpy(&value, data + payload, sizeof(value));
+
+            if (value.row >= instances_ || value.property >= properties_.size())
+                continue;
+
+            const auto* const bytes = data + payload + sizeof(value);
+            const auto bytes_size = static_cast<std::uint32_t>(record.size - sizeof(value));
+
+            // strings are handed out as wchar_t with a terminator, scalars as recorded
+            const auto read_bytes = wmi_is_string_type(properties_[value.property].type)
+                ? static_cast<std::uint32_t>((wmi_utf16_decode(bytes, bytes_size / sizeof(char16_t), nullptr) + 1) * sizeof(wchar_t))
+                : bytes_size;
+
+            const auto slot = static_cast<std::size_t>(value.row) * properties_.size() + value.property;
+
+            if (dense_)
+                table_[slot] = static_cast<std::uint32_t>(values_.size());
+            else
+                sparse_[slot] = static_cast<std::uint32_t>(values_.size());
+
+            values_.push_back({ bytes, bytes_size, read_bytes });
+        }
+
+        return instances_;
+    }
+
+    bool property_handle(const std::wstring& name, CIMTYPE& type, long& handle) const
+    {
+        for (std::size_t i = 0; i < properties_.size(); i++)
+        {
+            if (properties_[i].name == name)
+            {
+                type = properties_[i].type;
+                handle = static_cast<long>(i);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer) const
+    {
+        read_bytes = 0;
+
+        if (handle < 0 || static_cast<std::size_t>(handle) >= properties_.size() || row >= instances_)
+            return false;
+
+        const auto slot = static_cast<std::size_t>(row) * properties_.size() + static_cast<std::size_t>(handle);
+        auto index = none;
+
+        if (dense_)
+        {
+            index = table_[slot];
+        }
+        else if (const auto found = sparse_.find(slot); found != sparse_.end())
+        {
+            index = found->second;
+        }
+
+        if (index == none)
+            return false;
+
+        const auto& value = values_[index];
+        read_bytes = static_cast<long>(value.read_bytes);
+
+        if (size < read_bytes)
+            return false;
+
+        if (!wmi_is_string_type(properties_[static_cast<std::size_t>(handle)].type))
+        {
+            std::memcpy(buffer, value.bytes, value.size);
+            return true;
+        }
+
+        auto* const out = static_cast<wchar_t*>(buffer);
+        out[wmi_utf16_decode(value.bytes, value.size / sizeof(char16_t), out)] = L'\0';
+        return true;
+    }
+
+    void release()
+    {
+    }
+
+    void wait(const std::chrono::milliseconds)
+    {
+        if (pacing_ == wmi_replay_pacing::as_fast_as_possible || finished() || next_ == 0)
+            return;
+
+        // the next tick is due as long after the first one as it was recorded after it
+        std::this_thread::sleep_until(started_at_ + std::chrono::milliseconds(ticks_[next_].time - ticks_[0].time));
+    }
+
+private:
+
+    static constexpr std::uint32_t none = 0xffffffff;
+
+    struct property
+    {
+        std::wstring name;
+        CIMTYPE type;
+    };
+
+    struct tick
+    {
+        std::uint64_t time;
+        std::uint32_t instances;
+        std::uint32_t values; // value records
+        std::size_t begin; // offsets of the tick's value records
+        std::size_t end;
+    };
+
+    struct value
+    {
+        const char* bytes;
+        std::uint32_t size;
+        std::uint32_t read_bytes;
+    };
+
+    std::optional<wmi_mapped_file> file_;
+    wmi_replay_pacing pacing_ = wmi_replay_pacing::as_fast_as_possible;
+    std::vector<property> properties_;
+    std::vector<tick> ticks_;
+    std::size_t next_ = 0;
+    std::chrono::steady_clock::time_point started_at_;
+
+    // current tick
+    std::uint32_t instances_ = 0;
+    std::vector<value> values_;
+    bool dense_ = true;
+    std::vector<std::uint32_t> table_; // row * properties + property -> values_ index
+    std::unordered_map<std::size_t, std::uint32_t> sparse_; // the same for ticks with fewer values than instances
+};
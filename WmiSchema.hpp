@@ -0,0 +1,257 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "WmiHelper.hpp"
+
+// Binds WMI properties to the fields of a plain struct at compile time, so rows can be read straight into a
+// std::vector<Row> without wmi_any cells, handle hashing or per-cell type switches. Declare the binding by
+// specializing wmi_schema:
+//
+//   struct memory_row { std::wstring bank; std::uint32_t speed; std::uint64_t capacity; };
+//
+//   template<> struct wmi_schema<memory_row>
+//   {
+//       static constexpr auto fields = std::make_tuple(
+//           wmi_field(L"BankLabel", &memory_row::bank),
+//           wmi_field(L"Speed", &memory_row::speed),
+//           wmi_field(L"Capacity", &memory_row::capacity));
+//   };
+//
+// Supported field types are the fixed width integers, float, double, bool and std::wstring, and std::optional of
+// them. A failed read leaves an optional field empty and any other field value initialized (0, false or empty).
+
+template<typename Row>
+struct wmi_schema;
+
+// Field type of a binding, std::optional<T> binds like T.
+template<typename Member>
+struct wmi_schema_value
+{
+    using type = Member;
+    static constexpr bool optional = false;
+};
+
+template<typename Member>
+struct wmi_schema_value<std::optional<Member>>
+{
+    using type = Member;
+    static constexpr bool optional = true;
+};
+
+template<typename Row, typename Member>
+struct wmi_field_binding
+{
+    const wchar_t* name;
+    Member Row::* member;
+};
+
+template<typename Row, typename Member>
+constexpr wmi_field_binding<Row, Member> wmi_field(const wchar_t* name, Member Row::* member)
+{
+    using value_type = typename wmi_schema_value<Member>::type;
+
+    static_assert(std::is_same_v<value_type, std::wstring> || std::is_same_v<value_type, bool> || std::is_floating_point_v<value_type>
+        || (std::is_integral_v<value_type> && sizeof(value_type) <= sizeof(std::uint64_t)), "wmi_field() only binds integers, floating point, bool and std::wstring members, or std::optional of them.");
+
+    return { name, member };
+}
+
+class wmi_schema_error : public std::runtime_error
+{
+public:
+
+    using std::runtime_error::runtime_error;
+};
+
+// Reads the instances of a helper's class into a std::vector<Row> using wmi_schema<Row>. Property handles are resolved
+// and checked against the field types once, on the first sample with instances; every mismatch is reported together in
+// a single wmi_schema_error, which every later sample throws again without resolving anything. Do not use it while the
+// same helper runs a query.
+template<typename Row, std::size_t AnySize, typename Backend>
+class wmi_typed_query
+{
+public:
+
+    static constexpr std::size_t field_count = std::tuple_size_v<std::decay_t<decltype(wmi_schema<Row>::fields)>>;
+
+    explicit wmi_typed_query(wmi_helper<AnySize, Backend>& helper) : helper_(helper)
+    {
+    }
+
+    // Refreshes once and replaces rows with the current instances. rows keeps its capacity (and that of its string
+    // members) between calls, so a reused vector stops allocating once it has seen the largest result.
+    void sample(std::vector<Row>& rows)
+    {
+        auto& backend = helper_.backend();
+        const auto num_rows = helper_.refresh_data();
+
+        if (num_rows == 0)
+        {
+            backend.release();
+            rows.clear();
+            return;
+        }
+
+        if (!resolved_)
+            resolve(backend);
+
+        if (error_)
+        {
+            backend.release();
+            throw *error_;
+        }
+
+        rows.resize(num_rows);
+        failed_reads_ = 0;
+
+        for (std::uint32_t i = 0; i < num_rows; i++)
+            read_row(backend, i, rows[i], std::make_index_sequence<field_count>{});
+
+        backend.release();
+    }
+
+    [[nodiscard]] std::vector<Row> sample()
+    {
+        std::vector<Row> rows;
+        sample(rows);
+        return rows;
+    }
+
+    // Number of field reads that failed during the last sample.
+    [[nodiscard]] std::size_t failed_reads() const
+    {
+        return failed_reads_;
+    }
+
+private:
+
+    void resolve(Backend& backend)
+    {
+        std::string errors;
+
+        resolve_fields(backend, errors, std::make_index_sequence<field_count>{});
+
+        if (!errors.empty())
+            error_.emplace("wmi_typed_query: schema does not match the class:" + errors);
+
+        resolved_ = true;
+    }
+
+    template<std::size_t... I>
+    void resolve_fields(Backend& backend, std::string& errors, std::index_sequence<I...>)
+    {
+        (resolve_field<I>(backend, errors), ...);
+    }
+
+    template<std::size_t I>
+    void resolve_field(Backend& backend, std::string& errors)
+    {
+        const auto& field = std::get<I>(wmi_schema<Row>::fields);
+        using member_type = std::remove_reference_t<decltype(std::declval<Row&>().*(field.member))>;
+
+        CIMTYPE type;
+        const std::wstring name(field.name);
+
+        if (!backend.property_handle(name, type, handles_[I]))
+        {
+            errors += fmt::format(" {} does not exist;", wmi_to_utf8(name));
+            return;
+        }
+
+        if (!wmi_type_accepts<typename wmi_schema_value<member_type>::type>(type))
+            errors += fmt::format(" {} has CIMTYPE {} which does not fit the bound field;", wmi_to_utf8(name), type);
+    }
+
+    template<std::size_t... I>
+    void read_row(Backend& backend, const std::uint32_t row, Row& out, std::index_sequence<I...>)
+    {
+        (read_field<I>(backend, row, out), ...);
+    }
+
+    template<std::size_t I>
+    void read_field(Backend& backend, const std::uint32_t row, Row& out)
+    {
+        const auto& field = std::get<I>(wmi_schema<Row>::fields);
+        auto& value = out.*(field.member);
+        using member_type = std::remove_reference_t<decltype(value)>;
+
+        if constexpr (wmi_schema_value<member_type>::optional)
+        {
+            if (!value)
+                value.emplace();
+
+            if (!read_value(backend, row, handles_[I], *value))
+            {
+                value.reset();
+                failed_reads_++;
+            }
+        }
+        else if (!read_value(backend, row, handles_[I], value))
+        {
+            failed_reads_++;
+        }
+    }
+
+    // Leaves value value initialized and returns false if the read fails.
+    template<typename Value>
+    static bool read_value(Backend& backend, const std::uint32_t row, const long handle, Value& value)
+    {
+        long read_bytes = 0;
+
+        if constexpr (std::is_same_v<Value, std::wstring>)
+        {
+            // read into the existing capacity first, only grow when the backend asks for more
+            value.resize(value.capacity());
+
+            auto read = backend.read(row, handle, static_cast<long>(value.size() * sizeof(wchar_t)), read_bytes, value.data());
+
+            if (!read)
+            {
+                value.resize(static_cast<std::size_t>(read_bytes) / sizeof(wchar_t));
+                read = read_bytes > 0 && backend.read(row, handle, read_bytes, read_bytes, value.data());
+            }
+
+            value.resize(read ? std::min(value.size(), static_cast<std::size_t>(read_bytes) / sizeof(wchar_t)) : 0);
+
+            // the read includes the null terminator
+            while (!value.empty() && value.back() == L'\0')
+                value.pop_back();
+
+            return read;
+        }
+        else if constexpr (std::is_same_v<Value, bool>)
+        {
+            std::uint16_t flag = 0; // CIM_BOOLEAN is read as 16 bits
+            const auto read = backend.read(row, handle, sizeof(flag), read_bytes, &flag);
+            value = read && flag != 0;
+            return read;
+        }
+        else
+        {
+            value = Value{};
+
+            if (backend.read(row, handle, sizeof(Value), read_bytes, &value))
+                return true;
+
+            value = Value{};
+            return false;
+        }
+    }
+
+    wmi_helper<AnySize, Backend>& helper_;
+    long handles_[field_count > 0 ? field_count : 1] = {};
+    bool resolved_ = false;
+    std::optional<wmi_schema_error> error_;
+    std::size_t failed_reads_ = 0;
+};
+
+template<typename Row, std::size_t AnySize, typename Backend>
+wmi_typed_query<Row, AnySize, Backend> wmi_make_typed_query(wmi_helper<AnySize, Backend>& helper)
+{
+    return wmi_typed_query<Row, AnySize, Backend>(helper);
+}
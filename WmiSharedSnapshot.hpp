@@ -0,0 +1,601 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+
+#include "WmiCaptureFile.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Latest snapshots of one sampler in a named shared memory region, so several processes on a host read them instead of
+// each running a wmi_helper of its own:
+//
+//   wmi_capture_file_encoder_32 encoder(L"Win32_PerfFormattedData_PerfProc_Process");
+//   encoder.attach(helper, name_handle);
+//   wmi_shared_snapshot_publisher_32 publisher("wmi_processes", std::move(encoder));
+//   helper.query_async(publisher.callback());
+//
+//   wmi_shared_snapshot_reader reader("wmi_processes");             in the consumers
+//   if (const auto snapshot = reader.snapshot())
+//       snapshot->column(*reader.property("Name"))->string(0);
+//
+// Region layout, little endian:
+//
+//   wmi_shared_snapshot_header         magic, version and geometry, number of the latest snapshot
+//   schema block                       as in capture files, class name and properties
+//   slot_count slots of slot_size      a wmi_shared_snapshot_slot, then a standalone capture file tick block
+//
+// Snapshots are numbered from 1 and go to slot number % slot_count. Every slot is a seqlock: its sequence is odd while
+// the publisher writes it, so readers detect snapshots they raced with. Readers use the columns in place, they have
+// slot_count - 1 publish periods to finish with a snapshot before its slot is written again, valid() tells if it was.
+
+inline constexpr char wmi_shared_snapshot_magic[8] = { 'W', 'M', 'I', 'S', 'H', 'M', '\0', '\1' };
+inline constexpr std::uint32_t wmi_shared_snapshot_version = 1;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared snapshots need lock free 64 bit atomics.");
+
+struct wmi_shared_snapshot_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t slot_count;
+    std::uint64_t slot_size; // bytes per slot, its wmi_shared_snapshot_slot included
+    std::uint64_t slots_offset; // of the first slot, the schema block lies between the header and it
+    std::atomic<std::uint64_t> latest; // number of the last published snapshot, 0 before the first
+    std::uint64_t reserved[3];
+};
+
+struct wmi_shared_snapshot_slot
+{
+    std::atomic<std::uint64_t> sequence; // odd while the slot is written
+    std::atomic<std::uint64_t> number; // of the snapshot
+    std::atomic<std::uint64_t> size; // of the tick block that follows
+    std::uint64_t reserved;
+};
+
+static_assert(sizeof(wmi_shared_snapshot_header) == 64 && sizeof(wmi_shared_snapshot_slot) == 32, "unexpected shared snapshot layout.");
+
+class wmi_shared_snapshot_error : public std::runtime_error
+{
+public:
+
+    explicit wmi_shared_snapshot_error(const std::string& message) : std::runtime_error(message)
+    {
+    }
+};
+
+// Named shared memory mapping: a POSIX shm object, or a pagefile backed file mapping on Windows. The creator removes the
+// name again, mappings stay valid until they are unmapped. Move only.
+class wmi_shared_memory
+{
+public:
+
+    // Creates the region, replacing a stale one of the same name.
+    static wmi_shared_memory create(const char* name, const std::size_t size)
+    {
+        wmi_shared_memory memory;
+        memory.size_ = size;
+
+#ifdef _WIN32
+        memory.mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<std::uint64_t>(size) >> 32), static_cast<DWORD>(size), name);
+
+        if (!memory.mapping_)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: CreateFileMapping({}) failed: {}", name, GetLastError()));
+
+        memory.data_ = static_cast<char*>(MapViewOfFile(memory.mapping_, FILE_MAP_WRITE, 0, 0, size));
+#else
+        shm_unlink(name);
+
+        const auto fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+        if (fd < 0)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: shm_open({}) failed: {}", name, std::strerror(errno)));
+
+        memory.name_ = name;
+
+        if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        {
+            auto* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            memory.data_ = data == MAP_FAILED ? nullptr : static_cast<char*>(data);
+        }
+
+        close(fd);
+#endif
+
+        if (!memory.data_)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: mapping {} failed.", name));
+
+        return memory;
+    }
+
+    // Maps an existing region read only.
+    static wmi_shared_memory open(const char* name)
+    {
+        wmi_shared_memory memory;
+
+#ifdef _WIN32
+        memory.mapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+
+        if (!memory.mapping_)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: OpenFileMapping({}) failed: {}", name, GetLastError()));
+
+        memory.data_ = static_cast<char*>(MapViewOfFile(memory.mapping_, FILE_MAP_READ, 0, 0, 0));
+
+        MEMORY_BASIC_INFORMATION info;
+
+        if (memory.data_ && VirtualQuery(memory.data_, &info, sizeof(info)))
+            memory.size_ = info.RegionSize;
+#else
+        const auto fd = shm_open(name, O_RDONLY, 0);
+
+        if (fd < 0)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: shm_open({}) failed: {}", name, std::strerror(errno)));
+
+        struct stat status;
+
+        if (fstat(fd, &status) == 0 && status.st_size > 0)
+        {
+            memory.size_ = static_cast<std::size_t>(status.st_size);
+
+            auto* data = mmap(nullptr, memory.size_, PROT_READ, MAP_SHARED, fd, 0);
+            memory.data_ = data == MAP_FAILED ? nullptr : static_cast<char*>(data);
+        }
+
+        close(fd);
+#endif
+
+        if (!memory.data_)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_memory: mapping {} failed.", name));
+
+        return memory;
+    }
+
+    wmi_shared_memory(wmi_shared_memory&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    wmi_shared_memory& operator=(wmi_shared_memory&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+#ifdef _WIN32
+            std::swap(mapping_, other.mapping_);
+#else
+            std::swap(name_, other.name_);
+#endif
+        }
+
+        return *this;
+    }
+
+    ~wmi_shared_memory()
+    {
+        release();
+    }
+
+    [[nodiscard]] char* data() const
+    {
+        return data_;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+
+    wmi_shared_memory() = default;
+
+    void release()
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+
+        if (mapping_)
+            CloseHandle(mapping_);
+
+        mapping_ = nullptr;
+#else
+        if (data_)
+            munmap(data_, size_);
+
+        if (!name_.empty())
+            shm_unlink(name_.c_str());
+
+        name_.clear();
+#endif
+
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    char* data_ = nullptr;
+    std::size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE mapping_ = nullptr;
+#else
+    std::string name_; // to unlink, set for created regions only
+#endif
+};
+
+// Publishes results into a new shared memory region, see above. The encoder's attached properties make up the schema.
+// Throws wmi_shared_snapshot_error if a snapshot does not fit into a slot, slot_size is best chosen with headroom for
+// the instances to come.
+template<std::size_t AnySize>
+class wmi_shared_snapshot_publisher
+{
+public:
+
+    wmi_shared_snapshot_publisher(const char* name, wmi_capture_file_encoder<AnySize> encoder, const std::uint32_t slot_count = 4, const std::size_t slot_size = std::size_t(4) << 20)
+        : encoder_(std::move(encoder)), memory_(create(name, slot_count, slot_size))
+    {
+    }
+
+    // Writes the result into the next slot and makes it the latest snapshot.
+    void publish(const wmi_wrapper_class_result<AnySize>& wmi_result)
+    {
+        tick_.clear();
+        encoder_.encode_standalone(wmi_result, tick_);
+
+        const auto& header = this->header();
+
+        if (tick_.size() > header.slot_size - sizeof(wmi_shared_snapshot_slot))
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_snapshot_publisher: a snapshot of {} bytes does not fit into slots of {} bytes.", tick_.size(), header.slot_size));
+
+        const auto number = ++published_;
+        auto* slot_data = memory_.data() + header.slots_offset + (number % header.slot_count) * header.slot_size;
+        auto& slot = *reinterpret_cast<wmi_shared_snapshot_slot*>(slot_data);
+
+        const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.number.store(number, std::memory_order_relaxed);
+        slot.size.store(tick_.size(), std::memory_order_relaxed);
+        std::memcpy(slot_data + sizeof(wmi_shared_snapshot_slot), tick_.data(), tick_.size());
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        this->header().latest.store(number, std::memory_order_release);
+    }
+
+    // Callback for wmi_helper::query_async() that publishes every delivered result.
+    [[nodiscard]] wmi_helper_callback<AnySize> callback()
+    {
+        return [this](const wmi_helper_config&, const wmi_wrapper_class_result<AnySize>& wmi_result)
+        {
+            publish(wmi_result);
+        };
+    }
+
+    [[nodiscard]] std::uint64_t published() const
+    {
+        return published_;
+    }
+
+private:
+
+    wmi_shared_snapshot_header& header() const
+    {
+        return *reinterpret_cast<wmi_shared_snapshot_header*>(memory_.data());
+    }
+
+    wmi_shared_memory create(const char* name, const std::uint32_t slot_count, std::size_t slot_size)
+    {
+        if (slot_count < 2)
+            throw wmi_shared_snapshot_error("wmi_shared_snapshot_publisher needs at least 2 slots.");
+
+        fmt::memory_buffer schema;
+        encoder_.encode_schema_block(schema);
+
+        // slots on their own cache lines
+        const auto slots_offset = (sizeof(wmi_shared_snapshot_header) + schema.size() + 63) / 64 * 64;
+        slot_size = (std::max(slot_size, sizeof(wmi_shared_snapshot_slot) + 64) + 63) / 64 * 64;
+
+        auto memory = wmi_shared_memory::create(name, slots_offset + slot_count * slot_size);
+        std::memset(memory.data(), 0, memory.size());
+
+        auto* header = new (memory.data()) wmi_shared_snapshot_header{};
+        header->version = wmi_shared_snapshot_version;
+        header->slot_count = slot_count;
+        header->slot_size = slot_size;
+        header->slots_offset = slots_offset;
+        std::memcpy(memory.data() + sizeof(wmi_shared_snapshot_header), schema.data(), schema.size());
+
+        for (std::uint32_t slot = 0; slot < slot_count; slot++)
+            new (memory.data() + slots_offset + slot * slot_size) wmi_shared_snapshot_slot{};
+
+        // readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, wmi_shared_snapshot_magic, sizeof(header->magic));
+
+        return memory;
+    }
+
+    wmi_capture_file_encoder<AnySize> encoder_;
+    wmi_shared_memory memory_;
+    fmt::memory_buffer tick_;
+    std::uint64_t published_ = 0;
+};
+
+using wmi_shared_snapshot_publisher_32 = wmi_shared_snapshot_publisher<32>;
+
+// One snapshot of a shared memory region. Its columns point into the region, check valid() after using them.
+class wmi_shared_snapshot_view
+{
+public:
+
+    // A column header as it was checked and where its data starts.
+    struct column_entry
+    {
+        wmi_capture_file_column header;
+        const char* data;
+    };
+
+    wmi_shared_snapshot_view(const wmi_shared_snapshot_slot& slot, const std::uint64_t sequence, const std::uint64_t number, const wmi_capture_file_tick& tick, std::vector<column_entry> columns)
+        : slot_(&slot), sequence_(sequence), number_(number), tick_(tick), columns_(std::move(columns))
+    {
+    }
+
+    [[nodiscard]] std::uint64_t number() const
+    {
+        return number_;
+    }
+
+    [[nodiscard]] std::uint64_t time() const
+    {
+        return tick_.time;
+    }
+
+    [[nodiscard]] std::uint32_t rows() const
+    {
+        return tick_.rows;
+    }
+
+    // Column of a property (its index in wmi_shared_snapshot_reader::properties()), empty if the snapshot has none.
+    [[nodiscard]] std::optional<wmi_capture_file_column_view> column(const std::uint32_t property) const
+    {
+        static const std::vector<std::string_view> no_dictionary;
+
+        for (const auto& column : columns_)
+        {
+            if (column.header.property == property)
+                return wmi_capture_file_column_view(column.header, 0, column.data, tick_.rows, no_dictionary);
+        }
+
+        return std::nullopt;
+    }
+
+    // false once the publisher started to write the slot again, values read from the columns may be torn then.
+    [[nodiscard]] bool valid() const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot_->sequence.load(std::memory_order_relaxed) == sequence_;
+    }
+
+private:
+
+    const wmi_shared_snapshot_slot* slot_;
+    std::uint64_t sequence_;
+    std::uint64_t number_;
+    wmi_capture_file_tick tick_;
+    std::vector<column_entry> columns_;
+};
+
+// Maps a region created by a wmi_shared_snapshot_publisher read only. Throws wmi_shared_snapshot_error if it does not
+// exist or is not a snapshot region.
+class wmi_shared_snapshot_reader
+{
+public:
+
+    explicit wmi_shared_snapshot_reader(const char* name) : memory_(wmi_shared_memory::open(name))
+    {
+        if (memory_.size() < sizeof(wmi_shared_snapshot_header) || std::memcmp(header().magic, wmi_shared_snapshot_magic, sizeof(wmi_shared_snapshot_magic)) != 0)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_snapshot_reader: {} is not a snapshot region.", name));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        const auto& header = this->header();
+
+        if (header.version != wmi_shared_snapshot_version)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_snapshot_reader: {} has an unsupported version.", name));
+
+        if (header.slot_count == 0 || header.slot_size < sizeof(wmi_shared_snapshot_slot) || header.slots_offset < sizeof(wmi_shared_snapshot_header)
+            || header.slots_offset > memory_.size() || (memory_.size() - header.slots_offset) / header.slot_size < header.slot_count)
+            throw wmi_shared_snapshot_error(fmt::format("wmi_shared_snapshot_reader: {} is damaged.", name));
+
+        read_schema();
+    }
+
+    [[nodiscard]] std::string_view class_name() const
+    {
+        return class_name_;
+    }
+
+    // UTF-8 property names, columns are looked up by their index.
+    [[nodiscard]] const std::vector<std::string_view>& properties() const
+    {
+        return properties_;
+    }
+
+    [[nodiscard]] std::optional<std::uint32_t> property(const std::string_view name) const
+    {
+        const auto it = std::find(properties_.begin(), properties_.end(), name);
+
+        if (it == properties_.end())
+            return std::nullopt;
+
+        return static_cast<std::uint32_t>(it - properties_.begin());
+    }
+
+    // Number of the latest snapshot, 0 before the first.
+    [[nodiscard]] std::uint64_t latest() const
+    {
+        return header().latest.load(std::memory_order_acquire);
+    }
+
+    // The latest snapshot, empty before the first one. Retries while it races with the publisher.
+    [[nodiscard]] std::optional<wmi_shared_snapshot_view> snapshot() const
+    {
+        for (auto attempt = 0; attempt < 64; attempt++)
+        {
+            const auto number = latest();
+
+            if (number == 0)
+                return std::nullopt;
+
+            if (auto view = read(number))
+                return view;
+
+            std::this_thread::yield();
+        }
+
+        return std::nullopt;
+    }
+
+    // Waits up to timeout for a snapshot newer than number, polling every millisecond.
+    [[nodiscard]] std::optional<wmi_shared_snapshot_view> wait(const std::uint64_t number, const std::chrono::milliseconds timeout) const
+    {
+        const auto until = std::chrono::steady_clock::now() + timeout;
+
+        while (latest() <= number)
+        {
+            if (std::chrono::steady_clock::now() >= until)
+                return std::nullopt;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return snapshot();
+    }
+
+private:
+
+    [[nodiscard]] const wmi_shared_snapshot_header& header() const
+    {
+        return *reinterpret_cast<const wmi_shared_snapshot_header*>(memory_.data());
+    }
+
+    // The snapshot in the slot of number, whatever it holds by now. Empty while it is written or if it was written
+    // during the read. Everything read from the slot is bounds checked, as it may be torn.
+    [[nodiscard]] std::optional<wmi_shared_snapshot_view> read(const std::uint64_t number) const
+    {
+        const auto& header = this->header();
+        const auto* slot_data = memory_.data() + header.slots_offset + (number % header.slot_count) * header.slot_size;
+        const auto& slot = *reinterpret_cast<const wmi_shared_snapshot_slot*>(slot_data);
+
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+
+        if (sequence & 1)
+            return std::nullopt;
+
+        const auto current = slot.number.load(std::memory_order_relaxed);
+        const auto size = slot.size.load(std::memory_order_relaxed);
+        const auto* data = slot_data + sizeof(wmi_shared_snapshot_slot);
+
+        if (current == 0 || size < sizeof(wmi_capture_file_block) + sizeof(wmi_capture_file_tick) || size > header.slot_size - sizeof(wmi_shared_snapshot_slot))
+            return std::nullopt;
+
+        wmi_capture_file_tick tick;
+        std::memcpy(&tick, data + sizeof(wmi_capture_file_block), sizeof(tick));
+
+        std::vector<wmi_shared_snapshot_view::column_entry> columns;
+        auto offset = sizeof(wmi_capture_file_block) + sizeof(wmi_capture_file_tick);
+
+        for (std::uint32_t column = 0; column < tick.columns; column++)
+        {
+            if (size - offset < sizeof(wmi_capture_file_column))
+                return std::nullopt;
+
+            wmi_capture_file_column column_header;
+            std::memcpy(&column_header, data + offset, sizeof(column_header));
+
+            if (!fits(column_header, tick.rows) || column_header.size > size - offset - sizeof(column_header) || column_header.property >= properties_.size())
+                return std::nullopt;
+
+            columns.push_back({ column_header, data + offset + sizeof(column_header) });
+            offset += sizeof(column_header) + column_header.size;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            return std::nullopt;
+
+        return wmi_shared_snapshot_view(slot, sequence, current, tick, std::move(columns));
+    }
+
+    // The data of a column has to be large enough for its rows, snapshots hold no dictionary or repeat columns. Columns
+    // use the headers checked here, not the ones in the slot.
+    [[nodiscard]] static bool fits(const wmi_capture_file_column& header, const std::uint32_t rows)
+    {
+        auto required = (static_cast<std::uint64_t>(rows) + 63) / 64 * sizeof(std::uint64_t);
+
+        if (header.encoding == wmi_capture_file_encoding::scalar)
+            required += static_cast<std::uint64_t>(rows) * header.width;
+        else if (header.encoding == wmi_capture_file_encoding::utf8)
+            required += (static_cast<std::uint64_t>(rows) + 1) * sizeof(std::uint32_t);
+        else
+            return false;
+
+        return header.width <= 8 && header.size >= required;
+    }
+
+    void read_schema()
+    {
+        const auto& header = this->header();
+        auto offset = sizeof(wmi_shared_snapshot_header);
+
+        const auto load_u32 = [this, &offset, end = header.slots_offset]()
+        {
+            if (end - offset < sizeof(std::uint32_t))
+                throw wmi_shared_snapshot_error("wmi_shared_snapshot_reader: the schema is damaged.");
+
+            std::uint32_t value;
+            std::memcpy(&value, memory_.data() + offset, sizeof(value));
+            offset += sizeof(value);
+            return value;
+        };
+
+        const auto load_string = [this, &offset, &load_u32, end = header.slots_offset]()
+        {
+            const auto size = load_u32();
+
+            if (end - offset < size)
+                throw wmi_shared_snapshot_error("wmi_shared_snapshot_reader: the schema is damaged.");
+
+            const std::string_view value(memory_.data() + offset, size);
+            offset += size;
+            return value;
+        };
+
+        wmi_capture_file_block block;
+
+        if (header.slots_offset - offset < sizeof(block))
+            throw wmi_shared_snapshot_error("wmi_shared_snapshot_reader: the region has no schema.");
+
+        std::memcpy(&block, memory_.data() + offset, sizeof(block));
+        offset += sizeof(block);
+
+        if (block.kind != wmi_capture_file_block_kind::schema)
+            throw wmi_shared_snapshot_error("wmi_shared_snapshot_reader: the region has no schema.");
+
+        class_name_ = load_string();
+        properties_.resize(load_u32());
+
+        for (auto& property : properties_)
+            property = load_string();
+    }
+
+    wmi_shared_memory memory_;
+    std::string_view class_name_;
+    std::vector<std::string_view> properties_;
+};
@@ -0,0 +1,91 @@
+// Printing a 10k row result: the WmiFormat.hpp formatters into a reused fmt buffer, against the std::ostringstream
+// loop example.cpp's print_result used, which goes through wmi_any and a std::string per string value.
+#include <sstream>
+#include <string>
+
+#include "WmiFormat.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t rows = 10000;
+
+int main()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"BankLabel", CIM_STRING);
+    backend.add_property(L"DeviceLocator", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.add_property(L"Capacity", CIM_UINT64);
+    backend.resize(rows);
+
+    for (std::size_t row = 0; row < rows; row++)
+    {
+        backend.set(row, L"BankLabel", fmt::format(L"BANK {}", row % 4));
+        backend.set(row, L"DeviceLocator", fmt::format(L"ChannelA-DIMM{}", row));
+        backend.set(row, L"Speed", static_cast<std::uint32_t>(3200 + row % 3 * 400));
+        backend.set<std::uint64_t>(row, L"Capacity", std::uint64_t(8 + row % 4 * 8) << 30);
+    }
+
+    helper.init(wmi_helper_config(L"Win32_PhysicalMemory", 1, wmi_helper_config::infinite, 1000));
+
+    const auto bank = helper.capture_var(L"BankLabel");
+    const auto locator = helper.capture_var(L"DeviceLocator");
+    const auto speed = helper.capture_var(L"Speed");
+    const auto capacity = helper.capture_var(L"Capacity");
+    const auto wmi_result = helper.query().back();
+    const auto& result = wmi_result.result;
+
+    fmt::memory_buffer out;
+    std::size_t checksum = 0;
+
+    const auto print = [&](const char* path, const double ns, const std::size_t bytes)
+    {
+        fmt::print("{:<24} {:8.1f} us/result  {:6.1f} ns/row  {:6.0f} MB/s\n", path, ns / 1e3, ns / rows, bytes / ns * 1e3);
+    };
+
+    const auto run = [&](const char* path, const auto& format)
+    {
+        const auto ns = wmi_bench_ns([&]()
+        {
+            out.clear();
+            format();
+            checksum += out.size();
+        });
+
+        print(path, ns, out.size());
+    };
+
+    run("fmt {:k}", [&]() { fmt::format_to(out, "{:k}", wmi_named(result, helper)); });
+    run("fmt {:c}", [&]() { fmt::format_to(out, "{:c}", wmi_named(result, helper)); });
+    run("fmt {:t}", [&]() { fmt::format_to(out, "{:t}", wmi_named(result, helper)); });
+
+    // the same key=value lines as {:k}
+    std::ostringstream stream;
+
+    const auto stream_ns = wmi_bench_ns([&]()
+    {
+        stream.str({});
+
+        const auto banks = result[bank];
+        const auto locators = result[locator];
+        const auto speeds = result[speed];
+        const auto capacities = result[capacity];
+
+        for (std::size_t row = 0; row < banks.size(); row++)
+        {
+            stream << "BankLabel=" << banks[row].get_string() << " DeviceLocator=" << locators[row].get_string()
+                << " Speed=" << speeds[row].get<std::uint32_t>() << " Capacity=" << capacities[row].get<std::uint64_t>() << '\n';
+        }
+
+        checksum += static_cast<std::size_t>(stream.tellp());
+    });
+
+    out.clear();
+    fmt::format_to(out, "{:k}", wmi_named(result, helper));
+
+    print("ostringstream", stream_ns, stream.str().size());
+    fmt::print("same output as {{:k}}: {}, checksum {}\n", stream.str() == fmt::to_string(out), checksum);
+
+    return 0;
+}
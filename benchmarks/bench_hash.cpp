@@ -0,0 +1,63 @@
+// Row and column hashing cost per cell (wmi_cell::hash_rows()), against comparing every cell with the previous result.
+#include <string>
+#include <vector>
+
+#include "WmiHelper.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t rows = 10000;
+
+static void run(const char* name, const std::vector<wmi_cell>& cells, const std::wstring& arena)
+{
+    std::vector<std::uint64_t> row_hashes(cells.size());
+    std::uint64_t checksum = 0;
+
+    const auto hash_ns = wmi_bench_ns([&]()
+    {
+        checksum += wmi_cell::hash_rows(cells.data(), cells.size(), arena, 1, row_hashes.data());
+    });
+
+    // what change detection costs without hashes: every cell against the same cell of an equal previous result
+    const wmi_column_view<32> column(cells.data(), cells.size(), arena);
+    const wmi_column_view<32> previous(cells.data(), cells.size(), arena);
+
+    const auto compare_ns = wmi_bench_ns([&]()
+    {
+        for (std::size_t row = 0; row < column.size(); row++)
+            checksum += column.value_equals(row, previous, row);
+    });
+
+    fmt::print("{:<16} hash {:5.2f} ns/cell, compare {:5.2f} ns/cell (checksum {:x})\n", name, hash_ns / cells.size(), compare_ns / cells.size(), checksum);
+}
+
+int main()
+{
+    std::vector<wmi_cell> cells;
+    std::wstring arena;
+
+    for (std::uint64_t row = 0; row < rows; row++)
+        cells.push_back(wmi_cell::from(CIM_UINT64, row * 0x9e3779b97f4a7c15ull));
+
+    run("uint64", cells, arena);
+    cells.clear();
+
+    for (std::uint32_t row = 0; row < rows; row++)
+        cells.push_back(wmi_cell::from(CIM_REAL64, row * 0.25));
+
+    run("real64", cells, arena);
+    cells.clear();
+
+    // fits a cell, like short process names
+    for (std::size_t row = 0; row < rows; row++)
+        cells.push_back(wmi_cell::string(CIM_STRING, fmt::format(L"svc{}", row % 1000), arena));
+
+    run("string, inline", cells, arena);
+    cells.clear();
+
+    for (std::size_t row = 0; row < rows; row++)
+        cells.push_back(wmi_cell::string(CIM_STRING, fmt::format(L"C:\\Windows\\System32\\svchost_{}.exe", row), arena));
+
+    run("string, arena", cells, arena);
+
+    return 0;
+}
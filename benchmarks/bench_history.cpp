@@ -0,0 +1,134 @@
+// Compression and decoding speed of wmi_history_series for 2000 instances of four properties sampled once a second for
+// an hour, every sample time off by up to 5 ms:
+//
+//   slow   a counter growing at a rate that changes every minute, a gauge that changes one sample in 64, a constant
+//          and a real that changes every 10 seconds
+//   noisy  the counter growing by a random amount, and a real that changes on every sample
+#include <vector>
+
+#include "WmiHistory.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t instances = 2000;
+constexpr std::size_t properties = 4;
+constexpr std::uint64_t ticks = 3600;
+
+static std::uint64_t state = 0x9e3779b97f4a7c15ull;
+
+static std::uint64_t next_random()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static std::uint64_t real_bits(const double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static void run(const char* name, const bool noisy)
+{
+    std::vector<wmi_history_series> series;
+    series.reserve(instances * properties);
+
+    for (std::size_t instance = 0; instance < instances; instance++)
+    {
+        series.emplace_back(wmi_history_kind::unsigned_integer, 1024);
+        series.emplace_back(wmi_history_kind::unsigned_integer, 1024);
+        series.emplace_back(wmi_history_kind::unsigned_integer, 1024);
+        series.emplace_back(wmi_history_kind::real, 1024);
+    }
+
+    // per instance state, the samples of a tick are generated before its appends are timed
+    std::vector<std::uint64_t> counters(instances);
+    std::vector<std::uint64_t> rates(instances, 100000);
+    std::vector<std::uint64_t> gauges(instances, 4096);
+    std::vector<double> reals(instances, 12.5);
+    std::vector<std::uint64_t> tick_bits(instances * properties);
+
+    std::size_t bytes = 0;
+    double append_ns = 0.0;
+
+    for (std::uint64_t tick = 0; tick < ticks; tick++)
+    {
+        const auto time = 1700000000000 + tick * 1000 + next_random() % 11 - 5;
+
+        for (std::size_t instance = 0; instance < instances; instance++)
+        {
+            const auto random = next_random();
+
+            if (tick % 60 == 0)
+                rates[instance] = 100000 + random % 50000;
+
+            counters[instance] += noisy ? random % 1000000 : rates[instance];
+            gauges[instance] += (random >> 8) % 64 == 0 ? 4096 : 0;
+
+            if (noisy || tick % 10 == 0)
+                reals[instance] = static_cast<double>((random >> 16) % 10000) / 100.0;
+
+            auto* const bits = &tick_bits[instance * properties];
+            bits[0] = counters[instance];
+            bits[1] = gauges[instance];
+            bits[2] = instance;
+            bits[3] = real_bits(reals[instance]);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < series.size(); i++)
+            bytes += static_cast<std::size_t>(series[i].append(time, tick_bits[i]));
+
+        append_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::uint64_t checksum = 0;
+
+    const auto decode_ns = wmi_bench_ns([&]()
+    {
+        for (const auto& one : series)
+            one.for_each([&](const wmi_history_sample& sample) { checksum += sample.bits; });
+    });
+
+    const auto iterate_ns = wmi_bench_ns([&]()
+    {
+        for (const auto& one : series)
+        {
+            for (const auto& sample : one)
+                checksum += sample.time;
+        }
+    });
+
+    // one minute of every series, most chunks are skipped and one is decoded in part
+    const auto range_ns = wmi_bench_ns([&]()
+    {
+        for (const auto& one : series)
+            one.for_each(1700000000000 + 1800000, 1700000000000 + 1860000, [&](const wmi_history_sample& sample) { checksum += sample.bits; });
+    });
+
+    std::size_t kind_bytes[properties] = {};
+
+    for (std::size_t i = 0; i < series.size(); i++)
+        kind_bytes[i % properties] += series[i].bytes();
+
+    const auto total = static_cast<double>(ticks * series.size());
+    const auto per_property = total / properties;
+
+    fmt::print("{}: {:.0f} samples in {:.1f} MB, {:.2f} bytes/sample (counter {:.2f}, gauge {:.2f}, constant {:.2f}, real {:.2f})\n", name, total,
+        bytes / 1e6, bytes / total, kind_bytes[0] / per_property, kind_bytes[1] / per_property, kind_bytes[2] / per_property, kind_bytes[3] / per_property);
+    fmt::print("  append     {:6.1f} ns/sample\n", append_ns / total);
+    fmt::print("  for_each   {:6.1f} ns/sample  {:6.0f}M samples/s\n", decode_ns / total, total / decode_ns * 1e3);
+    fmt::print("  iterators  {:6.1f} ns/sample  {:6.0f}M samples/s\n", iterate_ns / total, total / iterate_ns * 1e3);
+    fmt::print("  one minute {:6.1f} us for all series, checksum {}\n", range_ns / 1e3, checksum);
+}
+
+int main()
+{
+    run("slow", false);
+    run("noisy", true);
+
+    return 0;
+}
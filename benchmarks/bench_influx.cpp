@@ -0,0 +1,113 @@
+// InfluxDB line protocol for synthetic snapshots of 10k process instances: wmi_influx_encoder with its per instance
+// prefixes reused, with the prefixes rendered again for every result, and wmi_influx_sink batching to /dev/null.
+#include <algorithm>
+#include <vector>
+
+#include "WmiExport.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t instances = 10000;
+constexpr std::size_t snapshots = 16;
+
+int main()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint64_t tick = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Description", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT64);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"Priority", CIM_UINT32);
+    backend.add_property(L"Critical", CIM_BOOLEAN);
+    backend.resize(instances);
+
+    for (std::size_t row = 0; row < instances; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process {}", row));
+        backend.set(row, L"Description", fmt::format(L"\"quoted\" description of process {}", row));
+        backend.set(row, L"Priority", static_cast<std::uint32_t>(row % 32));
+        backend.set(row, L"Critical", row % 7 == 0);
+    }
+
+    const std::wstring processor_time = L"PercentProcessorTime";
+    const std::wstring working_set = L"WorkingSet";
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        tick++;
+
+        for (std::size_t row = 0; row < instances; row++)
+        {
+            fake.set(row, processor_time, tick * row * 156250);
+            fake.set(row, working_set, (tick + row) << 12);
+        }
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", snapshots, wmi_helper_config::infinite, 1000));
+
+    wmi_capture_options key;
+    key.key = true;
+
+    const auto name = helper.capture_var(L"Name", key);
+    const wmi_var_handle fields[] = {
+        helper.capture_var(L"Description"),
+        helper.capture_var(L"PercentProcessorTime"),
+        helper.capture_var(L"WorkingSet"),
+        helper.capture_var(L"Priority"),
+        helper.capture_var(L"Critical"),
+    };
+
+    const auto results = helper.query();
+
+    const auto make_encoder = [&]()
+    {
+        wmi_influx_encoder_32 encoder(L"Win32_Process", name);
+
+        for (const auto handle : fields)
+            encoder.attach(helper, handle);
+
+        return encoder;
+    };
+
+    auto encoder = make_encoder();
+    fmt::memory_buffer out;
+    std::size_t next = 0;
+    std::size_t bytes = 0;
+
+    const auto encode_ns = wmi_bench_ns([&]()
+    {
+        out.clear();
+        encoder.encode(results[next++ % results.size()], out);
+        bytes = out.size();
+    });
+
+    // what the encoder costs when the measurement and tag part of every line is rendered and escaped again
+    const auto fresh_ns = wmi_bench_ns([&]()
+    {
+        auto fresh = make_encoder();
+
+        out.clear();
+        fresh.encode(results[next++ % results.size()], out);
+    });
+
+    wmi_influx_sink<32> sink(make_encoder(), wmi_export_output("/dev/null"));
+
+    const auto sink_ns = wmi_bench_ns([&]()
+    {
+        sink.write(results[next++ % results.size()]);
+    });
+
+    const auto print = [&](const char* path, const double ns)
+    {
+        fmt::print("{:<28} {:8.1f} us/snapshot  {:6.1f} ns/line  {:6.0f} MB/s\n", path, ns / 1e3, ns / instances, bytes / ns * 1e3);
+    };
+
+    print("encode", encode_ns);
+    print("encode, prefixes rendered", fresh_ns);
+    print("sink to /dev/null", sink_ns);
+    fmt::print("{} bytes per snapshot, first line: {}", bytes, std::string_view(out.data(), std::find(out.data(), out.data() + out.size(), '\n') - out.data() + 1));
+
+    return 0;
+}
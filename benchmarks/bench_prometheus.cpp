@@ -0,0 +1,155 @@
+// Prometheus text exposition of synthetic snapshots with 10k process instances and five gauges each, 50k samples per
+// render: wmi_prometheus_renderer with its labels reused, with the labels escaped again for every result, and the
+// global operator new calls of the steady state renders.
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "WmiExport.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t instances = 10000;
+constexpr std::size_t snapshots = 16;
+
+static std::atomic<std::uint64_t> allocations{ 0 };
+
+void* operator new(const std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto* data = std::malloc(size ? size : 1))
+        return data;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](const std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* data) noexcept
+{
+    std::free(data);
+}
+
+void operator delete[](void* data) noexcept
+{
+    operator delete(data);
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+    operator delete(data);
+}
+
+void operator delete[](void* data, std::size_t) noexcept
+{
+    operator delete[](data);
+}
+
+int main()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint64_t tick = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT64);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"HandleCount", CIM_UINT32);
+    backend.add_property(L"Priority", CIM_UINT32);
+    backend.add_property(L"Load", CIM_REAL64);
+    backend.resize(instances);
+
+    for (std::size_t row = 0; row < instances; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process \"{}\"", row));
+        backend.set(row, L"HandleCount", static_cast<std::uint32_t>(row % 4096));
+        backend.set(row, L"Priority", static_cast<std::uint32_t>(row % 32));
+    }
+
+    const std::wstring processor_time = L"PercentProcessorTime";
+    const std::wstring working_set = L"WorkingSet";
+    const std::wstring load = L"Load";
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        tick++;
+
+        for (std::size_t row = 0; row < instances; row++)
+        {
+            fake.set(row, processor_time, tick * row * 156250);
+            fake.set(row, working_set, (tick + row) << 12);
+            fake.set(row, load, static_cast<double>(tick * row) / 3.0);
+        }
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", snapshots, wmi_helper_config::infinite, 1000));
+
+    const auto name = helper.capture_var(L"Name");
+    const wmi_var_handle gauges[] = {
+        helper.capture_var(L"PercentProcessorTime"),
+        helper.capture_var(L"WorkingSet"),
+        helper.capture_var(L"HandleCount"),
+        helper.capture_var(L"Priority"),
+        helper.capture_var(L"Load"),
+    };
+
+    const auto results = helper.query();
+
+    const auto make_renderer = [&]()
+    {
+        wmi_prometheus_renderer_32 renderer(L"Win32_Process", name);
+
+        for (const auto handle : gauges)
+            renderer.attach(helper, handle);
+
+        renderer.timestamps(true);
+        return renderer;
+    };
+
+    auto renderer = make_renderer();
+    std::size_t next = 0;
+    std::size_t bytes = 0;
+    std::string_view text;
+
+    const auto render_ns = wmi_bench_ns([&]()
+    {
+        text = renderer.render(results[next++ % results.size()]);
+        bytes = text.size();
+    });
+
+    const auto before = allocations.load(std::memory_order_relaxed);
+
+    for (const auto& wmi_result : results)
+        bytes = renderer.render(wmi_result).size();
+
+    const auto steady_allocations = allocations.load(std::memory_order_relaxed) - before;
+
+    // what rendering costs when every label is converted and escaped again
+    const auto fresh_ns = wmi_bench_ns([&]()
+    {
+        auto fresh = make_renderer();
+        bytes = fresh.render(results[next++ % results.size()]).size();
+    });
+
+    const auto samples = instances * std::size(gauges);
+
+    const auto print = [&](const char* path, const double ns)
+    {
+        fmt::print("{:<24} {:8.1f} us/render  {:6.1f} ns/sample  {:6.0f} MB/s\n", path, ns / 1e3, ns / samples, bytes / ns * 1e3);
+    };
+
+    print("render", render_ns);
+    print("render, labels escaped", fresh_ns);
+
+    text = renderer.render(results.front());
+    const auto second = text.find('\n', text.find('\n') + 1);
+    fmt::print("{} samples, {} bytes per render, {} allocations in {} steady renders, first sample: {}", samples, bytes, steady_allocations,
+        results.size(), text.substr(text.find('\n') + 1, second - text.find('\n')));
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Replays a synthetic recording of 10k process instances through wmi_helper::query(), to see what the helper costs per
+// tick against a backend that does no work of its own: refresh() indexes the tick's values, reads are memcpys out of
+// the mapped file.
+#include <cstdio>
+
+#include "WmiReplay.hpp"
+#include "wmi_bench.hpp"
+
+constexpr std::size_t instances = 10000;
+constexpr std::int32_t ticks = 16;
+
+static const char* const path = "bench_replay.wmirec";
+
+static void record()
+{
+    wmi_helper<32, wmi_recording_backend<wmi_fake_backend>> helper;
+    auto& backend = helper.backend().inner();
+    std::uint64_t tick = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT64);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"Priority", CIM_UINT32);
+    backend.resize(instances);
+
+    for (std::size_t row = 0; row < instances; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process {}", row));
+        backend.set(row, L"Priority", static_cast<std::uint32_t>(row % 32));
+    }
+
+    const std::wstring processor_time = L"PercentProcessorTime";
+    const std::wstring working_set = L"WorkingSet";
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        tick++;
+
+        for (std::size_t row = 0; row < instances; row++)
+        {
+            fake.set(row, processor_time, tick * row * 156250);
+            fake.set(row, working_set, (tick + row) << 12);
+        }
+    });
+
+    helper.backend().record(wmi_export_output(path, wmi_export_output::mode::truncate));
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", ticks, wmi_helper_config::infinite, 1000));
+    helper.capture_var(L"Name");
+    helper.capture_var(L"PercentProcessorTime");
+    helper.capture_var(L"WorkingSet");
+    helper.capture_var(L"Priority");
+
+    (void)helper.query();
+    helper.backend().stop();
+}
+
+int main()
+{
+    record();
+
+    wmi_helper<32, wmi_replay_backend> replay;
+    replay.backend().load(path);
+    replay.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", ticks));
+
+    const auto name = replay.capture_var(L"Name");
+    replay.capture_var(L"PercentProcessorTime");
+    const auto working_set = replay.capture_var(L"WorkingSet");
+    replay.capture_var(L"Priority");
+
+    std::uint64_t checksum = 0;
+    std::size_t results = 0;
+
+    const auto query_ns = wmi_bench_ns([&]()
+    {
+        replay.backend().rewind();
+
+        const auto replayed = replay.query();
+        results = replayed.size();
+
+        for (const auto& wmi_result : replayed)
+            checksum += wmi_result.result[working_set].get<std::uint64_t>(instances - 1) + wmi_result.result[name].string(1).size();
+    });
+
+    std::remove(path);
+
+    fmt::print("query, {} ticks        {:8.1f} us/tick  {:6.1f} ns/instance\n", ticks, query_ns / ticks / 1e3, query_ns / ticks / instances);
+    fmt::print("{} results per query, checksum {}\n", results, checksum);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Top 20 of a process-like class by a raw value and by rate, against sorting the whole column.
+#include <algorithm>
+#include <vector>
+
+#include "WmiAggregates.hpp"
+#include "wmi_bench.hpp"
+
+static void run(const std::size_t instances, const std::size_t k)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint64_t seed = 88172645463325252ull;
+
+    const auto random = [&seed]()
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    };
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"IOOtherBytesPersec", CIM_UINT64);
+    backend.resize(instances);
+
+    for (std::size_t row = 0; row < instances; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process_{}", row));
+        backend.set<std::uint64_t>(row, L"WorkingSet", random() % (std::uint64_t(1) << 32));
+    }
+
+    std::vector<std::uint64_t> io(instances);
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        for (std::size_t row = 0; row < instances; row++)
+            fake.set<std::uint64_t>(row, L"IOOtherBytesPersec", io[row] += random() % 100000);
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", 2, wmi_helper_config::infinite, 1000));
+
+    const auto name = helper.capture_var(L"Name");
+    const auto working_set = helper.capture_var(L"WorkingSet");
+    const auto io_bytes = helper.capture_var(L"IOOtherBytesPersec");
+    const auto result = helper.query().back();
+
+    wmi_top_k_32 by_value(working_set, name, k);
+    wmi_top_k_32 by_rate(io_bytes, name, k, wmi_top_k_mode::rate);
+    double checksum = 0.0;
+
+    const auto raw_ns = wmi_bench_ns([&]() { checksum += by_value.select(result).front().value; });
+    const auto rate_ns = wmi_bench_ns([&]() { checksum += by_rate.select(result).front().value; });
+
+    // what a consumer does without wmi_top_k: rank every row, then look up the keys of the first k
+    std::vector<std::pair<double, std::size_t>> all;
+    std::vector<std::wstring> keys;
+
+    const auto sort_ns = wmi_bench_ns([&]()
+    {
+        const auto& column = result.result.at(working_set);
+        all.clear();
+        keys.clear();
+
+        for (std::size_t row = 0; row < column.size(); row++)
+            all.emplace_back(column.as_double(row), row);
+
+        std::sort(all.begin(), all.end(), std::greater<>());
+
+        for (std::size_t i = 0; i < k; i++)
+            keys.emplace_back(result.result.at(name).string(all[i].second));
+
+        checksum += all.front().first;
+    });
+
+    fmt::print("{:>6} instances, top {}: raw {:8.1f} us, rate {:8.1f} us, full sort {:8.1f} us (checksum {:g})\n",
+        instances, k, raw_ns / 1e3, rate_ns / 1e3, sort_ns / 1e3, checksum);
+}
+
+int main()
+{
+    for (const auto instances : { 5000, 50000 })
+        run(instances, 20);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// UTF-16 to UTF-8 conversion throughput: single strings through wmi_utf8_encode() and whole columns through
+// wmi_utf8_column, against the unit by unit narrowing copy wmi_any::get_string() used to do.
+#include <string>
+#include <vector>
+
+#include "WmiHelper.hpp"
+#include "wmi_bench.hpp"
+
+// 10k strings like the ones WMI returns, built from pieces of the given text.
+static std::vector<std::wstring> make_strings(const std::wstring_view piece)
+{
+    std::vector<std::wstring> strings;
+
+    for (std::size_t i = 0; i < 10000; i++)
+    {
+        std::wstring str;
+
+        for (std::size_t j = 0; j < 1 + i % 4; j++)
+            str += piece;
+
+        str += std::to_wstring(i);
+        strings.push_back(std::move(str));
+    }
+
+    return strings;
+}
+
+static void print(const char* name, const char* path, const double ns, const std::size_t units, const std::size_t bytes)
+{
+    fmt::print("{:<10} {:<22} {:8.1f} us  {:7.0f} M units/s  {:7.0f} MB/s of UTF-8\n", name, path, ns / 1e3, units / ns * 1e3, bytes / ns * 1e3);
+}
+
+static void run_strings(const char* name, const std::vector<std::wstring>& strings)
+{
+    std::size_t units = 0;
+    std::size_t bytes = 0;
+    std::size_t max_units = 0;
+
+    for (const auto& str : strings)
+    {
+        units += str.size();
+        bytes += wmi_to_utf8(str).size();
+        max_units = std::max(max_units, str.size());
+    }
+
+    std::vector<char> out(wmi_utf8_max_size(max_units));
+    std::string narrowed;
+    std::size_t checksum = 0;
+
+    const auto encode_ns = wmi_bench_ns([&]()
+    {
+        for (const auto& str : strings)
+            checksum += wmi_utf8_encode(str, out.data());
+    });
+
+    const auto narrow_ns = wmi_bench_ns([&]()
+    {
+        for (const auto& str : strings)
+        {
+            narrowed.assign(str.size(), '\0');
+
+            for (std::size_t i = 0; i < str.size(); i++)
+                narrowed[i] = static_cast<char>(str[i]);
+
+            checksum += narrowed.size();
+        }
+    });
+
+    print(name, "wmi_utf8_encode", encode_ns, units, bytes);
+    print(name, "narrowing copy (old)", narrow_ns, units, units);
+
+    if (checksum == 0)
+        fmt::print("no output\n");
+}
+
+static void run_column(const char* name, const std::vector<std::wstring>& strings, const bool dictionary)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.resize(strings.size());
+
+    // a dictionary column repeats 100 distinct values, as names of processes or services do
+    for (std::size_t row = 0; row < strings.size(); row++)
+        backend.set(row, L"Name", strings[dictionary ? row % 100 : row]);
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", 1, wmi_helper_config::infinite, 1000));
+
+    wmi_capture_options options;
+    options.dictionary = dictionary;
+
+    const auto handle = helper.capture_var(L"Name", options);
+    const auto result = helper.query().back().result;
+    const auto column = result.at(handle);
+
+    std::size_t units = 0;
+
+    for (std::size_t row = 0; row < column.size(); row++)
+        units += column.string(row).size();
+
+    wmi_utf8_column utf8;
+    const auto ns = wmi_bench_ns([&]() { utf8.assign(column); });
+
+    print(name, dictionary ? "column, dictionary" : "column", ns, units, utf8.data().size());
+}
+
+int main()
+{
+    const std::pair<const char*, std::wstring> inputs[] = {
+        { "ascii", L"svchost_netsvcs_" },
+        { "latin", L"Dienst für Überwachung " },
+        { "cjk", L"服务主机进程" },
+    };
+
+    for (const auto& [name, piece] : inputs)
+    {
+        const auto strings = make_strings(piece);
+
+        run_strings(name, strings);
+        run_column(name, strings, false);
+        run_column(name, strings, true);
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+#include "fmt/format.h"
+
+// Calls body until at least min_seconds have passed and returns the mean nanoseconds per call. One untimed call warms
+// up caches and scratch buffers first.
+template<typename Body>
+double wmi_bench_ns(Body&& body, const double min_seconds = 0.5)
+{
+    body();
+
+    const auto start = std::chrono::steady_clock::now();
+    std::uint64_t calls = 0;
+    double elapsed = 0.0;
+
+    do
+    {
+        body();
+        calls++;
+        elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < min_seconds * 1e9);
+
+    return elapsed / static_cast<double>(calls);
+}
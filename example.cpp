@@ -1,12 +1,14 @@
 #include <iostream>
 #include "WmiHelper.hpp"
+#include "WmiSchema.hpp"
+#include "WmiFormat.hpp"
 
 // WmiHelper.hpp uses std::optional and structured bindings. Either compile with a supported c++ version or remove the uses of optional and structured bindings. It is like one function.
 
-std::uint64_t bank_handle = 0;
-std::uint64_t speed_handle = 0;
-std::uint64_t capacity_handle = 0;
-std::uint64_t locator_handle = 0;
+wmi_var_handle bank_handle = 0;
+wmi_var_handle speed_handle = 0;
+wmi_var_handle capacity_handle = 0;
+wmi_var_handle locator_handle = 0;
 
 void print_result(const wmi_helper_config& config, const wmi_wrapper_32_class_result& wmi_result)
 {
@@ -18,10 +20,11 @@ void print_result(const wmi_helper_config& config, const wmi_wrapper_32_class_re
         if (results.count(bank_handle) && results.count(speed_handle) && results.count(capacity_handle) && results.count(locator_handle))
         {
 
-            auto& bank_results = results.at(bank_handle);
-            auto& speed_results = results.at(speed_handle);
-            auto& capacity_results = results.at(capacity_handle);
-            auto& locator_results = results.at(locator_handle);
+            // handles are column indices, checked by count() above
+            const auto bank_results = results[bank_handle];
+            const auto speed_results = results[speed_handle];
+            const auto capacity_results = results[capacity_handle];
+            const auto locator_results = results[locator_handle];
 
             for (auto i = 0; i < bank_results.size(); i++)
             {
@@ -41,6 +44,25 @@ void print_result(const wmi_helper_config& config, const wmi_wrapper_32_class_re
     }
 }
 
+// Typed alternative to capture_var. Rows are read straight into the struct, types are checked once against the class.
+struct memory_row
+{
+    std::wstring bank;
+    std::uint32_t speed;
+    std::uint64_t capacity;
+    std::wstring locator;
+};
+
+template<>
+struct wmi_schema<memory_row>
+{
+    static constexpr auto fields = std::make_tuple(
+        wmi_field(L"BankLabel", &memory_row::bank),
+        wmi_field(L"Speed", &memory_row::speed),
+        wmi_field(L"Capacity", &memory_row::capacity),
+        wmi_field(L"DeviceLocator", &memory_row::locator));
+};
+
 // Executes in its own thread. Use mutexes or whatever to synchronize between threads for data passing.
 void wmi_callback(const wmi_helper_config& config, const wmi_wrapper_32_class_result& wmi_result)
 {
@@ -79,6 +101,16 @@ void main()
 
     for(auto& result : sync_result)
 		print_result(config, result);
+
+    // the same results as a table, straight through fmt ({:c} for CSV, {:k} for Name=value lines)
+    for (auto& result : sync_result)
+        fmt::print("{:t}", wmi_named(result.result, helper));
+
+    // typed query
+    auto typed_query = wmi_make_typed_query<memory_row>(helper);
+
+    for (auto& row : typed_query.sample())
+        std::wcout << row.bank << L" at " << row.locator << L" has a speed of " << row.speed << L"mhz and a capacity of " << row.capacity << std::endl;
  
 
 	// asynchronous query
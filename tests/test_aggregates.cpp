@@ -0,0 +1,375 @@
+// Rolling stats and top k of WmiAggregates.hpp over results of wmi_fake_backend, keyed by numeric process ids, and the
+// quantile sketch against exact quantiles.
+#include <cmath>
+#include <vector>
+
+#include "WmiAggregates.hpp"
+#include "wmi_test.hpp"
+
+// Three processes whose Value is tick * 10 + row. The third one is replaced by process 8 on the fifth tick.
+static void fill(wmi_helper<32, wmi_fake_backend>& helper, const std::int32_t ticks)
+{
+    auto& backend = helper.backend();
+
+    backend.add_property(L"IDProcess", CIM_UINT32);
+    backend.add_property(L"Value", CIM_UINT32);
+    backend.resize(3);
+
+    backend.on_refresh([tick = std::uint32_t(0)](wmi_fake_backend& fake) mutable
+    {
+        const std::uint32_t ids[] = { 4, 100, tick < 4 ? 7u : 8u };
+
+        for (std::uint32_t row = 0; row < 3; row++)
+        {
+            fake.set(row, L"IDProcess", ids[row]);
+            fake.set(row, L"Value", tick * 10 + row);
+        }
+
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", ticks, wmi_helper_config::infinite, 1000));
+}
+
+static void test_tick_window()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    fill(helper, 5);
+
+    const auto id = helper.capture_var(L"IDProcess");
+    const auto value = helper.capture_var(L"Value");
+
+    wmi_rolling_aggregator_32 aggregator(wmi_rolling_window::last_ticks(3), id);
+    aggregator.attach(value);
+
+    for (const auto& wmi_result : helper.query())
+        aggregator.update(wmi_result);
+
+    const auto aggregates = aggregator.aggregates().at(value);
+
+    // numeric keys used to collapse every process into the one with an empty key
+    WMI_CHECK(aggregates.size() == 3 && aggregates.count(L"4") && aggregates.count(L"100") && aggregates.count(L"8"));
+
+    if (aggregates.size() != 3 || !aggregates.count(L"100") || !aggregates.count(L"8"))
+        return;
+
+    // ticks 2 to 4 are inside the window
+    const auto& stats = aggregates.at(L"100");
+    WMI_CHECK(stats.count == 3 && stats.mean == 31.0 && stats.min == 21.0 && stats.max == 41.0 && stats.last == 41.0);
+
+    // process 7 is gone, process 8 only has the last tick
+    const auto& replaced = aggregates.at(L"8");
+    WMI_CHECK(replaced.count == 1 && replaced.mean == 42.0 && replaced.min == 42.0 && replaced.max == 42.0);
+}
+
+static void test_time_window()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    fill(helper, 5);
+
+    const auto id = helper.capture_var(L"IDProcess");
+    const auto value = helper.capture_var(L"Value");
+
+    wmi_rolling_aggregator_32 aggregator(wmi_rolling_window::last_milliseconds(250), id);
+    aggregator.attach(value);
+
+    std::uint64_t time = 0;
+
+    for (auto wmi_result : helper.query())
+    {
+        // samples 100 ms apart, the ones 250 ms or older than the latest leave the window
+        wmi_result.time = time;
+        time += 100;
+
+        aggregator.update(wmi_result);
+    }
+
+    const auto aggregates = aggregator.aggregates();
+    const auto& stats = aggregates.at(value).at(L"4");
+    WMI_CHECK(stats.count == 3 && stats.mean == 30.0 && stats.min == 20.0 && stats.max == 40.0);
+}
+
+static void test_rolling_stats()
+{
+    wmi_rolling_stats stats(wmi_rolling_window::last_ticks(3));
+    const double values[] = { 5.0, 1.0, 9.0, 3.0, 2.0 };
+    std::uint64_t time = 0;
+
+    for (const auto value : values)
+        stats.push(time++, value);
+
+    // 9, 3, 2: the minimum 1 and later the maximum 9 leave the window
+    auto aggregate = stats.aggregate();
+    WMI_CHECK(aggregate.count == 3 && aggregate.min == 2.0 && aggregate.max == 9.0 && aggregate.mean == 14.0 / 3.0);
+
+    stats.push(time++, 4.0);
+    aggregate = stats.aggregate();
+    WMI_CHECK(aggregate.count == 3 && aggregate.min == 2.0 && aggregate.max == 4.0 && aggregate.mean == 3.0);
+
+    // NaN is not a sample
+    stats.push(time++, std::numeric_limits<double>::quiet_NaN());
+    WMI_CHECK(stats.aggregate().count == 3);
+}
+
+static void test_keys()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Signed", CIM_SINT32);
+    backend.add_property(L"Real", CIM_REAL64);
+    backend.resize(1);
+    backend.set(0, L"Signed", -5);
+    backend.set(0, L"Real", 1.5);
+
+    helper.init(wmi_helper_config(L"Win32_Keys", 1, wmi_helper_config::infinite, 1000));
+
+    const auto signed_handle = helper.capture_var(L"Signed");
+    const auto real_handle = helper.capture_var(L"Real");
+    const auto result = helper.query().back().result;
+
+    std::wstring buffer;
+    WMI_CHECK(result[signed_handle].key(0, buffer) == L"-5");
+    WMI_CHECK(result[real_handle].key(0, buffer) == L"1.5");
+}
+
+// Values from 1e-3 to 1e6 and their negatives, spread evenly on a log scale.
+static std::vector<double> sketch_values()
+{
+    std::vector<double> values;
+
+    for (std::uint32_t i = 0; i < 20000; i++)
+    {
+        const auto value = std::pow(10.0, -3.0 + 9.0 * i / 20000.0);
+        values.push_back(i % 3 ? value : -value);
+    }
+
+    return values;
+}
+
+static void check_quantiles(const wmi_quantile_sketch& a, const wmi_quantile_sketch& b)
+{
+    for (const auto q : { 0.0, 0.01, 0.25, 0.5, 0.75, 0.99, 1.0 })
+        WMI_CHECK(a.quantile(q) == b.quantile(q));
+}
+
+static void test_quantile_error()
+{
+    const auto accuracy = 0.01;
+    auto values = sketch_values();
+
+    wmi_quantile_sketch sketch(accuracy);
+
+    for (const auto value : values)
+        sketch.add(value);
+
+    std::sort(values.begin(), values.end());
+    WMI_CHECK(sketch.count() == values.size() && sketch.min() == values.front() && sketch.max() == values.back());
+
+    for (auto q = 0.0; q <= 1.0; q += 0.01)
+    {
+        const auto exact = values[static_cast<std::size_t>(q * static_cast<double>(values.size() - 1))];
+        WMI_CHECK(std::abs(sketch.quantile(q) - exact) <= accuracy * std::abs(exact) * (1.0 + 1e-9));
+    }
+}
+
+static void test_quantile_limits()
+{
+    // a relative accuracy this small needs keys far outside of int32 for the largest and smallest doubles, they are
+    // clamped into the outermost buckets instead of overflowing
+    wmi_quantile_sketch sketch(1e-12);
+
+    for (const auto value : { 1e300, -1e300, 1e-11, 1.0, std::numeric_limits<double>::max() })
+        sketch.add(value);
+
+    WMI_CHECK(sketch.count() == 5);
+
+    for (const auto q : { 0.0, 0.5, 1.0 })
+        WMI_CHECK(std::isfinite(sketch.quantile(q)) && sketch.quantile(q) >= sketch.min() && sketch.quantile(q) <= sketch.max());
+
+    sketch.add(std::numeric_limits<double>::infinity());
+    sketch.add(-std::numeric_limits<double>::infinity());
+    sketch.add(std::numeric_limits<double>::quiet_NaN());
+
+    WMI_CHECK(sketch.count() == 5 && sketch.max() == std::numeric_limits<double>::max());
+}
+
+static void test_quantile_merge()
+{
+    const auto values = sketch_values();
+
+    wmi_quantile_sketch whole(0.01, 256);
+    wmi_quantile_sketch first(0.01, 256);
+    wmi_quantile_sketch second(0.01, 256);
+
+    for (std::size_t i = 0; i < values.size(); i++)
+    {
+        whole.add(values[i]);
+        (i < values.size() / 2 ? first : second).add(values[i]);
+    }
+
+    first.merge(second);
+    WMI_CHECK(first.count() == whole.count() && first.min() == whole.min() && first.max() == whole.max());
+    check_quantiles(first, whole);
+
+    WMI_CHECK_THROWS(first.merge(wmi_quantile_sketch(0.02)), std::invalid_argument);
+}
+
+static void test_quantile_serialize()
+{
+    wmi_quantile_sketch sketch(0.01, 512);
+
+    for (const auto value : sketch_values())
+        sketch.add(value);
+
+    sketch.add(0.0, 3);
+
+    const auto bytes = sketch.serialize();
+    const auto copy = wmi_quantile_sketch::deserialize(bytes.data(), bytes.size());
+
+    WMI_CHECK(copy.count() == sketch.count() && copy.relative_accuracy() == sketch.relative_accuracy());
+    WMI_CHECK(copy.serialize() == bytes);
+    check_quantiles(copy, sketch);
+
+    WMI_CHECK_THROWS(wmi_quantile_sketch::deserialize(bytes.data(), bytes.size() - 1), std::out_of_range);
+
+    // relative accuracy, max buckets, zero count, count
+    const auto max_buckets_at = sizeof(double);
+    const auto count_at = max_buckets_at + sizeof(std::uint32_t) + sizeof(std::uint64_t);
+
+    auto damaged = bytes;
+    const std::uint32_t max_buckets = 2;
+    std::memcpy(damaged.data() + max_buckets_at, &max_buckets, sizeof(max_buckets));
+    WMI_CHECK_THROWS(wmi_quantile_sketch::deserialize(damaged.data(), damaged.size()), std::invalid_argument);
+
+    damaged = bytes;
+    const auto count = sketch.count() + 1;
+    std::memcpy(damaged.data() + count_at, &count, sizeof(count));
+    WMI_CHECK_THROWS(wmi_quantile_sketch::deserialize(damaged.data(), damaged.size()), std::invalid_argument);
+}
+
+// Two ticks of three processes, the second one with the rows in another order. Value of process id is id * 100 on the
+// first tick and grows by 25, 400 and 600 until the second.
+static wmi_wrapper_32_class_result top_k_result(wmi_helper<32, wmi_fake_backend>& helper, wmi_var_handle& id, wmi_var_handle& value)
+{
+    auto& backend = helper.backend();
+
+    backend.add_property(L"IDProcess", CIM_UINT32);
+    backend.add_property(L"Value", CIM_UINT64);
+    backend.resize(3);
+
+    backend.on_refresh([tick = 0](wmi_fake_backend& fake) mutable
+    {
+        const std::uint32_t ids[2][3] = { { 1, 2, 3 }, { 3, 1, 2 } };
+        const std::uint64_t growth[] = { 0, 25, 400, 600 };
+
+        for (std::uint32_t row = 0; row < 3; row++)
+        {
+            const auto process = ids[tick][row];
+            fake.set(row, L"IDProcess", process);
+            fake.set<std::uint64_t>(row, L"Value", process * 100 + (tick ? growth[process] : 0));
+        }
+
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", 2, wmi_helper_config::infinite, 1000));
+    id = helper.capture_var(L"IDProcess");
+    value = helper.capture_var(L"Value");
+
+    auto wmi_result = helper.query().back();
+    wmi_result.time = wmi_result.prev_time + 2000;
+    return wmi_result;
+}
+
+static void test_top_k_raw()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    wmi_var_handle id, value;
+    const auto wmi_result = top_k_result(helper, id, value);
+
+    // 900, 125 and 600 on rows 0 to 2
+    wmi_top_k_32 top(value, id, 2);
+    auto rows = top.select(wmi_result);
+
+    WMI_CHECK(rows.size() == 2);
+    WMI_CHECK(rows.size() == 2 && rows[0].row == 0 && rows[0].key == L"3" && rows[0].value == 900.0);
+    WMI_CHECK(rows.size() == 2 && rows[1].row == 2 && rows[1].key == L"2" && rows[1].value == 600.0);
+
+    // more than there are rows, every row is returned in order
+    wmi_top_k_32 all(value, std::nullopt, 10);
+    rows = all.select(wmi_result);
+
+    WMI_CHECK(rows.size() == 3);
+    WMI_CHECK(rows.size() == 3 && rows[0].key == L"0" && rows[1].key == L"2" && rows[2].key == L"1" && rows[2].value == 125.0);
+
+    WMI_CHECK(wmi_top_k_32(value, id, 0).select(wmi_result).empty());
+}
+
+static void test_top_k_rate()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    wmi_var_handle id, value;
+    const auto wmi_result = top_k_result(helper, id, value);
+
+    // the previous value of each process is found by its id although every process moved to another row, the rates
+    // over the 2 seconds are 300 for 3, 200 for 2 and 12.5 for 1
+    wmi_top_k_32 top(value, id, 3, wmi_top_k_mode::rate);
+    const auto rows = top.select(wmi_result);
+
+    WMI_CHECK(rows.size() == 3);
+    WMI_CHECK(rows.size() == 3 && rows[0].key == L"3" && rows[0].value == 300.0);
+    WMI_CHECK(rows.size() == 3 && rows[1].key == L"2" && rows[1].value == 200.0);
+    WMI_CHECK(rows.size() == 3 && rows[2].key == L"1" && rows[2].value == 12.5);
+
+    // by row the previous values belong to other processes: (900 - 100) / 2, (125 - 200) / 2, (600 - 300) / 2
+    wmi_top_k_32 by_row(value, std::nullopt, 1, wmi_top_k_mode::rate);
+    WMI_CHECK(by_row.select(wmi_result).size() == 1 && by_row.select(wmi_result)[0].value == 400.0);
+
+    // no time passed, no rate
+    auto same_time = wmi_result;
+    same_time.time = same_time.prev_time;
+    WMI_CHECK(top.select(same_time).empty());
+}
+
+static void test_top_k_ties()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Value", CIM_UINT32);
+    backend.resize(5);
+
+    const std::uint32_t values[] = { 5, 7, 7, 7, 1 };
+
+    for (std::uint32_t row = 0; row < 5; row++)
+        backend.set(row, L"Value", values[row]);
+
+    helper.init(wmi_helper_config(L"Win32_Ties", 1, wmi_helper_config::infinite, 1000));
+    const auto value = helper.capture_var(L"Value");
+
+    // a later row only replaces a selected one if its value is larger, so the first of the tied rows are kept
+    wmi_top_k_32 top(value, std::nullopt, 2);
+    const auto rows = top.select(helper.query().back());
+
+    WMI_CHECK(rows.size() == 2);
+    WMI_CHECK(rows.size() == 2 && rows[0].value == 7.0 && rows[1].value == 7.0);
+    WMI_CHECK(rows.size() == 2 && std::min(rows[0].row, rows[1].row) == 1 && std::max(rows[0].row, rows[1].row) == 2);
+}
+
+int main()
+{
+    test_tick_window();
+    test_time_window();
+    test_rolling_stats();
+    test_keys();
+    test_quantile_error();
+    test_quantile_limits();
+    test_quantile_merge();
+    test_quantile_serialize();
+    test_top_k_raw();
+    test_top_k_rate();
+    test_top_k_ties();
+
+    return wmi_test_result();
+}
@@ -0,0 +1,236 @@
+// Steady state sampling must not allocate: counts every global operator new between the callbacks of consecutive ticks.
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "WmiExport.hpp"
+#include "wmi_test.hpp"
+
+static std::atomic<std::uint64_t> allocations{ 0 };
+
+void* operator new(const std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto* data = std::malloc(size ? size : 1))
+        return data;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](const std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(const std::size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](const std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+// the array and sized forms forward here, calling free() from them is reported by GCC as a mismatched deallocation
+void operator delete(void* data) noexcept
+{
+    std::free(data);
+}
+
+void operator delete[](void* data) noexcept
+{
+    operator delete(data);
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+    operator delete(data);
+}
+
+void operator delete[](void* data, std::size_t) noexcept
+{
+    operator delete[](data);
+}
+
+constexpr std::size_t warmup_ticks = 8;
+constexpr std::size_t measured_ticks = 200;
+constexpr std::size_t rows = 3000;
+
+// One query_async() run of warmup_ticks + measured_ticks ticks. Returns the global operator new calls of every measured
+// tick, from the end of one callback to the end of the next: wait, refresh, reads, filters, hashing, recycling the
+// snapshot and the callback, which decodes the lazy column.
+//
+// Not counted: starting the query (std::async, the copies of vars and filters) and the warmup ticks, while the snapshot
+// pool and its arenas grow. The test's own on_refresh callback is counted but only writes numbers into the fake backend,
+// and the fake backend's string values do not change, so neither allocates. Direct malloc calls are not seen.
+static std::array<std::uint64_t, measured_ticks> run(const wmi_capture_options& name_options, const bool filtered, const bool lazy_and_slow)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint64_t counter = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Description", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT64);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"Priority", CIM_UINT32);
+    backend.resize(rows);
+
+    for (std::size_t row = 0; row < rows; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process_{}", row % 100));
+        backend.set(row, L"Description", fmt::format(L"a description too long for a cell, row {}", row));
+        backend.set(row, L"Priority", static_cast<std::uint32_t>(row % 32));
+    }
+
+    // wmi_fake_backend::set() takes the name as a std::wstring, so the names are built once here
+    const std::wstring processor_time = L"PercentProcessorTime";
+    const std::wstring working_set = L"WorkingSet";
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        counter++;
+
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            fake.set(row, processor_time, counter * row);
+            fake.set(row, working_set, (counter + row) << 12);
+        }
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", static_cast<std::int32_t>(warmup_ticks + measured_ticks), wmi_helper_config::infinite, 1000));
+
+    wmi_capture_options lazy;
+    wmi_capture_options slow;
+
+    lazy.lazy = lazy_and_slow;
+    slow.read_every = lazy_and_slow ? 3 : 1;
+
+    const auto name = helper.capture_var(L"Name", name_options);
+    const auto description = helper.capture_var(L"Description", lazy);
+    helper.capture_var(L"PercentProcessorTime");
+    helper.capture_var(L"WorkingSet", slow);
+    const auto priority = helper.capture_var(L"Priority");
+
+    if (filtered)
+    {
+        helper.filter(wmi_predicate::greater_equal(priority, 8));
+        helper.filter(wmi_predicate::not_equals(name, L"process_7"));
+    }
+
+    std::array<std::uint64_t, measured_ticks> counts{};
+    std::size_t tick = 0;
+    std::uint64_t last = 0;
+
+    helper.query_async([&](const wmi_helper_config&, const wmi_wrapper_32_class_result& wmi_result)
+    {
+        // look at the result the way consumers do, without keeping it, which also decodes the lazy column
+        WMI_CHECK(wmi_result.result.count(priority) && !wmi_result.result[priority].empty());
+        WMI_CHECK(wmi_result.result.at(description).size() == wmi_result.result[priority].size());
+
+        const auto now = allocations.load(std::memory_order_relaxed);
+
+        if (tick >= warmup_ticks)
+            counts[tick - warmup_ticks] = now - last;
+
+        tick++;
+        last = now;
+    }).wait();
+
+    WMI_CHECK(tick == warmup_ticks + measured_ticks);
+    return counts;
+}
+
+static void check_no_allocations(const wmi_capture_options& name_options, const bool filtered, const bool lazy_and_slow)
+{
+    const auto counts = run(name_options, filtered, lazy_and_slow);
+    std::uint64_t total = 0;
+    std::size_t allocating_ticks = 0;
+
+    for (std::size_t tick = 0; tick < counts.size(); tick++)
+    {
+        if (counts[tick] && allocating_ticks++ < 10)
+            fmt::print(stderr, "tick {} after warmup: {} allocations\n", tick, counts[tick]);
+
+        total += counts[tick];
+    }
+
+    if (total)
+        fmt::print(stderr, "{} allocations in {} of {} ticks\n", total, allocating_ticks, counts.size());
+
+    WMI_CHECK(total == 0);
+}
+
+// Rendering results whose instances stay on their rows reuses the labels and the output buffer.
+static void check_prometheus_no_allocations()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.add_property(L"Load", CIM_REAL64);
+    backend.resize(rows);
+
+    for (std::size_t row = 0; row < rows; row++)
+        backend.set(row, L"Name", fmt::format(L"process_{}", row));
+
+    const std::wstring working_set = L"WorkingSet";
+    const std::wstring load = L"Load";
+    std::uint64_t counter = 0;
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        counter++;
+
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            fake.set(row, working_set, (counter + row) << 12);
+            fake.set(row, load, static_cast<double>(counter * row) / 7.0);
+        }
+    });
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", 16, wmi_helper_config::infinite, 1000));
+
+    wmi_prometheus_renderer_32 renderer(L"Win32_Process", helper.capture_var(L"Name"));
+    renderer.attach(helper, helper.capture_var(L"WorkingSet"));
+    renderer.attach(helper, helper.capture_var(L"Load"));
+    renderer.timestamps(true);
+
+    const auto results = helper.query();
+    WMI_CHECK(!renderer.render(results.front()).empty());
+
+    const auto before = allocations.load(std::memory_order_relaxed);
+
+    for (const auto& wmi_result : results)
+        WMI_CHECK(!renderer.render(wmi_result).empty());
+
+    const auto total = allocations.load(std::memory_order_relaxed) - before;
+
+    if (total)
+        fmt::print(stderr, "prometheus: {} allocations in {} renders\n", total, results.size());
+
+    WMI_CHECK(total == 0);
+}
+
+int main()
+{
+    wmi_capture_options dictionary;
+    dictionary.dictionary = true;
+
+    // read_every columns are only carried over with a key
+    auto key = dictionary;
+    key.key = true;
+
+    check_no_allocations({}, false, false);
+    check_no_allocations({}, true, false);
+    check_no_allocations(dictionary, true, false);
+    check_no_allocations(key, true, true);
+    check_prometheus_no_allocations();
+
+    return wmi_test_result();
+}
@@ -0,0 +1,208 @@
+// Capture files written by wmi_capture_file_encoder and read back, intact and damaged.
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "WmiCaptureFile.hpp"
+#include "wmi_test.hpp"
+
+static const char* const path = "test_capture_file.wmic";
+
+// Ticks sampled at 1000, 1010, ... Speed changes on every tick, Name and Size never do and are repeat columns after the
+// first tick. Without finish the file is left unclosed as by a crash.
+static fmt::memory_buffer encode(const std::size_t ticks, const bool names, const std::uint32_t max_dictionary_entries = 1 << 20, const bool finish = true)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint32_t tick = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.add_property(L"Size", CIM_UINT32);
+    backend.resize(2);
+    backend.set(0, L"Name", L"fan 0");
+    backend.set(1, L"Name", L"fan 1");
+    backend.set(0, L"Size", 10u);
+    backend.set(1, L"Size", 20u);
+
+    backend.on_refresh([&tick](wmi_fake_backend& fake)
+    {
+        fake.set(0, L"Speed", 100 + tick);
+        fake.set(1, L"Speed", 200 + tick);
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Fan", static_cast<std::int32_t>(ticks), wmi_helper_config::infinite, 1000));
+
+    wmi_capture_file_encoder_32 encoder(L"Win32_Fan", max_dictionary_entries);
+
+    if (names)
+        encoder.attach(helper, helper.capture_var(L"Name"));
+
+    encoder.attach(helper, helper.capture_var(L"Speed"));
+    encoder.attach(helper, helper.capture_var(L"Size"));
+
+    fmt::memory_buffer out;
+    std::uint64_t time = 1000;
+
+    for (auto wmi_result : helper.query())
+    {
+        wmi_result.time = time;
+        time += 10;
+        encoder.encode(wmi_result, out);
+    }
+
+    if (finish)
+        encoder.finish(out);
+
+    return out;
+}
+
+static void write(const fmt::memory_buffer& bytes)
+{
+    auto* file = std::fopen(path, "wb");
+    WMI_CHECK(file && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+
+    if (file)
+        std::fclose(file);
+}
+
+static void test_read()
+{
+    write(encode(3, true));
+
+    const wmi_capture_file_reader reader(path);
+
+    WMI_CHECK(reader.indexed() && reader.ticks() == 3);
+    WMI_CHECK(reader.class_name() == "Win32_Fan" && reader.property("Speed") == 1u);
+    WMI_CHECK(reader.string(0) == "fan 0");
+    WMI_CHECK(reader.max(1, 0, ~0ull) == 202.0 && reader.min(1, 0, ~0ull) == 100.0);
+
+    WMI_CHECK_THROWS(reader.tick(3), wmi_capture_file_error);
+    WMI_CHECK_THROWS(reader.time(~std::size_t(0)), wmi_capture_file_error);
+}
+
+static void test_damaged_index()
+{
+    // without strings there is no dictionary whose offset would be read from the damaged index
+    auto bytes = encode(3, false);
+
+    wmi_capture_file_trailer trailer;
+    std::memcpy(&trailer, bytes.data() + bytes.size() - sizeof(trailer), sizeof(trailer));
+
+    // a tick count whose index size overflows to 16 bytes, which would fit the file
+    const auto tick_count = (std::uint64_t(1) << 60) + 1;
+    std::memcpy(bytes.data() + trailer.index_offset + sizeof(wmi_capture_file_block), &tick_count, sizeof(tick_count));
+    write(bytes);
+
+    WMI_CHECK_THROWS(wmi_capture_file_reader(path), wmi_capture_file_error);
+
+    // and a dictionary count that does not fit
+    bytes = encode(3, false);
+    const auto dictionary_count = ~std::uint64_t(0);
+    std::memcpy(bytes.data() + trailer.index_offset + sizeof(wmi_capture_file_block) + sizeof(std::uint64_t), &dictionary_count, sizeof(dictionary_count));
+    write(bytes);
+
+    WMI_CHECK_THROWS(wmi_capture_file_reader(path), wmi_capture_file_error);
+}
+
+static void test_seek()
+{
+    write(encode(3, true));
+
+    const wmi_capture_file_reader reader(path);
+
+    WMI_CHECK(reader.time(0) == 1000 && reader.time(2) == 1020);
+    WMI_CHECK(reader.seek(0) == 0 && reader.seek(1000) == 0 && reader.seek(1001) == 1 && reader.seek(1010) == 1);
+    WMI_CHECK(reader.seek(1020) == 2 && reader.seek(1021) == 3 && reader.seek(~0ull) == reader.ticks());
+
+    // scan() starts where seek() does and stops after the last tick sampled at or before to
+    std::vector<std::uint64_t> times;
+    reader.scan(1, 1005, 1020, [&](const wmi_capture_file_tick_view& tick, const wmi_capture_file_column_view&) { times.push_back(tick.time()); });
+
+    WMI_CHECK((times == std::vector<std::uint64_t>{ 1010, 1020 }));
+}
+
+static void test_repeat_columns()
+{
+    write(encode(4, true));
+
+    const wmi_capture_file_reader reader(path);
+    const auto name = *reader.property("Name");
+    const auto speed = *reader.property("Speed");
+    const auto size = *reader.property("Size");
+
+    // the columns that did not change share the data of the first tick, Speed has its own on every tick
+    const auto first_name = reader.tick(0).column(name);
+    const auto last_name = reader.tick(3).column(name);
+
+    WMI_CHECK(first_name && last_name && last_name->header_offset() == first_name->header_offset());
+    WMI_CHECK(last_name->encoding() == wmi_capture_file_encoding::code && last_name->string(1) == "fan 1");
+    WMI_CHECK(reader.tick(3).column(speed)->header_offset() != reader.tick(2).column(speed)->header_offset());
+    WMI_CHECK(reader.tick(3).column(size)->values<std::uint32_t>()[1] == 20);
+
+    // min and max fold every distinct column once, scanning all ticks visits the shared one four times
+    std::vector<std::uint64_t> offsets;
+    reader.scan(size, 0, ~0ull, [&](const wmi_capture_file_tick_view&, const wmi_capture_file_column_view& column) { offsets.push_back(column.header_offset()); });
+
+    WMI_CHECK(offsets.size() == 4 && std::count(offsets.begin(), offsets.end(), offsets.front()) == 4);
+    WMI_CHECK(reader.max(size, 0, ~0ull) == 20.0 && reader.min(size, 1010, 1030) == 10.0);
+    WMI_CHECK(reader.max(speed, 1010, 1020) == 202.0 && reader.min(speed, 1010, 1020) == 101.0);
+    WMI_CHECK(!reader.max(speed, 1031, ~0ull));
+}
+
+// With room for one string "fan 1" does not fit, the column falls back to UTF-8 and is still repeated.
+static void test_dictionary_full()
+{
+    write(encode(3, true, 1));
+
+    const wmi_capture_file_reader reader(path);
+    const auto name = *reader.property("Name");
+
+    WMI_CHECK(reader.string(0) == "fan 0");
+    WMI_CHECK_THROWS(reader.string(1), std::out_of_range);
+
+    const auto first = reader.tick(0).column(name);
+    const auto last = reader.tick(2).column(name);
+
+    WMI_CHECK(first && first->encoding() == wmi_capture_file_encoding::utf8);
+    WMI_CHECK(first->string(0) == "fan 0" && first->string(1) == "fan 1");
+    WMI_CHECK(last && last->header_offset() == first->header_offset() && last->string(1) == "fan 1");
+}
+
+// A file that was not closed is read by walking its blocks, a block cut off at the end is left out.
+static void test_unclosed()
+{
+    auto bytes = encode(3, true, 1 << 20, false);
+    write(bytes);
+
+    {
+        const wmi_capture_file_reader reader(path);
+
+        WMI_CHECK(!reader.indexed() && reader.ticks() == 3);
+        WMI_CHECK(reader.string(1) == "fan 1" && reader.seek(1015) == 2);
+        WMI_CHECK(reader.tick(2).column(*reader.property("Name"))->string(0) == "fan 0");
+        WMI_CHECK(reader.max(*reader.property("Speed"), 0, ~0ull) == 202.0);
+    }
+
+    bytes.resize(bytes.size() - 8);
+    write(bytes);
+
+    const wmi_capture_file_reader reader(path);
+
+    WMI_CHECK(!reader.indexed() && reader.ticks() == 2);
+    WMI_CHECK(reader.max(*reader.property("Speed"), 0, ~0ull) == 201.0);
+}
+
+int main()
+{
+    test_read();
+    test_damaged_index();
+    test_seek();
+    test_repeat_columns();
+    test_dictionary_full();
+    test_unclosed();
+
+    std::remove(path);
+    return wmi_test_result();
+}
@@ -0,0 +1,251 @@
+// Export formats written from wmi_fake_backend results.
+#include <limits>
+
+#include <unistd.h>
+
+#include "WmiExport.hpp"
+#include "wmi_test.hpp"
+
+static std::string encode_influx(const bool keyed)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(3);
+
+    backend.set(0, L"Name", L"fan 0");
+    backend.set(1, L"Name", L"");
+    backend.set(2, L"Name", L"fan,2");
+
+    for (std::uint32_t row = 0; row < 3; row++)
+        backend.set(row, L"Speed", 100 + row);
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+
+    const auto name = helper.capture_var(L"Name");
+    const auto speed = helper.capture_var(L"Speed");
+
+    wmi_influx_encoder_32 encoder(L"Win32_Fan", keyed ? std::optional<wmi_var_handle>(name) : std::nullopt);
+    encoder.attach(helper, speed);
+
+    auto result = helper.query().back();
+    result.time = 1700000000000;
+
+    fmt::memory_buffer out;
+    encoder.encode(result, out);
+
+    return fmt::to_string(out);
+}
+
+static void test_influx()
+{
+    // an empty key is no valid tag value, the row number stands in for it
+    WMI_CHECK(encode_influx(true) ==
+        "Win32_Fan,instance=fan\\ 0 Speed=100i 1700000000000000000\n"
+        "Win32_Fan,instance=1 Speed=101i 1700000000000000000\n"
+        "Win32_Fan,instance=fan\\,2 Speed=102i 1700000000000000000\n");
+
+    WMI_CHECK(encode_influx(false) ==
+        "Win32_Fan,instance=0 Speed=100i 1700000000000000000\n"
+        "Win32_Fan,instance=1 Speed=101i 1700000000000000000\n"
+        "Win32_Fan,instance=2 Speed=102i 1700000000000000000\n");
+}
+
+// Fails every read of one row.
+class failing_backend : public wmi_fake_backend
+{
+public:
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer)
+    {
+        if (row == failed_row)
+            return false;
+
+        return wmi_fake_backend::read(row, handle, size, read_bytes, buffer);
+    }
+
+    std::uint32_t failed_row = ~0u;
+};
+
+// Rows 0 to 3: a name, an empty name, a name to escape and a row whose reads fail. Id is a numeric key and Load a real
+// that is not finite on two rows.
+static void fill(wmi_helper<32, failing_backend>& helper)
+{
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Id", CIM_UINT32);
+    backend.add_property(L"Load", CIM_REAL64);
+    backend.resize(4);
+
+    backend.set(0, L"Name", L"fan 0");
+    backend.set(1, L"Name", L"");
+    backend.set(2, L"Name", L"fan \"2\"\n");
+    backend.set(3, L"Name", L"fan 3");
+
+    const double loads[] = { 0.5, std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::infinity(), 1.0 };
+
+    for (std::uint32_t row = 0; row < 4; row++)
+    {
+        backend.set(row, L"Id", 4000000000u + row);
+        backend.set(row, L"Load", loads[row]);
+    }
+
+    backend.failed_row = 3;
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+}
+
+static std::string render_prometheus(const wchar_t* key, const std::string_view label)
+{
+    wmi_helper<32, failing_backend> helper;
+    fill(helper);
+
+    const auto handle = helper.capture_var(key);
+    const auto load = helper.capture_var(L"Load");
+
+    wmi_prometheus_renderer_32 renderer(L"Win32_Fan", handle, "wmi", label);
+    renderer.attach(helper, load);
+    renderer.timestamps(true);
+
+    auto result = helper.query().back();
+    result.time = 1700000000000;
+
+    return std::string(renderer.render(result));
+}
+
+static void test_prometheus()
+{
+    // empty and unread keys fall back to the row, the failed row has no sample
+    WMI_CHECK(render_prometheus(L"Name", "wmi_instance") ==
+        "# TYPE wmi_win32_fan_load gauge\n"
+        "wmi_win32_fan_load{wmi_instance=\"fan 0\"} 0.5 1700000000000\n"
+        "wmi_win32_fan_load{wmi_instance=\"1\"} NaN 1700000000000\n"
+        "wmi_win32_fan_load{wmi_instance=\"fan \\\"2\\\"\\n\"} -Inf 1700000000000\n");
+
+    // numeric keys are written in decimal, the label is configurable
+    WMI_CHECK(render_prometheus(L"Id", "fan") ==
+        "# TYPE wmi_win32_fan_load gauge\n"
+        "wmi_win32_fan_load{fan=\"4000000000\"} 0.5 1700000000000\n"
+        "wmi_win32_fan_load{fan=\"4000000001\"} NaN 1700000000000\n"
+        "wmi_win32_fan_load{fan=\"4000000002\"} -Inf 1700000000000\n");
+}
+
+// Rows 0 to 3 keyed by Name: control characters, quotes, a backslash and a character outside the BMP, an empty name,
+// a name long enough for the 16 byte scan with a quote past it, and a row whose reads fail. Note is the same text with
+// dictionary encoding.
+static std::string render_ndjson(const bool keyed)
+{
+    wmi_helper<32, failing_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Note", CIM_STRING);
+    backend.add_property(L"Load", CIM_REAL64);
+    backend.add_property(L"Active", CIM_BOOLEAN);
+    backend.resize(4);
+
+    const std::wstring names[] = { L"a\x01\x1f\t\r\n\"b\\\U0001F600", L"", L"0123456789abcdef \"fan\"", L"fan 3" };
+    const double loads[] = { -0.25, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(), 1.0 };
+
+    for (std::uint32_t row = 0; row < 4; row++)
+    {
+        backend.set(row, L"Name", names[row]);
+        backend.set(row, L"Note", names[row]);
+        backend.set(row, L"Load", loads[row]);
+        backend.set<std::uint16_t>(row, L"Active", row % 2 ? 0xffff : 0);
+    }
+
+    backend.failed_row = 3;
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+
+    wmi_capture_options dictionary;
+    dictionary.dictionary = true;
+
+    const auto name = helper.capture_var(L"Name");
+    const auto note = helper.capture_var(L"Note", dictionary);
+
+    wmi_ndjson_writer_32 writer(L"Win32_Fan", keyed ? std::optional<wmi_var_handle>(name) : std::nullopt);
+    writer.attach(helper, note);
+    writer.attach(helper, helper.capture_var(L"Load"));
+    writer.attach(helper, helper.capture_var(L"Active"));
+
+    auto result = helper.query().back();
+    result.time = 1700000000000;
+
+    return std::string(writer.render(result));
+}
+
+static void test_ndjson()
+{
+    // control characters are escaped, the emoji is written as UTF-8, reals that are not finite and failed reads are
+    // null, empty and unread keys fall back to the row
+    WMI_CHECK(render_ndjson(true) ==
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":\"a\\u0001\\u001f\\t\\r\\n\\\"b\\\\\xf0\x9f\x98\x80\","
+        "\"Note\":\"a\\u0001\\u001f\\t\\r\\n\\\"b\\\\\xf0\x9f\x98\x80\",\"Load\":-0.25,\"Active\":false}\n"
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":1,\"Note\":\"\",\"Load\":null,\"Active\":true}\n"
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":\"0123456789abcdef \\\"fan\\\"\","
+        "\"Note\":\"0123456789abcdef \\\"fan\\\"\",\"Load\":null,\"Active\":false}\n"
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":3,\"Note\":null,\"Load\":null,\"Active\":null}\n");
+
+    const auto unkeyed = render_ndjson(false);
+    WMI_CHECK(unkeyed.find("\"instance\":0,") != std::string::npos && unkeyed.find("\"instance\":2,") != std::string::npos);
+}
+
+// The sink writes every result at once to a duplicate of the descriptor it was given.
+static void test_ndjson_sink()
+{
+    int ends[2];
+    WMI_CHECK(pipe(ends) == 0);
+
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(2);
+    backend.set(0, L"Speed", 100u);
+    backend.set(1, L"Speed", 101u);
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 2, wmi_helper_config::infinite, 1000));
+
+    wmi_ndjson_writer_32 writer(L"Win32_Fan");
+    writer.attach(helper, helper.capture_var(L"Speed"));
+
+    {
+        wmi_ndjson_sink<32> sink(std::move(writer), wmi_export_output(ends[1]));
+        close(ends[1]);
+
+        for (auto wmi_result : helper.query())
+        {
+            wmi_result.time = 1700000000000;
+            sink.write(wmi_result);
+        }
+    }
+
+    std::string text;
+    char chunk[256];
+    ssize_t size = 0;
+
+    while ((size = read(ends[0], chunk, sizeof(chunk))) > 0)
+        text.append(chunk, static_cast<std::size_t>(size));
+
+    close(ends[0]);
+
+    const std::string lines =
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":0,\"Speed\":100}\n"
+        "{\"time\":1700000000000,\"class\":\"Win32_Fan\",\"instance\":1,\"Speed\":101}\n";
+
+    // the pipe reaches its end once the sink closed its duplicate
+    WMI_CHECK(text == lines + lines);
+}
+
+int main()
+{
+    test_influx();
+    test_prometheus();
+    test_ndjson();
+    test_ndjson_sink();
+
+    return wmi_test_result();
+}
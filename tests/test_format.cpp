@@ -0,0 +1,68 @@
+// fmt::formatter specializations of WmiFormat.hpp.
+#include "WmiFormat.hpp"
+#include "wmi_test.hpp"
+
+static void test_result_styles()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(2);
+
+    backend.set(0, L"Name", L"fan, front");
+    backend.set(1, L"Name", L"fan");
+    backend.set(0, L"Speed", 100u);
+    backend.set(1, L"Speed", 2000u);
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+    helper.capture_var(L"Name");
+    helper.capture_var(L"Speed");
+
+    auto wmi_result = helper.query().back();
+    wmi_result.time = 1700000000000;
+
+    // the sample time must not break CSV
+    WMI_CHECK(fmt::format("{:c}", wmi_result) == "#0,#1\r\n\"fan, front\",100\r\nfan,2000\r\n");
+    WMI_CHECK(fmt::format("{:k}", wmi_result) == "time=1700000000000 #0=fan, front #1=100\ntime=1700000000000 #0=fan #1=2000\n");
+    WMI_CHECK(fmt::format("{:t}", wmi_result) == "# time=1700000000000\n#0          #1\nfan, front  100\nfan         2000\n");
+    WMI_CHECK(fmt::format("{}", wmi_result) == fmt::format("{:t}", wmi_result));
+
+    WMI_CHECK(fmt::format("{:k}", wmi_named(wmi_result.result, helper)) == "Name=fan, front Speed=100\nName=fan Speed=2000\n");
+    WMI_CHECK_THROWS(fmt::format("{:x}", wmi_result.result), fmt::format_error);
+}
+
+// Tables used to drop every column past the 64th handle.
+static void test_wide_table()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    for (std::uint32_t i = 0; i < 70; i++)
+        backend.add_property(fmt::format(L"Value{}", i), CIM_UINT32);
+
+    backend.resize(1);
+
+    for (std::uint32_t i = 0; i < 70; i++)
+        backend.set(0, fmt::format(L"Value{}", i), i);
+
+    helper.init(wmi_helper_config(L"Win32_Wide", 1, wmi_helper_config::infinite, 1000));
+
+    for (std::uint32_t i = 0; i < 70; i++)
+        helper.capture_var(fmt::format(L"Value{}", i));
+
+    const auto result = helper.query().back().result;
+    const auto table = fmt::format("{:t}", wmi_named(result, helper));
+
+    WMI_CHECK(table.find("Value69") != std::string::npos);
+    WMI_CHECK(table.size() > 4 && table.compare(table.size() - 4, 4, " 69\n") == 0);
+}
+
+int main()
+{
+    test_result_styles();
+    test_wide_table();
+
+    return wmi_test_result();
+}
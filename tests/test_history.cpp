@@ -0,0 +1,291 @@
+// Round trips through the compressed history chunks and series, and wmi_counter_history fed by wmi_fake_backend.
+#include <cmath>
+#include <limits>
+
+#include "WmiHistory.hpp"
+#include "wmi_test.hpp"
+
+struct raw_sample
+{
+    std::uint64_t time;
+    std::uint64_t bits;
+};
+
+static std::uint64_t real_bits(const double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Appends every sample to one chunk and reads them back bit exact with the iterators and with for_each().
+static void check_chunk(const wmi_history_kind kind, const std::vector<raw_sample>& samples)
+{
+    wmi_history_chunk chunk(kind, static_cast<std::uint32_t>(samples.size()));
+
+    for (const auto& sample : samples)
+        WMI_CHECK(chunk.append(sample.time, sample.bits));
+
+    WMI_CHECK(chunk.full() && !chunk.append(samples.back().time, samples.back().bits));
+
+    std::vector<raw_sample> iterated;
+    std::vector<raw_sample> visited;
+
+    for (const auto& sample : chunk)
+        iterated.push_back({ sample.time, sample.bits });
+
+    chunk.for_each([&](const wmi_history_sample& sample) { visited.push_back({ sample.time, sample.bits }); });
+
+    const auto equal = [&](const std::vector<raw_sample>& decoded)
+    {
+        if (decoded.size() != samples.size())
+            return false;
+
+        for (std::size_t i = 0; i < samples.size(); i++)
+        {
+            if (decoded[i].time != samples[i].time || decoded[i].bits != samples[i].bits)
+            {
+                fmt::print(stderr, "sample {}: {} {:#x} decoded as {} {:#x}\n", i, samples[i].time, samples[i].bits, decoded[i].time, decoded[i].bits);
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    WMI_CHECK(equal(iterated));
+    WMI_CHECK(equal(visited));
+}
+
+// Deltas of deltas of every code length, both signs, the 64 bit escape and differences that wrap around.
+static void test_delta_widths()
+{
+    const std::int64_t deltas[] = { 0, 1, -1, 15, -16, 16, 255, -256, 256, 32767, -32768, 32768, std::int64_t(1) << 40, -(std::int64_t(1) << 40),
+        std::numeric_limits<std::int64_t>::max(), std::numeric_limits<std::int64_t>::min() };
+
+    std::vector<raw_sample> samples;
+    std::uint64_t time = 1700000000000;
+    std::uint64_t value = 0;
+    std::uint64_t value_delta = 0;
+
+    samples.push_back({ time, value });
+
+    for (const auto delta : deltas)
+    {
+        // the value's delta of delta is delta, the time's grows by a step that widens with it
+        value_delta += static_cast<std::uint64_t>(delta);
+        value += value_delta;
+        time += 1000 + static_cast<std::uint64_t>(std::abs(delta % 100000));
+
+        samples.push_back({ time, value });
+        samples.push_back({ time, value });
+    }
+
+    // a counter that restarts, the extremes of both integer kinds and a time that jumps by 2^63
+    for (const auto bits : { std::uint64_t(0), ~std::uint64_t(0), std::uint64_t(0), std::uint64_t(1) << 63, (std::uint64_t(1) << 63) - 1, std::uint64_t(5) })
+        samples.push_back({ time++, bits });
+
+    samples.push_back({ time + (std::uint64_t(1) << 63), 7 });
+
+    check_chunk(wmi_history_kind::unsigned_integer, samples);
+    check_chunk(wmi_history_kind::signed_integer, samples);
+
+    // one sample and a constant rate, the single bit codes
+    check_chunk(wmi_history_kind::unsigned_integer, { { 5, 5 } });
+
+    std::vector<raw_sample> steady;
+
+    for (std::uint64_t i = 0; i < 100; i++)
+        steady.push_back({ 1000 * i, 4096 * i });
+
+    check_chunk(wmi_history_kind::signed_integer, steady);
+}
+
+// XORs inside the window of the previous one, a window that has to be replaced, the widest XOR and non-finite values.
+static void test_reals()
+{
+    const double values[] = { 1.0, 1.0, 1.5, 1.25, 1.75, 1.0, -1.0, 1e300, 1e-300, 0.0, -0.0, 4.9e-324, std::numeric_limits<double>::quiet_NaN(),
+        -std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0.1, 0.2, 0.30000000000000004 };
+
+    std::vector<raw_sample> samples;
+    std::uint64_t time = 0;
+
+    for (const auto value : values)
+        samples.push_back({ time += 10, real_bits(value) });
+
+    // XORs with 0 leading and trailing zeros
+    samples.push_back({ time += 10, 0x8000000000000001ull });
+    samples.push_back({ time += 10, 0 });
+    samples.push_back({ time += 10, ~std::uint64_t(0) });
+
+    check_chunk(wmi_history_kind::real, samples);
+
+    // NaNs and infinities come back as such
+    wmi_history_chunk chunk(wmi_history_kind::real, 4);
+    chunk.append(0, real_bits(std::numeric_limits<double>::quiet_NaN()));
+    chunk.append(1, real_bits(std::numeric_limits<double>::infinity()));
+    chunk.append(2, real_bits(-std::numeric_limits<double>::infinity()));
+
+    std::vector<double> decoded;
+    chunk.for_each([&](const wmi_history_sample& sample) { decoded.push_back(sample.value); });
+
+    WMI_CHECK(decoded.size() == 3 && std::isnan(decoded[0]) && decoded[1] == std::numeric_limits<double>::infinity() && decoded[2] == -decoded[1]);
+}
+
+// Pseudo random samples of mixed magnitudes, to reach combinations the cases above do not.
+static void test_random()
+{
+    std::uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    const auto next = [&state]()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    for (const auto kind : { wmi_history_kind::signed_integer, wmi_history_kind::unsigned_integer, wmi_history_kind::real })
+    {
+        std::vector<raw_sample> samples;
+        std::uint64_t time = 0;
+        std::uint64_t bits = 0;
+
+        for (std::size_t i = 0; i < 5000; i++)
+        {
+            const auto random = next();
+            time += random % 4 == 0 ? random >> (random % 64) : 1000;
+            bits = random % 3 == 0 ? bits : random % 3 == 1 ? bits + (random >> (random % 64)) : random;
+            samples.push_back({ time, bits });
+        }
+
+        check_chunk(kind, samples);
+    }
+}
+
+// A series split into chunks of 7 samples at times 100, 110, ... 590.
+static void test_series()
+{
+    wmi_history_series series(wmi_history_kind::unsigned_integer, 7);
+
+    for (std::uint64_t i = 0; i < 50; i++)
+        series.append(100 + 10 * i, i * i);
+
+    WMI_CHECK(series.size() == 50 && series.chunks().size() == 8 && series.chunks()[5].last_time() == 510);
+
+    std::uint64_t index = 0;
+    auto exact = true;
+
+    for (const auto& sample : series)
+        exact = exact && sample.time == 100 + 10 * index && sample.bits == index * index && index++ < 50;
+
+    WMI_CHECK(exact && index == 50);
+
+    const auto times = [&](const std::uint64_t from, const std::uint64_t to)
+    {
+        std::vector<std::uint64_t> found;
+        series.for_each(from, to, [&](const wmi_history_sample& sample) { found.push_back(sample.time); });
+        return found;
+    };
+
+    // ranges ending and starting inside chunks, on their first and last sample, and outside of every chunk
+    WMI_CHECK((times(155, 185) == std::vector<std::uint64_t>{ 160, 170, 180 }));
+    WMI_CHECK((times(160, 170) == std::vector<std::uint64_t>{ 160, 170 }));
+    WMI_CHECK(times(100, 590).size() == 50 && times(0, ~0ull).size() == 50);
+    WMI_CHECK(times(170, 240).size() == 8 && times(170, 240).front() == 170 && times(170, 240).back() == 240);
+    WMI_CHECK(times(101, 109).empty() && times(591, ~0ull).empty() && times(0, 99).empty() && times(300, 200).empty());
+
+    // full chunks older than the time are dropped, the one holding it stays
+    const auto before = series.bytes();
+    WMI_CHECK(series.drop_before(245) > 0 && series.bytes() < before);
+    WMI_CHECK(series.chunks().size() == 6 && series.begin()->time == 240 && series.size() == 36);
+}
+
+// Reals stored into integer series are truncated and saturated, NaN is 0.
+static void test_bits()
+{
+    const auto real = [](const double value)
+    {
+        wmi_export_number number;
+        number.type = wmi_export_number::kind::real;
+        number.real = value;
+        return number;
+    };
+
+    const auto as_signed = [](const std::uint64_t bits) { return static_cast<std::int64_t>(bits); };
+
+    WMI_CHECK(wmi_history_bits(wmi_history_kind::signed_integer, real(-5.7)) == static_cast<std::uint64_t>(-5));
+    WMI_CHECK(wmi_history_bits(wmi_history_kind::signed_integer, real(std::numeric_limits<double>::quiet_NaN())) == 0);
+    WMI_CHECK(as_signed(wmi_history_bits(wmi_history_kind::signed_integer, real(1e30))) == std::numeric_limits<std::int64_t>::max());
+    WMI_CHECK(as_signed(wmi_history_bits(wmi_history_kind::signed_integer, real(-1e30))) == std::numeric_limits<std::int64_t>::min());
+    WMI_CHECK(as_signed(wmi_history_bits(wmi_history_kind::signed_integer, real(-std::numeric_limits<double>::infinity()))) == std::numeric_limits<std::int64_t>::min());
+    WMI_CHECK(wmi_history_bits(wmi_history_kind::unsigned_integer, real(1.5e19)) == 15000000000000000000ull);
+    WMI_CHECK(wmi_history_bits(wmi_history_kind::unsigned_integer, real(1e30)) == ~std::uint64_t(0));
+    WMI_CHECK(as_signed(wmi_history_bits(wmi_history_kind::unsigned_integer, real(-3.0))) == -3);
+    WMI_CHECK(wmi_history_bits(wmi_history_kind::real, real(0.5)) == real_bits(0.5));
+}
+
+// Instances keyed by a numeric column each get their own series, an empty key falls back to the row.
+static void test_numeric_keys()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint32_t tick = 0;
+
+    backend.add_property(L"Id", CIM_UINT32);
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(3);
+
+    for (std::uint32_t row = 0; row < 3; row++)
+    {
+        backend.set(row, L"Id", 4000000000u + row);
+        backend.set(row, L"Name", row == 1 ? L"" : fmt::format(L"fan {}", row));
+    }
+
+    backend.on_refresh([&tick](wmi_fake_backend& fake)
+    {
+        for (std::uint32_t row = 0; row < 3; row++)
+            fake.set(row, L"Speed", 100 * row + tick);
+
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 3, wmi_helper_config::infinite, 1000));
+
+    const auto id = helper.capture_var(L"Id");
+    const auto name = helper.capture_var(L"Name");
+    const auto speed = helper.capture_var(L"Speed");
+
+    wmi_counter_history_32 by_id(id);
+    wmi_counter_history_32 by_name(name);
+    by_id.attach(speed);
+    by_name.attach(speed);
+
+    for (const auto& wmi_result : helper.query())
+    {
+        by_id.ingest(wmi_result);
+        by_name.ingest(wmi_result);
+    }
+
+    WMI_CHECK(by_id.instances() == 3 && by_id.samples() == 9);
+
+    const auto* series = by_id.series(L"4000000002", speed);
+    WMI_CHECK(series && series->size() == 3 && series->begin()->bits == 200);
+
+    WMI_CHECK(by_name.instances() == 3);
+    WMI_CHECK(by_name.series(L"1", speed) && by_name.series(L"1", speed)->begin()->bits == 100);
+    WMI_CHECK(by_name.series(L"fan 2", speed) && !by_name.series(L"", speed));
+}
+
+int main()
+{
+    test_delta_widths();
+    test_reals();
+    test_random();
+    test_series();
+    test_bits();
+    test_numeric_keys();
+
+    return wmi_test_result();
+}
@@ -0,0 +1,229 @@
+// wmi_history_store over 30 hours of 10 second ticks in a 3 MB budget, checked against every sample kept by the test:
+// 100 instances seen on every tick and 20 jobs an hour that run for 20 minutes and are never seen again.
+#include <cmath>
+#include <map>
+
+#include "WmiHistoryStore.hpp"
+#include "wmi_test.hpp"
+
+constexpr std::uint64_t start_time = 1699999200000; // on an hour
+constexpr std::uint64_t interval = 10000;
+constexpr std::uint64_t ticks = 30 * 360;
+constexpr std::uint32_t stable = 100;
+constexpr std::uint32_t jobs = 20;
+constexpr std::size_t budget = std::size_t(3) << 20;
+
+// Ticks as fast as they are refreshed.
+class instant_backend : public wmi_fake_backend
+{
+public:
+
+    void wait(std::chrono::milliseconds)
+    {
+    }
+};
+
+struct brute_sample
+{
+    std::uint64_t time;
+    double value;
+};
+
+// every sample ingested, by key and property
+using brute_force = std::map<std::wstring, std::vector<brute_sample>[2]>;
+
+static wmi_history_rollup summarize(const std::vector<brute_sample>& samples, const std::uint64_t from, const std::uint64_t end)
+{
+    wmi_history_rollup rollup;
+    rollup.start = from;
+
+    const auto before = [](const brute_sample& sample, const std::uint64_t time) { return sample.time < time; };
+
+    for (auto sample = std::lower_bound(samples.begin(), samples.end(), from, before); sample != samples.end() && sample->time < end; ++sample)
+        rollup.add(sample->value);
+
+    return rollup;
+}
+
+static bool same(const wmi_history_rollup& a, const wmi_history_rollup& b)
+{
+    return a.count == b.count && (a.count == 0 || (a.min == b.min && a.max == b.max && std::abs(a.sum - b.sum) <= 1e-9 * std::abs(b.sum)));
+}
+
+// The raw samples held are the newest ones, every rollup held matches the samples of its bucket and aggregate() over
+// all time sums up everything from the oldest bucket held.
+static void check_instance(const wmi_history_store_32& store, const std::wstring& key, const wmi_var_handle handle, const std::vector<brute_sample>& samples)
+{
+    std::vector<brute_sample> raw;
+    WMI_CHECK(store.samples(key, handle, 0, ~0ull, [&](const wmi_history_sample& sample) { raw.push_back({ sample.time, sample.value }); }));
+
+    const auto suffix = std::find_if(samples.begin(), samples.end(), [&](const brute_sample& sample) { return !raw.empty() && sample.time >= raw.front().time; });
+    auto exact = static_cast<std::size_t>(samples.end() - suffix) == raw.size();
+
+    for (std::size_t i = 0; exact && i < raw.size(); i++)
+        exact = raw[i].time == suffix[i].time && raw[i].value == suffix[i].value;
+
+    WMI_CHECK(exact);
+
+    std::uint64_t oldest = raw.empty() ? ~0ull : raw.front().time;
+
+    for (const auto tier : { wmi_history_tier::minute, wmi_history_tier::hour })
+    {
+        const auto period = wmi_history_tier_period(tier);
+        auto matching = true;
+
+        store.rollups(key, handle, tier, 0, ~0ull, [&](const wmi_history_rollup& bucket)
+        {
+            matching = matching && same(bucket, summarize(samples, bucket.start, bucket.start + period));
+            oldest = std::min(oldest, bucket.start);
+        });
+
+        WMI_CHECK(matching);
+    }
+
+    WMI_CHECK(same(store.aggregate(key, handle, 0, ~0ull), summarize(samples, oldest, ~0ull)));
+}
+
+static void test_budget()
+{
+    wmi_helper<32, instant_backend> helper;
+    auto& backend = helper.backend();
+    std::uint64_t tick = 0;
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Counter", CIM_UINT64);
+    backend.add_property(L"Load", CIM_REAL64);
+
+    const std::wstring name = L"Name";
+    const std::wstring counter = L"Counter";
+    const std::wstring load = L"Load";
+
+    // jobs run in the first 20 minutes of every hour, after the instances seen on every tick
+    const auto job_rows = [](const std::uint64_t at) { return at % 360 < 120 ? jobs : 0; };
+
+    backend.on_refresh([&](wmi_fake_backend& fake)
+    {
+        const auto rows = stable + job_rows(tick);
+        fake.resize(rows);
+
+        for (std::uint32_t row = 0; row < rows; row++)
+        {
+            fake.set(row, name, row < stable ? fmt::format(L"process {}", row) : fmt::format(L"job {}-{}", tick / 360, row - stable));
+            fake.set(row, counter, (tick + 1) * (row % 7 + 1) * 4096 + (tick % 13 == 0 ? row : 0));
+            fake.set(row, load, static_cast<double>((tick * 7 + row) % 100) / 4.0);
+        }
+
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Process", static_cast<std::int32_t>(ticks), wmi_helper_config::infinite, 1000));
+
+    const auto name_handle = helper.capture_var(L"Name");
+    const wmi_var_handle handles[2] = { helper.capture_var(L"Counter"), helper.capture_var(L"Load") };
+
+    wmi_history_store_32 store(name_handle, budget);
+    store.attach(handles[0]);
+    store.attach(handles[1]);
+
+    brute_force samples;
+    std::size_t over_budget = 0;
+    std::size_t most_instances = 0;
+    std::uint64_t at = 0;
+
+    helper.query_async([&](const wmi_helper_config&, const wmi_wrapper_32_class_result& wmi_result)
+    {
+        auto result = wmi_result;
+        result.time = start_time + at * interval;
+
+        const auto& columns = result.result;
+
+        for (std::size_t row = 0; row < columns[name_handle].size(); row++)
+        {
+            auto& series = samples[std::wstring(columns[name_handle].string(row))];
+
+            for (std::size_t property = 0; property < 2; property++)
+            {
+                const auto number = wmi_export_read_number(columns[handles[property]], row);
+                series[property].push_back({ result.time, wmi_history_value(number.type, wmi_history_bits(number.type, number)) });
+            }
+        }
+
+        store.ingest(result);
+
+        over_budget += store.memory() > budget;
+        most_instances = std::max(most_instances, store.instances());
+        at++;
+    }).wait();
+
+    WMI_CHECK(at == ticks);
+    WMI_CHECK(over_budget == 0);
+
+    // the budget is used, not emptied by eviction
+    WMI_CHECK(store.memory() > budget / 2);
+
+    // jobs of the first hours aged out with their keys, the stable instances and the latest jobs are kept
+    std::size_t listed = 0;
+    store.for_each_instance([&](const std::wstring_view) { listed++; });
+
+    WMI_CHECK(samples.size() == stable + 30 * jobs);
+    WMI_CHECK(store.instances() == listed && listed < samples.size() && most_instances < samples.size());
+    WMI_CHECK(store.instances() >= stable + jobs);
+    WMI_CHECK(!store.samples(L"job 0-0", handles[0], 0, ~0ull, [](const wmi_history_sample&) {}));
+    WMI_CHECK(store.samples(L"job 29-19", handles[0], 0, ~0ull, [](const wmi_history_sample&) {}));
+
+    WMI_CHECK(!store.over_budget());
+
+    for (const auto& [key, series] : samples)
+    {
+        if (store.samples(key, handles[0], 0, 0, [](const wmi_history_sample&) {}))
+        {
+            check_instance(store, key, handles[0], series[0]);
+            check_instance(store, key, handles[1], series[1]);
+        }
+    }
+}
+
+// A budget the latest result cannot fit into: its raw samples go, its open buckets and keys stay and say so.
+static void test_over_budget()
+{
+    wmi_helper<32, instant_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(2);
+
+    for (std::uint32_t row = 0; row < 2; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"fan {}", row));
+        backend.set(row, L"Speed", 100 + row);
+    }
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 3, wmi_helper_config::infinite, 1000));
+
+    const auto speed = helper.capture_var(L"Speed");
+
+    wmi_history_store_32 store(helper.capture_var(L"Name"), 64);
+    store.attach(speed);
+
+    std::uint64_t time = start_time;
+
+    for (auto wmi_result : helper.query())
+    {
+        wmi_result.time = time += interval;
+        store.ingest(wmi_result);
+    }
+
+    std::size_t raw = 0;
+    WMI_CHECK(store.samples(L"fan 1", speed, 0, ~0ull, [&raw](const wmi_history_sample&) { raw++; }));
+    WMI_CHECK(store.over_budget() && store.instances() == 2 && raw == 0);
+    WMI_CHECK(store.aggregate(L"fan 1", speed, 0, ~0ull).count == 3 && store.aggregate(L"fan 1", speed, 0, ~0ull).max == 101);
+}
+
+int main()
+{
+    test_budget();
+    test_over_budget();
+
+    return wmi_test_result();
+}
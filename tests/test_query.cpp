@@ -0,0 +1,194 @@
+// WQL subset compiler and prepared queries on wmi_fake_backend.
+#include "WmiQuery.hpp"
+#include "wmi_test.hpp"
+
+static void test_compile()
+{
+    const auto plan = wmi_compile_query(L"select Name, PercentProcessorTime from Win32_PerfRawData_PerfProc_Process "
+        L"Where Name <> '_Total' and PercentProcessorTime >= 2.5e1 AND Name IN ('svchost', 'it''s') AND Name LIKE 'sql%' "
+        L"AND Name LIKE 'exact' AND Critical = TRUE");
+
+    WMI_CHECK(plan.class_name == L"Win32_PerfRawData_PerfProc_Process");
+    WMI_CHECK((plan.columns == std::vector<std::wstring>{ L"Name", L"PercentProcessorTime" }));
+    WMI_CHECK(plan.conditions.size() == 6);
+
+    if (plan.conditions.size() != 6)
+        return;
+
+    WMI_CHECK(plan.conditions[0].property == L"Name" && plan.conditions[0].op == wmi_predicate_op::not_equal);
+    WMI_CHECK(plan.conditions[0].strings == std::vector<std::wstring>{ L"_Total" });
+
+    WMI_CHECK(plan.conditions[1].op == wmi_predicate_op::greater_equal && plan.conditions[1].number == 25.0);
+    WMI_CHECK(plan.conditions[1].strings.empty());
+
+    WMI_CHECK(plan.conditions[2].op == wmi_predicate_op::one_of);
+    WMI_CHECK((plan.conditions[2].strings == std::vector<std::wstring>{ L"svchost", L"it's" }));
+
+    WMI_CHECK(plan.conditions[3].op == wmi_predicate_op::prefix && plan.conditions[3].strings == std::vector<std::wstring>{ L"sql" });
+    WMI_CHECK(plan.conditions[4].op == wmi_predicate_op::equal && plan.conditions[4].strings == std::vector<std::wstring>{ L"exact" });
+    WMI_CHECK(plan.conditions[5].op == wmi_predicate_op::equal && plan.conditions[5].number == 1.0);
+
+    const auto plain = wmi_compile_query(L"SELECT Speed FROM Win32_Fan");
+    WMI_CHECK(plain.columns.size() == 1 && plain.conditions.empty());
+}
+
+static std::size_t error_position(const wchar_t* text)
+{
+    try
+    {
+        (void)wmi_compile_query(text);
+    }
+    catch (const wmi_query_error& error)
+    {
+        return error.position();
+    }
+
+    return std::wstring::npos;
+}
+
+static void test_errors()
+{
+    WMI_CHECK(error_position(L"SELECT * FROM Win32_Fan") == 7);
+    WMI_CHECK(error_position(L"SELECT Speed FROM Win32_Fan WHERE Speed > 1 OR Speed < 0") == 44);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Name LIKE '%x'") == 43);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Name = 'open") == 40);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Name < 'a'") == 40);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan extra") == 27);
+    WMI_CHECK(error_position(L"SELECT Name, FROM Win32_Fan") == 18);
+    WMI_CHECK(error_position(L"SELECT Name Win32_Fan") == 12);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Name IN ()") == 42);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Speed ~ 1") == 39);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Speed = 1.2.3") == 41);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Speed = 1e5e5") == 41);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Speed = 1e") == 41);
+    WMI_CHECK(error_position(L"SELECT Name FROM Win32_Fan WHERE Speed = 12abc") == 41);
+    WMI_CHECK(wmi_compile_query(L"SELECT Name FROM Win32_Fan WHERE Speed > -0.5E+2").conditions.front().number == -50.0);
+}
+
+static void test_prepared()
+{
+    const wchar_t* names[] = { L"_Total", L"svchost", L"sqlservr", L"sqlwriter", L"explorer", L"svchost" };
+    const std::uint32_t cpu[] = { 400, 30, 50, 0, 90, 10 };
+
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT32);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.resize(std::size(names));
+
+    for (std::size_t row = 0; row < std::size(names); row++)
+    {
+        backend.set(row, L"Name", names[row]);
+        backend.set(row, L"PercentProcessorTime", cpu[row]);
+        backend.set<std::uint64_t>(row, L"WorkingSet", row << 20);
+    }
+
+    const auto plan = wmi_compile_query(L"SELECT Name, WorkingSet FROM Win32_PerfRawData_PerfProc_Process "
+        L"WHERE Name <> '_Total' AND PercentProcessorTime > 20");
+
+    helper.init(plan.config(1, wmi_helper_config::infinite, 1000));
+
+    const auto prepared = wmi_prepare(helper, plan);
+    const auto name = prepared.handle(L"name");
+    const auto working_set = prepared.handle(L"WorkingSet");
+
+    WMI_CHECK(prepared.columns.size() == 2);
+    WMI_CHECK_THROWS(prepared.handle(L"PercentProcessorTime"), std::out_of_range);
+
+    auto result = helper.query().back().result;
+
+    // sqlwriter and the second svchost fail the CPU condition
+    WMI_CHECK(result[name].size() == 3 && result[working_set].size() == 3);
+
+    if (result[name].size() == 3)
+    {
+        WMI_CHECK(result[name].string(0) == L"svchost" && result[working_set].as_double(0) == double(1 << 20));
+        WMI_CHECK(result[name].string(1) == L"sqlservr" && result[working_set].as_double(1) == double(2 << 20));
+        WMI_CHECK(result[name].string(2) == L"explorer" && result[working_set].as_double(2) == double(4 << 20));
+    }
+
+    // vars captured before keep their options
+    wmi_capture_options dictionary;
+    dictionary.dictionary = true;
+
+    helper.capture_var(L"Name", dictionary);
+    wmi_prepare(helper, plan);
+    WMI_CHECK(helper.var_options(name).dictionary);
+
+    // preparing another plan replaces the filters
+    wmi_prepare(helper, wmi_compile_query(L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE Name IN ('svchost', 'missing')"));
+    result = helper.query().back().result;
+
+    WMI_CHECK(result[name].size() == 2);
+
+    for (std::size_t row = 0; row < result[name].size(); row++)
+        WMI_CHECK(result[name].string(row) == L"svchost");
+
+    wmi_prepare(helper, wmi_compile_query(L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE Name LIKE 'sql%'"));
+    WMI_CHECK(helper.query().back().result[name].size() == 2);
+
+    wmi_prepare(helper, wmi_compile_query(L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE Missing = 1"));
+    result = helper.query().back().result;
+    WMI_CHECK(!result.count(name) || result[name].empty());
+}
+
+// Filter columns are read for every row, the other columns only for the rows that pass.
+static void test_pushdown()
+{
+    const std::uint32_t cpu[] = { 400, 30, 50, 0, 90, 10 };
+
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"PercentProcessorTime", CIM_UINT32);
+    backend.add_property(L"WorkingSet", CIM_UINT64);
+    backend.resize(std::size(cpu));
+
+    for (std::size_t row = 0; row < std::size(cpu); row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"process_{}", row));
+        backend.set(row, L"PercentProcessorTime", cpu[row]);
+        backend.set<std::uint64_t>(row, L"WorkingSet", row << 20);
+    }
+
+    const auto reads = [&backend](wmi_helper<32, wmi_fake_backend>& query_helper, const wchar_t* query)
+    {
+        wmi_prepare(query_helper, wmi_compile_query(query));
+
+        const auto before = backend.read_count();
+        const auto rows = query_helper.query().back().result.column_size(0);
+        return std::make_pair(rows, backend.read_count() - before);
+    };
+
+    helper.init(wmi_helper_config(L"Win32_PerfRawData_PerfProc_Process", 1, wmi_helper_config::infinite, 1000));
+
+    const auto all = reads(helper, L"SELECT Name, WorkingSet, PercentProcessorTime FROM Win32_PerfRawData_PerfProc_Process");
+    const auto filtered = reads(helper, L"SELECT Name, WorkingSet, PercentProcessorTime FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime >= 50");
+
+    // the 3 rows that fail the filter are not read for the 2 other columns
+    WMI_CHECK(all.first == 6 && filtered.first == 3);
+    WMI_CHECK(all.second - filtered.second == 3 * 2);
+
+    const auto few = reads(helper, L"SELECT Name, WorkingSet FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime > 100");
+    WMI_CHECK(few.first == 1 && few.second < all.second);
+
+    // quoted numbers are compared as numbers, they used to compare the property with 0
+    WMI_CHECK(reads(helper, L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime = '50'").first == 1);
+    WMI_CHECK(reads(helper, L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime <> '0'").first == 5);
+    WMI_CHECK(reads(helper, L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime IN ('30', '90', '1')").first == 2);
+
+    WMI_CHECK_THROWS(reads(helper, L"SELECT Name FROM Win32_PerfRawData_PerfProc_Process WHERE PercentProcessorTime = 'high'"), wmi_type_error);
+}
+
+int main()
+{
+    test_compile();
+    test_errors();
+    test_prepared();
+    test_pushdown();
+
+    return wmi_test_result();
+}
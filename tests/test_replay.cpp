@@ -0,0 +1,161 @@
+// Recording wmi_fake_backend with wmi_recording_backend and replaying it with wmi_replay_backend.
+#include <cstdio>
+#include <cstring>
+#include <future>
+
+#include "WmiReplay.hpp"
+#include "wmi_test.hpp"
+
+static const char* const path = "test_replay.wmirec";
+
+// Five ticks, the third one without instances.
+static void record()
+{
+    wmi_helper<32, wmi_recording_backend<wmi_fake_backend>> helper;
+    auto& fake = helper.backend().inner();
+    std::uint32_t tick = 0;
+
+    fake.add_property(L"Name", CIM_STRING);
+    fake.add_property(L"Speed", CIM_UINT32);
+
+    fake.on_refresh([&tick](wmi_fake_backend& backend)
+    {
+        backend.resize(tick == 2 ? 0 : 2);
+
+        for (std::uint32_t row = 0; tick != 2 && row < 2; row++)
+        {
+            backend.set(row, L"Name", fmt::format(L"fan {}", row));
+            backend.set(row, L"Speed", 100 * tick + row);
+        }
+
+        tick++;
+    });
+
+    helper.backend().record(wmi_export_output(path, wmi_export_output::mode::truncate));
+    helper.init(wmi_helper_config(L"Win32_Fan", 5, wmi_helper_config::infinite, 1000));
+    helper.capture_var(L"Name");
+    helper.capture_var(L"Speed");
+
+    // the empty tick counts towards fire_count
+    WMI_CHECK(helper.query().size() == 4);
+    WMI_CHECK(tick == 5);
+
+    helper.backend().stop();
+}
+
+static void check_speeds(const std::vector<std::uint32_t>& speeds)
+{
+    WMI_CHECK((speeds == std::vector<std::uint32_t>{ 1, 101, 301, 401 }));
+}
+
+static void test_replay_count()
+{
+    wmi_helper<32, wmi_replay_backend> replay;
+    replay.backend().load(path);
+
+    WMI_CHECK(replay.backend().ticks() == 5);
+
+    replay.init(wmi_helper_config(L"Win32_Fan", static_cast<std::int32_t>(replay.backend().ticks())));
+    replay.capture_var(L"Name");
+    const auto speed = replay.capture_var(L"Speed");
+
+    std::vector<std::uint32_t> speeds;
+
+    for (const auto& wmi_result : replay.query())
+        speeds.push_back(wmi_result.result[speed].get<std::uint32_t>(1));
+
+    check_speeds(speeds);
+    WMI_CHECK(replay.backend().finished());
+}
+
+// Without any limit the query ends with the recording instead of refreshing past its end.
+static void test_replay_to_end()
+{
+    wmi_helper<32, wmi_replay_backend> replay;
+    replay.backend().load(path);
+    replay.init(wmi_helper_config(L"Win32_Fan", wmi_helper_config::infinite, wmi_helper_config::infinite, 1000));
+
+    const auto speed = replay.capture_var(L"Speed");
+    std::vector<std::uint32_t> speeds;
+
+    auto done = replay.query_async([&](const wmi_helper_config&, const wmi_wrapper_32_class_result& wmi_result)
+    {
+        speeds.push_back(wmi_result.result[speed].get<std::uint32_t>(1));
+    });
+
+    const auto ended = done.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    WMI_CHECK(ended);
+
+    if (!ended)
+    {
+        replay.stop_query();
+        return;
+    }
+
+    check_speeds(speeds);
+}
+
+template<typename T>
+static void append(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// A tick that claims 2^32 - 1 instances with values for two rows replays those two without a table for every row.
+static void test_damaged_instance_count()
+{
+    static const char* const damaged = "test_replay_damaged.wmirec";
+
+    std::string bytes;
+    append(bytes, wmi_recording_header{ {}, wmi_recording_version, 0 });
+    std::memcpy(bytes.data(), wmi_recording_magic, sizeof(wmi_recording_magic));
+
+    const char16_t name[] = u"Speed";
+    append(bytes, wmi_recording_record{ wmi_recording_kind::property, sizeof(wmi_recording_property) + 5 * sizeof(char16_t) });
+    append(bytes, wmi_recording_property{ CIM_UINT32, 0 });
+    bytes.append(reinterpret_cast<const char*>(name), 5 * sizeof(char16_t));
+
+    append(bytes, wmi_recording_record{ wmi_recording_kind::tick, sizeof(wmi_recording_tick) });
+    append(bytes, wmi_recording_tick{ 0, 0xffffffff, 0 });
+
+    for (const std::uint32_t row : { 7u, 0xfffffffeu })
+    {
+        append(bytes, wmi_recording_record{ wmi_recording_kind::value, sizeof(wmi_recording_value) + sizeof(std::uint32_t) });
+        append(bytes, wmi_recording_value{ row, 0 });
+        append(bytes, row + 1);
+    }
+
+    auto* file = std::fopen(damaged, "wb");
+    WMI_CHECK(file && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+
+    if (file)
+        std::fclose(file);
+
+    wmi_replay_backend backend;
+    backend.load(damaged);
+
+    CIMTYPE type = CIM_EMPTY;
+    long handle = -1;
+    WMI_CHECK(backend.property_handle(L"Speed", type, handle) && type == CIM_UINT32);
+    WMI_CHECK(backend.refresh() == 0xffffffff);
+
+    std::uint32_t value = 0;
+    long read_bytes = 0;
+
+    WMI_CHECK(backend.read(7, handle, sizeof(value), read_bytes, &value) && value == 8);
+    WMI_CHECK(backend.read(0xfffffffe, handle, sizeof(value), read_bytes, &value) && value == 0xffffffff);
+    WMI_CHECK(!backend.read(8, handle, sizeof(value), read_bytes, &value) && read_bytes == 0);
+
+    std::remove(damaged);
+}
+
+int main()
+{
+    record();
+    test_replay_count();
+    test_replay_to_end();
+    test_damaged_instance_count();
+
+    std::remove(path);
+    return wmi_test_result();
+}
@@ -0,0 +1,253 @@
+// Result columns read by wmi_helper from wmi_fake_backend.
+#include "WmiHelper.hpp"
+#include "wmi_test.hpp"
+
+// Fails every read of one row and property.
+class failing_backend : public wmi_fake_backend
+{
+public:
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer)
+    {
+        if (row == failed_row && handle == failed_handle)
+            return false;
+
+        return wmi_fake_backend::read(row, handle, size, read_bytes, buffer);
+    }
+
+    std::uint32_t failed_row = 0;
+    long failed_handle = -1;
+};
+
+static void fill(wmi_fake_backend& backend)
+{
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.add_property(L"InstallDate", CIM_DATETIME);
+    backend.add_property(L"Path", CIM_REFERENCE);
+    backend.resize(3);
+
+    for (std::uint32_t row = 0; row < 3; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"instance_{}", row));
+        backend.set(row, L"Speed", 100 + row);
+        backend.set(row, L"InstallDate", fmt::format(L"2024010{}000000.000000+000", row));
+        backend.set(row, L"Path", fmt::format(L"\\\\HOST\\root\\cimv2:Win32_Fan.DeviceID=\"{}\"", row));
+    }
+}
+
+static void test_string_types()
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    fill(helper.backend());
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+
+    const auto install_date = helper.capture_var(L"InstallDate");
+    const auto path = helper.capture_var(L"Path");
+    const auto result = helper.query().back().result;
+
+    WMI_CHECK(result[install_date].size() == 3 && result[path].size() == 3);
+
+    if (result[install_date].size() != 3 || result[path].size() != 3)
+        return;
+
+    WMI_CHECK(result[install_date].cell(2).type() == CIM_DATETIME);
+    WMI_CHECK(result[install_date].string(2) == L"20240102000000.000000+000");
+    WMI_CHECK(result[install_date][1].get_wide_string() == L"20240101000000.000000+000");
+    WMI_CHECK(result[path].string(0) == L"\\\\HOST\\root\\cimv2:Win32_Fan.DeviceID=\"0\"");
+}
+
+static void test_failed_reads(const bool lazy)
+{
+    wmi_helper<32, failing_backend> helper;
+    fill(helper.backend());
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+
+    wmi_capture_options options;
+    options.lazy = lazy;
+
+    const auto name = helper.capture_var(L"Name", options);
+    const auto speed = helper.capture_var(L"Speed", options);
+
+    // the read of the second instance's name fails
+    CIMTYPE type;
+    helper.backend().property_handle(L"Name", type, helper.backend().failed_handle);
+    helper.backend().failed_row = 1;
+
+    const auto result = helper.query().back().result;
+
+    WMI_CHECK(result[name].size() == 3 && result[speed].size() == 3);
+
+    if (result[name].size() != 3 || result[speed].size() != 3)
+        return;
+
+    WMI_CHECK(result[name].cell(0).has_value() && result[name].string(0) == L"instance_0");
+    WMI_CHECK(!result[name].cell(1).has_value());
+    WMI_CHECK(result[name].cell(2).has_value() && result[name].string(2) == L"instance_2");
+    WMI_CHECK(result[speed].get<std::uint32_t>(2) == 102);
+}
+
+static void test_failed_filter_reads()
+{
+    wmi_helper<32, failing_backend> helper;
+    fill(helper.backend());
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+
+    const auto name = helper.capture_var(L"Name");
+    const auto speed = helper.capture_var(L"Speed");
+
+    // the string predicate still applies when the first row's read fails
+    CIMTYPE type;
+    helper.backend().property_handle(L"Name", type, helper.backend().failed_handle);
+    helper.filter(wmi_predicate::starts_with(name, L"instance_"));
+
+    const auto result = helper.query().back().result;
+
+    WMI_CHECK(result[name].size() == 2 && result[speed].size() == 2);
+
+    if (result[speed].size() == 2)
+        WMI_CHECK(result[speed].get<std::uint32_t>(0) == 101 && result[name].string(1) == L"instance_2");
+}
+
+// Capacity is read every third tick and carried over in between while the instances stay the same.
+static void test_read_every(const bool keyed)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint32_t tick = 0;
+
+    fill(backend);
+    backend.add_property(L"Capacity", CIM_UINT64);
+
+    backend.on_refresh([&tick](wmi_fake_backend& fake)
+    {
+        for (std::uint32_t row = 0; row < 3; row++)
+            fake.set<std::uint64_t>(row, L"Capacity", tick * 10 + row);
+
+        // another instance takes the second row on tick 4
+        if (tick == 4)
+            fake.set(1, L"Name", L"replaced");
+
+        tick++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 7, wmi_helper_config::infinite, 200));
+
+    wmi_capture_options key;
+    wmi_capture_options slow;
+
+    key.key = keyed;
+    key.read_every = 3; // ignored for keys
+    slow.read_every = 3;
+
+    const auto name = helper.capture_var(L"Name", key);
+    const auto capacity = helper.capture_var(L"Capacity", slow);
+    const auto results = helper.query();
+
+    WMI_CHECK(results.size() == 7);
+
+    for (std::uint32_t i = 0; i < results.size(); i++)
+    {
+        const auto& result = results[i].result;
+
+        // ticks 0, 3 and 6 are read anyway, tick 4 because the instances changed
+        const auto read = !keyed || i % 3 == 0 || i == 4;
+        const auto read_tick = read ? i : i - (i % 3 == 2 && i > 4 ? 1 : i % 3);
+
+        WMI_CHECK(result[name].string(1) == (i >= 4 ? L"replaced" : L"instance_1"));
+        WMI_CHECK(result[capacity].get<std::uint64_t>(1) == read_tick * 10 + 1);
+        WMI_CHECK(read == (result.column_time(capacity) == result.column_time(name)));
+    }
+}
+
+// Two property names with the same wmi_name_hash() used to share one handle and column.
+static void test_name_collision()
+{
+    constexpr auto first = L"5d5aa1727e5c93f4";
+    constexpr auto second = L"5cad1828e6241be7";
+    static_assert(wmi_name_hash(first) == wmi_name_hash(second), "the names are meant to collide");
+
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+
+    backend.add_property(first, CIM_UINT32);
+    backend.add_property(second, CIM_UINT32);
+    backend.resize(1);
+    backend.set(0, first, 1u);
+    backend.set(0, second, 2u);
+
+    helper.init(wmi_helper_config(L"Win32_Collision", 1, wmi_helper_config::infinite, 1000));
+
+    const auto a = helper.capture_var(first);
+    const auto b = helper.capture_var(second);
+
+    WMI_CHECK(a != b && helper.var_count() == 2);
+    WMI_CHECK(helper.capture_var(L"5CAD1828E6241BE7") == b && helper.handle_of(first) == a && helper.find_var(second) == b);
+    WMI_CHECK(!helper.find_var(L"5d5aa1727e5c93f5"));
+    WMI_CHECK_THROWS(helper.handle_of<wmi_name_hash(first)>(), std::out_of_range);
+
+    const auto result = helper.query().back().result;
+    WMI_CHECK(result[a].get<std::uint32_t>(0) == 1 && result[b].get<std::uint32_t>(0) == 2);
+}
+
+// Five ticks 5 ms apart with a result cache, counting refreshes. Speed changes on every refresh if changing.
+static std::pair<std::vector<wmi_wrapper_32_class_result>, std::uint32_t> cached_query(const std::uint64_t ttl, const wmi_cache_delivery delivery, const bool changing)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    auto& backend = helper.backend();
+    std::uint32_t refreshes = 0;
+
+    fill(backend);
+
+    backend.on_refresh([&refreshes, changing](wmi_fake_backend& fake)
+    {
+        if (changing)
+            fake.set(0, L"Speed", refreshes);
+
+        refreshes++;
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 5, wmi_helper_config::infinite, 200));
+    helper.capture_var(L"Name");
+    helper.capture_var(L"Speed");
+    helper.cache_results(ttl, delivery);
+
+    auto results = helper.query();
+    return { std::move(results), refreshes };
+}
+
+static void test_result_cache()
+{
+    // within the TTL the class is refreshed once, the cached result used to be delivered again on every tick
+    auto [results, refreshes] = cached_query(3600000, wmi_cache_delivery::changes, true);
+    WMI_CHECK(refreshes == 1 && results.size() == 1);
+
+    std::tie(results, refreshes) = cached_query(3600000, wmi_cache_delivery::every_tick, true);
+    WMI_CHECK(refreshes == 1 && results.size() == 5);
+    WMI_CHECK(results.size() == 5 && results[4].time == results[0].time);
+
+    // the TTL expires before every tick, an unchanged hash publishes nothing new
+    std::tie(results, refreshes) = cached_query(1, wmi_cache_delivery::changes, false);
+    WMI_CHECK(refreshes == 5 && results.size() == 1);
+
+    // a changed hash does
+    std::tie(results, refreshes) = cached_query(1, wmi_cache_delivery::changes, true);
+    WMI_CHECK(refreshes == 5 && results.size() == 5);
+
+    for (std::size_t i = 0; i < results.size(); i++)
+        WMI_CHECK(results[i].result[1].get<std::uint32_t>(0) == i);
+}
+
+int main()
+{
+    test_string_types();
+    test_failed_reads(false);
+    test_failed_reads(true);
+    test_failed_filter_reads();
+    test_read_every(true);
+    test_read_every(false);
+    test_name_collision();
+    test_result_cache();
+
+    return wmi_test_result();
+}
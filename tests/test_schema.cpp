@@ -0,0 +1,147 @@
+// Rows read by wmi_typed_query from wmi_fake_backend through wmi_schema bindings.
+#include "WmiSchema.hpp"
+#include "wmi_test.hpp"
+
+// Fails every read of one row and counts property handle lookups.
+class schema_backend : public wmi_fake_backend
+{
+public:
+
+    bool property_handle(const std::wstring& name, CIMTYPE& type, long& handle)
+    {
+        lookups++;
+        return wmi_fake_backend::property_handle(name, type, handle);
+    }
+
+    bool read(const std::uint32_t row, const long handle, const long size, long& read_bytes, void* buffer)
+    {
+        if (row == failed_row)
+            return false;
+
+        return wmi_fake_backend::read(row, handle, size, read_bytes, buffer);
+    }
+
+    std::uint32_t failed_row = ~0u;
+    std::size_t lookups = 0;
+};
+
+struct fan_row
+{
+    std::wstring name;
+    std::uint32_t speed = 0;
+    std::optional<std::uint64_t> capacity;
+    bool active = false;
+    double load = 0.0;
+};
+
+template<>
+struct wmi_schema<fan_row>
+{
+    static constexpr auto fields = std::make_tuple(
+        wmi_field(L"Name", &fan_row::name),
+        wmi_field(L"Speed", &fan_row::speed),
+        wmi_field(L"Capacity", &fan_row::capacity),
+        wmi_field(L"Active", &fan_row::active),
+        wmi_field(L"Load", &fan_row::load));
+};
+
+// Name is bound to an integer and Missingé does not exist.
+struct broken_row
+{
+    std::uint32_t name = 0;
+    std::uint32_t missing = 0;
+};
+
+template<>
+struct wmi_schema<broken_row>
+{
+    static constexpr auto fields = std::make_tuple(
+        wmi_field(L"Name", &broken_row::name),
+        wmi_field(L"Missing\u00e9", &broken_row::missing));
+};
+
+static void fill(wmi_helper<32, schema_backend>& helper)
+{
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.add_property(L"Capacity", CIM_UINT64);
+    backend.add_property(L"Active", CIM_BOOLEAN);
+    backend.add_property(L"Load", CIM_REAL64);
+    backend.resize(3);
+
+    for (std::uint32_t row = 0; row < 3; row++)
+    {
+        backend.set(row, L"Name", fmt::format(L"a fan with a long name {}", row));
+        backend.set(row, L"Speed", 1000 + row);
+        backend.set<std::uint64_t>(row, L"Capacity", std::uint64_t(row) << 40);
+        backend.set<std::uint16_t>(row, L"Active", row % 2 ? 0xffff : 0);
+        backend.set(row, L"Load", row * 0.25);
+    }
+
+    helper.init(wmi_helper_config(L"Win32_Fan", 1, wmi_helper_config::infinite, 1000));
+}
+
+static void test_binding()
+{
+    wmi_helper<32, schema_backend> helper;
+    fill(helper);
+
+    auto query = wmi_make_typed_query<fan_row>(helper);
+    auto rows = query.sample();
+
+    WMI_CHECK(rows.size() == 3 && query.failed_reads() == 0);
+
+    if (rows.size() != 3)
+        return;
+
+    WMI_CHECK(rows[2].name == L"a fan with a long name 2" && rows[2].speed == 1002 && rows[2].capacity == std::uint64_t(2) << 40);
+    WMI_CHECK(rows[1].active && !rows[2].active && rows[2].load == 0.5);
+
+    // the failed row keeps no stale values, the optional field tells the failure from a 0
+    helper.backend().failed_row = 1;
+    query.sample(rows);
+
+    WMI_CHECK(query.failed_reads() == 5);
+    WMI_CHECK(rows[1].name.empty() && rows[1].speed == 0 && !rows[1].capacity && !rows[1].active && rows[1].load == 0.0);
+    WMI_CHECK(rows[0].capacity == 0u && rows[2].speed == 1002);
+}
+
+static void test_schema_errors()
+{
+    wmi_helper<32, schema_backend> helper;
+    fill(helper);
+
+    auto query = wmi_make_typed_query<broken_row>(helper);
+    std::string message;
+
+    try
+    {
+        (void)query.sample();
+    }
+    catch (const wmi_schema_error& error)
+    {
+        message = error.what();
+    }
+
+    // both problems in one error, the name converted to UTF-8
+    WMI_CHECK(message.find("Name has CIMTYPE 8") != std::string::npos);
+    WMI_CHECK(message.find("Missing\xc3\xa9 does not exist") != std::string::npos);
+
+    // later samples throw the same error without resolving the schema again
+    const auto lookups = helper.backend().lookups;
+    WMI_CHECK(lookups == 2);
+
+    WMI_CHECK_THROWS(query.sample(), wmi_schema_error);
+    WMI_CHECK_THROWS(query.sample(), wmi_schema_error);
+    WMI_CHECK(helper.backend().lookups == lookups);
+}
+
+int main()
+{
+    test_binding();
+    test_schema_errors();
+
+    return wmi_test_result();
+}
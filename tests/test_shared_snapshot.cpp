@@ -0,0 +1,188 @@
+// Shared snapshots over POSIX shm: a publisher fed by wmi_fake_backend and readers in the same and in another process.
+#include <cstdlib>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "WmiSharedSnapshot.hpp"
+#include "wmi_test.hpp"
+
+constexpr std::uint32_t rows = 64;
+
+// Speed of a row is tick * 1000 + row on every tick, so a snapshot read whole has the same tick on every row.
+static void fill(wmi_helper<32, wmi_fake_backend>& helper, const std::int32_t ticks, const std::int32_t updates_per_second)
+{
+    auto& backend = helper.backend();
+
+    backend.add_property(L"Name", CIM_STRING);
+    backend.add_property(L"Speed", CIM_UINT32);
+    backend.resize(rows);
+
+    for (std::uint32_t row = 0; row < rows; row++)
+        backend.set(row, L"Name", fmt::format(L"fan {}", row));
+
+    backend.on_refresh([tick = std::uint32_t(0)](wmi_fake_backend& fake) mutable
+    {
+        const std::wstring speed = L"Speed";
+        tick++;
+
+        for (std::uint32_t row = 0; row < rows; row++)
+            fake.set(row, speed, tick * 1000 + row);
+    });
+
+    helper.init(wmi_helper_config(L"Win32_Fan", ticks, wmi_helper_config::infinite, updates_per_second));
+}
+
+static wmi_capture_file_encoder_32 make_encoder(wmi_helper<32, wmi_fake_backend>& helper)
+{
+    wmi_capture_file_encoder_32 encoder(L"Win32_Fan");
+    encoder.attach(helper, helper.capture_var(L"Name"));
+    encoder.attach(helper, helper.capture_var(L"Speed"));
+    return encoder;
+}
+
+// Checks a snapshot's rows against its number, false if the publisher overwrote it meanwhile.
+static bool check_snapshot(const wmi_shared_snapshot_reader& reader, const wmi_shared_snapshot_view& snapshot)
+{
+    const auto name = snapshot.column(*reader.property("Name"));
+    const auto speed = snapshot.column(*reader.property("Speed"));
+    auto consistent = name && speed && snapshot.rows() == rows;
+
+    for (std::uint32_t row = 0; consistent && row < rows; row++)
+    {
+        consistent = speed->values<std::uint32_t>()[row] == snapshot.number() * 1000 + row
+            && name->string(row) == fmt::format("fan {}", row);
+    }
+
+    if (!snapshot.valid())
+        return false;
+
+    WMI_CHECK(consistent);
+    return true;
+}
+
+static void test_same_process(const char* name)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    fill(helper, 6, 1000);
+
+    wmi_shared_snapshot_publisher_32 publisher(name, make_encoder(helper), 4, 64 << 10);
+    const wmi_shared_snapshot_reader reader(name);
+
+    WMI_CHECK(reader.class_name() == "Win32_Fan");
+    WMI_CHECK(reader.properties().size() == 2 && reader.property("Speed") == 1u);
+    WMI_CHECK(reader.latest() == 0 && !reader.snapshot());
+
+    // more snapshots than slots, the latest one is read
+    for (const auto& wmi_result : helper.query())
+        publisher.publish(wmi_result);
+
+    WMI_CHECK(publisher.published() == 6 && reader.latest() == 6);
+
+    const auto snapshot = reader.snapshot();
+    WMI_CHECK(snapshot && snapshot->number() == 6);
+
+    if (snapshot)
+        WMI_CHECK(check_snapshot(reader, *snapshot));
+
+    WMI_CHECK(!reader.wait(6, std::chrono::milliseconds(5)));
+}
+
+static void test_errors(const char* name)
+{
+    wmi_helper<32, wmi_fake_backend> helper;
+    fill(helper, 1, 1000);
+
+    WMI_CHECK_THROWS(wmi_shared_snapshot_reader(name), wmi_shared_snapshot_error);
+    WMI_CHECK_THROWS(wmi_shared_snapshot_publisher_32(name, make_encoder(helper), 1), wmi_shared_snapshot_error);
+
+    // 64 rows do not fit into the smallest slots
+    wmi_shared_snapshot_publisher_32 publisher(name, make_encoder(helper), 2, 0);
+    WMI_CHECK_THROWS(publisher.publish(helper.query().back()), wmi_shared_snapshot_error);
+}
+
+// The publisher runs in a child process at 1000 ticks per second while this one reads every snapshot it can.
+static void test_other_process(const char* name)
+{
+    constexpr std::int32_t ticks = 400;
+
+    const auto child = fork();
+    WMI_CHECK(child >= 0);
+
+    if (child < 0)
+        return;
+
+    if (child == 0)
+    {
+        auto failed = true;
+
+        try
+        {
+            wmi_helper<32, wmi_fake_backend> helper;
+            fill(helper, ticks, 1000);
+
+            wmi_shared_snapshot_publisher_32 publisher(name, make_encoder(helper), 4, 64 << 10);
+            helper.query_async(publisher.callback()).get();
+
+            // the reader maps the region before it is unlinked
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            failed = publisher.published() != ticks;
+        }
+        catch (const std::exception& error)
+        {
+            fmt::print(stderr, "publisher: {}\n", error.what());
+        }
+
+        std::_Exit(failed ? 1 : 0);
+    }
+
+    std::optional<wmi_shared_snapshot_reader> reader;
+    const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+    while (!reader && std::chrono::steady_clock::now() < until)
+    {
+        try
+        {
+            reader.emplace(name);
+        }
+        catch (const wmi_shared_snapshot_error&)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    WMI_CHECK(reader.has_value());
+
+    std::uint64_t last = 0;
+    std::size_t checked = 0;
+
+    while (reader && last < static_cast<std::uint64_t>(ticks))
+    {
+        const auto snapshot = reader->wait(last, std::chrono::seconds(5));
+
+        if (!snapshot)
+            break;
+
+        WMI_CHECK(snapshot->number() > last);
+        last = snapshot->number();
+        checked += check_snapshot(*reader, *snapshot);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    WMI_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    WMI_CHECK(last == static_cast<std::uint64_t>(ticks));
+    WMI_CHECK(checked > 0);
+}
+
+int main()
+{
+    const auto name = fmt::format("/wmi_test_shared_snapshot_{}", getpid());
+
+    test_same_process(name.c_str());
+    test_errors(name.c_str());
+    test_other_process(name.c_str());
+
+    return wmi_test_result();
+}
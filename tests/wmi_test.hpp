@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdio>
+
+#include "fmt/format.h"
+
+// Minimal checks for the tests: a failed check is reported and fails the test, the test goes on with the next one.
+
+inline int& wmi_test_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define WMI_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fmt::print(stderr, "{}:{}: check failed: {}\n", __FILE__, __LINE__, #condition); \
+            wmi_test_failures()++; \
+        } \
+    } while (false)
+
+#define WMI_CHECK_THROWS(expression, exception) \
+    do \
+    { \
+        auto thrown = false; \
+        try \
+        { \
+            (void)(expression); \
+        } \
+        catch (const exception&) \
+        { \
+            thrown = true; \
+        } \
+        if (!thrown) \
+        { \
+            fmt::print(stderr, "{}:{}: {} did not throw {}\n", __FILE__, __LINE__, #expression, #exception); \
+            wmi_test_failures()++; \
+        } \
+    } while (false)
+
+// Exit code of a test.
+inline int wmi_test_result()
+{
+    if (wmi_test_failures())
+        fmt::print(stderr, "{} checks failed\n", wmi_test_failures());
+
+    return wmi_test_failures() ? 1 : 0;
+}